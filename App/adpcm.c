@@ -0,0 +1,181 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#include "adpcm.h"
+#include "crc16.h"
+
+// Standard IMA-ADPCM tables
+static const int8_t indexTable[16] = {
+    -1, -1, -1, -1, 2, 4, 6, 8,
+    -1, -1, -1, -1, 2, 4, 6, 8
+};
+static const int16_t stepTable[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+    19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+    130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+    337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+    876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+    2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+    5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+// Apply a code to the state, returning the reconstructed sample.  The encoder and
+// decoder share this so that they can never disagree.
+static int16_t adpcmStep(adpcmState *st, uint8_t code)
+{
+    int32_t step = stepTable[st->index];
+    int32_t diff = step >> 3;
+    if (code & 4) {
+        diff += step;
+    }
+    if (code & 2) {
+        diff += step >> 1;
+    }
+    if (code & 1) {
+        diff += step >> 2;
+    }
+    int32_t predictor = st->predictor;
+    if (code & 8) {
+        predictor -= diff;
+    } else {
+        predictor += diff;
+    }
+    if (predictor > 32767) {
+        predictor = 32767;
+    } else if (predictor < -32768) {
+        predictor = -32768;
+    }
+    int32_t index = st->index + indexTable[code];
+    if (index < 0) {
+        index = 0;
+    } else if (index > 88) {
+        index = 88;
+    }
+    st->predictor = (int16_t) predictor;
+    st->index = (uint8_t) index;
+    return st->predictor;
+}
+
+// Reset encoder or decoder state
+void adpcmInit(adpcmState *st)
+{
+    st->predictor = 0;
+    st->index = 0;
+}
+
+// Encode samples into 4-bit codes, two per byte with the first in the low nibble
+void adpcmEncode(adpcmState *st, const int16_t *pcm, uint32_t samples, uint8_t *codes)
+{
+    for (uint32_t i=0; i<samples; i++) {
+        int32_t step = stepTable[st->index];
+        int32_t diff = (int32_t) pcm[i] - st->predictor;
+        uint8_t code = 0;
+        if (diff < 0) {
+            code = 8;
+            diff = -diff;
+        }
+        if (diff >= step) {
+            code |= 4;
+            diff -= step;
+        }
+        step >>= 1;
+        if (diff >= step) {
+            code |= 2;
+            diff -= step;
+        }
+        step >>= 1;
+        if (diff >= step) {
+            code |= 1;
+        }
+        adpcmStep(st, code);
+        if ((i & 1) == 0) {
+            codes[i/2] = code;
+        } else {
+            codes[i/2] |= code << 4;
+        }
+    }
+}
+
+// Decode 4-bit codes back into samples
+void adpcmDecode(adpcmState *st, const uint8_t *codes, uint32_t samples, int16_t *pcm)
+{
+    for (uint32_t i=0; i<samples; i++) {
+        uint8_t code = (i & 1) == 0 ? (codes[i/2] & 0x0f) : (codes[i/2] >> 4);
+        pcm[i] = adpcmStep(st, code);
+    }
+}
+
+// Encode samples into a self-contained frame, returning its length or 0 if the
+// frame buffer is too small.
+uint32_t adpcmFrame(adpcmState *st, const int16_t *pcm, uint32_t samples, uint16_t sequence, uint32_t timeMs, uint8_t *frame, uint32_t frameLen)
+{
+
+    uint32_t len = ADPCM_FRAME_SIZE(samples);
+    if (samples > 255 || len > frameLen) {
+        return 0;
+    }
+
+    // Header
+    frame[0] = ADPCM_FRAME_MAGIC;
+    frame[1] = (uint8_t) samples;
+    frame[2] = (uint8_t) sequence;
+    frame[3] = (uint8_t) (sequence >> 8);
+    frame[4] = (uint8_t) st->predictor;
+    frame[5] = (uint8_t) ((uint16_t) st->predictor >> 8);
+    frame[6] = st->index;
+    frame[7] = 0;
+    frame[8] = (uint8_t) timeMs;
+    frame[9] = (uint8_t) (timeMs >> 8);
+    frame[10] = (uint8_t) (timeMs >> 16);
+    frame[11] = (uint8_t) (timeMs >> 24);
+
+    // Body
+    adpcmEncode(st, pcm, samples, &frame[ADPCM_FRAME_HEADER]);
+
+    // Trailer
+    uint32_t crcLen = len - ADPCM_FRAME_TRAILER;
+    uint16_t crc = crc16(frame, crcLen);
+    frame[crcLen] = (uint8_t) crc;
+    frame[crcLen+1] = (uint8_t) (crc >> 8);
+    return len;
+
+}
+
+// Validate a frame and decode its samples, returning how many there were or 0 if
+// the frame is malformed, fails its CRC, or has more samples than will fit.
+uint32_t adpcmUnframe(const uint8_t *frame, uint32_t frameLen, int16_t *pcm, uint32_t pcmMax, uint16_t *retSequence, uint32_t *retTimeMs)
+{
+
+    if (frameLen < ADPCM_FRAME_SIZE(0) || frame[0] != ADPCM_FRAME_MAGIC) {
+        return 0;
+    }
+    uint32_t samples = frame[1];
+    if (samples == 0 || samples > pcmMax || frameLen != ADPCM_FRAME_SIZE(samples)) {
+        return 0;
+    }
+    uint32_t crcLen = frameLen - ADPCM_FRAME_TRAILER;
+    if (crc16(frame, crcLen) != (uint16_t) (frame[crcLen] | (frame[crcLen+1] << 8))) {
+        return 0;
+    }
+
+    // Each frame carries the encoder state as it was before its first sample
+    adpcmState st;
+    st.predictor = (int16_t) (frame[4] | (frame[5] << 8));
+    st.index = frame[6];
+    if (st.index > 88) {
+        return 0;
+    }
+    adpcmDecode(&st, &frame[ADPCM_FRAME_HEADER], samples, pcm);
+
+    if (retSequence != NULL) {
+        *retSequence = (uint16_t) (frame[2] | (frame[3] << 8));
+    }
+    if (retTimeMs != NULL) {
+        *retTimeMs = (uint32_t) frame[8] | ((uint32_t) frame[9] << 8) | ((uint32_t) frame[10] << 16) | ((uint32_t) frame[11] << 24);
+    }
+    return samples;
+
+}
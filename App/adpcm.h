@@ -0,0 +1,39 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// IMA-ADPCM encoder state, carried from one block to the next so that the stream
+// is continuous.  Like duty.h, this is free of any HAL or RTOS dependency, and
+// Test/adpcm_test.c round-trips it on a host.
+typedef struct {
+    int16_t predictor;          // Last reconstructed sample
+    uint8_t index;              // Index into the step size table
+} adpcmState;
+
+// A framed block, all fields little-endian:
+//   [0]     ADPCM_FRAME_MAGIC
+//   [1]     number of samples in the frame
+//   [2..3]  frame sequence number
+//   [4..5]  encoder predictor before the first sample
+//   [6]     encoder step index before the first sample
+//   [7]     reserved, 0
+//   [8..11] RTC time of the first sample, in milliseconds (low 32 bits)
+//   [...]   (samples+1)/2 bytes of 4-bit codes, first sample in the low nibble
+//   [...]   CRC16 (crc16.c) of everything preceding it
+// Because each frame carries the encoder state, frames can be decoded independently.
+#define ADPCM_FRAME_MAGIC       0xAD
+#define ADPCM_FRAME_HEADER      12
+#define ADPCM_FRAME_TRAILER     2
+#define ADPCM_FRAME_SIZE(samples)   (ADPCM_FRAME_HEADER + (((samples)+1)/2) + ADPCM_FRAME_TRAILER)
+
+void adpcmInit(adpcmState *st);
+void adpcmEncode(adpcmState *st, const int16_t *pcm, uint32_t samples, uint8_t *codes);
+void adpcmDecode(adpcmState *st, const uint8_t *codes, uint32_t samples, int16_t *pcm);
+uint32_t adpcmFrame(adpcmState *st, const int16_t *pcm, uint32_t samples, uint16_t sequence, uint32_t timeMs, uint8_t *frame, uint32_t frameLen);
+uint32_t adpcmUnframe(const uint8_t *frame, uint32_t frameLen, int16_t *pcm, uint32_t pcmMax, uint16_t *retSequence, uint32_t *retTimeMs);
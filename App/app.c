@@ -7,12 +7,28 @@
 #include "rtc.h"
 #include "stm32_lpm_if.h"
 
+// Main task storage, when statically allocating
+#if STATIC_ALLOCATION_PROFILE
+STATIC StaticTask_t mainTaskTCB;
+STATIC StackType_t mainTaskStack[STACKWORDS(TASKSTACK_MAIN)];
+#endif
+
 // Initialize the app
 void appInit()
 {
 
+    // Create the global packages' mutexes, which must exist before any task locks them
+    timerInit();
+    taskInit();
+    randInit();
+    errInit();
+
     // Create the main task
+#if STATIC_ALLOCATION_PROFILE
+    xTaskCreateStatic(mainTask, TASKNAME_MAIN, STACKWORDS(TASKSTACK_MAIN), NULL, TASKPRI_MAIN, mainTaskStack, &mainTaskTCB);
+#else
     xTaskCreate(mainTask, TASKNAME_MAIN, STACKWORDS(TASKSTACK_MAIN), NULL, TASKPRI_MAIN, NULL);
+#endif
 
 }
 
@@ -33,10 +49,10 @@ void appISR(uint16_t GPIO_Pin)
 #endif
 
     // USB Detect processing, noting that the signal is ACTIVE HIGH
-    // We just wake up any task that might be interested in the change
+    // We just let any task that might be interested know of the change
 #ifdef USB_DETECT_Pin
     if ((GPIO_Pin & USB_DETECT_Pin) != 0) {
-        taskGiveAllFromISR();
+        taskPostAll(TASKMSG_USB_DETECT, HAL_GPIO_ReadPin(USB_DETECT_GPIO_Port, USB_DETECT_Pin) == GPIO_PIN_SET);
     }
 #endif
 
@@ -109,5 +125,8 @@ bool appSleepAllowed(void)
     if (osUsbDetected()) {
         return false;
     }
+    if (audioDutyCycling()) {
+        return true;
+    }
     return APP_SUPPORTS_STOP2_MODE;
 }
@@ -14,6 +14,8 @@
 #define ENABLE_USART2               false
 
 // Task parameters
+#define TASK_STACK_PROFILE          true        // Record worst-case use of the TASKSTACK_* sizes across resets
+
 #define TASKID_MAIN                 0           // Serial uart poller
 #define TASKNAME_MAIN               "uart"
 #define TASKLETTER_MAIN             'U'
@@ -34,26 +36,106 @@
 
 #define TASKID_NUM_TASKS            3           // Total
 #define TASKID_UNKNOWN              0xFFFF
+
+// Messages posted to tasks by interrupts (see taskPost)
+#define TASKMSG_BUTTON              1           // value is nonzero if pressed
+#define TASKMSG_USB_DETECT          2           // value is nonzero if USB is present
+#define TASKMSG_AUDIO_BLOCK         3           // value is the block's capture cycle count
+#define TASKMSG_SERIAL_RX           4           // value is nonzero if a receive error
+#define TASKMSG_SERIAL_TX           5
+#define TASKMSG_SERIAL_WAKE         6
 #define STACKWORDS(x)               ((x) / sizeof(StackType_t))
 
 // audio.c
+#define AUDIO_DUTY_WINDOW_MS        0           // 0 means measure continuously
+#define AUDIO_DUTY_PERIOD_MS        ms1Min
+#define AUDIO_SETTLE_BLOCKS         1           // Discarded after starting, for filter settling
+#define AUDIO_ACTIVE_MA             9.0         // Estimated draw at 80Mhz with SAI, PLLSAI1 and mic
+#define AUDIO_IDLE_MA               0.02        // Estimated draw in STOP2 with the mic unclocked
+#define AUDIO_ADPCM_FRAMES          4           // Encoded frames buffered for the consumer
+#define AUDIO_BANDS_MAX             8           // Most octave bands reported
+#define AUDIO_PCM_RATE_HZ           (((double) AUDIO_PCM_SAMPLES * (double) AUDIO_IN_FREQ_MHZ) / ((double) BLOCK_SIZE * 8.0))
 void audioTask(void *params);
 double audioSpl(void);
+int64_t audioSplTimeUs(void);
+void audioSplStats(uint32_t *count, double *min, double *max, double *leq, uint32_t *secs);
+void audioSplStatsReset(void);
+uint32_t audioBands(double *levels, uint32_t maxLevels, uint32_t *centersHz);
+void audioDutySet(uint32_t windowMs, uint32_t periodMs);
+bool audioDutyCycling(void);
+void audioDutyStats(uint32_t *windowMs, uint32_t *periodMs, uint32_t *measuringSecs, uint32_t *idleSecs, double *avgMa);
+void audioAdpcmStream(uint32_t frames);
+bool audioAdpcmNextFrame(uint8_t *frame, uint32_t frameLen, uint32_t *retLen);
+void audioAdpcmStats(uint32_t *frames, uint32_t *dropped, double *cyclesPerSample);
+
+// blocktime.c
+void blocktimeReset(void);
+uint32_t blocktimeCaptureFromISR(void);
+int64_t blocktimeStamp(uint32_t sequence, uint32_t captureCycles);
+void blocktimeStats(double *periodUs, double *driftPpm, uint32_t *resyncs);
+
+// snapshot.c
+#define SNAPSHOT_BLOCKS             64          // ~1.5s of audio at ~24ms per block
+#define SNAPSHOT_POST_BLOCKS        16          // Blocks captured after the trigger
+#define SNAPSHOT_DEFAULT_THRESHOLD  0           // SPL that triggers a snapshot, 0 for none
+#define SNAPSHOT_EXPORT_BYTES       96          // Encoded samples per exported line
+void snapshotAddBlock(int16_t *pcm, uint32_t samples, int64_t blockStartUs, double spl);
+void snapshotRestart(void);
+void snapshotTrigger(void);
+void snapshotSetThreshold(double spl);
+void snapshotStatus(char **state, double *threshold, uint32_t *triggers);
+err_t snapshotExport(void);
 
 // simple.c
 void simple_pdm2pcm_init(void);
 void simple_pdm2pcm(uint8_t *pdm_data, int16_t *pcm_data, int block_size);
 
 // serial.c
+#define SERIAL_TX_CHUNK             0           // Bytes per transmit on UARTs, 0 meaning as many as are queued
+#define SERIAL_TX_CHUNK_USB         0           // Bytes per transfer on USB, 0 meaning as many as the CDC engine stages
+#define SERIAL_TX_GAP_MS            0           // Delay between chunks, for hosts that can't keep up
+#define SERIAL_RX_LINES             4           // Received lines queued per port for the request task
+#define SERIAL_RX_GUARD_MS          25          // Time to stay awake after an RX wakeup, for bytes to arrive
+#define SERIAL_BAUD_DEFAULT         9600        // Rate at boot, and that we fall back to
+#define SERIAL_BAUD_RATES           { 9600, 19200, 38400, 57600, 115200, 230400, 460800 }
+#define SERIAL_BAUD_CONFIRM_MS      2000        // Host must send to us at a new rate within this time
+#define SERIAL_BAUD_IDLE_MS         60000       // Revert to the default rate after this long without traffic
+typedef struct {
+    uint8_t *buf;
+    uint32_t len;
+} serialSegment;
 bool serialIsActive(void);
+uint32_t serialWakeupCount(void);
 void serialInit(uint32_t serialTaskID);
 void serialPoll(void);
 bool serialIsDebugPort(UART_HandleTypeDef *huart);
-bool serialLock(UART_HandleTypeDef *huart, uint8_t **retData, uint32_t *retDataLen, bool *retDiagAllowed);
+bool serialLock(UART_HandleTypeDef *huart, uint8_t **retData, uint32_t *retDataLen, bool *retDiagAllowed, bool *retBinary);
 void serialUnlock(UART_HandleTypeDef *huart, bool reset);
+void serialRxStats(UART_HandleTypeDef *huart, uint32_t *retQueued, uint32_t *retOverflows, uint32_t *retAbandoned);
+err_t serialCheckBaudRate(UART_HandleTypeDef *huart, uint32_t baudRate);
+err_t serialSetBaudRate(UART_HandleTypeDef *huart, uint32_t baudRate);
+void serialBaudStats(UART_HandleTypeDef *huart, uint32_t *retBaudRate, uint32_t *retFallbacks);
 void serialOutputString(UART_HandleTypeDef *huart, char *buf);
-void serialOutput(UART_HandleTypeDef *huart, uint8_t *buf, uint32_t buflen);
-void serialOutputLn(UART_HandleTypeDef *huart, uint8_t *buf, uint32_t buflen);
+bool serialOutput(UART_HandleTypeDef *huart, uint8_t *buf, uint32_t buflen);
+void serialSetPacing(UART_HandleTypeDef *huart, uint16_t chunkLen, uint16_t gapMs);
+void serialFlush(UART_HandleTypeDef *huart, uint32_t timeoutMs);
+bool serialOutputV(UART_HandleTypeDef *huart, serialSegment *segs, uint32_t count);
+bool serialOutputLn(UART_HandleTypeDef *huart, uint8_t *buf, uint32_t buflen);
+bool serialTryOutputV(UART_HandleTypeDef *huart, serialSegment *segs, uint32_t count);
+void serialWake(void);
+
+// telemetry.c
+#define TELEMETRY_NONE              0
+#define TELEMETRY_SPL               1           // SPL of the most recent block
+#define TELEMETRY_INTERVAL          2           // Min/max/Leq over each period
+#define TELEMETRY_JSON              0
+#define TELEMETRY_BINARY            1           // Frames, as in frame.h
+#define TELEMETRY_MIN_PERIOD_MS     25          // About one block
+#define TELEMETRY_DEFAULT_SECS      600         // Subscriptions lapse unless renewed
+err_t telemetrySubscribe(UART_HandleTypeDef *huart, uint8_t kind, uint8_t format, uint32_t periodMs, uint32_t secs);
+void telemetryStats(UART_HandleTypeDef *huart, uint8_t *kind, uint32_t *periodMs, uint32_t *sent, uint32_t *coalesced);
+void telemetryBlock(double spl, int64_t blockStartUs);
+bool telemetryService(void);
 
 // maintask.c
 void mainTask(void *params);
@@ -62,9 +144,14 @@ void mainTask(void *params);
 #include "st/pdm2pcm.h"
 #define BUFFER_COUNT    3
 #define BUFFER_SIZE     BLOCK_SIZE
+#if USE_SIMPLE_DECIMATION
+#define AUDIO_PCM_SAMPLES   (BLOCK_SIZE * 8 / AUDIO_IN_DECIMATOR_FACTOR)
+#else
+#define AUDIO_PCM_SAMPLES   (BLOCK_SIZE / (DEC_CIC_FACTOR * DEC_OUT_FACTOR))
+#endif
 void bufferInit(void);
-void bufferGetNextFree(uint8_t **buffer, uint32_t *buffer_length);
-bool bufferGetNextCompleted(uint8_t **buffer, uint32_t *buffer_length);
+void bufferGetNextFree(uint32_t captureCycles, uint8_t **buffer, uint32_t *buffer_length);
+bool bufferGetNextCompleted(uint8_t **buffer, uint32_t *buffer_length, uint32_t *sequence, uint32_t *captureCycles);
 void bufferFree(uint8_t *buffer);
 void bufferStats(uint32_t *gets, uint32_t *frees, uint32_t *overruns, uint32_t *hwm, double *avgGetMs, double *avgProcessMs);
 
@@ -80,11 +167,21 @@ bool ledIsEnabled(void);
 #define rdtNone             0
 #define rdtRestart          1
 #define rdtBootloader       2
+#define REQ_READY_LPUART1   0x00000001  // Readiness bits signalled to the request task, by priority
+#define REQ_READY_USART1    0x00000002
+#define REQ_READY_USB       0x00000004
+#define REQ_READY_USART2    0x00000008
+#define REQ_READY_ALL       (REQ_READY_LPUART1 | REQ_READY_USART1 | REQ_READY_USB | REQ_READY_USART2 | TASK_SIGNAL_WAKE)
 void reqTask(void *params);
-void reqButtonPressedISR(void);
 
 // req.c
-err_t reqProcess(bool debugPort, uint8_t *reqJSON, bool diagAllowed);
+#define REQ_MAX_TOKENS      48          // JSON tokens in a single request
+#define REQ_MAX_RESPONSE    320         // Bytes in a single JSON response
+err_t reqProcess(UART_HandleTypeDef *huart, uint8_t *reqJSON, bool diagAllowed);
+void reqProcessFrame(UART_HandleTypeDef *huart, uint8_t *frame, uint32_t frameLen);
+err_t reqDispatch(UART_HandleTypeDef *huart, char *reqJSON, char *rsp, uint32_t rspLen, uint32_t *retRspLen);
+void reqStats(uint32_t *count, double *avgUs, double *maxUs);
+void reqFrameStats(uint32_t *frames, uint32_t *errors);
 
 // diag.c
 err_t diagProcess(char *diagCommand);
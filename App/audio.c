@@ -3,34 +3,77 @@
 // copyright holder including that found in the LICENSE file.
 
 #include "app.h"
+#include "duty.h"
+#include "adpcm.h"
+#include "bands.h"
 #include "sai.h"
 #include <math.h>
 
 // PCM buffer
-#if USE_SIMPLE_DECIMATION
-int16_t pcm_buffer[BLOCK_SIZE * 8 / AUDIO_IN_DECIMATOR_FACTOR];
-#else
-int16_t pcm_buffer[BLOCK_SIZE / (DEC_CIC_FACTOR * DEC_OUT_FACTOR)];
-#endif
+int16_t pcm_buffer[AUDIO_PCM_SAMPLES];
 
 // Define buffer sizes for processing half a buffer
 double lastSpl = 0;
+int64_t lastSplTimeUs = 0;
+
+// Octave band levels of the last block
+STATIC bandsState bands;
+STATIC double lastBands[BANDS_COUNT];
+
+// SPL statistics since they were last reset.  Resets are posted by other tasks and
+// applied by the audio task.
+STATIC uint32_t splStatsCount = 0;
+STATIC double splStatsMin = 0;
+STATIC double splStatsMax = 0;
+STATIC double splStatsEnergy = 0;
+STATIC int64_t splStatsBeganMs = 0;
+STATIC volatile bool splStatsResetRequested = true;
 
 // Errors
 uint32_t saiErrorCount = 0;
 
+// Duty cycling.  Config changes are posted by other tasks and applied by the audio task.
+STATIC dutySchedule schedule = {0};
+STATIC volatile bool scheduleChanged = false;
+STATIC volatile uint32_t scheduleWindowMs = AUDIO_DUTY_WINDOW_MS;
+STATIC volatile uint32_t schedulePeriodMs = AUDIO_DUTY_PERIOD_MS;
+
+// ADPCM streaming.  Frames are encoded on the audio task into a small ring that is
+// drained by whichever task requested the stream.
+STATIC adpcmState adpcmEncoder;
+STATIC uint8_t adpcmFrames[AUDIO_ADPCM_FRAMES][ADPCM_FRAME_SIZE(AUDIO_PCM_SAMPLES)];
+STATIC uint32_t adpcmFrameLen[AUDIO_ADPCM_FRAMES];
+STATIC volatile uint32_t adpcmHead = 0;
+STATIC volatile uint32_t adpcmTail = 0;
+STATIC volatile uint32_t adpcmWanted = 0;
+STATIC volatile bool adpcmRestart = false;
+STATIC uint16_t adpcmSequence = 0;
+STATIC uint32_t adpcmDropped = 0;
+STATIC uint64_t adpcmCycles = 0;
+STATIC uint64_t adpcmSamples = 0;
+
+// Whether or not the SAI is running, and how many blocks to discard after starting
+STATIC volatile bool audioRunning = false;
+STATIC uint32_t discardBlocks = 0;
+
 // Forwards
 bool processAudio(void);
+void audioStart(void);
+void audioStop(void);
 double compute_spl(int16_t *pcm_data, int num_samples);
+double splFromMeanSquare(double meanSquare);
+void updateSplStats(double spl);
+void encodeADPCM(uint32_t pcm_entries, int64_t blockStartUs);
 
 // Process one chunk of PDM data
-void processPDMData(uint8_t *pdm_data, uint32_t pdm_size)
+void processPDMData(uint8_t *pdm_data, uint32_t pdm_size, int64_t blockStartUs)
 {
 
     // Exit if incorrect pdm_size
     if (pdm_size != BLOCK_SIZE) {
         return;
     }
+    timelineSpanBegin(TIMELINE_SPAN_BLOCK);
 
     // Convert the PDM data tp PCM data
     // To convert the PDM data captured from the microphone to PCM data with an 8 kHz sample rate,
@@ -39,15 +82,69 @@ void processPDMData(uint8_t *pdm_data, uint32_t pdm_size)
     //      This involves summing groups of bits and downsampling the data.
     // 2.	Low-Pass Filtering:
     //      Remove high-frequency noise introduced by the PDM encoding.
+    timelineSpanBegin(TIMELINE_SPAN_PCM);
 #if USE_SIMPLE_DECIMATION
     simple_pdm2pcm(pdm_data, pcm_buffer, pdm_size);
 #else
     pdm2pcm(pdm_data, pcm_buffer, pdm_size);
 #endif
+    timelineSpanEnd(TIMELINE_SPAN_PCM);
 
     // Remember it
     uint32_t pcm_entries = sizeof(pcm_buffer) / sizeof(pcm_buffer[0]);
     lastSpl = compute_spl(pcm_buffer, pcm_entries);
+    lastSplTimeUs = blockStartUs;
+    updateSplStats(lastSpl);
+    telemetryBlock(lastSpl, blockStartUs);
+
+    // Break it down into octave bands
+    timelineSpanBegin(TIMELINE_SPAN_BANDS);
+    double meanSquare[BANDS_COUNT];
+    bandsProcess(&bands, pcm_buffer, pcm_entries, meanSquare);
+    for (int i=0; i<BANDS_COUNT; i++) {
+        lastBands[i] = splFromMeanSquare(meanSquare[i]);
+    }
+    timelineSpanEnd(TIMELINE_SPAN_BANDS);
+
+    // Retain it in case something interesting happens
+    snapshotAddBlock(pcm_buffer, pcm_entries, blockStartUs, lastSpl);
+
+    // Encode it if someone is streaming
+    if (adpcmWanted > 0) {
+        timelineSpanBegin(TIMELINE_SPAN_ADPCM);
+        encodeADPCM(pcm_entries, blockStartUs);
+        timelineSpanEnd(TIMELINE_SPAN_ADPCM);
+    }
+
+    timelineSpanEnd(TIMELINE_SPAN_BLOCK);
+}
+
+// Encode the PCM buffer as an ADPCM frame, measuring the encoder cost
+void encodeADPCM(uint32_t pcm_entries, int64_t blockStartUs)
+{
+
+    if (adpcmRestart) {
+        adpcmRestart = false;
+        adpcmInit(&adpcmEncoder);
+        adpcmSequence = 0;
+    }
+
+    // If the consumer isn't keeping up, drop the frame
+    if (adpcmHead - adpcmTail >= AUDIO_ADPCM_FRAMES) {
+        adpcmSequence++;
+        adpcmDropped++;
+        adpcmWanted--;
+        return;
+    }
+
+    uint32_t slot = adpcmHead % AUDIO_ADPCM_FRAMES;
+    uint32_t beganCycles = MX_CYC_Count();
+    adpcmFrameLen[slot] = adpcmFrame(&adpcmEncoder, pcm_buffer, pcm_entries, adpcmSequence++,
+                                     (uint32_t) (blockStartUs / 1000), adpcmFrames[slot], sizeof(adpcmFrames[slot]));
+    adpcmCycles += (uint32_t) (MX_CYC_Count() - beganCycles);
+    adpcmSamples += pcm_entries;
+    adpcmHead++;
+    adpcmWanted--;
 
 }
 
@@ -61,8 +158,15 @@ double compute_spl(int16_t *pcm_data, int num_samples)
         sum += pcm_data[i] * pcm_data[i];
     }
 
+    return splFromMeanSquare((double)sum / num_samples);
+}
+
+// Convert the mean square of PCM samples to SPL in dB
+double splFromMeanSquare(double meanSquare)
+{
+
     // Compute RMS value
-    double rms = sqrt((double)sum / num_samples);
+    double rms = sqrt(meanSquare);
 
     // Compute SPL in dB
     double reference_rms = 1032.0f;
@@ -71,12 +175,98 @@ double compute_spl(int16_t *pcm_data, int num_samples)
     return spl;
 }
 
+// Accumulate SPL statistics, where the average is the energy (Leq) average
+void updateSplStats(double spl)
+{
+    if (splStatsResetRequested) {
+        splStatsResetRequested = false;
+        splStatsCount = 0;
+        splStatsEnergy = 0;
+        splStatsBeganMs = timerMs();
+    }
+    if (splStatsCount == 0 || spl < splStatsMin) {
+        splStatsMin = spl;
+    }
+    if (splStatsCount == 0 || spl > splStatsMax) {
+        splStatsMax = spl;
+    }
+    splStatsEnergy += pow(10.0, spl / 10.0);
+    splStatsCount++;
+}
+
 // Get the last spl
 double audioSpl(void)
 {
     return lastSpl;
 }
 
+// Get the RTC time, in microseconds, of the first sample of the block that produced the last spl
+int64_t audioSplTimeUs(void)
+{
+    return lastSplTimeUs;
+}
+
+// Get SPL statistics since they were last reset
+void audioSplStats(uint32_t *count, double *min, double *max, double *leq, uint32_t *secs)
+{
+    uint32_t n = splStatsResetRequested ? 0 : splStatsCount;
+    *count = n;
+    *min = n == 0 ? 0 : splStatsMin;
+    *max = n == 0 ? 0 : splStatsMax;
+    *leq = n == 0 ? 0 : 10.0 * log10(splStatsEnergy / n);
+    *secs = n == 0 ? 0 : (uint32_t) ((timerMs() - splStatsBeganMs) / ms1Sec);
+}
+
+// Reset SPL statistics, which takes effect with the next block
+void audioSplStatsReset(void)
+{
+    splStatsResetRequested = true;
+}
+
+// Get the octave band levels of the last block, in dB, returning the number of bands
+uint32_t audioBands(double *levels, uint32_t maxLevels, uint32_t *centersHz)
+{
+    static const uint32_t centers[BANDS_COUNT] = BANDS_CENTERS_HZ;
+    uint32_t n = GMIN(maxLevels, BANDS_COUNT);
+    for (uint32_t i=0; i<n; i++) {
+        levels[i] = lastBands[i];
+        if (centersHz != NULL) {
+            centersHz[i] = centers[i];
+        }
+    }
+    return n;
+}
+
+// Begin streaming the specified number of ADPCM frames, discarding any not yet consumed
+void audioAdpcmStream(uint32_t frames)
+{
+    adpcmWanted = 0;
+    adpcmTail = adpcmHead;
+    adpcmRestart = true;
+    adpcmWanted = frames;
+}
+
+// Get the next encoded ADPCM frame, if one is available
+bool audioAdpcmNextFrame(uint8_t *frame, uint32_t frameLen, uint32_t *retLen)
+{
+    if (adpcmTail == adpcmHead) {
+        return false;
+    }
+    uint32_t slot = adpcmTail % AUDIO_ADPCM_FRAMES;
+    uint32_t len = GMIN(adpcmFrameLen[slot], frameLen);
+    memcpy(frame, adpcmFrames[slot], len);
+    *retLen = len;
+    adpcmTail++;
+    return true;
+}
+
+// Get ADPCM encoder stats
+void audioAdpcmStats(uint32_t *frames, uint32_t *dropped, double *cyclesPerSample)
+{
+    *frames = adpcmSequence;
+    *dropped = adpcmDropped;
+    *cyclesPerSample = adpcmSamples == 0 ? 0 : (double) adpcmCycles / (double) adpcmSamples;
+}
 
 // Audio task
 void audioTask(void *params)
@@ -85,7 +275,49 @@ void audioTask(void *params)
     // Init task
     taskRegister(TASKID_AUDIO, TASKNAME_AUDIO, TASKLETTER_AUDIO, TASKSTACK_AUDIO);
 
-    // Init pdm2pcm
+    // Init the measurement schedule and band filters
+    dutyInit(&schedule, scheduleWindowMs, schedulePeriodMs);
+    bandsInit(&bands, AUDIO_PCM_RATE_HZ);
+
+    // Loop, polling
+    while (true) {
+
+        // Blocks are handed over through the buffer ring, so the messages that the
+        // SAI posts (and USB detect changes) only serve to wake us
+        msgqMsg msg;
+        while (taskReceive(TASKID_AUDIO, &msg)) {
+        }
+
+        // Apply schedule changes
+        if (scheduleChanged) {
+            scheduleChanged = false;
+            dutyInit(&schedule, scheduleWindowMs, schedulePeriodMs);
+        }
+
+        // Start or stop the audio pipeline based upon where we are in the schedule
+        uint32_t waitMs;
+        bool measure = dutyUpdate(&schedule, timerMs(), &waitMs);
+        if (measure && !audioRunning) {
+            audioStart();
+        } else if (!measure && audioRunning) {
+            audioStop();
+        }
+
+        // Process audio or wait for the next window, noting that between
+        // windows the system is allowed to enter STOP2.
+        if (!audioRunning || !processAudio()) {
+            taskTake(TASKID_AUDIO, GMIN(waitMs, ms1Hour));
+        }
+
+    }
+
+}
+
+// Start the audio pipeline
+void audioStart(void)
+{
+
+    // Init pdm2pcm, which also resets the filter state
 #if USE_SIMPLE_DECIMATION
     simple_pdm2pcm_init();
 #else
@@ -94,33 +326,69 @@ void audioTask(void *params)
     }
 #endif
 
-
     // Init buffer I/O management
     bufferInit();
+    blocktimeReset();
+    snapshotRestart();
+    bandsReset(&bands);
 
-    // Initialize SAI
+    // The filters need a block to settle after starting
+    discardBlocks = AUDIO_SETTLE_BLOCKS;
+
+    // Initialize SAI, which also enables PLLSAI1
     MX_SAI1_Init();
 
     // Start the first receive
+    audioRunning = true;
     HAL_SAI_RxCpltCallback(&hsai_BlockA1);
 
-    // Loop, polling
-    while (true) {
-        if (!processAudio()) {
-            taskTake(TASKID_AUDIO, ms1Hour);
-        }
-    }
+}
 
+// Stop the audio pipeline, shutting down SAI, its DMA, and PLLSAI1
+void audioStop(void)
+{
+    audioRunning = false;
+    HAL_SAI_DMAStop(&hsai_BlockA1);
+    MX_SAI1_DeInit();
+}
+
+// Set the measurement schedule, where a window of 0 means continuous
+void audioDutySet(uint32_t windowMs, uint32_t periodMs)
+{
+    scheduleWindowMs = windowMs;
+    schedulePeriodMs = periodMs;
+    scheduleChanged = true;
+    taskGive(TASKID_AUDIO);
+}
+
+// See if we're duty-cycling, in which case we allow STOP2 between windows
+bool audioDutyCycling(void)
+{
+    return dutyIsCycling(&schedule) && !audioRunning;
+}
+
+// Get duty-cycle stats, including an estimate of average current
+void audioDutyStats(uint32_t *windowMs, uint32_t *periodMs, uint32_t *measuringSecs, uint32_t *idleSecs, double *avgMa)
+{
+    *windowMs = schedule.windowMs;
+    *periodMs = schedule.periodMs;
+    *measuringSecs = (uint32_t) (schedule.measuringTotalMs / ms1Sec);
+    *idleSecs = (uint32_t) (schedule.idleTotalMs / ms1Sec);
+    *avgMa = dutyAverageMa(&schedule, AUDIO_ACTIVE_MA, AUDIO_IDLE_MA);
 }
 
 // Start the next receive
 void HAL_SAI_RxCpltCallback(SAI_HandleTypeDef *hsai)
 {
+    if (!audioRunning) {
+        return;
+    }
+    uint32_t captureCycles = blocktimeCaptureFromISR();
     uint8_t *pdm_buffer;
     uint32_t pdm_buffer_length;
-    bufferGetNextFree(&pdm_buffer, &pdm_buffer_length);
+    bufferGetNextFree(captureCycles, &pdm_buffer, &pdm_buffer_length);
     HAL_SAI_Receive_DMA(hsai, pdm_buffer, pdm_buffer_length);
-    taskGiveFromISR(TASKID_AUDIO);
+    taskPost(TASKID_AUDIO, TASKMSG_AUDIO_BLOCK, captureCycles);
 }
 
 // Errors
@@ -136,13 +404,21 @@ bool processAudio(void)
 
     // If no audio buffer ready, exit
     uint8_t *buf;
-    uint32_t buflen;
-    if (!bufferGetNextCompleted(&buf, &buflen)) {
+    uint32_t buflen, sequence, captureCycles;
+    if (!bufferGetNextCompleted(&buf, &buflen, &sequence, &captureCycles)) {
         return false;
     }
 
-    // Process it
-    processPDMData(buf, buflen);
+    // Discard blocks while the filters settle
+    if (discardBlocks > 0) {
+        discardBlocks--;
+        bufferFree(buf);
+        return true;
+    }
+
+    // Stamp it with the time of its first sample, and process it
+    int64_t blockStartUs = blocktimeStamp(sequence, captureCycles);
+    processPDMData(buf, buflen, blockStartUs);
 
     // Done
     bufferFree(buf);
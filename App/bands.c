@@ -0,0 +1,59 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#include "bands.h"
+#include <math.h>
+
+// Compute the coefficients for each band, using the RBJ cookbook bandpass with
+// a bandwidth of one octave.  Because b1 is always 0 and b2 is always -b0, only
+// b0, a1 and a2 need be kept.
+void bandsInit(bandsState *st, double sampleRateHz)
+{
+    static const double centersHz[BANDS_COUNT] = BANDS_CENTERS_HZ;
+    for (int i=0; i<BANDS_COUNT; i++) {
+        double w0 = 2.0 * M_PI * centersHz[i] / sampleRateHz;
+        if (w0 >= M_PI) {
+            w0 = M_PI * 0.99;
+        }
+        double alpha = sin(w0) * sinh((log(2.0) / 2.0) * 1.0 * w0 / sin(w0));
+        double a0 = 1.0 + alpha;
+        st->filter[i].b0 = (float) (alpha / a0);
+        st->filter[i].a1 = (float) ((-2.0 * cos(w0)) / a0);
+        st->filter[i].a2 = (float) ((1.0 - alpha) / a0);
+    }
+    bandsReset(st);
+}
+
+// Clear the filters' history, such as when the audio pipeline is restarted
+void bandsReset(bandsState *st)
+{
+    for (int i=0; i<BANDS_COUNT; i++) {
+        bandsFilter *f = &st->filter[i];
+        f->x1 = f->x2 = f->y1 = f->y2 = 0;
+    }
+}
+
+// Filter a block through each band, returning the mean square of each band's output
+void bandsProcess(bandsState *st, const int16_t *pcm, uint32_t samples, double *retMeanSquare)
+{
+    for (int i=0; i<BANDS_COUNT; i++) {
+        bandsFilter *f = &st->filter[i];
+        float x1 = f->x1, x2 = f->x2, y1 = f->y1, y2 = f->y2;
+        float sum = 0;
+        for (uint32_t j=0; j<samples; j++) {
+            float x = (float) pcm[j];
+            float y = f->b0 * (x - x2) - f->a1 * y1 - f->a2 * y2;
+            x2 = x1;
+            x1 = x;
+            y2 = y1;
+            y1 = y;
+            sum += y * y;
+        }
+        f->x1 = x1;
+        f->x2 = x2;
+        f->y1 = y1;
+        f->y2 = y2;
+        retMeanSquare[i] = (samples == 0) ? 0 : (double) sum / (double) samples;
+    }
+}
@@ -0,0 +1,33 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Octave band filter bank, run over each block of decimated PCM.  Like duty.h, this
+// is free of any HAL or RTOS dependency, and Test/bands_test.c measures its response
+// on a host.  Note that at our ~4.76kHz sample rate the top band's upper edge is above
+// Nyquist, so it is effectively a high-pass, passing 1kHz only 1.9dB down where the
+// other bands reject their neighbours' centers by at least 6.5dB.
+#define BANDS_COUNT         5
+#define BANDS_CENTERS_HZ    { 125, 250, 500, 1000, 2000 }
+
+// A constant-peak-gain bandpass biquad, and its delay line
+typedef struct {
+    float b0;
+    float a1;
+    float a2;
+    float x1, x2;
+    float y1, y2;
+} bandsFilter;
+
+typedef struct {
+    bandsFilter filter[BANDS_COUNT];
+} bandsState;
+
+void bandsInit(bandsState *st, double sampleRateHz);
+void bandsReset(bandsState *st);
+void bandsProcess(bandsState *st, const int16_t *pcm, uint32_t samples, double *retMeanSquare);
@@ -0,0 +1,97 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#include "app.h"
+#include "rtc.h"
+
+// This module assigns a sample-accurate start time to each completed audio block.
+// The SAI completion ISR captures the free-running cycle counter, and then on the
+// audio task we convert that capture to RTC time.  Because the RTC subsecond
+// resolution is coarse and the SAI clock (HSI/PLLSAI1) drifts relative to the
+// RTC (LSE), we don't use the raw observation directly.  Instead we maintain a
+// linear model of "block N ended at anchor + N*period", nudging its phase on
+// every block and re-estimating its period every calibration interval.
+
+// Nominal duration of a single PDM block, in microseconds
+#define BLOCKTIME_NOMINAL_US        (((double) BLOCK_SIZE * 8.0 * 1000000.0) / (double) AUDIO_IN_FREQ_MHZ)
+
+// How often we re-estimate the period (~10s), and how aggressively we track phase
+#define BLOCKTIME_CALIBRATE_BLOCKS  400
+#define BLOCKTIME_PHASE_GAIN        16.0
+#define BLOCKTIME_PERIOD_GAIN       4.0
+
+// If an observation is this far from the model, blocks were lost or the clock was set
+#define BLOCKTIME_RESYNC_US         (BLOCKTIME_NOMINAL_US / 2.0)
+
+// Model state, only touched from the audio task
+STATIC bool anchored = false;
+STATIC uint32_t anchorSequence = 0;
+STATIC double anchorUs = 0;
+STATIC double periodUs = BLOCKTIME_NOMINAL_US;
+STATIC uint32_t calSequence = 0;
+STATIC double calUs = 0;
+STATIC uint32_t resyncCount = 0;
+
+// Reset the model, such as when the audio pipeline is restarted
+void blocktimeReset(void)
+{
+    anchored = false;
+}
+
+// Capture the cycle counter at block completion.  Called at ISR level.
+uint32_t blocktimeCaptureFromISR(void)
+{
+    return MX_CYC_Count();
+}
+
+// Convert a completed block's capture to the RTC time (in microseconds) of the block's
+// first sample.  Blocks must be presented in sequence order.
+int64_t blocktimeStamp(uint32_t sequence, uint32_t captureCycles)
+{
+
+    // Observe when the block ended, in RTC microseconds.  We sample the cycle counter
+    // and the RTC together so that the age of the capture can be subtracted.
+    uint32_t nowCycles = MX_CYC_Count();
+    int64_t nowMs = MX_RTC_GetMs();
+    double observedUs = ((double) nowMs * 1000.0) - MX_CYC_ToUs((uint32_t) (nowCycles - captureCycles));
+
+    // Re-anchor if we've never anchored or if the observation isn't plausible
+    double predictedUs = anchorUs + ((double) (sequence - anchorSequence) * periodUs);
+    double errorUs = observedUs - predictedUs;
+    if (!anchored || errorUs > BLOCKTIME_RESYNC_US || errorUs < -BLOCKTIME_RESYNC_US) {
+        if (anchored) {
+            resyncCount++;
+        }
+        anchored = true;
+        anchorSequence = calSequence = sequence;
+        anchorUs = calUs = predictedUs = observedUs;
+        return (int64_t) (predictedUs - periodUs);
+    }
+
+    // Slowly pull the phase toward the observation, which averages out RTC quantization
+    anchorUs += errorUs / BLOCKTIME_PHASE_GAIN;
+    predictedUs += errorUs / BLOCKTIME_PHASE_GAIN;
+
+    // Periodically re-estimate the block period against the RTC, compensating for drift
+    uint32_t calBlocks = sequence - calSequence;
+    if (calBlocks >= BLOCKTIME_CALIBRATE_BLOCKS) {
+        double measuredUs = (observedUs - calUs) / (double) calBlocks;
+        periodUs += (measuredUs - periodUs) / BLOCKTIME_PERIOD_GAIN;
+        anchorSequence = calSequence = sequence;
+        anchorUs = predictedUs;
+        calUs = observedUs;
+    }
+
+    // The block began one period before it ended
+    return (int64_t) (predictedUs - periodUs);
+
+}
+
+// Get block timing stats
+void blocktimeStats(double *retPeriodUs, double *retDriftPpm, uint32_t *retResyncs)
+{
+    *retPeriodUs = periodUs;
+    *retDriftPpm = ((periodUs - BLOCKTIME_NOMINAL_US) / BLOCKTIME_NOMINAL_US) * 1000000.0;
+    *retResyncs = resyncCount;
+}
@@ -16,6 +16,7 @@ typedef struct {
     uint8_t data[BUFFER_SIZE];
     atomic_int state; // Use atomic_int for safe concurrent state updates
     atomic_uint sequence_number;
+    uint32_t capture_cycles;    // Cycle counter when the DMA completed this buffer
 } Buffer;
 
 static Buffer buffers[BUFFER_COUNT];
@@ -40,8 +41,9 @@ void bufferInit(void)
 }
 
 // Get the next free buffer, marking it as busy.  Note that only one buffer can be
-// marked as busy at any given moment in time.
-void bufferGetNextFree(uint8_t **buffer, uint32_t *buffer_length)
+// marked as busy at any given moment in time.  The capture cycles are stamped
+// onto the previously-busy buffer as it is marked completed.
+void bufferGetNextFree(uint32_t captureCycles, uint8_t **buffer, uint32_t *buffer_length)
 {
     *buffer_length = BUFFER_SIZE;
 
@@ -80,6 +82,7 @@ void bufferGetNextFree(uint8_t **buffer, uint32_t *buffer_length)
     // Issue next busy and mark the previous one as completed
     if (next_busy != NULL) {
         if (current_busy != NULL) {
+            current_busy->capture_cycles = captureCycles;
             atomic_store(&current_busy->sequence_number, atomic_fetch_add(&next_sequence_number, 1));
             atomic_store(&current_busy->state, BUFFER_STATE_COMPLETED);
         }
@@ -100,8 +103,8 @@ void bufferGetNextFree(uint8_t **buffer, uint32_t *buffer_length)
     }
 }
 
-// Get the next completed buffer, in FIFO order
-bool bufferGetNextCompleted(uint8_t **buffer, uint32_t *buffer_length)
+// Get the next completed buffer, in FIFO order, along with its sequence number and capture time
+bool bufferGetNextCompleted(uint8_t **buffer, uint32_t *buffer_length, uint32_t *sequence, uint32_t *captureCycles)
 {
     Buffer *lowest = NULL;
     for (int i = 0; i < BUFFER_COUNT; i++) {
@@ -114,6 +117,8 @@ bool bufferGetNextCompleted(uint8_t **buffer, uint32_t *buffer_length)
     if (lowest != NULL) {
         *buffer = lowest->data;
         *buffer_length = BUFFER_SIZE;
+        *sequence = (uint32_t) atomic_load(&lowest->sequence_number);
+        *captureCycles = lowest->capture_cycles;
         lastProcessMs = timerMs();
         return true;
     }
@@ -24,6 +24,6 @@ void buttonPressISR(bool pressed)
     }
 
     // Process button press outside of ISR level
-    reqButtonPressedISR();
+    taskPost(TASKID_REQ, TASKMSG_BUTTON, 1);
 
 }
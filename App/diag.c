@@ -3,6 +3,7 @@
 // copyright holder including that found in the LICENSE file.
 
 #include "app.h"
+#include "adpcm.h"
 #include "usart.h"
 #include "post.h"
 extern float getLastSpl(void); // OZZIE
@@ -20,6 +21,16 @@ typedef enum {
     CMD_TRACE,
     CMD_T,
     CMD_POST,
+    CMD_DUTY,
+    CMD_SNAP,
+    CMD_ADPCM,
+    CMD_SERIAL,
+    CMD_REQ,
+    CMD_LOG,
+    CMD_TIMELINE,
+    CMD_CPU,
+    CMD_MUTEX,
+    CMD_MSG,
     CMD_UNRECOGNIZED
 } allCommands;
 
@@ -37,6 +48,16 @@ STATIC const cmd_def cmdText[] = {
     {"power", CMD_POWER},
     {"bootloader", CMD_BOOTLOADER_DIRECT},
     {"post", CMD_POST},
+    {"duty", CMD_DUTY},
+    {"snap", CMD_SNAP},
+    {"adpcm", CMD_ADPCM},
+    {"serial", CMD_SERIAL},
+    {"req", CMD_REQ},
+    {"log", CMD_LOG},
+    {"timeline", CMD_TIMELINE},
+    {"cpu", CMD_CPU},
+    {"mutex", CMD_MUTEX},
+    {"msg", CMD_MSG},
     {NULL, 0},
 };
 
@@ -139,9 +160,14 @@ err_t diagProcess(char *diagCommand)
             double avgGetMs, avgProcessMs;
             bufferStats(&gets, &frees, &overruns, &hwm, &avgGetMs, &avgProcessMs);
             debugR("spl:%0.2f gets:%ld frees:%ld overruns:%ld hwm:%ld/%ld getMs:%0.2f processMs:%0.2f\n", audioSpl(), gets, frees, overruns, hwm, BUFFER_COUNT, avgGetMs, avgProcessMs);
+            double periodUs, driftPpm;
+            uint32_t resyncs;
+            blocktimeStats(&periodUs, &driftPpm, &resyncs);
+            debugR("block:%0.1fus drift:%0.1fppm resyncs:%ld\n", periodUs, driftPpm, resyncs);
         } else {
             for (int i=0; i<argvn[1]; i++) {
-                debugR("%0.2f\n", audioSpl());
+                int64_t us = audioSplTimeUs();
+                debugR("%lu.%06lu %0.2f\n", (unsigned long) (us / us1Sec), (unsigned long) (us % us1Sec), audioSpl());
                 timerMsSleep(100);
             }
         }
@@ -149,9 +175,16 @@ err_t diagProcess(char *diagCommand)
     }
 
     case CMD_MEM: {
+        // mem [stacks-reset], where the reset forgets the worst-case stack use across resets
+        if (streql(argv[1], "stacks-reset")) {
+            taskStackProfileReset();
+        }
         debugR("RAM   physical: %lu\n", heapPhysical);
         debugR("RAM at startup: %lu\n", heapFreeAtStartup);
         debugR("RAM       free: %lu\n", xPortGetFreeHeapSize());
+        debugR("RAM   low-water: %lu\n", xPortGetMinimumEverFreeHeapSize());
+        taskMemoryStats();
+        memStats();
         taskStackStats();
         break;
     }
@@ -187,6 +220,193 @@ err_t diagProcess(char *diagCommand)
         break;
     }
 
+    case CMD_DUTY: {
+        // duty <windowSecs> <periodSecs> to duty-cycle, or duty 0 for continuous
+        if (argc > 1) {
+            audioDutySet(argvn[1] * ms1Sec, argc > 2 ? argvn[2] * ms1Sec : AUDIO_DUTY_PERIOD_MS);
+            timerMsSleep(10);
+        }
+        uint32_t windowMs, periodMs, measuringSecs, idleSecs;
+        double avgMa;
+        audioDutyStats(&windowMs, &periodMs, &measuringSecs, &idleSecs, &avgMa);
+        if (windowMs == 0) {
+            debugR("duty: continuous\n");
+        } else {
+            debugR("duty: %lus every %lus\n", (unsigned long) (windowMs/ms1Sec), (unsigned long) (periodMs/ms1Sec));
+        }
+        debugR("measuring:%lus idle:%lus est:%0.3fmA (%0.1fmAh/day)\n", (unsigned long) measuringSecs, (unsigned long) idleSecs, avgMa, avgMa * hours1Day);
+        break;
+    }
+
+    case CMD_SNAP: {
+        // snap threshold <spl>, snap trigger, or snap dump
+        if (streql(argv[1], "threshold")) {
+            snapshotSetThreshold(argvn[2]);
+        }
+        if (streql(argv[1], "trigger")) {
+            snapshotTrigger();
+        }
+        if (streql(argv[1], "dump")) {
+            err = snapshotExport();
+            break;
+        }
+        char *state;
+        double threshold;
+        uint32_t triggers;
+        snapshotStatus(&state, &threshold, &triggers);
+        debugR("snapshot: %s threshold:%0.1f triggers:%lu\n", state, threshold, (unsigned long) triggers);
+        break;
+    }
+
+    case CMD_ADPCM: {
+        // adpcm <frames> streams that many base64-encoded frames (see adpcm.h), which
+        // Test/adpcmdecode turns back into audio
+        if (argvn[1] > 0) {
+            uint8_t frame[ADPCM_FRAME_SIZE(AUDIO_PCM_SAMPLES)];
+            char line[((sizeof(frame) + 2) / 3 * 4) + 1];
+            uint32_t frameLen;
+            int64_t idleBeganMs = timerMs();
+            audioAdpcmStream(argvn[1]);
+            for (int i=0; i<argvn[1] && !timerMsElapsed(idleBeganMs, ms1Sec);) {
+                if (!audioAdpcmNextFrame(frame, sizeof(frame), &frameLen)) {
+                    timerMsSleep(5);
+                    continue;
+                }
+                Base64encode(line, (const char *) frame, frameLen);
+                debugR("adpcm:%s\n", line);
+                idleBeganMs = timerMs();
+                i++;
+            }
+            audioAdpcmStream(0);
+        }
+        uint32_t frames, dropped;
+        double cyclesPerSample;
+        audioAdpcmStats(&frames, &dropped, &cyclesPerSample);
+        debugR("adpcm: frames:%lu dropped:%lu encoder:%0.1f cycles/sample\n", (unsigned long) frames, (unsigned long) dropped, cyclesPerSample);
+        break;
+    }
+
+    case CMD_SERIAL: {
+        struct {
+            char *name;
+            UART_HandleTypeDef *huart;
+        } ports[] = {
+            { "lpuart1", &hlpuart1 },
+#if ENABLE_USART1
+            { "usart1", &huart1 },
+#endif
+            { "usb", NULL },
+        };
+        debugR("serial: wakeups:%lu %s\n", (unsigned long) serialWakeupCount(), serialIsActive() ? "active" : "idle");
+        for (int i=0; i<sizeof(ports)/sizeof(ports[0]); i++) {
+            uint32_t queued, overflows, abandoned, baudRate, fallbacks, rxErrors, rxOverruns;
+            serialRxStats(ports[i].huart, &queued, &overflows, &abandoned);
+            serialBaudStats(ports[i].huart, &baudRate, &fallbacks);
+            MX_UART_RxStats(ports[i].huart, &rxErrors, &rxOverruns);
+            debugR("%s: lines:%lu overflows:%lu abandoned:%lu rx-errors:%lu rx-overruns:%lu tx:%s baud:%lu fallbacks:%lu\n", ports[i].name, (unsigned long) queued,
+                   (unsigned long) overflows, (unsigned long) abandoned, (unsigned long) rxErrors, (unsigned long) rxOverruns, MX_UART_TxPending(ports[i].huart) ? "busy" : "idle", (unsigned long) baudRate, (unsigned long) fallbacks);
+            uint8_t kind;
+            uint32_t periodMs, sent, coalesced;
+            telemetryStats(ports[i].huart, &kind, &periodMs, &sent, &coalesced);
+            if (kind != TELEMETRY_NONE) {
+                debugR("%s: telemetry:%s every %lums sent:%lu coalesced:%lu\n", ports[i].name, kind == TELEMETRY_INTERVAL ? "interval" : "spl",
+                       (unsigned long) periodMs, (unsigned long) sent, (unsigned long) coalesced);
+            }
+        }
+        break;
+    }
+
+    case CMD_REQ: {
+        // req <json> processes a JSON request, showing the response and its cost
+        if (argc > 1) {
+            char rsp[REQ_MAX_RESPONSE];
+            uint32_t rspLen;
+            err = reqDispatch(NULL, &cmdline[4], rsp, sizeof(rsp), &rspLen);
+            if (!err) {
+                debugR("%s\n", rsp);
+            }
+        }
+        uint32_t count;
+        double avgUs, maxUs;
+        reqStats(&count, &avgUs, &maxUs);
+        debugR("req: count:%lu avg:%0.1fus max:%0.1fus\n", (unsigned long) count, avgUs, maxUs);
+        uint32_t frames, frameErrors;
+        reqFrameStats(&frames, &frameErrors);
+        debugR("frames: count:%lu errors:%lu\n", (unsigned long) frames, (unsigned long) frameErrors);
+        break;
+    }
+
+    case CMD_LOG: {
+        // log tokens|text selects whether debug output is sent as FRAME_LOG records
+        // for a host to render (see Test/tlogdecode.c), or formatted here
+        if (streql(argv[1], "tokens")) {
+            debugLogTokenized(true);
+        }
+        if (streql(argv[1], "text")) {
+            debugLogTokenized(false);
+        }
+        bool tokenized;
+        uint32_t records, dropped, avgCycles, pendingBytes;
+        debugLogStats(&tokenized, &records, &dropped, &avgCycles, &pendingBytes);
+        debugR("log: %s records:%lu dropped:%lu pending:%lu bytes avg:%lu cycles\n", tokenized ? "tokens" : "text",
+               (unsigned long) records, (unsigned long) dropped, (unsigned long) pendingBytes, (unsigned long) avgCycles);
+        break;
+    }
+
+    case CMD_TIMELINE: {
+        // timeline on|off|dump, where the dump is a Chrome trace for Perfetto
+        if (streql(argv[1], "on")) {
+            timelineEnable(true);
+        }
+        if (streql(argv[1], "off")) {
+            timelineEnable(false);
+        }
+        if (streql(argv[1], "dump")) {
+            timelineDump();
+            break;
+        }
+        uint32_t events;
+        bool on = timelineStatus(&events);
+        debugR("timeline: %s events:%lu of %lu\n", on ? "on" : "off", (unsigned long) events, (unsigned long) TIMELINE_EVENTS);
+        break;
+    }
+
+    case CMD_CPU:
+        // Report CPU use since the last report, and begin a new interval
+        tssPause();
+        tssStats();
+        tssResume();
+        break;
+
+    case CMD_MUTEX: {
+        // mutex [reset], reporting contention and hold times per mutex type
+        if (streql(argv[1], "reset")) {
+            mutexProfileReset();
+            break;
+        }
+        mutexProfileEntry p;
+        debugR("mutex: acquired contended wait(avg/max us) hold(avg/max us)\n");
+        for (int i=0; mutexProfileGet(i, &p); i++) {
+            double waitAvg = p.contended ? MX_CYC_ToUs(p.waitCycles) / p.contended : 0;
+            double holdAvg = p.acquisitions ? MX_CYC_ToUs(p.holdCycles) / p.acquisitions : 0;
+            debugR("%10s: %lu %lu wait %.1f/%.1f hold %.1f/%.1f\n", mutexTypeName(p.mtx),
+                   (unsigned long) p.acquisitions, (unsigned long) p.contended,
+                   waitAvg, MX_CYC_ToUs(p.waitMaxCycles), holdAvg, MX_CYC_ToUs(p.holdMaxCycles));
+#if mutexTrace
+            if (p.waitMaxFilename != NULL) {
+                debugR("%10s  longest wait at %s:%lu\n", "", justFilename(p.waitMaxFilename), (unsigned long) p.waitMaxLineno);
+            }
+            if (p.holdMaxFilename != NULL) {
+                debugR("%10s  longest hold from %s:%lu\n", "", justFilename(p.holdMaxFilename), (unsigned long) p.holdMaxLineno);
+            }
+#endif
+        }
+        break;
+    }
+
+    case CMD_MSG:
+        taskMessageStats();
+        break;
 
     case CMD_UNRECOGNIZED: {
         debugf("'%s' ??\n", diagCommand);
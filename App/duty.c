@@ -0,0 +1,84 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#include "duty.h"
+
+// Initialize a schedule.  A window that is zero or that fills the whole period
+// means that we measure continuously.
+void dutyInit(dutySchedule *ds, uint32_t windowMs, uint32_t periodMs)
+{
+    if (windowMs >= periodMs) {
+        windowMs = 0;
+    }
+    ds->windowMs = windowMs;
+    ds->periodMs = periodMs;
+    ds->cycleBeganMs = 0;
+    ds->lastUpdateMs = 0;
+    ds->measuring = false;
+    ds->measuringTotalMs = 0;
+    ds->idleTotalMs = 0;
+}
+
+// See if we are duty-cycling rather than measuring continuously
+bool dutyIsCycling(dutySchedule *ds)
+{
+    return (ds->windowMs != 0);
+}
+
+// Advance the schedule to the specified time, returning true if we should be
+// measuring, and returning the number of ms until the next state change.
+bool dutyUpdate(dutySchedule *ds, int64_t nowMs, uint32_t *retWaitMs)
+{
+
+    // Account for the time since we were last called
+    if (ds->lastUpdateMs != 0 && nowMs > ds->lastUpdateMs) {
+        if (ds->measuring) {
+            ds->measuringTotalMs += nowMs - ds->lastUpdateMs;
+        } else {
+            ds->idleTotalMs += nowMs - ds->lastUpdateMs;
+        }
+    }
+    ds->lastUpdateMs = nowMs;
+
+    // Continuous
+    if (!dutyIsCycling(ds)) {
+        ds->measuring = true;
+        *retWaitMs = 0xffffffff;
+        return true;
+    }
+
+    // Begin a new period if it's time.  If we've missed entire periods (such as
+    // because we were held awake or debugging), restart the cadence from now
+    // rather than trying to catch up.
+    if (ds->cycleBeganMs == 0 || nowMs < ds->cycleBeganMs) {
+        ds->cycleBeganMs = nowMs;
+    } else if (nowMs >= ds->cycleBeganMs + ds->periodMs) {
+        ds->cycleBeganMs += ds->periodMs;
+        if (nowMs >= ds->cycleBeganMs + ds->periodMs) {
+            ds->cycleBeganMs = nowMs;
+        }
+    }
+
+    // Determine which part of the period we're in
+    uint32_t elapsedMs = (uint32_t) (nowMs - ds->cycleBeganMs);
+    if (elapsedMs < ds->windowMs) {
+        ds->measuring = true;
+        *retWaitMs = ds->windowMs - elapsedMs;
+    } else {
+        ds->measuring = false;
+        *retWaitMs = ds->periodMs - elapsedMs;
+    }
+    return ds->measuring;
+
+}
+
+// Estimate the average current draw given the currents while measuring and while idle
+double dutyAverageMa(dutySchedule *ds, double activeMa, double idleMa)
+{
+    int64_t totalMs = ds->measuringTotalMs + ds->idleTotalMs;
+    if (totalMs == 0) {
+        return ds->measuring || !dutyIsCycling(ds) ? activeMa : idleMa;
+    }
+    return ((activeMa * (double) ds->measuringTotalMs) + (idleMa * (double) ds->idleTotalMs)) / (double) totalMs;
+}
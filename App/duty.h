@@ -0,0 +1,25 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Duty-cycle schedule for measurement windows.  This is intentionally free of any
+// HAL or RTOS dependency so that the scheduling logic can be exercised on a host.
+typedef struct {
+    uint32_t windowMs;          // Length of each measurement window, or 0 for continuous
+    uint32_t periodMs;          // Interval between the starts of measurement windows
+    int64_t cycleBeganMs;       // When the current period began, or 0 if not yet begun
+    int64_t lastUpdateMs;       // When we last accounted for time
+    bool measuring;             // Whether we're currently inside a measurement window
+    int64_t measuringTotalMs;   // Accumulated time spent measuring
+    int64_t idleTotalMs;        // Accumulated time spent between windows
+} dutySchedule;
+
+void dutyInit(dutySchedule *ds, uint32_t windowMs, uint32_t periodMs);
+bool dutyIsCycling(dutySchedule *ds);
+bool dutyUpdate(dutySchedule *ds, int64_t nowMs, uint32_t *retWaitMs);
+double dutyAverageMa(dutySchedule *ds, double activeMa, double idleMa);
@@ -0,0 +1,209 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#include "frame.h"
+#include "crc16.h"
+#include <string.h>
+
+// Little-endian field access
+static void put16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t) v;
+    p[1] = (uint8_t) (v >> 8);
+}
+static void put32(uint8_t *p, uint32_t v)
+{
+    put16(p, (uint16_t) v);
+    put16(p+2, (uint16_t) (v >> 16));
+}
+static void put64(uint8_t *p, uint64_t v)
+{
+    put32(p, (uint32_t) v);
+    put32(p+4, (uint32_t) (v >> 32));
+}
+static uint16_t get16(const uint8_t *p)
+{
+    return (uint16_t) (p[0] | (p[1] << 8));
+}
+static uint32_t get32(const uint8_t *p)
+{
+    return get16(p) | ((uint32_t) get16(p+2) << 16);
+}
+static uint64_t get64(const uint8_t *p)
+{
+    return get32(p) | ((uint64_t) get32(p+4) << 32);
+}
+
+// Levels travel as signed centi-dB
+static int16_t toCentiDb(double db)
+{
+    double v = db * 100.0;
+    if (v > 32767.0) {
+        return 32767;
+    }
+    if (v < -32768.0) {
+        return -32768;
+    }
+    return (int16_t) (v < 0 ? v - 0.5 : v + 0.5);
+}
+static double fromCentiDb(uint16_t v)
+{
+    return (double) (int16_t) v / 100.0;
+}
+
+// COBS-encode a buffer, returning the encoded length, which is at most
+// len + len/254 + 1.  The output contains no zero bytes.
+uint32_t cobsEncode(const uint8_t *in, uint32_t len, uint8_t *out)
+{
+    uint32_t codeAt = 0;
+    uint32_t o = 1;
+    uint8_t code = 1;
+    for (uint32_t i=0; i<len; i++) {
+        if (in[i] != 0) {
+            out[o++] = in[i];
+            code++;
+        }
+        if (in[i] == 0 || code == 0xff) {
+            out[codeAt] = code;
+            codeAt = o++;
+            code = 1;
+        }
+    }
+    out[codeAt] = code;
+    return o;
+}
+
+// Decode a COBS buffer (without delimiters) in a single pass, returning the decoded
+// length or -1 if malformed.  The output may be the same buffer as the input.
+int32_t cobsDecode(const uint8_t *in, uint32_t len, uint8_t *out)
+{
+    uint32_t i = 0;
+    uint32_t o = 0;
+    while (i < len) {
+        uint8_t code = in[i++];
+        if (code == 0 || i + code - 1 > len) {
+            return -1;
+        }
+        for (uint8_t j=1; j<code; j++) {
+            if (in[i] == 0) {
+                return -1;
+            }
+            out[o++] = in[i++];
+        }
+        if (code != 0xff && i < len) {
+            out[o++] = 0;
+        }
+    }
+    return (int32_t) o;
+}
+
+// Build a frame, COBS-encode it, and wrap it in delimiters, returning the number
+// of bytes to transmit or 0 if it doesn't fit.
+uint32_t frameEncode(uint8_t type, uint8_t sequence, const uint8_t *payload, uint32_t payloadLen, uint8_t *wire, uint32_t wireLen)
+{
+    uint8_t frame[FRAME_HEADER + FRAME_MAX_PAYLOAD + FRAME_TRAILER];
+    if (payloadLen > FRAME_MAX_PAYLOAD || wireLen < FRAME_MAX_WIRE(payloadLen)) {
+        return 0;
+    }
+    frame[0] = type;
+    frame[1] = sequence;
+    if (payloadLen > 0) {
+        memcpy(&frame[FRAME_HEADER], payload, payloadLen);
+    }
+    uint32_t crcLen = FRAME_HEADER + payloadLen;
+    put16(&frame[crcLen], crc16(frame, crcLen));
+    wire[0] = FRAME_DELIMITER;
+    uint32_t len = 1 + cobsEncode(frame, crcLen + FRAME_TRAILER, &wire[1]);
+    wire[len++] = FRAME_DELIMITER;
+    return len;
+}
+
+// Decode and validate the COBS bytes between a pair of delimiters into the buffer,
+// returning FRAME_OK with the payload pointing into the buffer, or a FRAME_ERR_.
+int frameDecode(const uint8_t *cobs, uint32_t cobsLen, uint8_t *buf, uint32_t bufLen, uint8_t *retType, uint8_t *retSequence, uint8_t **retPayload, uint32_t *retPayloadLen)
+{
+    if (cobsLen > bufLen) {
+        return FRAME_ERR_LENGTH;
+    }
+    int32_t len = cobsDecode(cobs, cobsLen, buf);
+    if (len < 0) {
+        return FRAME_ERR_COBS;
+    }
+    if (len < FRAME_HEADER + FRAME_TRAILER) {
+        return FRAME_ERR_LENGTH;
+    }
+    uint32_t crcLen = (uint32_t) len - FRAME_TRAILER;
+    if (crc16(buf, crcLen) != get16(&buf[crcLen])) {
+        return FRAME_ERR_CRC;
+    }
+    *retType = buf[0];
+    *retSequence = buf[1];
+    *retPayload = &buf[FRAME_HEADER];
+    *retPayloadLen = crcLen - FRAME_HEADER;
+    return FRAME_OK;
+}
+
+// FRAME_SPL
+uint32_t framePackSpl(const frameSpl *msg, uint8_t *payload)
+{
+    put64(&payload[0], (uint64_t) msg->timeUs);
+    put16(&payload[8], (uint16_t) toCentiDb(msg->spl));
+    return 10;
+}
+bool frameUnpackSpl(const uint8_t *payload, uint32_t len, frameSpl *msg)
+{
+    if (len != 10) {
+        return false;
+    }
+    msg->timeUs = (int64_t) get64(&payload[0]);
+    msg->spl = fromCentiDb(get16(&payload[8]));
+    return true;
+}
+
+// FRAME_BANDS
+uint32_t framePackBands(const frameBands *msg, uint8_t *payload)
+{
+    uint8_t count = msg->count > FRAME_MAX_BANDS ? FRAME_MAX_BANDS : msg->count;
+    payload[0] = count;
+    for (uint8_t i=0; i<count; i++) {
+        put16(&payload[1+(i*4)], msg->centerHz[i]);
+        put16(&payload[1+(i*4)+2], (uint16_t) toCentiDb(msg->level[i]));
+    }
+    return 1 + (count * 4);
+}
+bool frameUnpackBands(const uint8_t *payload, uint32_t len, frameBands *msg)
+{
+    if (len < 1 || payload[0] > FRAME_MAX_BANDS || len != 1 + ((uint32_t) payload[0] * 4)) {
+        return false;
+    }
+    msg->count = payload[0];
+    for (uint8_t i=0; i<msg->count; i++) {
+        msg->centerHz[i] = get16(&payload[1+(i*4)]);
+        msg->level[i] = fromCentiDb(get16(&payload[1+(i*4)+2]));
+    }
+    return true;
+}
+
+// FRAME_INTERVAL
+uint32_t framePackInterval(const frameInterval *msg, uint8_t *payload)
+{
+    put32(&payload[0], msg->blocks);
+    put32(&payload[4], msg->secs);
+    put16(&payload[8], (uint16_t) toCentiDb(msg->min));
+    put16(&payload[10], (uint16_t) toCentiDb(msg->max));
+    put16(&payload[12], (uint16_t) toCentiDb(msg->leq));
+    return 14;
+}
+bool frameUnpackInterval(const uint8_t *payload, uint32_t len, frameInterval *msg)
+{
+    if (len != 14) {
+        return false;
+    }
+    msg->blocks = get32(&payload[0]);
+    msg->secs = get32(&payload[4]);
+    msg->min = fromCentiDb(get16(&payload[8]));
+    msg->max = fromCentiDb(get16(&payload[10]));
+    msg->leq = fromCentiDb(get16(&payload[12]));
+    return true;
+}
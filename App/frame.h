@@ -0,0 +1,93 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Binary framed protocol, usable on the same ports as JSON.  Because text requests
+// never contain a 0x00 byte, a 0x00 introduces a binary frame.  On the wire:
+//   0x00 COBS(frame) 0x00
+// where the frame, before COBS encoding, is:
+//   [0]     message type
+//   [1]     sequence number, echoed in the response
+//   [...]   fixed-layout payload for the type, all fields little-endian
+//   [...]   CRC16 (crc16.c) of everything preceding it
+// Each frame carries its own leading delimiter, and empty frames are ignored.
+// Like duty.h this is free of any HAL or RTOS dependency, so that it can be
+// compiled into a host application as the codec for the other end, as
+// Test/frame_test.c does.
+//
+// For comparison, at 9600 baud (~960 bytes/sec), spl.get costs 18 bytes out and
+// 39 back as JSON, versus 7 and 17 as frames; bands.get with eight bands returns
+// 99 bytes of JSON versus 40 bytes framed (as measured by Test/frame_test.c).
+
+// Message types, where responses have the high bit set
+#define FRAME_SPL_GET           0x01    // no payload
+#define FRAME_BANDS_GET         0x02    // no payload
+#define FRAME_INTERVAL_GET      0x03    // [0] flags
+#define FRAME_SUBSCRIBE         0x04    // [0] TELEMETRY_ kind, [1..4] period in ms, [5..6] duration in secs
+#define FRAME_SPL               0x81    // [0..7] RTC time of the block in us, [8..9] SPL in centi-dB
+#define FRAME_BANDS             0x82    // [0] count, then count * ([0..1] center Hz, [2..3] level in centi-dB)
+#define FRAME_INTERVAL          0x83    // [0..3] blocks, [4..7] secs, [8..9] min, [10..11] max, [12..13] Leq, in centi-dB
+#define FRAME_SUBSCRIBED        0x84    // no payload; records then follow as FRAME_SPL or FRAME_INTERVAL
+#define FRAME_LOG               0x85    // unsolicited; a tokenized log record as laid out in tlog.h
+#define FRAME_ERROR             0xFF    // [0] error code
+#define FRAME_RESPONSE          0x80
+
+// FRAME_INTERVAL_GET flags
+#define FRAME_INTERVAL_RESET    0x01    // Begin a new interval after reporting this one
+
+// Error codes, as returned by frameDecode and as carried by FRAME_ERROR
+#define FRAME_OK                0
+#define FRAME_ERR_COBS          1       // Malformed COBS encoding
+#define FRAME_ERR_LENGTH        2       // Too short, too long, or wrong payload length for its type
+#define FRAME_ERR_CRC           3       // CRC mismatch
+#define FRAME_ERR_TYPE          4       // Unrecognized message type
+#define FRAME_ERR_ARG           5       // Well-formed, but a field's value is not acceptable
+
+// Frame sizes
+#define FRAME_DELIMITER         0x00
+#define FRAME_HEADER            2
+#define FRAME_TRAILER           2
+#define FRAME_MAX_PAYLOAD       128
+#define FRAME_MAX_BANDS         8
+#define FRAME_MAX_WIRE(payload) (2 + FRAME_HEADER + (payload) + FRAME_TRAILER + (((FRAME_HEADER + (payload) + FRAME_TRAILER) / 254) + 1))
+
+// Decoded message contents
+typedef struct {
+    int64_t timeUs;
+    double spl;
+} frameSpl;
+
+typedef struct {
+    uint8_t count;
+    uint16_t centerHz[FRAME_MAX_BANDS];
+    double level[FRAME_MAX_BANDS];
+} frameBands;
+
+typedef struct {
+    uint32_t blocks;
+    uint32_t secs;
+    double min;
+    double max;
+    double leq;
+} frameInterval;
+
+// COBS
+uint32_t cobsEncode(const uint8_t *in, uint32_t len, uint8_t *out);
+int32_t cobsDecode(const uint8_t *in, uint32_t len, uint8_t *out);
+
+// Framing
+uint32_t frameEncode(uint8_t type, uint8_t sequence, const uint8_t *payload, uint32_t payloadLen, uint8_t *wire, uint32_t wireLen);
+int frameDecode(const uint8_t *cobs, uint32_t cobsLen, uint8_t *buf, uint32_t bufLen, uint8_t *retType, uint8_t *retSequence, uint8_t **retPayload, uint32_t *retPayloadLen);
+
+// Message payloads
+uint32_t framePackSpl(const frameSpl *msg, uint8_t *payload);
+bool frameUnpackSpl(const uint8_t *payload, uint32_t len, frameSpl *msg);
+uint32_t framePackBands(const frameBands *msg, uint8_t *payload);
+bool frameUnpackBands(const uint8_t *payload, uint32_t len, frameBands *msg);
+uint32_t framePackInterval(const frameInterval *msg, uint8_t *payload);
+bool frameUnpackInterval(const uint8_t *payload, uint32_t len, frameInterval *msg);
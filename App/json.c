@@ -0,0 +1,319 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#include "json.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// The tokenizer makes a single pass over the text, in the style of jsmn.  An object's
+// keys are its children, and each key's value is the key's only child, which means
+// that a value always immediately follows its key in the token array.  Containers
+// are tracked through the parent links rather than with a separate stack.
+
+// Allocate the next token
+static int jsonAlloc(jsonToken *tokens, int *count, int maxTokens, uint8_t type, uint32_t start, int parent)
+{
+    if (*count >= maxTokens) {
+        return JSON_ERR_NOMEM;
+    }
+    int i = (*count)++;
+    tokens[i].type = type;
+    tokens[i].start = (uint16_t) start;
+    tokens[i].len = 0;
+    tokens[i].size = 0;
+    tokens[i].parent = (int16_t) parent;
+    if (parent >= 0) {
+        tokens[parent].size++;
+    }
+    return i;
+}
+
+// A value may not appear where a key is expected
+static bool jsonExpectingKey(const jsonToken *tokens, int cur)
+{
+    return (cur >= 0 && tokens[cur].type == JSON_OBJECT);
+}
+
+// Tokenize null-terminated JSON text, returning the number of tokens or a JSON_ERR_
+int jsonParse(const char *json, jsonToken *tokens, int maxTokens)
+{
+    int count = 0;
+    int cur = -1;
+
+    uint32_t p;
+    for (p=0; json[p] != '\0'; p++) {
+        if (p > UINT16_MAX) {
+            return JSON_ERR_INVALID;
+        }
+        char c = json[p];
+        switch (c) {
+
+        case ' ':
+        case '\t':
+        case '\r':
+        case '\n':
+            break;
+
+        case '{':
+        case '[': {
+            if (jsonExpectingKey(tokens, cur)) {
+                return JSON_ERR_INVALID;
+            }
+            int i = jsonAlloc(tokens, &count, maxTokens, c == '{' ? JSON_OBJECT : JSON_ARRAY, p, cur);
+            if (i < 0) {
+                return i;
+            }
+            cur = i;
+            break;
+        }
+
+        case '}':
+        case ']': {
+            uint8_t type = (c == '}') ? JSON_OBJECT : JSON_ARRAY;
+            if (cur >= 0 && tokens[cur].type != JSON_OBJECT && tokens[cur].type != JSON_ARRAY) {
+                cur = tokens[cur].parent;
+            }
+            if (cur < 0 || tokens[cur].type != type) {
+                return JSON_ERR_INVALID;
+            }
+            tokens[cur].len = (uint16_t) (p + 1 - tokens[cur].start);
+            cur = tokens[cur].parent;
+            break;
+        }
+
+        case '"': {
+            uint32_t start = ++p;
+            while (json[p] != '"') {
+                if (json[p] == '\0') {
+                    return JSON_ERR_PARTIAL;
+                }
+                if (json[p] == '\\') {
+                    p++;
+                    if (json[p] == '\0') {
+                        return JSON_ERR_PARTIAL;
+                    }
+                    if (strchr("\"\\/bfnrtu", json[p]) == NULL) {
+                        return JSON_ERR_INVALID;
+                    }
+                }
+                p++;
+            }
+            int i = jsonAlloc(tokens, &count, maxTokens, JSON_STRING, start, cur);
+            if (i < 0) {
+                return i;
+            }
+            tokens[i].len = (uint16_t) (p - start);
+            break;
+        }
+
+        case ':':
+            // The key just parsed becomes the parent of its value
+            cur = count - 1;
+            if (cur < 0 || tokens[cur].type != JSON_STRING || tokens[cur].parent < 0 || tokens[tokens[cur].parent].type != JSON_OBJECT) {
+                return JSON_ERR_INVALID;
+            }
+            break;
+
+        case ',':
+            if (cur >= 0 && tokens[cur].type != JSON_OBJECT && tokens[cur].type != JSON_ARRAY) {
+                cur = tokens[cur].parent;
+            }
+            break;
+
+        default: {
+            if ((c < '0' || c > '9') && c != '-' && c != 't' && c != 'f' && c != 'n') {
+                return JSON_ERR_INVALID;
+            }
+            if (jsonExpectingKey(tokens, cur)) {
+                return JSON_ERR_INVALID;
+            }
+            uint32_t start = p;
+            while (json[p] != '\0' && strchr(" \t\r\n,]}", json[p]) == NULL) {
+                p++;
+            }
+            int i = jsonAlloc(tokens, &count, maxTokens, JSON_PRIMITIVE, start, cur);
+            if (i < 0) {
+                return i;
+            }
+            tokens[i].len = (uint16_t) (p - start);
+            p--;
+            break;
+        }
+
+        }
+    }
+
+    // Every container must have been closed
+    for (int i=0; i<count; i++) {
+        if ((tokens[i].type == JSON_OBJECT || tokens[i].type == JSON_ARRAY) && tokens[i].len == 0) {
+            return JSON_ERR_PARTIAL;
+        }
+    }
+    return count;
+
+}
+
+// Find the value of a key within an object, returning its token index or -1
+int jsonObjectGet(const char *json, const jsonToken *tokens, int count, int object, const char *key)
+{
+    if (object < 0 || object >= count || tokens[object].type != JSON_OBJECT) {
+        return -1;
+    }
+    for (int i=object+1; i<count-1; i++) {
+        if (tokens[i].parent == object && jsonEquals(json, &tokens[i], key) && tokens[i+1].parent == i) {
+            return i+1;
+        }
+    }
+    return -1;
+}
+
+// See if a string or primitive token matches the specified text
+bool jsonEquals(const char *json, const jsonToken *token, const char *str)
+{
+    if (token->type != JSON_STRING && token->type != JSON_PRIMITIVE) {
+        return false;
+    }
+    size_t len = strlen(str);
+    return (len == token->len && memcmp(&json[token->start], str, len) == 0);
+}
+
+// Get the value of a numeric token
+bool jsonNumber(const char *json, const jsonToken *token, double *retValue)
+{
+    if (token->type != JSON_PRIMITIVE) {
+        return false;
+    }
+    char *end;
+    double value = strtod(&json[token->start], &end);
+    if (end != &json[token->start + token->len]) {
+        return false;
+    }
+    *retValue = value;
+    return true;
+}
+
+// Get the value of a boolean token
+bool jsonBool(const char *json, const jsonToken *token, bool *retValue)
+{
+    if (jsonEquals(json, token, "true")) {
+        *retValue = true;
+        return true;
+    }
+    if (jsonEquals(json, token, "false")) {
+        *retValue = false;
+        return true;
+    }
+    return false;
+}
+
+// Append formatted text to the response, noting if it didn't fit
+static void jsonAppend(jsonWriter *w, const char *format, ...)
+{
+    if (w->overflow) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(&w->buf[w->len], w->size - w->len, format, args);
+    va_end(args);
+    if (n < 0 || (uint32_t) n >= w->size - w->len) {
+        w->overflow = true;
+        return;
+    }
+    w->len += (uint32_t) n;
+}
+
+// Append the separator and key that precede each member
+static void jsonAppendKey(jsonWriter *w, const char *key)
+{
+    jsonAppend(w, "%s\"%s\":", w->items++ > 0 ? "," : "", key);
+}
+
+// Begin a response object
+void jsonWriterBegin(jsonWriter *w, char *buf, uint32_t size)
+{
+    w->buf = buf;
+    w->size = size;
+    w->len = 0;
+    w->items = 0;
+    w->overflow = (size == 0);
+    jsonAppend(w, "{");
+}
+
+// Add a string member, escaping it as needed
+void jsonAddString(jsonWriter *w, const char *key, const char *value)
+{
+    jsonAppendKey(w, key);
+    jsonAppend(w, "\"");
+    for (; *value != '\0'; value++) {
+        char c = *value;
+        if (c == '"' || c == '\\') {
+            jsonAppend(w, "\\%c", c);
+        } else if ((uint8_t) c < ' ') {
+            jsonAppend(w, "\\u%04x", (unsigned) c);
+        } else {
+            jsonAppend(w, "%c", c);
+        }
+    }
+    jsonAppend(w, "\"");
+}
+
+// Append a number with the specified number of decimal places.  JSON has no NaN or
+// infinity, which we get for the level of digital silence, and so those are null.
+static void jsonAppendNumber(jsonWriter *w, double value, int decimals)
+{
+    if (!isfinite(value)) {
+        jsonAppend(w, "null");
+    } else {
+        jsonAppend(w, "%.*f", decimals, value);
+    }
+}
+
+// Add a numeric member with the specified number of decimal places
+void jsonAddNumber(jsonWriter *w, const char *key, double value, int decimals)
+{
+    jsonAppendKey(w, key);
+    jsonAppendNumber(w, value, decimals);
+}
+
+// Add an integer member
+void jsonAddInt(jsonWriter *w, const char *key, int64_t value)
+{
+    jsonAppendKey(w, key);
+    jsonAppend(w, "%lld", (long long) value);
+}
+
+// Add a boolean member
+void jsonAddBool(jsonWriter *w, const char *key, bool value)
+{
+    jsonAppendKey(w, key);
+    jsonAppend(w, value ? "true" : "false");
+}
+
+// Add an array of numbers
+void jsonAddNumbers(jsonWriter *w, const char *key, const double *values, uint32_t count, int decimals)
+{
+    jsonAppendKey(w, key);
+    jsonAppend(w, "[");
+    for (uint32_t i=0; i<count; i++) {
+        if (i > 0) {
+            jsonAppend(w, ",");
+        }
+        jsonAppendNumber(w, values[i], decimals);
+    }
+    jsonAppend(w, "]");
+}
+
+// Close the response, returning its length or 0 if it didn't fit
+uint32_t jsonWriterEnd(jsonWriter *w)
+{
+    jsonAppend(w, "}");
+    if (w->overflow) {
+        return 0;
+    }
+    return w->len;
+}
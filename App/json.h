@@ -0,0 +1,56 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// A minimal JSON tokenizer and writer that never allocates.  Tokens refer to the
+// caller's null-terminated text by offset, and responses are written into a caller
+// buffer.  Like duty.h, this is free of any HAL or RTOS dependency, and
+// Test/json_test.c exercises and times it on a host.
+
+// Token types
+#define JSON_UNDEFINED      0
+#define JSON_OBJECT         1
+#define JSON_ARRAY          2
+#define JSON_STRING         3
+#define JSON_PRIMITIVE      4           // number, true, false, or null
+
+// Parse errors, returned as negative token counts
+#define JSON_ERR_NOMEM      -1          // Not enough tokens
+#define JSON_ERR_INVALID    -2          // Malformed JSON
+#define JSON_ERR_PARTIAL    -3          // Text ended mid-value
+
+typedef struct {
+    uint8_t type;
+    uint16_t start;                     // Offset of the first character (within the quotes for strings)
+    uint16_t len;                       // Length in characters
+    uint16_t size;                      // Number of children, with an object's key/value pairs counting once
+    int16_t parent;                     // Index of the enclosing token, or -1 at top level
+} jsonToken;
+
+int jsonParse(const char *json, jsonToken *tokens, int maxTokens);
+int jsonObjectGet(const char *json, const jsonToken *tokens, int count, int object, const char *key);
+bool jsonEquals(const char *json, const jsonToken *token, const char *str);
+bool jsonNumber(const char *json, const jsonToken *token, double *retValue);
+bool jsonBool(const char *json, const jsonToken *token, bool *retValue);
+
+// Response writer, which emits a single object
+typedef struct {
+    char *buf;
+    uint32_t size;
+    uint32_t len;
+    uint32_t items;
+    bool overflow;
+} jsonWriter;
+
+void jsonWriterBegin(jsonWriter *w, char *buf, uint32_t size);
+void jsonAddString(jsonWriter *w, const char *key, const char *value);
+void jsonAddNumber(jsonWriter *w, const char *key, double value, int decimals);
+void jsonAddInt(jsonWriter *w, const char *key, int64_t value);
+void jsonAddBool(jsonWriter *w, const char *key, bool value);
+void jsonAddNumbers(jsonWriter *w, const char *key, const double *values, uint32_t count, int decimals);
+uint32_t jsonWriterEnd(jsonWriter *w);
@@ -0,0 +1,98 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#include "linescan.h"
+#include <string.h>
+
+// Begin with nothing assembled, in text mode
+void lineScanInit(lineScanner *ls)
+{
+    memset(ls, 0, sizeof(lineScanner));
+}
+
+// Scan a span of received bytes, returning how many of them were consumed.  Of those,
+// the first *retAppendLen are to be appended to the line or frame being assembled,
+// after which *retEvent says what, if anything, has been completed.  Where the span
+// holds several lines, the caller scans what remains of it again.  nowMs is any
+// running millisecond count, used to notice when a frame has gone quiet.
+uint32_t lineScan(lineScanner *ls, const uint8_t *data, uint32_t dataLen, uint32_t nowMs, uint32_t *retAppendLen, int *retEvent)
+{
+
+    *retAppendLen = 0;
+    *retEvent = LINESCAN_MORE;
+    if (dataLen == 0) {
+        return 0;
+    }
+
+    // If the sender paused mid-frame for longer than any sender of frames would,
+    // abandon the frame without consuming anything, and treat what follows as text
+    if (ls->binary && (uint32_t) (nowMs - ls->lastMs) >= LINESCAN_FRAME_IDLE_MS) {
+        ls->binary = false;
+        ls->length = 0;
+        *retEvent = LINESCAN_ABANDON;
+        return 0;
+    }
+    ls->lastMs = nowMs;
+
+    // Swallow the \n of a \r\n pair
+    if (data[0] == '\n' && ls->swallowNextNewline && !ls->binary) {
+        ls->swallowNextNewline = false;
+        return 1;
+    }
+    ls->swallowNextNewline = false;
+
+    // Find the end of the line or frame in the span.  A text line ends at the first
+    // \r or \n, or at a 0x00 that introduces a binary frame, while a binary frame ends
+    // only at its closing 0x00.
+    uint32_t lineLen = dataLen;
+    const uint8_t *nul = memchr(data, FRAME_DELIMITER, lineLen);
+    if (nul != NULL) {
+        lineLen = nul - data;
+    }
+    if (!ls->binary) {
+        const uint8_t *cr = memchr(data, '\r', lineLen);
+        if (cr != NULL) {
+            lineLen = cr - data;
+        }
+        const uint8_t *nl = memchr(data, '\n', lineLen);
+        if (nl != NULL) {
+            lineLen = nl - data;
+        }
+    }
+
+    // If a frame would grow beyond the largest that is valid, abandon it, consuming
+    // only up to the first byte that is too many so that the rest is read as text
+    if (ls->binary && ls->length + lineLen > LINESCAN_FRAME_MAX) {
+        uint32_t consumed = LINESCAN_FRAME_MAX + 1 - ls->length;
+        ls->binary = false;
+        ls->length = 0;
+        *retEvent = LINESCAN_ABANDON;
+        return consumed;
+    }
+    *retAppendLen = lineLen;
+    ls->length += lineLen;
+    if (lineLen == dataLen) {
+        return dataLen;
+    }
+    uint8_t terminator = data[lineLen];
+
+    // A 0x00 in text discards any partial line and begins a frame, and an empty
+    // frame is simply a delimiter for the one that follows.
+    if (!ls->binary && terminator == FRAME_DELIMITER) {
+        ls->binary = true;
+        ls->length = 0;
+        *retAppendLen = 0;
+        *retEvent = LINESCAN_DISCARD;
+        return lineLen+1;
+    }
+    if (ls->binary && ls->length == 0) {
+        return lineLen+1;
+    }
+    *retEvent = ls->binary ? LINESCAN_FRAME : LINESCAN_LINE;
+    ls->binary = false;
+    ls->swallowNextNewline = (terminator == '\r');
+    ls->length = 0;
+    return lineLen+1;
+
+}
@@ -0,0 +1,41 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "frame.h"
+
+// Splits received bytes into text lines and binary frames (see frame.h).  The caller
+// hands it contiguous spans straight from the receive ring, and it finds the end of
+// the line or frame in each with memchr, saying how many bytes to append to what is
+// being assembled and whether that is now complete.  A text line ends at \r or \n,
+// where the \n of a \r\n pair is swallowed, and a 0x00 in text begins a frame that
+// ends at the next 0x00.  So that a host that only speaks text can't be locked out by
+// a stray 0x00 (line noise, or a host opening the port), a frame that grows beyond
+// the largest that is valid, or that goes quiet before it ends, is abandoned and we
+// return to text.  Like duty.h, this is free of any HAL or RTOS dependency,
+// and Test/serial_test.c drives it from a simulated UART ring on a host.
+
+// What the bytes consumed by lineScan completed
+#define LINESCAN_MORE           0       // Nothing; the line or frame continues
+#define LINESCAN_LINE           1       // A text line, possibly empty
+#define LINESCAN_FRAME          2       // A binary frame, which is never empty
+#define LINESCAN_DISCARD        3       // A frame is beginning, so discard any partial line
+#define LINESCAN_ABANDON        4       // A frame was too long or went quiet, so discard it
+
+// Limits on a frame, beyond which we assume that it wasn't one
+#define LINESCAN_FRAME_MAX      FRAME_MAX_WIRE(FRAME_MAX_PAYLOAD)
+#define LINESCAN_FRAME_IDLE_MS  500
+
+typedef struct {
+    bool binary;                // Assembling a frame rather than a line
+    bool swallowNextNewline;    // The last line ended with \r
+    uint32_t length;            // Bytes assembled so far
+    uint32_t lastMs;            // When bytes last arrived
+} lineScanner;
+
+void lineScanInit(lineScanner *ls);
+uint32_t lineScan(lineScanner *ls, const uint8_t *data, uint32_t dataLen, uint32_t nowMs, uint32_t *retAppendLen, int *retEvent);
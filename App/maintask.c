@@ -10,6 +10,14 @@
 #include "rtc.h"
 #include "utilities_def.h"
 
+// Task storage, when statically allocating
+#if STATIC_ALLOCATION_PROFILE
+STATIC StaticTask_t reqTaskTCB;
+STATIC StackType_t reqTaskStack[STACKWORDS(TASKSTACK_REQ)];
+STATIC StaticTask_t audioTaskTCB;
+STATIC StackType_t audioTaskStack[STACKWORDS(TASKSTACK_AUDIO)];
+#endif
+
 // Main task
 void mainTask(void *params)
 {
@@ -57,10 +65,18 @@ void mainTask(void *params)
     ledRestartSignal();
 
     // Create the serial request processing task
+#if STATIC_ALLOCATION_PROFILE
+    xTaskCreateStatic(reqTask, TASKNAME_REQ, STACKWORDS(TASKSTACK_REQ), NULL, TASKPRI_REQ, reqTaskStack, &reqTaskTCB);
+#else
     xTaskCreate(reqTask, TASKNAME_REQ, STACKWORDS(TASKSTACK_REQ), NULL, TASKPRI_REQ, NULL);
+#endif
 
     // Initialize audio, and create the audio processing task
+#if STATIC_ALLOCATION_PROFILE
+    xTaskCreateStatic(audioTask, TASKNAME_AUDIO, STACKWORDS(TASKSTACK_AUDIO), NULL, TASKPRI_AUDIO, audioTaskStack, &audioTaskTCB);
+#else
     xTaskCreate(audioTask, TASKNAME_AUDIO, STACKWORDS(TASKSTACK_AUDIO), NULL, TASKPRI_AUDIO, NULL);
+#endif
 
     // Poll, moving serial data from interrupt buffers to app buffers
     for (;;) {
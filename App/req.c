@@ -3,11 +3,41 @@
 // copyright holder including that found in the LICENSE file.
 
 #include "app.h"
+#include "json.h"
+#include "frame.h"
+#include "reqtable.h"
+#include <math.h>
+
+// Request table (see reqtable.h)
+STATIC const reqDef reqTable[] = {
+    REQ_TABLE(REQ_TABLE_ENTRY)
+    {NULL, NULL},
+};
+
+// Longest window or period, in seconds, whose ms fit in a uint32_t
+#define REQ_SECS_MAX    (UINT32_MAX / ms1Sec)
+
+// Tokens and response for the request being processed, which is only ever
+// done on the request task.
+STATIC jsonToken reqTokens[REQ_MAX_TOKENS];
+STATIC char reqResponse[REQ_MAX_RESPONSE];
+
+// Baud rate change to be made once the response has been sent
+STATIC uint32_t reqPendingBaudRate = 0;
+
+// Parse-and-dispatch timing
+STATIC uint32_t reqCount = 0;
+STATIC uint64_t reqCyclesTotal = 0;
+STATIC uint32_t reqCyclesMax = 0;
+
+// Binary frames processed, and those rejected
+STATIC uint32_t reqFrames = 0;
+STATIC uint32_t reqFrameErrors = 0;
 
 // Process a request.  Note, it is guaranteed that reqJSON[reqJSONLen] == '\0'
-err_t reqProcess(bool debugPort, uint8_t *reqJSON, bool diagAllowed)
+err_t reqProcess(UART_HandleTypeDef *huart, uint8_t *reqJSON, bool diagAllowed)
 {
-    err_t err = errNone;
+    bool debugPort = serialIsDebugPort(huart);
 
     // Process diagnostic commands
     if (reqJSON[0] != '{') {
@@ -23,10 +53,300 @@ err_t reqProcess(bool debugPort, uint8_t *reqJSON, bool diagAllowed)
         return errNone;
     }
 
-    // An example of where an app might process JSON requests
-    err = errF("JSON requests not implemented");
+    // Process the JSON request, replying with an error object if it fails
+    uint32_t rspLen;
+    err_t err = reqDispatch(huart, (char *) reqJSON, reqResponse, sizeof(reqResponse), &rspLen);
+    if (err) {
+        reqPendingBaudRate = 0;
+        jsonWriter w;
+        jsonWriterBegin(&w, reqResponse, sizeof(reqResponse));
+        jsonAddString(&w, "err", errString(err));
+        rspLen = jsonWriterEnd(&w);
+    }
+    serialOutputLn(huart, (uint8_t *) reqResponse, rspLen);
+
+    // Now that the reply is on its way at the current rate, switch rates
+    if (reqPendingBaudRate != 0) {
+        serialSetBaudRate(huart, reqPendingBaudRate);
+        reqPendingBaudRate = 0;
+    }
 
     // Done
-    return err;
+    return errNone;
+
+}
+
+// Process a binary frame (see frame.h), which is the COBS-encoded content between
+// its delimiters.  Decoding is done in place, which is safe because the decoded
+// frame is never longer than its encoding.
+void reqProcessFrame(UART_HandleTypeDef *huart, uint8_t *frame, uint32_t frameLen)
+{
+    uint8_t payload[FRAME_MAX_PAYLOAD];
+    uint32_t payloadLen = 0;
+    uint8_t rspType = FRAME_ERROR;
+
+    // Decode and validate
+    uint8_t type, sequence = 0;
+    uint8_t *req;
+    uint32_t reqLen;
+    int status = frameDecode(frame, frameLen, frame, frameLen, &type, &sequence, &req, &reqLen);
+
+    // Dispatch
+    if (status == FRAME_OK) {
+        switch (type) {
+
+        case FRAME_SPL_GET: {
+            frameSpl msg = { audioSplTimeUs(), audioSpl() };
+            payloadLen = framePackSpl(&msg, payload);
+            rspType = FRAME_SPL;
+            break;
+        }
+
+        case FRAME_BANDS_GET: {
+            frameBands msg;
+            double levels[FRAME_MAX_BANDS];
+            uint32_t centersHz[FRAME_MAX_BANDS];
+            msg.count = (uint8_t) audioBands(levels, FRAME_MAX_BANDS, centersHz);
+            for (int i=0; i<msg.count; i++) {
+                msg.centerHz[i] = (uint16_t) centersHz[i];
+                msg.level[i] = levels[i];
+            }
+            payloadLen = framePackBands(&msg, payload);
+            rspType = FRAME_BANDS;
+            break;
+        }
+
+        case FRAME_INTERVAL_GET: {
+            frameInterval msg;
+            audioSplStats(&msg.blocks, &msg.min, &msg.max, &msg.leq, &msg.secs);
+            if (reqLen > 0 && (req[0] & FRAME_INTERVAL_RESET) != 0) {
+                audioSplStatsReset();
+            }
+            payloadLen = framePackInterval(&msg, payload);
+            rspType = FRAME_INTERVAL;
+            break;
+        }
+
+        case FRAME_SUBSCRIBE: {
+            if (reqLen != 7) {
+                status = FRAME_ERR_LENGTH;
+                break;
+            }
+            uint32_t periodMs = req[1] | (req[2] << 8) | (req[3] << 16) | ((uint32_t) req[4] << 24);
+            uint32_t secs = req[5] | (req[6] << 8);
+            if (telemetrySubscribe(huart, req[0], TELEMETRY_BINARY, periodMs, secs) != errNone) {
+                status = FRAME_ERR_ARG;
+                break;
+            }
+            rspType = FRAME_SUBSCRIBED;
+            break;
+        }
+
+        default:
+            status = FRAME_ERR_TYPE;
+            break;
+
+        }
+    }
+
+    // Reply, noting that we reply to corrupted frames so that the host needn't time out
+    if (status != FRAME_OK) {
+        reqFrameErrors++;
+        payload[0] = (uint8_t) status;
+        payloadLen = 1;
+    }
+    reqFrames++;
+    uint8_t wire[FRAME_MAX_WIRE(FRAME_MAX_PAYLOAD)];
+    uint32_t wireLen = frameEncode(rspType, sequence, payload, payloadLen, wire, sizeof(wire));
+    serialOutput(huart, wire, wireLen);
+
+}
+
+// Get binary frame stats
+void reqFrameStats(uint32_t *frames, uint32_t *errors)
+{
+    *frames = reqFrames;
+    *errors = reqFrameErrors;
+}
+
+// Parse a JSON request and dispatch it, writing the response into the buffer
+err_t reqDispatch(UART_HandleTypeDef *huart, char *reqJSON, char *rsp, uint32_t rspLen, uint32_t *retRspLen)
+{
+    uint32_t beganCycles = MX_CYC_Count();
+    err_t err = reqTableDispatch(reqTable, huart, reqJSON, reqTokens, REQ_MAX_TOKENS, rsp, rspLen, retRspLen);
+    if (err) {
+        return err;
+    }
+
+    // Account for the time taken
+    uint32_t cycles = MX_CYC_Count() - beganCycles;
+    reqCount++;
+    reqCyclesTotal += cycles;
+    if (cycles > reqCyclesMax) {
+        reqCyclesMax = cycles;
+    }
+    return errNone;
+}
 
+// Get parse-and-dispatch timing
+void reqStats(uint32_t *count, double *avgUs, double *maxUs)
+{
+    *count = reqCount;
+    *avgUs = reqCount == 0 ? 0 : MX_CYC_ToUs((uint32_t) (reqCyclesTotal / reqCount));
+    *maxUs = MX_CYC_ToUs(reqCyclesMax);
+}
+
+// {"req":"spl.get"} returns the last SPL and the time of its block's first sample
+err_t reqSplGet(reqContext *ctx)
+{
+    jsonAddNumber(ctx->rsp, "spl", audioSpl(), 2);
+    jsonAddNumber(ctx->rsp, "time", (double) audioSplTimeUs() / (double) us1Sec, 6);
+    return errNone;
+}
+
+// {"req":"spl.stats","reset":true} returns SPL statistics, optionally resetting them
+err_t reqSplStats(reqContext *ctx)
+{
+    uint32_t count, secs;
+    double min, max, leq;
+    audioSplStats(&count, &min, &max, &leq, &secs);
+    jsonAddInt(ctx->rsp, "count", count);
+    jsonAddNumber(ctx->rsp, "min", min, 2);
+    jsonAddNumber(ctx->rsp, "max", max, 2);
+    jsonAddNumber(ctx->rsp, "leq", leq, 2);
+    jsonAddInt(ctx->rsp, "secs", secs);
+    bool reset;
+    if (reqArgBool(ctx, "reset", &reset) && reset) {
+        audioSplStatsReset();
+    }
+    return errNone;
+}
+
+// {"req":"bands.get"} returns the octave band levels of the last block
+err_t reqBandsGet(reqContext *ctx)
+{
+    double levels[AUDIO_BANDS_MAX];
+    uint32_t centersHz[AUDIO_BANDS_MAX];
+    uint32_t bands = audioBands(levels, AUDIO_BANDS_MAX, centersHz);
+    double centers[AUDIO_BANDS_MAX];
+    for (uint32_t i=0; i<bands; i++) {
+        centers[i] = centersHz[i];
+    }
+    jsonAddNumbers(ctx->rsp, "hz", centers, bands, 0);
+    jsonAddNumbers(ctx->rsp, "db", levels, bands, 2);
+    return errNone;
+}
+
+// {"req":"config.set","threshold":<spl>,"window":<secs>,"period":<secs>} changes
+// whichever settings are specified, and returns the resulting configuration.  Every
+// argument is validated before any is applied, so that a bad one changes nothing.
+err_t reqConfigSet(reqContext *ctx)
+{
+
+    // Snapshot trigger
+    double threshold;
+    bool thresholdChanged = reqArgNumber(ctx, "threshold", &threshold);
+    if (thresholdChanged && !isfinite(threshold)) {
+        return errF("threshold must be finite");
+    }
+
+    // Duty cycle, where a window of 0 means continuous
+    uint32_t windowMs, periodMs, measuringSecs, idleSecs;
+    double avgMa;
+    audioDutyStats(&windowMs, &periodMs, &measuringSecs, &idleSecs, &avgMa);
+    bool dutyChanged = false;
+    double value;
+    if (reqArgNumber(ctx, "window", &value)) {
+        if (!isfinite(value) || value < 0 || value > REQ_SECS_MAX) {
+            return errF("window must be from 0 to %lu", (unsigned long) REQ_SECS_MAX);
+        }
+        windowMs = (uint32_t) (value * ms1Sec);
+        dutyChanged = true;
+    }
+    if (reqArgNumber(ctx, "period", &value)) {
+        if (!isfinite(value) || value <= 0 || value > REQ_SECS_MAX) {
+            return errF("period must be positive and at most %lu", (unsigned long) REQ_SECS_MAX);
+        }
+        periodMs = (uint32_t) (value * ms1Sec);
+        dutyChanged = true;
+    }
+
+    // Apply them
+    if (thresholdChanged) {
+        snapshotSetThreshold(threshold);
+    }
+    if (dutyChanged) {
+        audioDutySet(windowMs, periodMs);
+    }
+
+    // Reply with the configuration
+    char *state;
+    uint32_t triggers;
+    snapshotStatus(&state, &threshold, &triggers);
+    jsonAddNumber(ctx->rsp, "threshold", threshold, 1);
+    jsonAddNumber(ctx->rsp, "window", (double) windowMs / ms1Sec, 0);
+    jsonAddNumber(ctx->rsp, "period", (double) periodMs / ms1Sec, 0);
+    return errNone;
+
+}
+
+// {"req":"serial.baud","rate":115200} changes the port's baud rate, replying at the
+// current rate before switching
+err_t reqSerialBaud(reqContext *ctx)
+{
+    double rate;
+    if (!reqArgNumber(ctx, "rate", &rate)) {
+        return errF("rate must be specified");
+    }
+    if (!isfinite(rate) || rate <= 0 || rate > UINT32_MAX || rate != floor(rate)) {
+        return errF("unsupported baud rate");
+    }
+    uint32_t baudRate = (uint32_t) rate;
+    err_t err = serialCheckBaudRate(ctx->huart, baudRate);
+    if (err) {
+        return err;
+    }
+    reqPendingBaudRate = baudRate;
+    jsonAddInt(ctx->rsp, "rate", reqPendingBaudRate);
+    return errNone;
+}
+
+// {"req":"spl.subscribe","type":"spl"|"interval","ms":<period>,"secs":<duration>,"format":"json"|"binary"}
+// pushes a record to this port every period until unsubscribed or until the duration lapses
+err_t reqSplSubscribe(reqContext *ctx)
+{
+    uint8_t kind = TELEMETRY_SPL;
+    int i = jsonObjectGet(ctx->json, ctx->tokens, ctx->count, 0, "type");
+    if (i >= 0) {
+        if (jsonEquals(ctx->json, &ctx->tokens[i], "interval")) {
+            kind = TELEMETRY_INTERVAL;
+        } else if (!jsonEquals(ctx->json, &ctx->tokens[i], "spl")) {
+            return errF("type must be spl or interval");
+        }
+    }
+    uint8_t format = TELEMETRY_JSON;
+    i = jsonObjectGet(ctx->json, ctx->tokens, ctx->count, 0, "format");
+    if (i >= 0 && jsonEquals(ctx->json, &ctx->tokens[i], "binary")) {
+        format = TELEMETRY_BINARY;
+    }
+    double periodMs = ms1Sec;
+    reqArgNumber(ctx, "ms", &periodMs);
+    double secs = 0;
+    reqArgNumber(ctx, "secs", &secs);
+    if (periodMs < 0 || secs < 0) {
+        return errF("ms and secs must not be negative");
+    }
+    err_t err = telemetrySubscribe(ctx->huart, kind, format, (uint32_t) periodMs, (uint32_t) secs);
+    if (err) {
+        return err;
+    }
+    jsonAddInt(ctx->rsp, "ms", (uint32_t) periodMs);
+    jsonAddInt(ctx->rsp, "secs", secs == 0 ? TELEMETRY_DEFAULT_SECS : (uint32_t) secs);
+    return errNone;
+}
+
+// {"req":"spl.unsubscribe"} stops pushing records to this port
+err_t reqSplUnsubscribe(reqContext *ctx)
+{
+    return telemetrySubscribe(ctx->huart, TELEMETRY_NONE, TELEMETRY_JSON, 0, 0);
 }
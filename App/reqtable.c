@@ -0,0 +1,71 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#include "reqtable.h"
+
+// Parse a JSON request into the tokens and dispatch it through the table, writing
+// the response into the buffer
+err_t reqTableDispatch(const reqDef *table, struct __UART_HandleTypeDef *huart, char *reqJSON, jsonToken *tokens, int maxTokens, char *rsp, uint32_t rspLen, uint32_t *retRspLen)
+{
+
+    // Tokenize
+    int count = jsonParse(reqJSON, tokens, maxTokens);
+    if (count == JSON_ERR_NOMEM) {
+        return errF("request is too complex");
+    }
+    if (count <= 0 || tokens[0].type != JSON_OBJECT) {
+        return errF("request is not a valid JSON object");
+    }
+
+    // Find the handler
+    int req = jsonObjectGet(reqJSON, tokens, count, 0, "req");
+    if (req < 0) {
+        return errF("no request specified");
+    }
+    const reqDef *def = NULL;
+    for (int i=0; table[i].name != NULL; i++) {
+        if (jsonEquals(reqJSON, &tokens[req], table[i].name)) {
+            def = &table[i];
+            break;
+        }
+    }
+    if (def == NULL) {
+        return errF("unrecognized request");
+    }
+
+    // Dispatch
+    jsonWriter w;
+    jsonWriterBegin(&w, rsp, rspLen);
+    reqContext ctx = { huart, reqJSON, tokens, count, &w };
+    err_t err = def->handler(&ctx);
+    if (err) {
+        return err;
+    }
+    *retRspLen = jsonWriterEnd(&w);
+    if (*retRspLen == 0) {
+        return errF("response is too large");
+    }
+    return errNone;
+
+}
+
+// Get a numeric argument
+bool reqArgNumber(reqContext *ctx, char *field, double *retValue)
+{
+    int i = jsonObjectGet(ctx->json, ctx->tokens, ctx->count, 0, field);
+    if (i < 0) {
+        return false;
+    }
+    return jsonNumber(ctx->json, &ctx->tokens[i], retValue);
+}
+
+// Get a boolean argument
+bool reqArgBool(reqContext *ctx, char *field, bool *retValue)
+{
+    int i = jsonObjectGet(ctx->json, ctx->tokens, ctx->count, 0, field);
+    if (i < 0) {
+        return false;
+    }
+    return jsonBool(ctx->json, &ctx->tokens[i], retValue);
+}
@@ -0,0 +1,45 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#pragma once
+
+#include "global.h"
+#include "json.h"
+
+// JSON requests are of the form {"req":"<name>",...} and are tokenized in place,
+// without allocation, and then dispatched through the request table.  Each handler
+// writes its response object into the caller's buffer.  Like duty.h, this is free of
+// any HAL or RTOS dependency, and Test/json_test.c times it on a host with stand-ins
+// for the handlers, which are in req.c.
+struct __UART_HandleTypeDef;
+
+// Request context passed to handlers
+typedef struct {
+    struct __UART_HandleTypeDef *huart;
+    const char *json;
+    jsonToken *tokens;
+    int count;
+    jsonWriter *rsp;
+} reqContext;
+
+// Request table, in the order that requests are looked up
+typedef struct {
+    char *name;
+    err_t (*handler)(reqContext *ctx);
+} reqDef;
+#define REQ_TABLE(X) \
+    X("spl.get", reqSplGet) \
+    X("spl.stats", reqSplStats) \
+    X("bands.get", reqBandsGet) \
+    X("config.set", reqConfigSet) \
+    X("serial.baud", reqSerialBaud) \
+    X("spl.subscribe", reqSplSubscribe) \
+    X("spl.unsubscribe", reqSplUnsubscribe)
+#define REQ_TABLE_HANDLER(name, handler)    err_t handler(reqContext *ctx);
+#define REQ_TABLE_ENTRY(name, handler)      {name, handler},
+REQ_TABLE(REQ_TABLE_HANDLER)
+
+err_t reqTableDispatch(const reqDef *table, struct __UART_HandleTypeDef *huart, char *reqJSON, jsonToken *tokens, int maxTokens, char *rsp, uint32_t rspLen, uint32_t *retRspLen);
+bool reqArgNumber(reqContext *ctx, char *field, double *retValue);
+bool reqArgBool(reqContext *ctx, char *field, bool *retValue);
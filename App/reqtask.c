@@ -5,34 +5,51 @@
 #include "app.h"
 #include "usart.h"
 
-// A button was pressed
-STATIC bool processButtonPress = false;
-
 // Perform work after sending reply
 uint32_t reqDeferredWork = rdtNone;
 
 // Forwards
 bool processReq(UART_HandleTypeDef *huart);
-bool processButton(void);
+bool processMessages(void);
+void processButton(void);
 
 // Request task
 void reqTask(void *params)
 {
 
-    // Init task
+    // Init task, which is woken with a bit for each source that has work ready
+    taskRegisterAsSignalled(TASKID_REQ);
     taskRegister(TASKID_REQ, TASKNAME_REQ, TASKLETTER_REQ, TASKSTACK_REQ);
 
-    // Loop, extracting requests from the serial ports and processing them
+    // Loop, servicing only the sources that are ready, highest priority first.  A
+    // source stays ready until it has nothing more for us, because ports may have
+    // several requests queued, and each pass picks up whatever else has become ready
+    // meanwhile so that a busy port doesn't hide the others.  Start with all of them
+    // in case any became ready before we registered.
+    uint32_t ready = REQ_READY_ALL;
     while (true) {
 
-        bool didSomething = false;
-        didSomething |= processReq(&hlpuart1);
-        didSomething |= processReq(&huart1);
-        didSomething |= processReq(NULL);
-        didSomething |= processButton();
-        if (!didSomething) {
-            taskTake(TASKID_REQ, ms1Hour);
+        ready |= taskPollSignals(TASKID_REQ);
+        if (ready == 0) {
+            ready = taskWaitSignals(TASKID_REQ, ms1Hour);
+        }
+
+        if ((ready & REQ_READY_LPUART1) != 0 && !processReq(&hlpuart1)) {
+            ready &= ~REQ_READY_LPUART1;
+        }
+        if ((ready & REQ_READY_USART1) != 0 && !processReq(&huart1)) {
+            ready &= ~REQ_READY_USART1;
+        }
+        if ((ready & REQ_READY_USB) != 0 && !processReq(NULL)) {
+            ready &= ~REQ_READY_USB;
         }
+        if ((ready & REQ_READY_USART2) != 0 && !processReq(&huart2)) {
+            ready &= ~REQ_READY_USART2;
+        }
+        if ((ready & TASK_SIGNAL_WAKE) != 0 && !processMessages()) {
+            ready &= ~TASK_SIGNAL_WAKE;
+        }
+
     }
 
 }
@@ -44,11 +61,18 @@ bool processReq(UART_HandleTypeDef *huart)
     // Get the pending JSON request
     uint8_t *reqJSON;
     uint32_t reqJSONLen;
-    bool diagAllowed;
-    if (!serialLock(huart, &reqJSON, &reqJSONLen, &diagAllowed)) {
+    bool diagAllowed, binary;
+    if (!serialLock(huart, &reqJSON, &reqJSONLen, &diagAllowed, &binary)) {
         return false;
     }
 
+    // Binary frames have their own replies
+    if (binary) {
+        reqProcessFrame(huart, reqJSON, reqJSONLen);
+        serialUnlock(huart, true);
+        return true;
+    }
+
     // If it's a 0-length request, we must output our standard \r\n response
     // because this is critical for note-c to answer "are you there?"
     if (reqJSONLen == 0) {
@@ -62,7 +86,7 @@ bool processReq(UART_HandleTypeDef *huart)
 
     // Process the request (which is conveniently null-terminated by the serial subsystem)
     bool debugWasEnabled = MX_DBG_Enable(false);
-    err_t err = reqProcess(serialIsDebugPort(huart), reqJSON, diagAllowed);
+    err_t err = reqProcess(huart, reqJSON, diagAllowed);
     MX_DBG_Enable(debugWasEnabled);
     serialUnlock(huart, true);
     if (err) {
@@ -92,20 +116,25 @@ bool processReq(UART_HandleTypeDef *huart)
 
 }
 
-// Note that the button was pressed
-void reqButtonPressedISR()
+// Process messages posted to us by interrupts
+bool processMessages()
 {
-    processButtonPress = true;
-    taskGiveFromISR(TASKID_REQ);
+    bool didSomething = false;
+    msgqMsg msg;
+    while (taskReceive(TASKID_REQ, &msg)) {
+        switch (msg.type) {
+        case TASKMSG_BUTTON:
+            processButton();
+            didSomething = true;
+            break;
+        }
+    }
+    return didSomething;
 }
 
 // Process button press
-bool processButton()
+void processButton()
 {
-    if (!processButtonPress) {
-        return false;
-    }
-    processButtonPress = false;
 
     // Give positive indication that we're still alive
     int iterations = 2;
@@ -118,7 +147,4 @@ bool processButton()
         }
     }
 
-    // Done
-    return true;
-
 }
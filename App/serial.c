@@ -5,19 +5,35 @@
 #include "app.h"
 #include "usart.h"
 #include "usb_device.h"
+#include "frame.h"
+#include "linescan.h"
+#include "serialwait.h"
+#include "tlog.h"
 
 // This set of methods has two jobs:
 // 1. rapidly transfer data from interrupt buffers into userspace buffers without loss
 // 2. gather non-blank lines that are terminated by either \r or \n and wake up req task to process them
+// 3. gather binary frames (see frame.h), which begin and end with 0x00, and hand them off the same way
 
 // Port descriptors
 typedef struct {
     array *bytes;
-    bool bytesTerminated;
-    bool swallowNextNewline;
+    array *lines[SERIAL_RX_LINES];
+    bool linesBinary[SERIAL_RX_LINES];
+    uint32_t linesIn;
+    uint32_t linesOut;
+    uint32_t lineOverflows;
+    uint32_t framesAbandoned;
+    lineScanner scanner;
     mutex rxLock;
     mutex txLock;
     int taskId;
+    uint32_t readyBit;
+    uint32_t baudPending;
+    int64_t baudConfirmByMs;
+    int64_t lastActivityMs;
+    uint32_t lastTxQueued;
+    uint32_t baudFallbacks;
 } serialDesc;
 STATIC serialDesc usbDesc = {0};
 #if ENABLE_USART1
@@ -37,22 +53,40 @@ STATIC uint8_t usart1InterruptBuffer[600];
 STATIC uint8_t usart2InterruptBuffer[600];
 #endif
 STATIC uint8_t usbInterruptBuffer[600];
-STATIC uint8_t isrDebugOutput[120];             // some messages will get truncated but who cares
-STATIC uint32_t isrDebugOutputLen = 0;
 
-// Last time we did work moving serial data
-STATIC int64_t lastTimeDidWorkMs = 0L;
+// Transmit queues
+STATIC uint8_t lpuart1TransmitBuffer[512];
+#if ENABLE_USART1
+STATIC uint8_t usart1TransmitBuffer[512];
+#endif
+#if ENABLE_USART2
+STATIC uint8_t usart2TransmitBuffer[512];
+#endif
+STATIC uint8_t usbTransmitBuffer[1024];
 
 // Task ID
 STATIC uint32_t serialTaskID = TASKID_UNKNOWN;
 
-// Whether or not the serial polling is active
-bool serialActive = false;
+// When a receive notification arrives we may not yet have the bytes, such as when
+// LPUART1 wakes us from STOP2 on a start bit, and so we stay awake until this time.
+STATIC volatile int64_t rxExpectedUntilMs = 0;
+
+// Number of times the serial task has been awakened, for diagnostics
+STATIC uint32_t serialWakeups = 0;
+
+// Sequence number of tokenized log frames, so that a host can tell if it missed any
+STATIC uint8_t logSequence = 0;
 
 // Forwards
 void serialReceivedNotification(UART_HandleTypeDef *huart, bool error);
+void serialTransmittedNotification(UART_HandleTypeDef *huart);
+uint32_t serviceTransmit(UART_HandleTypeDef *huart, bool *pending);
+bool portPending(UART_HandleTypeDef *huart);
+serialDesc *portDesc(UART_HandleTypeDef *huart);
 bool pollPort(UART_HandleTypeDef *huart);
+uint32_t serviceBaud(UART_HandleTypeDef *huart);
 void debugOutput(uint8_t *buf, uint32_t buflen);
+bool serviceLog(void);
 
 // Serial poller init
 void serialInit(uint32_t taskID)
@@ -75,37 +109,46 @@ void serialInit(uint32_t taskID)
     mutexInit(&usart2Desc.txLock, MTX_SERIAL_TX);
 #endif
 
-    // Set the tasks of the handlers
+    // Set the tasks of the handlers, and what they signal when a request is ready
     usbDesc.taskId = TASKID_REQ;
+    usbDesc.readyBit = REQ_READY_USB;
     lpuart1Desc.taskId = TASKID_REQ;
+    lpuart1Desc.readyBit = REQ_READY_LPUART1;
 #if ENABLE_USART1
     usart1Desc.taskId = TASKID_REQ;
+    usart1Desc.readyBit = REQ_READY_USART1;
 #endif
 #if ENABLE_USART2
     usart2Desc.taskId = TASKID_REQ;
+    usart2Desc.readyBit = REQ_READY_USART2;
 #endif
 
     // LPUART1
     MX_UART_RxConfigure(&hlpuart1, lpuart1InterruptBuffer, sizeof(lpuart1InterruptBuffer), serialReceivedNotification);
-    MX_LPUART1_UART_Init(false, 9600);
+    MX_UART_TxConfigure(&hlpuart1, lpuart1TransmitBuffer, sizeof(lpuart1TransmitBuffer), SERIAL_TX_CHUNK, SERIAL_TX_GAP_MS, serialTransmittedNotification);
+    MX_LPUART1_UART_Init(false, SERIAL_BAUD_DEFAULT);
 
     // USART1
 #if ENABLE_USART1
     MX_UART_RxConfigure(&huart1, usart1InterruptBuffer, sizeof(usart1InterruptBuffer), serialReceivedNotification);
-    MX_USART1_UART_Init(9600);
+    MX_UART_TxConfigure(&huart1, usart1TransmitBuffer, sizeof(usart1TransmitBuffer), SERIAL_TX_CHUNK, SERIAL_TX_GAP_MS, serialTransmittedNotification);
+    MX_USART1_UART_Init(SERIAL_BAUD_DEFAULT);
 #endif
 
     // USART2
 #if ENABLE_USART2
     MX_UART_RxConfigure(&huart2, usart2InterruptBuffer, sizeof(usart2InterruptBuffer), serialReceivedNotification);
-    MX_USART2_UART_Init(9600);
+    MX_UART_TxConfigure(&huart2, usart2TransmitBuffer, sizeof(usart2TransmitBuffer), SERIAL_TX_CHUNK, SERIAL_TX_GAP_MS, serialTransmittedNotification);
+    MX_USART2_UART_Init(SERIAL_BAUD_DEFAULT);
 #endif
 
     // USB (debug port)
     MX_UART_RxConfigure(NULL, usbInterruptBuffer, sizeof(usbInterruptBuffer), serialReceivedNotification);
+    MX_UART_TxConfigure(NULL, usbTransmitBuffer, sizeof(usbTransmitBuffer), SERIAL_TX_CHUNK_USB, SERIAL_TX_GAP_MS, serialTransmittedNotification);
 
     // Set debug function
     MX_DBG_SetOutput(debugOutput);
+    debugLogSetNotify(serialWake);
 
 }
 
@@ -113,6 +156,11 @@ void serialInit(uint32_t taskID)
 void serialPoll(void)
 {
 
+    // Messages from interrupts only serve to wake us, because the ports are polled below
+    msgqMsg msg;
+    while (taskReceive(serialTaskID, &msg)) {
+    }
+
     // Rest the USB if it needs to be reset
     if (osUsbDetected() && (peripherals & PERIPHERAL_USB) == 0) {
         MX_USB_DEVICE_Init();
@@ -120,48 +168,69 @@ void serialPoll(void)
         MX_USB_DEVICE_DeInit();
     }
 
-    // Note that we are busy servicing serial
-    serialActive = true;
-
-    // Poll ports so long as there's something to do
-    bool didWork = false;
+    // Move received data so long as there's something to do
+    serialWakeups++;
     while (true) {
         bool didSomething = false;
         didSomething |= pollPort(&hlpuart1);
         didSomething |= pollPort(&huart1);
         didSomething |= pollPort(&huart2);
         didSomething |= pollPort(NULL);
-        if (isrDebugOutputLen > 0) {
-            debugOutput(isrDebugOutput, isrDebugOutputLen);
-            isrDebugOutputLen = 0;
-        }
-        didWork |= didSomething;
         if (!didSomething) {
             break;
         }
     }
 
-    // If nothing was done, truly go idle
-    uint32_t pollMs;
-    if (didWork) {
-        pollMs = 1;
-        lastTimeDidWorkMs = timerMs();
-    } else if (!timerMsElapsed(lastTimeDidWorkMs, 3000)) {
-        pollMs = 100;
-    } else {
-        pollMs = ms1Hour;
-        serialActive = false;
-    }
+    // Queue any telemetry that's due and deferred debug output, ahead of servicing
+    // the transmitters, leaving what doesn't fit for when a transmit completes
+    serialWaitInputs wait = {0};
+    wait.telemetryBlocked = telemetryService();
+    wait.logBlocked = serviceLog();
+
+    // Start paced transmits and recover stalled ones
+    wait.txServiceMs = serviceTransmit(&hlpuart1, &wait.txPending);
+    wait.txServiceMs = GMIN(wait.txServiceMs, serviceTransmit(&huart1, &wait.txPending));
+    wait.txServiceMs = GMIN(wait.txServiceMs, serviceTransmit(&huart2, &wait.txPending));
+    wait.txServiceMs = GMIN(wait.txServiceMs, serviceTransmit(NULL, &wait.txPending));
+
+    // Switch baud rates once acknowledged, and fall back if the host has gone quiet
+    wait.baudMs = serviceBaud(&hlpuart1);
+    wait.baudMs = GMIN(wait.baudMs, serviceBaud(&huart1));
+    wait.baudMs = GMIN(wait.baudMs, serviceBaud(&huart2));
 
-    // Wait until there's something to do
-    taskTake(serialTaskID, pollMs);
+    // If we're expecting bytes that haven't yet arrived, check back when they should have
+    wait.rxGuardMs = timerMsUntil(rxExpectedUntilMs);
+
+    // Sleep until an interrupt notifies us of received bytes or transmit completion,
+    // or until one of the above needs us (Test/wakeup_test.c sleeps its simulated task
+    // by the same serialWaitMs, to count our wakeups per request)
+    taskTake(serialTaskID, serialWaitMs(&wait));
 
 }
 
-// Whether or not serial is active
+// See if a port has received bytes, lines, or transmits that are still in progress
+bool portPending(UART_HandleTypeDef *huart)
+{
+    serialDesc *desc = portDesc(huart);
+    if (desc == NULL) {
+        return false;
+    }
+    return (MX_UART_RxAvailable(huart) || desc->linesIn != desc->linesOut || MX_UART_TxPending(huart));
+}
+
+// Whether or not serial is active, meaning that we must not enter STOP2
 bool serialIsActive(void)
 {
-    return serialActive;
+    if (timerMsUntil(rxExpectedUntilMs) > 0) {
+        return true;
+    }
+    return (portPending(&hlpuart1) || portPending(&huart1) || portPending(&huart2) || portPending(NULL));
+}
+
+// Get the number of times the serial task has been awakened
+uint32_t serialWakeupCount(void)
+{
+    return serialWakeups;
 }
 
 // Notification
@@ -171,12 +240,12 @@ void serialReceivedNotification(UART_HandleTypeDef *huart, bool error)
 
         // Because notifications are received (on LPUART1) before the character
         // has been fully received, and because the receive is not actually
-        // yet completed, make sure we mark this as "work done" so that the
-        // serialPoll loop doesn't just go back to sleep on the first iteration.
-        lastTimeDidWorkMs = timerMs();
+        // yet completed, make sure that we stay awake until the IDLE interrupt
+        // has had a chance to deliver it.
+        rxExpectedUntilMs = timerMsFromISR() + SERIAL_RX_GUARD_MS;
 
         // Wake the serial task
-        taskGiveFromISR(serialTaskID);
+        taskPost(serialTaskID, TASKMSG_SERIAL_RX, error);
 
     }
 }
@@ -200,6 +269,137 @@ serialDesc *portDesc(UART_HandleTypeDef *huart)
     return NULL;
 }
 
+// Transmit notification, when a port has drained or is waiting to send a paced chunk
+void serialTransmittedNotification(UART_HandleTypeDef *huart)
+{
+    if (serialTaskID != TASKID_UNKNOWN) {
+        taskPost(serialTaskID, TASKMSG_SERIAL_TX, 0);
+    }
+}
+
+// Service a port's transmit queue, returning how long until it next needs service
+uint32_t serviceTransmit(UART_HandleTypeDef *huart, bool *pending)
+{
+    if (portDesc(huart) == NULL) {
+        return ms1Hour;
+    }
+    uint32_t waitMs = MX_UART_TxService(huart);
+    if (MX_UART_TxPending(huart)) {
+        *pending = true;
+    }
+    return waitMs;
+}
+
+// See if a port can be switched to the specified baud rate
+err_t serialCheckBaudRate(UART_HandleTypeDef *huart, uint32_t baudRate)
+{
+
+    // Only physical UARTs have a baud rate
+    if (huart == NULL || portDesc(huart) == NULL) {
+        return errF("baud rate cannot be changed on this port");
+    }
+
+    // Validate against the rates we support
+    static const uint32_t rates[] = SERIAL_BAUD_RATES;
+    for (uint32_t i=0; i<sizeof(rates)/sizeof(rates[0]); i++) {
+        if (rates[i] == baudRate) {
+            return errNone;
+        }
+    }
+    return errF("unsupported baud rate");
+
+}
+
+// Request that a port change its baud rate.  The caller is expected to have queued
+// its acknowledgement at the current rate, and we switch only after that has been
+// transmitted.  If the host doesn't then send us something at the new rate within
+// SERIAL_BAUD_CONFIRM_MS, or if the port is later idle for SERIAL_BAUD_IDLE_MS, we
+// fall back to SERIAL_BAUD_DEFAULT so that a host that has lost sync (or that has
+// restarted) can always reach us.
+err_t serialSetBaudRate(UART_HandleTypeDef *huart, uint32_t baudRate)
+{
+
+    // Validate
+    err_t err = serialCheckBaudRate(huart, baudRate);
+    if (err) {
+        return err;
+    }
+
+    // Defer to the serial task, which owns the receive ring
+    serialDesc *desc = portDesc(huart);
+    desc->baudPending = baudRate;
+    if (serialTaskID != TASKID_UNKNOWN) {
+        taskGive(serialTaskID);
+    }
+    return errNone;
+
+}
+
+// Perform a pending baud rate change, or fall back to the default if the host isn't
+// talking to us.  Returns how long until the port next needs service.
+uint32_t serviceBaud(UART_HandleTypeDef *huart)
+{
+
+    // Exit if not a port we manage
+    serialDesc *desc = portDesc(huart);
+    if (huart == NULL || desc == NULL) {
+        return ms1Hour;
+    }
+
+    // Outbound traffic counts as activity, such as when streaming to a quiet host
+    uint32_t txQueued = MX_UART_TxQueued(huart);
+    if (txQueued != desc->lastTxQueued) {
+        desc->lastTxQueued = txQueued;
+        desc->lastActivityMs = timerMs();
+    }
+
+    // Switch once the acknowledgement has fully left the wire
+    if (desc->baudPending != 0) {
+        if (MX_UART_TxPending(huart)) {
+            return 1;
+        }
+        uint32_t baudRate = desc->baudPending;
+        desc->baudPending = 0;
+        if (MX_UART_SetBaudRate(huart, baudRate) && baudRate != SERIAL_BAUD_DEFAULT) {
+            desc->baudConfirmByMs = timerMs() + SERIAL_BAUD_CONFIRM_MS;
+            desc->lastActivityMs = timerMs();
+        }
+    }
+
+    // Nothing to monitor at the default rate
+    if (MX_UART_BaudRate(huart) == SERIAL_BAUD_DEFAULT) {
+        desc->baudConfirmByMs = 0;
+        return ms1Hour;
+    }
+
+    // Fall back if unconfirmed or idle, taking care not to cut off a transmit
+    int64_t deadlineMs = desc->lastActivityMs + SERIAL_BAUD_IDLE_MS;
+    if (desc->baudConfirmByMs != 0) {
+        deadlineMs = desc->baudConfirmByMs;
+    }
+    uint32_t waitMs = timerMsUntil(deadlineMs);
+    if (waitMs > 0 || MX_UART_TxPending(huart) || MX_UART_RxAvailable(huart)) {
+        return GMAX(waitMs, 1);
+    }
+    desc->baudConfirmByMs = 0;
+    desc->baudFallbacks++;
+    MX_UART_SetBaudRate(huart, SERIAL_BAUD_DEFAULT);
+    return ms1Hour;
+
+}
+
+// Get the current baud rate of a port, and the number of times it has fallen back
+void serialBaudStats(UART_HandleTypeDef *huart, uint32_t *retBaudRate, uint32_t *retFallbacks)
+{
+    serialDesc *desc = portDesc(huart);
+    if (huart == NULL || desc == NULL) {
+        *retBaudRate = *retFallbacks = 0;
+        return;
+    }
+    *retBaudRate = MX_UART_BaudRate(huart);
+    *retFallbacks = desc->baudFallbacks;
+}
+
 // See if there's port activity
 bool pollPort(UART_HandleTypeDef *huart)
 {
@@ -210,68 +410,73 @@ bool pollPort(UART_HandleTypeDef *huart)
         return false;
     }
 
-    // Exit if we're already processing something for this task
-    if (mutexIsLocked(&desc->rxLock, NULL)) {
-        return false;
-    }
-
     // Exit immediately if nothing available
     if (!MX_UART_RxAvailable(huart)) {
         return false;
     }
 
-    // Lock the mutex and see if we're already processing something.  This
-    // is a really unusual condition because it means that someone is
-    // sequentially chaining "cmd"s or something like that.  We need
-    // to wait until that command is processed, though, before taking
-    // any more from the interrupt handler.
+    // Note that the host is talking to us, which confirms any baud rate change
+    desc->lastActivityMs = timerMs();
+    desc->baudConfirmByMs = 0;
+
+    // Move contiguous spans out of the interrupt buffer until it is drained, noting that
+    // it takes two spans if it has wrapped.  Completed lines are handed off to the request
+    // task's queue, and we keep assembling the next line while it processes them.
     mutexLock(&desc->rxLock);
-    if (desc->bytesTerminated) {
-        mutexUnlock(&desc->rxLock);
-        taskGive(desc->taskId);
-        timerMsSleep(50);
-        return false;
-    }
+    uint8_t *data;
+    uint32_t dataLen;
+    while ((dataLen = MX_UART_RxPeek(huart, &data)) > 0) {
+
+        // Alloc if new
+        if (desc->bytes == NULL) {
+            if (arrayAllocBytes(&desc->bytes) != errNone) {
+                mutexUnlock(&desc->rxLock);
+                return false;
+            }
+        }
 
-    // Get the databyte
-    uint8_t databyte = MX_UART_RxGet(huart);
+        // Find the end of the line or frame in the span, if it holds one
+        uint32_t appendLen;
+        int event;
+        uint32_t consumed = lineScan(&desc->scanner, data, dataLen, (uint32_t) timerMs(), &appendLen, &event);
 
-    // Alloc if new
-    if (desc->bytes == NULL) {
-        if (arrayAllocBytes(&desc->bytes) != errNone) {
+        // Append all bytes except the terminator, making sure that we ALWAYS have a '\0' at the end
+        // so that later we can do a JParse that requires a null-terminated string.
+        if (appendLen > 0 && arrayAppendStringSpan(desc->bytes, (char *) data, appendLen) != errNone) {
             mutexUnlock(&desc->rxLock);
             return false;
         }
-        desc->bytesTerminated = false;
-    }
-
-    // Swallow newline if appropriate
-    if (databyte == '\n' && desc->swallowNextNewline) {
-        desc->swallowNextNewline = false;
-        mutexUnlock(&desc->rxLock);
-        return true;
-    }
+        MX_UART_RxConsume(huart, consumed);
+        if (event == LINESCAN_MORE) {
+            continue;
+        }
+        if (event == LINESCAN_DISCARD || event == LINESCAN_ABANDON) {
+            if (event == LINESCAN_ABANDON) {
+                desc->framesAbandoned++;
+            }
+            arrayFree(desc->bytes);
+            desc->bytes = NULL;
+            continue;
+        }
+        bool binary = (event == LINESCAN_FRAME);
+        if (desc->taskId == TASKID_UNKNOWN) {
+            continue;
+        }
 
-    // Awaken request processing task if a control character, because it's a waste to do otherwise
-    if (databyte == '\r' || databyte == '\n') {
-        desc->swallowNextNewline = (databyte == '\r');
-        if (desc->taskId != TASKID_UNKNOWN) {
-            desc->bytesTerminated = true;
-            taskGive(desc->taskId);
+        // Queue the completed line, discarding it if the request task has fallen too far behind
+        if (desc->linesIn - desc->linesOut >= SERIAL_RX_LINES) {
+            desc->lineOverflows++;
+            arrayFree(desc->bytes);
+        } else {
+            desc->lines[desc->linesIn % SERIAL_RX_LINES] = desc->bytes;
+            desc->linesBinary[desc->linesIn % SERIAL_RX_LINES] = binary;
+            desc->linesIn++;
         }
-        mutexUnlock(&desc->rxLock);
-        return true;
-    }
-    desc->swallowNextNewline = false;
+        desc->bytes = NULL;
+
+        // Let the request processing task know that this port has a request ready
+        taskSignal(desc->taskId, desc->readyBit);
 
-    // Append all bytes except \r and \n, making sure that we ALWAYS have a '\0' at the end
-    // so that later we can do a JParse that requires a null-terminated string.
-    char byteString[2];
-    byteString[0] = (char) databyte;
-    byteString[1] = '\0';
-    if (arrayAppendStringBytes(desc->bytes, byteString) != errNone) {
-        mutexUnlock(&desc->rxLock);
-        return false;
     }
 
     // Done
@@ -279,8 +484,9 @@ bool pollPort(UART_HandleTypeDef *huart)
     return true;
 }
 
-// See if there's data, and lock the receive buffer if so
-bool serialLock(UART_HandleTypeDef *huart, uint8_t **retData, uint32_t *retDataLen, bool *retDiagAllowed)
+// See if there's a line or frame waiting, returning the oldest if so.  The line remains owned
+// by the caller until serialUnlock, while the poller continues to assemble more.
+bool serialLock(UART_HandleTypeDef *huart, uint8_t **retData, uint32_t *retDataLen, bool *retDiagAllowed, bool *retBinary)
 {
 
     // Get port desc
@@ -289,37 +495,26 @@ bool serialLock(UART_HandleTypeDef *huart, uint8_t **retData, uint32_t *retDataL
         return false;
     }
 
-    // If a different task is already processing this serial, don't block
-    if (mutexIsLocked(&desc->rxLock, NULL)) {
-        return false;
-    }
-
     // If no data is waiting, don't block
-    if (desc->bytes == NULL) {
-        return false;
-    }
-    mutexLock(&desc->rxLock);
-    if (desc->bytes == NULL) {
-        mutexUnlock(&desc->rxLock);
+    if (desc->linesIn == desc->linesOut) {
         return false;
     }
 
-    // Return buffer, leaving desc locked.  Note that we return
-    // with 0-length if just a newline was passed to us, and this
-    // is essential when note-c is initializing and it's just
-    // sending \n\n\n's to see if we're alive.
-    if (!desc->bytesTerminated) {
-        mutexUnlock(&desc->rxLock);
-        return false;
-    }
-    *retData = (uint8_t *) arrayAddress(desc->bytes);
-    *retDataLen = arrayLength(desc->bytes);
+    // Return the oldest line.  Note that we return with 0-length if just a
+    // newline was passed to us, and this is essential when note-c is
+    // initializing and it's just sending \n\n\n's to see if we're alive.
+    mutexLock(&desc->rxLock);
+    array *line = desc->lines[desc->linesOut % SERIAL_RX_LINES];
+    *retData = (uint8_t *) arrayAddress(line);
+    *retDataLen = arrayLength(line);
     *retDiagAllowed = serialIsDebugPort(huart);
+    *retBinary = desc->linesBinary[desc->linesOut % SERIAL_RX_LINES];
+    mutexUnlock(&desc->rxLock);
     return true;
 
 }
 
-// Unlock and potentially reset
+// Done with the line returned by serialLock, removing it from the queue if reset
 void serialUnlock(UART_HandleTypeDef *huart, bool reset)
 {
 
@@ -329,17 +524,32 @@ void serialUnlock(UART_HandleTypeDef *huart, bool reset)
         return;
     }
 
-    // Reset if desired
+    // Remove it if desired
     if (reset) {
-        if (desc->bytes != NULL) {
-            arrayFree(desc->bytes);
-            desc->bytes = NULL;
+        mutexLock(&desc->rxLock);
+        if (desc->linesIn != desc->linesOut) {
+            uint32_t i = desc->linesOut % SERIAL_RX_LINES;
+            arrayFree(desc->lines[i]);
+            desc->lines[i] = NULL;
+            desc->linesOut++;
         }
-        desc->bytesTerminated = false;
+        mutexUnlock(&desc->rxLock);
     }
 
-    // Unlock
-    mutexUnlock(&desc->rxLock);
+}
+
+// Get the number of lines waiting, the number discarded because the queue was full, and
+// the number of partial frames abandoned because they grew too long or went quiet
+void serialRxStats(UART_HandleTypeDef *huart, uint32_t *retQueued, uint32_t *retOverflows, uint32_t *retAbandoned)
+{
+    serialDesc *desc = portDesc(huart);
+    if (desc == NULL) {
+        *retQueued = *retOverflows = *retAbandoned = 0;
+        return;
+    }
+    *retQueued = desc->linesIn - desc->linesOut;
+    *retOverflows = desc->lineOverflows;
+    *retAbandoned = desc->framesAbandoned;
 }
 
 // Output string to debug uart
@@ -361,15 +571,9 @@ bool serialIsDebugPort(UART_HandleTypeDef *huart)
 void debugOutput(uint8_t *buf, uint32_t buflen)
 {
 
-    // Buffer the output as debug output if we're in an ISR (which ST's middleware does)
+    // Defer the output to the log ring if we're in an ISR (which ST's middleware does)
     if (MX_InISR()) {
-        uint32_t left = sizeof(isrDebugOutput)-isrDebugOutputLen;
-        if (buflen > left) {
-            buflen = left;
-        }
-        memcpy(&isrDebugOutput[isrDebugOutputLen], buf, buflen);
-        isrDebugOutputLen += buflen;
-        taskGiveFromISR(serialTaskID);
+        debugLogText((char *) buf, buflen);
         return;
     }
 
@@ -380,64 +584,229 @@ void debugOutput(uint8_t *buf, uint32_t buflen)
 
 }
 
-// Output to a port, suspending tasks that might interrupt it if not DMA
-void uartTransmit(UART_HandleTypeDef *huart, uint8_t *buf, uint32_t buflen, uint32_t timeoutMs)
+// Queue a frame of segments to a port as a single logical transmission, waiting only if the
+// queue is full or if asked to wait for completion.  A frame that fits in the queue is queued
+// whole or not at all, while a larger one is streamed through it.  We give up only if the port
+// makes no progress for timeoutMs, returning false.  The caller must hold the port's txLock.
+bool uartTransmitV(UART_HandleTypeDef *huart, serialSegment *segs, uint32_t count, uint32_t timeoutMs, bool wait)
 {
-    if (MX_UART_IsDMA(huart)) {
-        MX_UART_Transmit(huart, buf, buflen, timeoutMs);
-    } else {
-        uint32_t prio = taskIOPriorityBegin();
-        MX_UART_Transmit(huart, buf, buflen, timeoutMs);
-        taskIOPriorityEnd(prio);
+
+    // Wait for room for the whole frame if it can fit, so that we never leave part of
+    // it queued.  Because we hold the txLock, the space only ever grows while we wait.
+    uint32_t total = 0;
+    for (uint32_t i=0; i<count; i++) {
+        total += segs[i].len;
     }
+    int64_t beganMs = timerMs();
+    if (total <= MX_UART_TxCapacity(huart)) {
+        uint32_t space = MX_UART_TxSpace(huart);
+        while (space < total) {
+            if (timerMsElapsed(beganMs, timeoutMs)) {
+                return false;
+            }
+            MX_UART_TxService(huart);
+            timerMsSleep(1);
+            uint32_t nowSpace = MX_UART_TxSpace(huart);
+            if (nowSpace > space) {
+                beganMs = timerMs();
+            }
+            space = nowSpace;
+        }
+    }
+
+    // Queue as much as we can, waiting for room if need be.  We don't kick the
+    // transmitter until the last segment so that the frame goes out together.
+    for (uint32_t i=0; i<count; i++) {
+        uint8_t *buf = segs[i].buf;
+        uint32_t buflen = segs[i].len;
+        bool more = (i+1 < count);
+        while (buflen > 0) {
+            uint32_t queued = MX_UART_TxEnqueue(huart, buf, buflen, more);
+            buf += queued;
+            buflen -= queued;
+            if (buflen == 0) {
+                break;
+            }
+            if (queued > 0) {
+                beganMs = timerMs();
+            } else if (timerMsElapsed(beganMs, timeoutMs)) {
+                return false;
+            }
+            MX_UART_TxService(huart);
+            timerMsSleep(1);
+        }
+    }
+
+    // Wait for it to be sent if desired
+    if (wait) {
+        uint32_t queued = MX_UART_TxQueued(huart);
+        uint32_t space = MX_UART_TxSpace(huart);
+        beganMs = timerMs();
+        while (!MX_UART_TxCompleted(huart, queued)) {
+            if (timerMsElapsed(beganMs, timeoutMs)) {
+                return false;
+            }
+            MX_UART_TxService(huart);
+            timerMsSleep(1);
+            uint32_t nowSpace = MX_UART_TxSpace(huart);
+            if (nowSpace > space) {
+                beganMs = timerMs();
+            }
+            space = nowSpace;
+        }
+    }
+    return true;
+
 }
 
-// Output to the specified port
-void serialOutput(UART_HandleTypeDef *huart, uint8_t *buf, uint32_t buflen)
+// Queue a single buffer to a port
+bool uartTransmit(UART_HandleTypeDef *huart, uint8_t *buf, uint32_t buflen, uint32_t timeoutMs, bool wait)
 {
+    serialSegment seg = { buf, buflen };
+    return uartTransmitV(huart, &seg, 1, timeoutMs, wait);
+}
 
-    // Output
+// Change the chunking and inter-chunk delay of a port's output
+void serialSetPacing(UART_HandleTypeDef *huart, uint16_t chunkLen, uint16_t gapMs)
+{
+    MX_UART_TxPacing(huart, chunkLen, gapMs);
+    if (serialTaskID != TASKID_UNKNOWN) {
+        taskGive(serialTaskID);
+    }
+}
+
+// Wait until everything queued for a port has been transmitted
+void serialFlush(UART_HandleTypeDef *huart, uint32_t timeoutMs)
+{
     serialDesc *desc = portDesc(huart);
     if (desc == NULL) {
         return;
     }
+    mutexLock(&desc->txLock);
+    uartTransmit(huart, NULL, 0, timeoutMs, true);
+    mutexUnlock(&desc->txLock);
+}
+
+// Output to the specified port, returning false if the port stalled before it was all queued
+bool serialOutput(UART_HandleTypeDef *huart, uint8_t *buf, uint32_t buflen)
+{
+
+    // Output
+    serialDesc *desc = portDesc(huart);
+    if (desc == NULL) {
+        return false;
+    }
+    bool success = true;
     if (buflen > 0) {
         mutexLock(&desc->txLock);
-        uartTransmit(huart, buf, buflen, 500);
+        success = uartTransmit(huart, buf, buflen, 500, false);
         mutexUnlock(&desc->txLock);
     }
+    return success;
 }
 
-// Output to the specified port with the Request Terminator (\r\n)
-void serialOutputLn(UART_HandleTypeDef *huart, uint8_t *buf, uint32_t buflen)
+// Output a set of segments to the specified port as a single transmission, returning false
+// if the port stalled, in which case a frame that fits the transmit queue wasn't queued at all
+bool serialOutputV(UART_HandleTypeDef *huart, serialSegment *segs, uint32_t count)
 {
+    serialDesc *desc = portDesc(huart);
+    if (desc == NULL) {
+        return false;
+    }
+    mutexLock(&desc->txLock);
+    bool success = uartTransmitV(huart, segs, count, 500, false);
+    mutexUnlock(&desc->txLock);
+    return success;
+}
 
-    // Change terminator based upon target
-    uint8_t *terminator = (uint8_t *) "\r\n";;
-    uint32_t terminatorLen = 2;
-
+// Queue a set of segments to a port only if it can be done without waiting, for tasks
+// that must never block on a slow link.  Returns false if the port is in use or if
+// there isn't room for all of it, in which case nothing was queued.
+bool serialTryOutputV(UART_HandleTypeDef *huart, serialSegment *segs, uint32_t count)
+{
     serialDesc *desc = portDesc(huart);
     if (desc == NULL) {
+        return false;
+    }
+    uint32_t total = 0;
+    for (uint32_t i=0; i<count; i++) {
+        total += segs[i].len;
+    }
+    if (!mutexTryLock(&desc->txLock)) {
+        return false;
+    }
+    bool fits = (MX_UART_TxSpace(huart) >= total);
+    if (fits) {
+        for (uint32_t i=0; i<count; i++) {
+            MX_UART_TxEnqueue(huart, segs[i].buf, segs[i].len, i+1 < count);
+        }
+    }
+    mutexUnlock(&desc->txLock);
+    return fits;
+}
+
+// Wake the serial task, such as when there's output for it to generate
+void serialWake(void)
+{
+    if (serialTaskID == TASKID_UNKNOWN) {
         return;
     }
-    mutexLock(&desc->txLock);
-    if (buflen == 0) {
-        uartTransmit(huart, terminator, terminatorLen, 500);
-    } else {
-        // We prefer to send it in a single chunk because it eliminates
-        // an I2C poll iteration for the client.
-        uint8_t *temp;
-        err_t err = memDup(buf, buflen+terminatorLen, &temp);
-        if (err) {
-            uartTransmit(huart, buf, buflen, 500);
-            uartTransmit(huart, terminator, terminatorLen, 500);
+    taskPost(serialTaskID, TASKMSG_SERIAL_WAKE, 0);
+}
+
+// Send deferred debug output to USB without blocking, as frames if tokenized or else
+// formatted as text, returning true if records are left for when USB's transmit
+// completion wakes us.  We never need to poll for more, because debug.c wakes us when
+// a record becomes the oldest.
+bool serviceLog(void)
+{
+    bool tokenized;
+    uint32_t records, dropped, avgCycles, pendingBytes;
+    debugLogStats(&tokenized, &records, &dropped, &avgCycles, &pendingBytes);
+
+    uint8_t rec[TLOG_HEADER + TLOG_MAX_ARGS];
+    uint32_t len;
+    while ((len = debugLogPeek(rec, sizeof(rec))) != 0) {
+
+        // Discard it if there's nobody listening
+        if (!osUsbDetected()) {
+            debugLogConsume();
+            continue;
+        }
+
+        // Send it, leaving it if USB can't take it now
+        bool sent;
+        if (tokenized) {
+            uint8_t wire[FRAME_MAX_WIRE(FRAME_MAX_PAYLOAD)];
+            serialSegment seg = { wire, frameEncode(FRAME_LOG, logSequence, rec, len, wire, sizeof(wire)) };
+            sent = serialTryOutputV(NULL, &seg, 1);
         } else {
-            for (int i=0; i<terminatorLen; i++) {
-                temp[buflen++] = terminator[i];
-            }
-            uartTransmit(huart, temp, buflen, 500);
-            memFree(temp);
+            const char *format;
+            memcpy(&format, rec, sizeof(format));
+            char text[MAXERRSTRING];
+            serialSegment seg = { (uint8_t *) text, tlogRender(format, &rec[TLOG_HEADER], len - TLOG_HEADER, text, sizeof(text)) };
+            sent = serialTryOutputV(NULL, &seg, 1);
+        }
+        if (!sent) {
+            return true;
         }
+        debugLogConsume();
+        logSequence++;
+
     }
-    mutexUnlock(&desc->txLock);
+
+    // A record that was reserved but not yet published wakes us when it is
+    return false;
+}
+
+// Output to the specified port with the Request Terminator (\r\n).  We send it as a
+// single frame because it eliminates an I2C poll iteration for the client, and so that
+// the terminator is never lost to a stall after the line has been queued.
+bool serialOutputLn(UART_HandleTypeDef *huart, uint8_t *buf, uint32_t buflen)
+{
+    serialSegment segs[2] = {
+        { buf, buflen },
+        { (uint8_t *) "\r\n", 2 },
+    };
+    return serialOutputV(huart, segs, 2);
 }
@@ -0,0 +1,27 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#include "serialwait.h"
+
+// The number of ms until the serial task next needs to run if nothing notifies it.
+// Output that didn't fit a transmit ring is sent when a completion makes room, so it
+// needs a timed retry only when nothing is queued or in flight to complete, such as
+// when the ring's lock was held by another task as we tried it.
+uint32_t serialWaitMs(const serialWaitInputs *in)
+{
+    uint32_t waitMs = SERIAL_WAIT_MAX_MS;
+    if (in->txServiceMs < waitMs) {
+        waitMs = in->txServiceMs;
+    }
+    if (in->baudMs < waitMs) {
+        waitMs = in->baudMs;
+    }
+    if (in->rxGuardMs > 0 && in->rxGuardMs < waitMs) {
+        waitMs = in->rxGuardMs;
+    }
+    if ((in->logBlocked || in->telemetryBlocked) && !in->txPending && SERIAL_WAIT_RETRY_MS < waitMs) {
+        waitMs = SERIAL_WAIT_RETRY_MS;
+    }
+    return waitMs;
+}
@@ -0,0 +1,32 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// How long the serial task may sleep after a pass, given what each of its services is
+// waiting for.  Apart from the waits gathered here it is woken only by notifications:
+// a received terminator, a half-full ring or an idle line (rxRingISR), a completed
+// transmit (serialTransmittedNotification), a log record that has become the oldest
+// (debugLogPost), and telemetry that is ready (serialWake).  Like duty.h, this is free
+// of any HAL or RTOS dependency, and Test/wakeup_test.c sleeps its simulated task for
+// exactly what this returns.
+
+// The longest that the task sleeps, and how soon it retries output that nothing will
+// wake it for
+#define SERIAL_WAIT_MAX_MS      3600000
+#define SERIAL_WAIT_RETRY_MS    10
+
+typedef struct {
+    uint32_t txServiceMs;       // Least returned by MX_UART_TxService, for a paced gap or stall check
+    uint32_t baudMs;            // Least returned by serviceBaud, for a switch or fallback
+    uint32_t rxGuardMs;         // How long bytes are still expected after an RX notification
+    bool txPending;             // A transmit is queued or in flight on some port
+    bool logBlocked;            // Log records are ready but didn't fit USB's transmit ring
+    bool telemetryBlocked;      // Telemetry is ready but didn't fit its port's transmit ring
+} serialWaitInputs;
+
+uint32_t serialWaitMs(const serialWaitInputs *in);
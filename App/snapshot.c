@@ -0,0 +1,176 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#include "app.h"
+#include "ulaw.h"
+
+// This module keeps a ring of the most recent decimated PCM blocks, companded to
+// 8-bit G.711 mu-law so that the per-block cost is a single pass over the samples
+// and memory is half that of raw PCM.  When a trigger fires (SPL threshold or an
+// explicit call) we continue recording for SNAPSHOT_POST_BLOCKS, then freeze the
+// ring until it has been exported, at which point we re-arm.
+//
+// The export format is a set of text lines on the debug port, so that it can be
+// captured from any terminal and decoded with nothing more than base64 and mu-law
+// (Test/snapdecode.c converts a captured log to a WAV file):
+//   snapshot:{"rate":<hz>,"samples":<n>,"pre":<n>,"time":<secs>.<us>,"spl":<db>,"enc":"ulaw"}
+//   snapshot:<base64 of up to SNAPSHOT_EXPORT_BYTES encoded samples>
+//   ...
+//   snapshot:end <crc32 of all encoded samples, in hex>
+// Samples are in chronological order, "pre" of them precede the trigger block,
+// and "time" is the RTC time of the first sample.
+
+// Ring state
+#define SNAPSHOT_ARMED          0
+#define SNAPSHOT_TRIGGERED      1
+#define SNAPSHOT_FROZEN         2
+STATIC volatile int snapshotState = SNAPSHOT_ARMED;
+STATIC uint8_t ring[SNAPSHOT_BLOCKS][AUDIO_PCM_SAMPLES];
+STATIC int64_t ringTimeUs[SNAPSHOT_BLOCKS];
+STATIC uint32_t blocksWritten = 0;
+STATIC uint32_t triggerBlock = 0;
+STATIC uint32_t postRemaining = 0;
+STATIC double triggerSpl = 0;
+STATIC volatile bool triggerRequested = false;
+STATIC volatile double thresholdSpl = SNAPSHOT_DEFAULT_THRESHOLD;
+STATIC uint32_t triggerCount = 0;
+
+// Add a block of PCM to the ring, checking whether it should trigger a snapshot.
+// Called on the audio task for every processed block.
+void snapshotAddBlock(int16_t *pcm, uint32_t samples, int64_t blockStartUs, double spl)
+{
+
+    // Nothing to do while frozen awaiting export
+    if (snapshotState == SNAPSHOT_FROZEN) {
+        return;
+    }
+
+    // Compand into the next slot
+    uint32_t slot = blocksWritten % SNAPSHOT_BLOCKS;
+    uint8_t *out = ring[slot];
+    if (samples > AUDIO_PCM_SAMPLES) {
+        samples = AUDIO_PCM_SAMPLES;
+    }
+    for (uint32_t i=0; i<samples; i++) {
+        out[i] = ulawEncode(pcm[i]);
+    }
+    ringTimeUs[slot] = blockStartUs;
+    blocksWritten++;
+
+    // See if we should trigger
+    if (snapshotState == SNAPSHOT_ARMED) {
+        bool trigger = triggerRequested;
+        if (thresholdSpl != 0 && spl >= thresholdSpl) {
+            trigger = true;
+        }
+        if (trigger) {
+            triggerRequested = false;
+            triggerBlock = blocksWritten - 1;
+            triggerSpl = spl;
+            postRemaining = SNAPSHOT_POST_BLOCKS;
+            triggerCount++;
+            snapshotState = SNAPSHOT_TRIGGERED;
+        }
+        return;
+    }
+
+    // Capture the post-trigger window, then freeze
+    if (postRemaining > 0) {
+        postRemaining--;
+    }
+    if (postRemaining == 0) {
+        snapshotState = SNAPSHOT_FROZEN;
+    }
+
+}
+
+// Discard pre-trigger audio when the pipeline restarts, because it isn't contiguous
+void snapshotRestart(void)
+{
+    if (snapshotState == SNAPSHOT_ARMED) {
+        blocksWritten = 0;
+    }
+}
+
+// Request a snapshot as soon as the next block is processed, such as from a detector
+void snapshotTrigger(void)
+{
+    triggerRequested = true;
+}
+
+// Set the SPL trigger threshold, or 0 to disable
+void snapshotSetThreshold(double spl)
+{
+    thresholdSpl = spl;
+}
+
+// Get the snapshot status
+void snapshotStatus(char **state, double *threshold, uint32_t *triggers)
+{
+    switch (snapshotState) {
+    case SNAPSHOT_ARMED:
+        *state = "armed";
+        break;
+    case SNAPSHOT_TRIGGERED:
+        *state = "triggered";
+        break;
+    default:
+        *state = "frozen";
+        break;
+    }
+    *threshold = thresholdSpl;
+    *triggers = triggerCount;
+}
+
+// Export a frozen snapshot to the debug port and re-arm.  Returns an error if there's
+// nothing frozen to export.
+err_t snapshotExport(void)
+{
+
+    if (snapshotState != SNAPSHOT_FROZEN) {
+        return errF("no snapshot has been captured");
+    }
+
+    // Determine the span of the ring that is valid, oldest first
+    uint32_t blocks = GMIN(blocksWritten, SNAPSHOT_BLOCKS);
+    uint32_t firstBlock = blocksWritten - blocks;
+    uint32_t preSamples = (triggerBlock - firstBlock) * AUDIO_PCM_SAMPLES;
+    int64_t firstUs = ringTimeUs[firstBlock % SNAPSHOT_BLOCKS];
+
+    // Compute the sample rate from the measured block period
+    double periodUs, driftPpm;
+    uint32_t resyncs;
+    blocktimeStats(&periodUs, &driftPpm, &resyncs);
+    uint32_t rateHz = (uint32_t) (((double) AUDIO_PCM_SAMPLES * 1000000.0) / periodUs);
+
+    // Header
+    debugR("snapshot:{\"rate\":%lu,\"samples\":%lu,\"pre\":%lu,\"time\":%lu.%06lu,\"spl\":%0.2f,\"enc\":\"ulaw\"}\n",
+           (unsigned long) rateHz, (unsigned long) (blocks * AUDIO_PCM_SAMPLES), (unsigned long) preSamples,
+           (unsigned long) (firstUs / us1Sec), (unsigned long) (firstUs % us1Sec), triggerSpl);
+
+    // Body, as a contiguous stream of samples broken into lines
+    uint8_t chunk[SNAPSHOT_EXPORT_BYTES];
+    char line[((SNAPSHOT_EXPORT_BYTES + 2) / 3 * 4) + 1];
+    uint32_t chunkLen = 0;
+    uint32_t crc = 0;
+    for (uint32_t b=0; b<blocks; b++) {
+        uint8_t *samples = ring[(firstBlock + b) % SNAPSHOT_BLOCKS];
+        for (uint32_t i=0; i<AUDIO_PCM_SAMPLES; i++) {
+            chunk[chunkLen++] = samples[i];
+            if (chunkLen == sizeof(chunk) || (b == blocks-1 && i == AUDIO_PCM_SAMPLES-1)) {
+                crc = (uint32_t) crc32Update(crc, chunk, chunkLen);
+                Base64encode(line, (const char *) chunk, chunkLen);
+                debugR("snapshot:%s\n", line);
+                chunkLen = 0;
+            }
+        }
+    }
+    debugR("snapshot:end %08lx\n", (unsigned long) crc);
+
+    // Re-arm
+    blocksWritten = 0;
+    snapshotState = SNAPSHOT_ARMED;
+    return errNone;
+
+}
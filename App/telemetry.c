@@ -0,0 +1,311 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#include "app.h"
+#include "usart.h"
+#include "json.h"
+#include "frame.h"
+#include <math.h>
+
+// This module pushes readings to subscribed ports so that hosts needn't poll.  Each
+// port may have one subscription, to either the SPL of the latest block or to
+// interval records (min/max/Leq) accumulated over the subscription's period.
+//
+// Three tasks are involved.  The request task posts subscription changes; the audio
+// task applies them and, as each block is processed, accumulates and hands off a
+// record when one is due; and the serial task formats the record and queues it
+// for transmission without blocking.  If a record is still waiting when the next
+// one comes due, because the link is slower than the stream, the two are coalesced:
+// an SPL record is replaced by the newer one, and an interval keeps accumulating.
+
+// A record handed from the audio task to the serial task, carrying the kind and
+// format that it was made for, because the audio task may change the subscription's
+// own while the serial task is formatting it
+typedef struct {
+    uint8_t kind;
+    uint8_t format;
+    int64_t timeUs;
+    double spl;
+    uint32_t blocks;
+    double min;
+    double max;
+    double leq;
+    uint32_t periodMs;
+    uint8_t sequence;
+} telemetryRecord;
+
+// Subscription state
+typedef struct {
+
+    // Posted by the request task and applied by the audio task, both under a critical section
+    volatile bool changed;
+    uint8_t newKind;
+    uint8_t newFormat;
+    uint32_t newPeriodMs;
+    uint32_t newSecs;
+
+    // Owned by the audio task
+    uint8_t kind;
+    uint8_t format;
+    uint32_t periodMs;
+    int64_t nextUs;
+    int64_t expiresMs;
+    uint32_t blocks;
+    double min;
+    double max;
+    double energy;
+    int64_t beganUs;
+
+    // Handed off to the serial task, where a record is waiting if posted != emitted
+    telemetryRecord record;
+    volatile uint32_t posted;
+    volatile uint32_t emitted;
+    uint8_t sequence;
+    uint32_t sent;
+    uint32_t coalesced;
+
+} telemetrySub;
+
+// One subscription per port
+#define TELEMETRY_PORTS     3
+STATIC telemetrySub subs[TELEMETRY_PORTS] = {0};
+
+// Forwards
+UART_HandleTypeDef *telemetryPort(int port);
+int telemetryPortIndex(UART_HandleTypeDef *huart);
+void telemetryEmit(int port, telemetrySub *sub);
+
+// Map between ports and subscriptions
+UART_HandleTypeDef *telemetryPort(int port)
+{
+    switch (port) {
+    case 0:
+        return &hlpuart1;
+#if ENABLE_USART1
+    case 1:
+        return &huart1;
+#endif
+    default:
+        return NULL;
+    }
+}
+int telemetryPortIndex(UART_HandleTypeDef *huart)
+{
+    if (huart == &hlpuart1) {
+        return 0;
+    }
+#if ENABLE_USART1
+    if (huart == &huart1) {
+        return 1;
+    }
+#endif
+    if (huart == NULL) {
+        return 2;
+    }
+    return -1;
+}
+
+// Subscribe a port to a stream, replacing any existing subscription.  A kind of
+// TELEMETRY_NONE unsubscribes, and secs of 0 means TELEMETRY_DEFAULT_SECS.
+err_t telemetrySubscribe(UART_HandleTypeDef *huart, uint8_t kind, uint8_t format, uint32_t periodMs, uint32_t secs)
+{
+    int port = telemetryPortIndex(huart);
+    if (port < 0) {
+        return errF("telemetry is not supported on this port");
+    }
+    if (kind > TELEMETRY_INTERVAL) {
+        return errF("unrecognized telemetry type");
+    }
+    if (kind != TELEMETRY_NONE && periodMs < TELEMETRY_MIN_PERIOD_MS) {
+        return errF("period is too short");
+    }
+
+    // Publish the change as a whole, so that the audio task never applies half of it
+    telemetrySub *sub = &subs[port];
+    taskENTER_CRITICAL();
+    sub->newKind = kind;
+    sub->newFormat = format;
+    sub->newPeriodMs = periodMs;
+    sub->newSecs = (secs == 0) ? TELEMETRY_DEFAULT_SECS : secs;
+    sub->changed = true;
+    taskEXIT_CRITICAL();
+    return errNone;
+}
+
+// Get a port's subscription stats
+void telemetryStats(UART_HandleTypeDef *huart, uint8_t *kind, uint32_t *periodMs, uint32_t *sent, uint32_t *coalesced)
+{
+    int port = telemetryPortIndex(huart);
+    if (port < 0) {
+        *kind = TELEMETRY_NONE;
+        *periodMs = *sent = *coalesced = 0;
+        return;
+    }
+    *kind = subs[port].kind;
+    *periodMs = subs[port].periodMs;
+    *sent = subs[port].sent;
+    *coalesced = subs[port].coalesced;
+}
+
+// Account for a processed block, handing off records that are due.  Called on the
+// audio task for every block.
+void telemetryBlock(double spl, int64_t blockStartUs)
+{
+    bool wake = false;
+
+    for (int port=0; port<TELEMETRY_PORTS; port++) {
+        telemetrySub *sub = &subs[port];
+
+        // Apply subscription changes
+        if (sub->changed) {
+            taskENTER_CRITICAL();
+            sub->changed = false;
+            sub->kind = sub->newKind;
+            sub->format = sub->newFormat;
+            sub->periodMs = sub->newPeriodMs;
+            uint32_t secs = sub->newSecs;
+            taskEXIT_CRITICAL();
+            sub->expiresMs = timerMs() + (int64_t) secs * ms1Sec;
+            sub->nextUs = blockStartUs + (int64_t) sub->periodMs * 1000;
+            sub->blocks = 0;
+            sub->emitted = sub->posted;
+            sub->sent = sub->coalesced = 0;
+            sub->sequence = 0;
+        }
+        if (sub->kind == TELEMETRY_NONE) {
+            continue;
+        }
+        if (timerMs() >= sub->expiresMs) {
+            sub->kind = TELEMETRY_NONE;
+            continue;
+        }
+
+        // Accumulate the interval
+        if (sub->blocks == 0) {
+            sub->beganUs = blockStartUs;
+            sub->min = sub->max = spl;
+            sub->energy = 0;
+        }
+        sub->min = GMIN(sub->min, spl);
+        sub->max = GMAX(sub->max, spl);
+        sub->energy += pow(10.0, spl / 10.0);
+        sub->blocks++;
+
+        // Exit if not yet due, resynchronizing if blocks were missed (such as when duty cycling)
+        if (blockStartUs < sub->nextUs) {
+            continue;
+        }
+        sub->nextUs += (int64_t) sub->periodMs * 1000;
+        if (sub->nextUs <= blockStartUs) {
+            sub->nextUs = blockStartUs + (int64_t) sub->periodMs * 1000;
+        }
+
+        // If the last record hasn't gone out, coalesce.  An interval simply keeps accumulating.
+        // Records are numbered as they come due, so the host can see what was coalesced.
+        sub->sequence++;
+        if (sub->posted != sub->emitted) {
+            sub->coalesced++;
+            if (sub->kind == TELEMETRY_INTERVAL) {
+                continue;
+            }
+        }
+
+        // Hand off the record
+        telemetryRecord record;
+        record.kind = sub->kind;
+        record.format = sub->format;
+        record.spl = spl;
+        record.timeUs = (sub->kind == TELEMETRY_INTERVAL) ? sub->beganUs : blockStartUs;
+        record.blocks = sub->blocks;
+        record.min = sub->min;
+        record.max = sub->max;
+        record.leq = 10.0 * log10(sub->energy / sub->blocks);
+        record.periodMs = (uint32_t) ((blockStartUs - sub->beganUs) / 1000);
+        record.sequence = sub->sequence;
+        taskENTER_CRITICAL();
+        sub->record = record;
+        sub->posted++;
+        taskEXIT_CRITICAL();
+        sub->blocks = 0;
+        wake = true;
+
+    }
+
+    // Have the serial task send what's ready
+    if (wake) {
+        serialWake();
+    }
+
+}
+
+// Send records that are ready, without blocking, returning true if any are left
+// because their port couldn't take them.  Called on the serial task.
+bool telemetryService(void)
+{
+    bool blocked = false;
+    for (int port=0; port<TELEMETRY_PORTS; port++) {
+        if (subs[port].posted != subs[port].emitted) {
+            telemetryEmit(port, &subs[port]);
+            blocked |= (subs[port].posted != subs[port].emitted);
+        }
+    }
+    return blocked;
+}
+
+// Format and queue a record, leaving it ready if the port can't take it now
+void telemetryEmit(int port, telemetrySub *sub)
+{
+
+    // Take a consistent copy
+    taskENTER_CRITICAL();
+    telemetryRecord record = sub->record;
+    uint32_t posted = sub->posted;
+    taskEXIT_CRITICAL();
+
+    // Format it
+    uint8_t buf[FRAME_MAX_WIRE(FRAME_MAX_PAYLOAD)];
+    serialSegment segs[2] = {
+        { buf, 0 },
+        { (uint8_t *) "\r\n", 2 },
+    };
+    uint32_t segCount = 1;
+    if (record.format == TELEMETRY_BINARY) {
+        uint8_t payload[FRAME_MAX_PAYLOAD];
+        uint32_t payloadLen;
+        uint8_t type;
+        if (record.kind == TELEMETRY_INTERVAL) {
+            frameInterval msg = { record.blocks, record.periodMs / ms1Sec, record.min, record.max, record.leq };
+            payloadLen = framePackInterval(&msg, payload);
+            type = FRAME_INTERVAL;
+        } else {
+            frameSpl msg = { record.timeUs, record.spl };
+            payloadLen = framePackSpl(&msg, payload);
+            type = FRAME_SPL;
+        }
+        segs[0].len = frameEncode(type, record.sequence, payload, payloadLen, buf, sizeof(buf));
+    } else {
+        jsonWriter w;
+        jsonWriterBegin(&w, (char *) buf, sizeof(buf));
+        if (record.kind == TELEMETRY_INTERVAL) {
+            jsonAddNumber(&w, "leq", record.leq, 2);
+            jsonAddNumber(&w, "min", record.min, 2);
+            jsonAddNumber(&w, "max", record.max, 2);
+            jsonAddInt(&w, "blocks", record.blocks);
+            jsonAddInt(&w, "ms", record.periodMs);
+        } else {
+            jsonAddNumber(&w, "spl", record.spl, 2);
+        }
+        jsonAddNumber(&w, "time", (double) record.timeUs / (double) us1Sec, 6);
+        jsonAddInt(&w, "seq", record.sequence);
+        segs[0].len = jsonWriterEnd(&w);
+        segCount = 2;
+    }
+
+    // Queue it, or leave it for the next attempt
+    if (serialTryOutputV(telemetryPort(port), segs, segCount)) {
+        sub->emitted = posted;
+        sub->sent++;
+    }
+
+}
@@ -0,0 +1,40 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#include "ulaw.h"
+
+#define ULAW_BIAS   0x84
+#define ULAW_CLIP   32635
+
+// Convert a 16-bit linear sample to G.711 mu-law
+uint8_t ulawEncode(int16_t sample)
+{
+    int32_t pcm = sample;
+    uint8_t sign = 0;
+    if (pcm < 0) {
+        pcm = -pcm;
+        sign = 0x80;
+    }
+    if (pcm > ULAW_CLIP) {
+        pcm = ULAW_CLIP;
+    }
+    pcm += ULAW_BIAS;
+    uint8_t exponent = 7;
+    for (int32_t mask = 0x4000; (pcm & mask) == 0 && exponent > 0; mask >>= 1) {
+        exponent--;
+    }
+    uint8_t mantissa = (pcm >> (exponent + 3)) & 0x0F;
+    return ~(sign | (exponent << 4) | mantissa);
+}
+
+// Convert a G.711 mu-law code back to a 16-bit linear sample, at the middle of the
+// range of samples that encode to it
+int16_t ulawDecode(uint8_t code)
+{
+    code = ~code;
+    uint8_t exponent = (code >> 4) & 0x07;
+    uint8_t mantissa = code & 0x0F;
+    int32_t pcm = ((((int32_t) mantissa << 3) + ULAW_BIAS) << exponent) - ULAW_BIAS;
+    return (int16_t) ((code & 0x80) ? -pcm : pcm);
+}
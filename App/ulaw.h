@@ -0,0 +1,14 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#pragma once
+
+#include <stdint.h>
+
+// G.711 mu-law companding of 16-bit PCM to 8 bits, as used by snapshot.c.  Like
+// duty.h, this is free of any HAL or RTOS dependency, so that Test/snapdecode.c can
+// decode exported snapshots on a host with the same tables that encoded them.
+
+uint8_t ulawEncode(int16_t sample);
+int16_t ulawDecode(uint8_t code);
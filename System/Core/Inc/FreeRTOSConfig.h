@@ -57,9 +57,10 @@ extern uint32_t SystemCoreClock;
 #define configTICK_RATE_HZ                       ((TickType_t)1000)
 #define configMAX_PRIORITIES                     ( 56 )
 #define configMINIMAL_STACK_SIZE                 ((uint16_t)128)
-#define configTOTAL_HEAP_SIZE                    ((size_t)3000)
+#define configTOTAL_HEAP_SIZE                    ((size_t)6656)     // See STATIC_ALLOCATION_PROFILE
 #define configMAX_TASK_NAME_LEN                  ( 16 )
 #define configUSE_TRACE_FACILITY                 1
+#define configNUM_THREAD_LOCAL_STORAGE_POINTERS  1
 #define configUSE_16_BIT_TICKS                   0
 #define configUSE_MUTEXES                        1
 #define configQUEUE_REGISTRY_SIZE                8
@@ -169,4 +170,18 @@ void appPostSleepProcessing(uint32_t ulExpectedIdleTime);
 #define configPOST_SLEEP_PROCESSING	appPostSleepProcessing
 #endif // configUSE_TICKLESS_IDLE == 1
 
+// Account for CPU use (tss.c) and record the event timeline (timeline.c) at context
+// switches, identifying tasks by the task number that configUSE_TRACE_FACILITY assigns
+#if defined(__ICCARM__) || defined(__CC_ARM) || defined(__GNUC__)
+void tssTaskSwitchedIn(uint32_t taskNumber);
+void tssTaskSwitchedOut(uint32_t taskNumber);
+#endif // defined(__ICCARM__) || defined(__CC_ARM) || defined(__GNUC__)
+#define traceTASK_SWITCHED_IN()     tssTaskSwitchedIn(pxCurrentTCB->uxTCBNumber)
+#define traceTASK_SWITCHED_OUT()    tssTaskSwitchedOut(pxCurrentTCB->uxTCBNumber)
+
+// Tasks and mutexes in static storage, heap_4 a fixed array (splash.ewp sets this for compiler and linker)
+#ifndef STATIC_ALLOCATION_PROFILE
+#define STATIC_ALLOCATION_PROFILE               0
+#endif
+
 #endif // FREERTOS_CONFIG_H
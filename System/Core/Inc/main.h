@@ -22,6 +22,7 @@
 #define PERIPHERAL_I2C3     0x00000100
 #define PERIPHERAL_SPI1     0x00000200
 #define PERIPHERAL_SPI2     0x00000400
+#define PERIPHERAL_SAI1     0x00000800
 
 // global
 size_t strlcpy(char *dst, const char *src, size_t siz);
@@ -69,6 +70,10 @@ void MX_DBG_Init(void);
 void MX_DBG_SetOutput(void (*fn)(uint8_t *buf, uint32_t buflen));
 void MX_DBG(const char *message, size_t length);
 bool MX_DBG_Enable(bool on);
+bool MX_DBG_Enabled(void);
+void MX_CYC_Init(void);
+#define MX_CYC_Count() (DWT->CYCCNT)
+#define MX_CYC_ToUs(cycles) ((double)(cycles) * 1000000.0 / (double)SystemCoreClock)
 
 // heap_4.c
 extern uint32_t heapPhysical;
@@ -8,6 +8,10 @@
 
 extern RTC_HandleTypeDef hrtc;
 
+// Backup registers, which survive resets.  DR0 notes that the RTC has been set.
+#define RTC_BACKUP_STACK_MAGIC      RTC_BKP_DR1         // Stack profile layout
+#define RTC_BACKUP_STACK_FIRST      RTC_BKP_DR2         // Worst-case stack bytes, one per task
+
 void MX_RTC_Init(void);
 void MX_RTC_DeInit(void);
 void MX_RTC_ResetWakeupTimer(void);
@@ -15,3 +19,5 @@ int64_t MX_RTC_GetMs(void);
 bool MX_RTC_GetErrors(uint32_t *retFailures, uint32_t *retResets);
 bool MX_RTC_GetDateTime(int *retYear, int *retMon1, int *retDay1, int *retHour0, int *retMin0, int *retSec0, int *retMs);
 bool MX_RTC_SetDateTime(int year, int mon1, int day1, int hour0, int min0, int sec0);
+uint32_t MX_RTC_GetBackup(uint32_t reg);
+void MX_RTC_SetBackup(uint32_t reg, uint32_t value);
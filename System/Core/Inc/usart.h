@@ -32,12 +32,26 @@ void MX_USART2_UART_DeInit(void);
 void MX_USART2_UART_Transmit(uint8_t *buf, uint32_t len, uint32_t timeoutMs);
 
 void MX_UART_RxStart(UART_HandleTypeDef *huart);
+bool MX_UART_SetBaudRate(UART_HandleTypeDef *huart, uint32_t baudRate);
+uint32_t MX_UART_BaudRate(UART_HandleTypeDef *huart);
 void MX_UART_RxConfigure(UART_HandleTypeDef *huart, uint8_t *rxbuf, uint16_t rxbuflen, void (*cb)(UART_HandleTypeDef *huart, bool error));
 bool MX_UART_RxAvailable(UART_HandleTypeDef *huart);
 uint8_t MX_UART_RxGet(UART_HandleTypeDef *huart);
-void MX_UART_Transmit(UART_HandleTypeDef *huart, uint8_t *buf, uint32_t len, uint32_t timeoutMs);
-bool MX_UART_TransmitFull(UART_HandleTypeDef *huart, uint8_t *buf, uint32_t len, uint32_t timeoutMs);
+uint32_t MX_UART_RxPeek(UART_HandleTypeDef *huart, uint8_t **retData);
+void MX_UART_RxConsume(UART_HandleTypeDef *huart, uint32_t len);
+void MX_UART_RxStats(UART_HandleTypeDef *huart, uint32_t *retErrors, uint32_t *retOverruns);
+void MX_UART_TxConfigure(UART_HandleTypeDef *huart, uint8_t *txbuf, uint16_t txbuflen, uint16_t chunklen, uint16_t gapMs, void (*cb)(UART_HandleTypeDef *huart));
+void MX_UART_TxPacing(UART_HandleTypeDef *huart, uint16_t chunklen, uint16_t gapMs);
+uint32_t MX_UART_TxEnqueue(UART_HandleTypeDef *huart, uint8_t *buf, uint32_t len, bool more);
+uint32_t MX_UART_TxQueued(UART_HandleTypeDef *huart);
+uint32_t MX_UART_TxSpace(UART_HandleTypeDef *huart);
+uint32_t MX_UART_TxCapacity(UART_HandleTypeDef *huart);
+bool MX_UART_TxCompleted(UART_HandleTypeDef *huart, uint32_t queued);
+bool MX_UART_TxPending(UART_HandleTypeDef *huart);
+uint32_t MX_UART_TxService(UART_HandleTypeDef *huart);
+void MX_UART_TxCpltFromISR(UART_HandleTypeDef *huart);
 
 // Receive complete for USB serial device
 void MX_USB_RxCplt(uint8_t* buf, uint32_t buflen);
+void MX_USB_TxCplt(uint32_t len);
 
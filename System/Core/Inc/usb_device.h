@@ -12,3 +12,6 @@ void MX_USB_DEVICE_Init(void);
 void MX_USB_DEVICE_DeInit(void);
 uint8_t CDC_Transmit_FS(uint8_t* Buf, uint16_t Len);
 uint8_t CDC_Transmit_Completed(void);
+uint16_t CDC_TxStage(uint8_t *buf, uint16_t len);
+bool CDC_TxKick(void);
+void CDC_TxAbort(void);
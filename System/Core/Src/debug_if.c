@@ -87,6 +87,21 @@ bool MX_DBG_Enable(bool on)
     return prevState;
 }
 
+// See if debug output is enabled
+bool MX_DBG_Enabled(void)
+{
+    return dbgEnabled;
+}
+
+// Enable the DWT cycle counter, which is a cheap free-running timestamp at SYSCLK
+// resolution.  It wraps every ~53s at 80Mhz, so callers must only use it for deltas.
+void MX_CYC_Init(void)
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
 // Init debugging
 void MX_DBG_Init(void)
 {
@@ -44,8 +44,8 @@ task.h is included from an application file. */
 #include "FreeRTOS.h"
 #include "task.h"
 
-// BLUES: malloc the heap
-#define MALLOC_HEAP             true
+// BLUES: malloc the heap, unless statically allocating
+#define MALLOC_HEAP             (STATIC_ALLOCATION_PROFILE == 0)
 
 #undef MPU_WRAPPERS_INCLUDED_FROM_API_FILE
 
@@ -342,6 +342,11 @@ static void prvHeapInit( void )
     heapFreeAtStartup = xTotalHeapSize;
     heapPhysical = 65536;
 
+#else
+
+    heapFreeAtStartup = xTotalHeapSize;
+    heapPhysical = 65536;
+
 #endif
 
     /* Ensure the heap starts on a correctly aligned boundary. */
@@ -73,6 +73,7 @@ int main(void)
     MX_GPIO_Init();
     MX_DMA_Init();
     MX_DBG_Init();
+    MX_CYC_Init();
 
     // Init scheduler
     osKernelInitialize();  // Call init function for freertos objects (in freertos.c)
@@ -200,6 +201,9 @@ void MX_ActivePeripherals(char *buf, uint32_t buflen)
     if ((peripherals & PERIPHERAL_SPI2) != 0) {
         strlcat(buf, "SPI2 ", buflen);
     }
+    if ((peripherals & PERIPHERAL_SAI1) != 0) {
+        strlcat(buf, "SAI1 ", buflen);
+    }
 
 }
 
@@ -166,6 +166,18 @@ void MX_RTC_ResetWakeupTimer()
 
 }
 
+// Read a backup register
+uint32_t MX_RTC_GetBackup(uint32_t reg)
+{
+    return HAL_RTCEx_BKUPRead(&hrtc, reg);
+}
+
+// Write a backup register, which will retain its value across resets
+void MX_RTC_SetBackup(uint32_t reg, uint32_t value)
+{
+    HAL_RTCEx_BKUPWrite(&hrtc, reg, value);
+}
+
 // Wakeup event
 void HAL_RTCEx_WakeUpTimerEventCallback(RTC_HandleTypeDef *hrtc)
 {
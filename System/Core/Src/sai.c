@@ -45,15 +45,21 @@ void MX_SAI1_Init(void)
     if (HAL_SAI_Init(&hsai_BlockA1) != HAL_OK) {
         Error_Handler();
     }
+    peripherals |= PERIPHERAL_SAI1;
 #else
     Error_Handler();
 #endif
 }
 
-// SAI1 De-initialization Function
+// SAI1 De-initialization Function, which also stops PLLSAI1 because it is
+// only used to clock the microphone and would otherwise keep drawing power.
 void MX_SAI1_DeInit(void)
 {
+    peripherals &= ~PERIPHERAL_SAI1;
     HAL_SAI_DeInit(&hsai_BlockA1);
+#ifdef CLOCK_OPTIMIZE_FOR_HIGH_SPEED
+    HAL_RCCEx_DisablePLLSAI1();
+#endif
 }
 
 void HAL_SAI_MspInit(SAI_HandleTypeDef* hsai)
@@ -4,6 +4,7 @@
 
 #include "main.h"
 #include "usart.h"
+#include "global.h"
 #include "stm32l4xx_it.h"
 
 extern LPTIM_HandleTypeDef hlptim1;
@@ -89,13 +90,17 @@ void TIM2_IRQHandler(void)
 // RTC alarm
 void RTC_Alarm_IRQHandler(void)
 {
+    tssIsrEnter(TSS_ISR_RTC);
     HAL_RTC_AlarmIRQHandler(&hrtc);
+    tssIsrExit(TSS_ISR_RTC);
 }
 
 // RTC wakeup
 void RTC_WKUP_IRQHandler(void)
 {
+    tssIsrEnter(TSS_ISR_RTC);
     HAL_RTCEx_WakeUpTimerIRQHandler(&hrtc);
+    tssIsrExit(TSS_ISR_RTC);
 }
 
 // This function handles LPTIM1 global interrupt.
@@ -123,7 +128,9 @@ void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim)
 // USB interrupt
 void USB_IRQHandler(void)
 {
+    tssIsrEnter(TSS_ISR_USB);
     HAL_PCD_IRQHandler(&hpcd_USB_FS);
+    tssIsrExit(TSS_ISR_USB);
 }
 
 // This function handles CAN1 TX interrupt.
@@ -177,22 +184,28 @@ void I2C3_ER_IRQHandler(void)
 // This function handles LPUART1 global interrupt.
 void LPUART1_IRQHandler(void)
 {
+    tssIsrEnter(TSS_ISR_LPUART1);
     HAL_UART_IRQHandler(&hlpuart1);
     MX_UART_IDLE_IRQHandler(&hlpuart1);
+    tssIsrExit(TSS_ISR_LPUART1);
 }
 
 // This function handles USART1 global interrupt.
 void USART1_IRQHandler(void)
 {
+    tssIsrEnter(TSS_ISR_USART1);
     HAL_UART_IRQHandler(&huart1);
     MX_UART_IDLE_IRQHandler(&huart1);
+    tssIsrExit(TSS_ISR_USART1);
 }
 
 // This function handles USART2 global interrupt.
 void USART2_IRQHandler(void)
 {
+    tssIsrEnter(TSS_ISR_USART2);
     HAL_UART_IRQHandler(&huart2);
     MX_UART_IDLE_IRQHandler(&huart2);
+    tssIsrExit(TSS_ISR_USART2);
 }
 
 // This function handles SPI1 global interrupt.
@@ -234,25 +247,33 @@ void USART2_TX_DMA_IRQHandler(void)
 // This function handles USART1 global interrupt.
 void USART1_TX_DMA_IRQHandler(void)
 {
+    tssIsrEnter(TSS_ISR_USART1_DMA);
     HAL_DMA_IRQHandler(&hdma_usart1_tx);
+    tssIsrExit(TSS_ISR_USART1_DMA);
 }
 
 // This function handles USART1 global interrupt.
 void USART1_RX_DMA_IRQHandler(void)
 {
+    tssIsrEnter(TSS_ISR_USART1_DMA);
     HAL_DMA_IRQHandler(&hdma_usart1_rx);
+    tssIsrExit(TSS_ISR_USART1_DMA);
 }
 
 // This function handles the SAI global interrupt.
 void SAI1_DMA_IRQHandler(void)
 {
+    tssIsrEnter(TSS_ISR_SAI_DMA);
     HAL_DMA_IRQHandler(&hdma_sai1_a);
+    tssIsrExit(TSS_ISR_SAI_DMA);
 }
 
 // SAI1 global interrupt handler
 void SAI1_IRQHandler(void)
 {
+    tssIsrEnter(TSS_ISR_SAI);
     HAL_SAI_IRQHandler(&hsai_BlockA1);
+    tssIsrExit(TSS_ISR_SAI);
 }
 
 void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
@@ -11,7 +11,6 @@
 #include "usb_device.h"
 #include "global.h"
 #include "dma.h"
-#include <stdatomic.h>
 
 UART_HandleTypeDef hlpuart1;
 bool lpuart1UsingAlternatePins = false;
@@ -28,7 +27,10 @@ DMA_HandleTypeDef hdma_usart2_tx;
 bool usart2UsingRS485 = false;
 uint32_t usart2BaudRate = 0;
 
-// LPUART variable speed handling
+// LPUART variable speed handling.  The LSE can only clock LPUART1 at up to 9600 baud,
+// so at higher rates we remain on the HSI even while in STOP2, relying upon the LPUART
+// to request the HSI on the start bit when it wakes us.
+#define LPUART1_LSE_MAX_BAUD 9600
 #if defined(LPUART1_DISABLE_HIGH_BUSY_SAMPLING_RATE)
 uint32_t lpuart1PeriphClockSelection = RCC_LPUART1CLKSOURCE_LSE;
 #else
@@ -36,33 +38,79 @@ uint32_t lpuart1PeriphClockSelection = RCC_LPUART1CLKSOURCE_HSI;
 #endif
 
 // For UART receive
-// UART receive I/O descriptor.  Note that if we ever fill the buffer
-// completely we will get an I/O error because we can't start a receive
-// without overwriting the data waiting to be pulled out.  There must
-// always be at least one byte available to start a receive.
+// UART receive I/O descriptor.  The ring is written directly by the hardware: on
+// DMA ports the RX DMA channel runs circularly over it, and so the fill position is
+// derived from the channel's NDTR rather than being stored, while on LPUART1 (which
+// has no DMA channel to spare) and USB the interrupt handler appends to it.  Either
+// way, nothing needs to be copied or re-armed as data arrives.
+//
+// Only the owning task moves drain.  When an interrupt must discard what has been
+// received, such as after a receive error, it instead requests a reset by bumping
+// resets, and the task applies it the next time it peeks, because it may be part way
+// between a peek and a consume.  On DMA ports the wrap interrupt counts laps of the
+// ring, so that by comparing the bytes written against those consumed the task can
+// tell when the DMA has overwritten data that it hadn't yet read.
 typedef struct {
-    uint8_t *iobuf;
-    uint16_t iobuflen;
     uint8_t *buf;
     uint16_t buflen;
-    uint16_t fill;
-    uint16_t drain;
-    uint16_t rxlen;
+    volatile uint16_t fill;
+    volatile uint16_t drain;
+    bool dmaRing;
     void (*notifyReceivedFn)(UART_HandleTypeDef *huart, bool error);
+    volatile uint32_t resets;           // Written only by interrupts
+    volatile uint16_t resetDrain;
+    volatile uint32_t laps;
+    volatile uint32_t errors;
+    uint32_t resetsApplied;             // Written only by the owning task
+    uint32_t consumed;
+    uint32_t overruns;
 } UARTIO;
 UARTIO rxioLPUART1 = {0};
 UARTIO rxioUSART1 = {0};
 UARTIO rxioUSART2 = {0};
 UARTIO rxioUSB = {0};
 
-// Number of bytes for UART receives, and a temporary RXBUF for double-buffering
-#define UART_IOBUF_LEN 512
-atomic_int rxtempInUse = 0;
-uint8_t rxtemp[UART_IOBUF_LEN];
+// UART transmit queue.  Callers copy data into the ring and return immediately, and
+// the ring is drained in chunks of up to chunklen bytes, each started from the
+// completion interrupt of the previous one.  If the port is paced with a gap between
+// chunks, the next chunk is instead started by MX_UART_TxService() once the gap has
+// elapsed.  The enqueued and completed counters are running byte counts, so that a
+// caller can wait for a specific enqueue to have been transmitted.  USB differs only
+// in that the ring is drained into the CDC engine's staging buffer (usbd_cdc_if.c),
+// which chains its own transfers.
+typedef struct {
+    uint8_t *buf;
+    uint16_t buflen;
+    volatile uint16_t fill;
+    volatile uint16_t drain;
+    volatile uint16_t inflight;
+    uint16_t chunklen;
+    uint16_t gapMs;
+    volatile uint32_t enqueued;
+    volatile uint32_t completed;
+    volatile uint32_t startedMs;
+    volatile uint32_t completedMs;
+    void (*notifyTransmittedFn)(UART_HandleTypeDef *huart);
+} UARTTX;
+UARTTX txioLPUART1 = {0};
+UARTTX txioUSART1 = {0};
+UARTTX txioUSART2 = {0};
+UARTTX txioUSB = {0};
+
+// If a chunk hasn't completed in this long, the peer (generally a USB host that has
+// stopped reading) isn't listening, and we discard what's queued.
+#define UART_TX_STALL_MS 500
 
 // Forwards
 bool uioReceivedBytes(UARTIO *uio, uint8_t *buf, uint32_t buflen);
-void receiveComplete(UART_HandleTypeDef *huart, UARTIO *uio, uint8_t *buf, uint32_t buflen);
+UARTIO *rxPort(UART_HandleTypeDef *huart);
+void rxRingISR(UART_HandleTypeDef *huart);
+void rxReset(UARTIO *uio, uint16_t drain);
+uint16_t rxDrain(UARTIO *uio);
+void rxSync(UART_HandleTypeDef *huart, UARTIO *uio);
+uint16_t rxFill(UART_HandleTypeDef *huart, UARTIO *uio);
+void txUSBStage(UARTTX *tio);
+bool txUSBStart(UARTTX *tio);
 
 // See if a port is DMA
 bool MX_UART_IsDMA(UART_HandleTypeDef *huart)
@@ -84,72 +132,60 @@ bool MX_UART_IsDMA(UART_HandleTypeDef *huart)
     return false;
 }
 
-// Transmit to a port synchronously, broken up into 64 byte chunks because we have
-// seen repeatedly that hosts are not generally designed to handle large transfers.
-// We've chosen 64 bytes simply due to the fact that USB frame size is 64.
-void MX_UART_Transmit(UART_HandleTypeDef *huart, uint8_t *buf, uint32_t len, uint32_t timeoutMs)
+// Get tx port
+UARTTX *txPort(UART_HandleTypeDef *huart)
 {
-    uint32_t chunksize = 64;
-    while (len) {
-
-        // Break it into chunks
-        uint32_t chunklen = len;
-        if (chunklen > chunksize) {
-            chunklen = chunksize;
-        }
-
-        // Wait up to 100mS for transmission of a single chunk to succeed
-        uint32_t singleChunkTimeoutMs = 100;
-        for (int i=0;; i++) {
-            if (i >= singleChunkTimeoutMs) {
-                return;
-            }
-            if (MX_UART_TransmitFull(huart, buf, chunklen, timeoutMs)) {
-                break;
-            }
-            HAL_Delay(1);
-        }
-
-        // Delay a bit between chunks
-        uint32_t delayBetweenChunksMs = 10;
-        HAL_Delay(delayBetweenChunksMs);
-        buf += chunklen;
-        len -= chunklen;
-
+    if (huart == NULL) {
+        return &txioUSB;
+    }
+    if (huart == &hlpuart1) {
+        return &txioLPUART1;
     }
+    if (huart == &huart1) {
+        return &txioUSART1;
+    }
+    if (huart == &huart2) {
+        return &txioUSART2;
+    }
+    return NULL;
 }
 
-
-// Transmit a 64-byte chunk to a port, returning false if busy or failure, else true if success
-bool MX_UART_TransmitFull(UART_HandleTypeDef *huart, uint8_t *buf, uint32_t len, uint32_t timeoutMs)
+// Start transmitting the next chunk from the queue, if idle.  This must be called
+// either at interrupt level or with interrupts disabled.
+bool txStart(UART_HandleTypeDef *huart, UARTTX *tio)
 {
 
-    // USB is a special case but the same logic
+    // USB has its own transmit engine
     if (huart == NULL) {
-        if (CDC_Transmit_Completed() == USBD_BUSY) {
-            return false;
-        }
-        bool success = (CDC_Transmit_FS(buf, len) == USBD_OK);
-        for (uint32_t i=0; success; i++) {
-            if (CDC_Transmit_Completed() != USBD_BUSY) {
-                break;
-            }
-            if (i >= timeoutMs) {
-                return false;
-            }
-            HAL_Delay(1);
-        }
-        return success;
+        return txUSBStart(tio);
     }
 
-    // Exit if busy
-    if ((HAL_UART_GetState(huart) & HAL_UART_STATE_BUSY_TX) == HAL_UART_STATE_BUSY_TX) {
+    // Exit if busy or if there's nothing to do
+    uint16_t fill = tio->fill;
+    uint16_t drain = tio->drain;
+    if (tio->inflight != 0 || fill == drain) {
         return false;
     }
 
+    // Send the next contiguous span of the ring, up to a chunk
+    uint32_t len = (fill > drain) ? (fill - drain) : (tio->buflen - drain);
+    if (tio->chunklen != 0 && len > tio->chunklen) {
+        len = tio->chunklen;
+    }
+    uint8_t *buf = &tio->buf[drain];
+    tio->inflight = len;
+    tio->startedMs = HAL_GetTick();
+
     // Transmit
     bool success = false;
     if (huart == &hlpuart1) {
+#if !defined(LPUART1_DISABLE_HIGH_BUSY_SAMPLING_RATE)
+        if (lpuart1PeriphClockSelection != RCC_LPUART1CLKSOURCE_HSI) {
+            lpuart1PeriphClockSelection = RCC_LPUART1CLKSOURCE_HSI;
+            __HAL_RCC_LPUART1_CONFIG(lpuart1PeriphClockSelection);
+            hlpuart1.Instance->BRR = UART_DIV_LPUART(HSI_VALUE, hlpuart1.Init.BaudRate);
+        }
+#endif
         success = (HAL_UART_Transmit_IT(huart, buf, len) == HAL_OK);
     } else if (huart == &huart1) {
 #if USART1_USE_DMA
@@ -165,64 +201,408 @@ bool MX_UART_TransmitFull(UART_HandleTypeDef *huart, uint8_t *buf, uint32_t len,
 #endif
     }
 
-    // Wait, so that the caller won't mess with the buffer while the HAL is using it
-    for (uint32_t i=0; success; i++) {
-        if ((HAL_UART_GetState(huart) & HAL_UART_STATE_BUSY_TX) != HAL_UART_STATE_BUSY_TX) {
+    // If we couldn't start it, MX_UART_TxService will retry
+    if (!success) {
+        tio->inflight = 0;
+    }
+    return success;
+
+}
+
+// Move as much of the ring as the CDC engine will take into its staging buffer,
+// which frees the ring for more output while the previous transfer is in flight.
+// For USB, inflight is the number of bytes handed to the engine and not yet sent.
+void txUSBStage(UARTTX *tio)
+{
+    while (tio->fill != tio->drain) {
+        uint16_t fill = tio->fill;
+        uint16_t drain = tio->drain;
+        uint32_t len = (fill > drain) ? (fill - drain) : (tio->buflen - drain);
+        if (tio->chunklen != 0 && len > tio->chunklen) {
+            len = tio->chunklen;
+        }
+        uint32_t staged = CDC_TxStage(&tio->buf[drain], len);
+        if (staged == 0) {
             break;
         }
-        if (i >= timeoutMs) {
-            return false;
+        drain += staged;
+        if (drain >= tio->buflen) {
+            drain -= tio->buflen;
+        }
+        tio->drain = drain;
+        tio->inflight += staged;
+        if (tio->chunklen != 0) {
+            break;
         }
-        HAL_Delay(1);
     }
+}
 
-    // Success
-    return success;
+// Stage the ring into both halves of the CDC engine, starting a transfer if the
+// endpoint is idle.  Returns true if a transfer is in flight.  This must be called
+// either at interrupt level or with interrupts disabled.
+bool txUSBStart(UARTTX *tio)
+{
+    if (tio->inflight == 0) {
+        tio->startedMs = HAL_GetTick();
+    }
+    txUSBStage(tio);
+    bool busy = CDC_TxKick();
+    if (busy) {
+        txUSBStage(tio);
+    }
+    return busy;
+}
+
+// Configure the transmit queue for a port
+void MX_UART_TxConfigure(UART_HandleTypeDef *huart, uint8_t *txbuf, uint16_t txbuflen, uint16_t chunklen, uint16_t gapMs, void (*cb)(UART_HandleTypeDef *huart))
+{
+    UARTTX *tio = txPort(huart);
+    if (tio == NULL) {
+        return;
+    }
+    tio->buf = txbuf;
+    tio->buflen = txbuflen;
+    tio->fill = tio->drain = tio->inflight = 0;
+    tio->enqueued = tio->completed = 0;
+    tio->startedMs = tio->completedMs = 0;
+    tio->chunklen = chunklen;
+    tio->gapMs = gapMs;
+    tio->notifyTransmittedFn = cb;
+}
+
+// Change the pacing of a port, where a chunklen of 0 means "as large as possible"
+void MX_UART_TxPacing(UART_HandleTypeDef *huart, uint16_t chunklen, uint16_t gapMs)
+{
+    UARTTX *tio = txPort(huart);
+    if (tio == NULL) {
+        return;
+    }
+    tio->chunklen = chunklen;
+    tio->gapMs = gapMs;
+}
+
+// Queue data for transmission without waiting, returning the number of bytes that fit.
+// If more is true, the caller is about to enqueue the rest of a logical frame and so we
+// don't kick the transmitter.  Only a single task may enqueue to a port at a time.
+uint32_t MX_UART_TxEnqueue(UART_HandleTypeDef *huart, uint8_t *buf, uint32_t len, bool more)
+{
+
+    UARTTX *tio = txPort(huart);
+    if (tio == NULL || tio->buf == NULL) {
+        return 0;
+    }
+
+    // Copy as much as fits, leaving a byte free so that full and empty are distinct
+    uint16_t fill = tio->fill;
+    uint16_t drain = tio->drain;
+    uint32_t used = (fill >= drain) ? (fill - drain) : (tio->buflen - drain + fill);
+    uint32_t space = tio->buflen - 1 - used;
+    if (len > space) {
+        len = space;
+    }
+    uint32_t first = tio->buflen - fill;
+    if (first > len) {
+        first = len;
+    }
+    memcpy(&tio->buf[fill], buf, first);
+    memcpy(tio->buf, &buf[first], len - first);
+    fill += len;
+    if (fill >= tio->buflen) {
+        fill -= tio->buflen;
+    }
+
+    // Publish it and kick the transmitter if it's idle and not being paced
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    tio->fill = fill;
+    tio->enqueued += len;
+    if (!more && (tio->gapMs == 0 || (uint32_t) (HAL_GetTick() - tio->completedMs) >= tio->gapMs)) {
+        txStart(huart, tio);
+    }
+    __set_PRIMASK(primask);
+    return len;
+
+}
+
+// Get the number of bytes that can be enqueued without waiting
+uint32_t MX_UART_TxSpace(UART_HandleTypeDef *huart)
+{
+    UARTTX *tio = txPort(huart);
+    if (tio == NULL || tio->buf == NULL) {
+        return 0;
+    }
+    uint16_t fill = tio->fill;
+    uint16_t drain = tio->drain;
+    uint32_t used = (fill >= drain) ? (fill - drain) : (tio->buflen - drain + fill);
+    return tio->buflen - 1 - used;
+}
+
+// Get the most that can ever be enqueued at once, which is when the queue is empty
+uint32_t MX_UART_TxCapacity(UART_HandleTypeDef *huart)
+{
+    UARTTX *tio = txPort(huart);
+    if (tio == NULL || tio->buf == NULL) {
+        return 0;
+    }
+    return tio->buflen - 1;
+}
+
+// Get the running count of bytes enqueued, for use with MX_UART_TxCompleted
+uint32_t MX_UART_TxQueued(UART_HandleTypeDef *huart)
+{
+    UARTTX *tio = txPort(huart);
+    if (tio == NULL) {
+        return 0;
+    }
+    return tio->enqueued;
+}
+
+// See if everything up to the specified running count of enqueued bytes has been sent
+bool MX_UART_TxCompleted(UART_HandleTypeDef *huart, uint32_t queued)
+{
+    UARTTX *tio = txPort(huart);
+    if (tio == NULL) {
+        return true;
+    }
+    return ((int32_t) (tio->completed - queued) >= 0);
+}
+
+// See if there's anything queued or being transmitted
+bool MX_UART_TxPending(UART_HandleTypeDef *huart)
+{
+    UARTTX *tio = txPort(huart);
+    if (tio == NULL) {
+        return false;
+    }
+    return (tio->fill != tio->drain || tio->inflight != 0);
+}
+
+// Start paced chunks and recover stalled ports, returning how long until we next need service
+uint32_t MX_UART_TxService(UART_HandleTypeDef *huart)
+{
+
+    UARTTX *tio = txPort(huart);
+    if (tio == NULL || tio->buf == NULL) {
+        return 0xffffffff;
+    }
+
+    uint32_t waitMs = 0xffffffff;
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    uint32_t now = HAL_GetTick();
+
+    // If a chunk is in flight, see if it has stalled and if so discard everything queued.
+    // USB data may be staged but not yet submitted if the host wasn't ready, so retry it.
+    if (tio->inflight != 0) {
+        if (huart == NULL) {
+            txUSBStart(tio);
+        }
+        uint32_t elapsedMs = now - tio->startedMs;
+        if (elapsedMs < UART_TX_STALL_MS) {
+            waitMs = UART_TX_STALL_MS - elapsedMs;
+        } else {
+            if (huart != NULL) {
+                HAL_UART_AbortTransmit(huart);
+            } else {
+                CDC_TxAbort();
+            }
+            tio->inflight = 0;
+            tio->drain = tio->fill;
+            tio->completed = tio->enqueued;
+            tio->completedMs = now;
+        }
+    }
+
+    // If idle with something to send, start it once the gap has elapsed
+    if (tio->inflight == 0 && tio->fill != tio->drain) {
+        uint32_t elapsedMs = now - tio->completedMs;
+        if (elapsedMs < tio->gapMs) {
+            waitMs = tio->gapMs - elapsedMs;
+        } else if (txStart(huart, tio)) {
+            waitMs = (tio->gapMs != 0) ? tio->gapMs : UART_TX_STALL_MS;
+        } else {
+            waitMs = 1;
+        }
+    }
+
+    __set_PRIMASK(primask);
+    return waitMs;
+
+}
+
+// Transmit completion, called at interrupt level for UARTs
+void MX_UART_TxCpltFromISR(UART_HandleTypeDef *huart)
+{
+
+    UARTTX *tio = txPort(huart);
+    if (tio == NULL || tio->inflight == 0) {
+        return;
+    }
+
+    // Retire the chunk
+    uint32_t drain = tio->drain + tio->inflight;
+    if (drain >= tio->buflen) {
+        drain -= tio->buflen;
+    }
+    tio->drain = drain;
+    tio->completed += tio->inflight;
+    tio->inflight = 0;
+    tio->completedMs = HAL_GetTick();
+
+    // Chain the next chunk unless paced, notifying the task if it has work to do
+    if (tio->gapMs != 0 || !txStart(huart, tio)) {
+        if (tio->notifyTransmittedFn != NULL) {
+            tio->notifyTransmittedFn(huart);
+        }
+    }
+
+}
+
+// Transmit complete for USB serial device, called at interrupt level by the CDC
+// engine after it has chained its next transfer, with the number of bytes sent
+void MX_USB_TxCplt(uint32_t len)
+{
+    UARTTX *tio = &txioUSB;
+    if (len > tio->inflight) {
+        len = tio->inflight;
+    }
+    tio->completed += len;
+    tio->inflight -= len;
+    tio->startedMs = tio->completedMs = HAL_GetTick();
+
+    // Refill the engine unless paced, notifying the task once it runs dry
+    if (tio->gapMs != 0 || !txUSBStart(tio)) {
+        if (tio->notifyTransmittedFn != NULL) {
+            tio->notifyTransmittedFn(NULL);
+        }
+    }
 
 }
 
 // Transmit complete callback for serial ports
 void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
 {
+    MX_UART_TxCpltFromISR(huart);
 }
 
 // We must restart the receive if there is a receive or transmit error
 void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart)
 {
-    HAL_UART_RxCpltCallback(huart);
+
+    UARTIO *uio = rxPort(huart);
+    if (uio == NULL) {
+        return;
+    }
+
+    // Discard what we have, and restart the receive.  Note that we only abort the
+    // receive so that a transmit in progress isn't affected, and that on DMA ports
+    // restarting the receive is what discards it.
+    HAL_UART_AbortReceive(huart);
+    uio->errors++;
+    if (!uio->dmaRing) {
+        rxReset(uio, uio->fill);
+    }
+    if (uio->notifyReceivedFn != NULL) {
+        uio->notifyReceivedFn(huart, true);
+    }
+    MX_UART_RxStart(huart);
+
 }
 
 // Get rx port
-UARTIO *rxPort(UART_HandleTypeDef *huart, uint16_t *rxBytes)
+UARTIO *rxPort(UART_HandleTypeDef *huart)
 {
-    UARTIO *uio = NULL;
-    uint16_t receivedBytes = 0;
     if (huart == NULL) {
-        uio = &rxioUSB;
-        receivedBytes = 0;
+        return &rxioUSB;
     }
     if (huart == &hlpuart1) {
-        uio = &rxioLPUART1;
-        receivedBytes = uio->iobuflen - huart->RxXferCount;
+        return &rxioLPUART1;
     }
     if (huart == &huart1) {
-        uio = &rxioUSART1;
-#if USART1_USE_DMA
-        receivedBytes = uio->iobuflen - __HAL_DMA_GET_COUNTER(huart->hdmarx);
-#else
-        receivedBytes = uio->iobuflen - huart->RxXferCount;
-#endif
+        return &rxioUSART1;
     }
     if (huart == &huart2) {
-        uio = &rxioUSART2;
-#if USART2_USE_DMA
-        receivedBytes = uio->iobuflen - __HAL_DMA_GET_COUNTER(huart->hdmarx);
-#else
-        receivedBytes = uio->iobuflen - huart->RxXferCount;
-#endif
+        return &rxioUSART2;
+    }
+    return NULL;
+}
+
+// Request that the owning task discard everything received before the specified
+// position, from any context
+void rxReset(UARTIO *uio, uint16_t drain)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    uio->laps = 0;
+    uio->resetDrain = drain;
+    uio->resets++;
+    __set_PRIMASK(primask);
+}
+
+// Get the drain position of the receive ring as it will be once any pending reset has
+// been applied, which is where new data must not overrun
+uint16_t rxDrain(UARTIO *uio)
+{
+    return (uio->resets != uio->resetsApplied) ? uio->resetDrain : uio->drain;
+}
+
+// Apply any reset requested by an interrupt and, if the DMA has lapped us, discard
+// everything unread because it has been overwritten.  Called only by the owning task.
+void rxSync(UART_HandleTypeDef *huart, UARTIO *uio)
+{
+
+    // Take a consistent snapshot of the reset request
+    uint32_t resets;
+    uint16_t resetDrain;
+    do {
+        resets = uio->resets;
+        resetDrain = uio->resetDrain;
+    } while (resets != uio->resets);
+    if (resets != uio->resetsApplied) {
+        uio->drain = resetDrain;
+        uio->consumed = resetDrain;
+        uio->resetsApplied = resets;
+    }
+
+    // Compare the running count of bytes the DMA has written with those consumed
+    if (!uio->dmaRing) {
+        return;
+    }
+    uint32_t laps;
+    uint16_t fill;
+    do {
+        laps = uio->laps;
+        fill = rxFill(huart, uio);
+    } while (laps != uio->laps);
+    uint32_t written = laps * uio->buflen + fill;
+    if ((int32_t) (written - uio->consumed) >= (int32_t) uio->buflen) {
+        uio->overruns++;
+        uio->drain = fill;
+        uio->consumed = written;
+    }
+
+}
+
+// Get the fill position of the receive ring, which on DMA ports is where the DMA
+// channel will write next.
+uint16_t rxFill(UART_HandleTypeDef *huart, UARTIO *uio)
+{
+    if (!uio->dmaRing) {
+        return uio->fill;
+    }
+    uint16_t fill = uio->buflen - __HAL_DMA_GET_COUNTER(huart->hdmarx);
+    if (fill >= uio->buflen) {
+        fill = 0;
+    }
+    return fill;
+}
+
+// Notify the owner of a port that there's received data waiting
+void rxNotify(UART_HandleTypeDef *huart, UARTIO *uio)
+{
+    if (uio->notifyReceivedFn != NULL && rxFill(huart, uio) != rxDrain(uio)) {
+        uio->notifyReceivedFn(huart, false);
     }
-    *rxBytes = receivedBytes;
-    return uio;
 }
 
 // UART IRQ handler, used exclusively for IDLE processing
@@ -233,22 +613,50 @@ void MX_UART_IDLE_IRQHandler(UART_HandleTypeDef *huart)
         // Clear the idle flag.
         __HAL_UART_CLEAR_IDLEFLAG(huart);
 
-        // Get the receive port and received bytes
-        uint16_t receivedBytes;
-        UARTIO *uio = rxPort(huart, &receivedBytes);
+        // Get the receive port
+        UARTIO *uio = rxPort(huart);
         if (uio == NULL) {
             return;
         }
 
-        // Only process things that won't naturally go to a RxCpltCallback
-        if (receivedBytes != 0 && receivedBytes != uio->iobuflen) {
-            HAL_UART_RxCpltCallback(huart);
+        // If we've gone into low speed mode, crank it back up now that the line is idle
+#if !defined(LPUART1_DISABLE_HIGH_BUSY_SAMPLING_RATE)
+        if (huart == &hlpuart1 && lpuart1PeriphClockSelection != RCC_LPUART1CLKSOURCE_HSI) {
+            lpuart1PeriphClockSelection = RCC_LPUART1CLKSOURCE_HSI;
+            __HAL_RCC_LPUART1_CONFIG(lpuart1PeriphClockSelection);
+            hlpuart1.Instance->BRR = UART_DIV_LPUART(HSI_VALUE, hlpuart1.Init.BaudRate);
         }
+#endif
+
+        // The sender has paused, so hand off whatever has arrived
+        rxNotify(huart, uio);
 
     }
 }
 
-// Start a receive
+// Receive interrupt for ports without DMA, which appends directly to the ring.  We
+// only wake the task for a line terminator, when the ring is half full, or (via IDLE)
+// when the sender pauses, rather than for every byte.
+void rxRingISR(UART_HandleTypeDef *huart)
+{
+    uint8_t databyte = (uint8_t) (huart->Instance->RDR & 0xff);
+    UARTIO *uio = rxPort(huart);
+    bool success = uioReceivedBytes(uio, &databyte, 1);
+    if (uio->notifyReceivedFn == NULL) {
+        return;
+    }
+    if (!success) {
+        uio->notifyReceivedFn(huart, true);
+        return;
+    }
+    uint16_t drain = rxDrain(uio);
+    uint16_t used = (uio->fill >= drain) ? (uio->fill - drain) : (uio->buflen - drain + uio->fill);
+    if (databyte == '\r' || databyte == '\n' || used == uio->buflen/2) {
+        uio->notifyReceivedFn(huart, false);
+    }
+}
+
+// Start a receive, which runs until stopped or until an error
 void MX_UART_RxStart(UART_HandleTypeDef *huart)
 {
 
@@ -257,95 +665,59 @@ void MX_UART_RxStart(UART_HandleTypeDef *huart)
         return;
     }
 
-    // Importantly, abort any existing transfer so the receive doesn't return BUSY, such as
-    // is the case when restarting receive after an IDLE interrupt.
+    // Importantly, abort any existing transfer so the receive doesn't return BUSY
     if (huart->RxState != HAL_UART_STATE_READY) {
         HAL_UART_AbortReceive(huart);
     }
 
-    // Start the new receive
-    if (huart == &hlpuart1 && rxioLPUART1.buf != NULL) {
-        if (HAL_UART_Receive_IT(huart, rxioLPUART1.iobuf, rxioLPUART1.iobuflen) == HAL_OK) {
-            return;
-        }
+    // Exit if not configured
+    UARTIO *uio = rxPort(huart);
+    if (uio == NULL || uio->buf == NULL) {
         return;
     }
-    if (huart == &huart1 && rxioUSART1.buf != NULL) {
-#if USART1_USE_DMA
-        if (HAL_UART_Receive_DMA(huart, rxioUSART1.iobuf, rxioUSART1.iobuflen) == HAL_OK) {
-            return;
-        }
-#else
-        if (HAL_UART_Receive_IT(huart, rxioUSART1.iobuf, rxioUSART1.iobuflen) == HAL_OK) {
-            return;
-        }
-#endif
-        return;
-    }
-    if (huart == &huart2 && rxioUSART2.buf != NULL) {
-#if USART2_USE_DMA
-        if (HAL_UART_Receive_DMA(huart, rxioUSART2.iobuf, rxioUSART2.iobuflen) == HAL_OK) {
-            return;
-        }
-#else
-        if (HAL_UART_Receive_IT(huart, rxioUSART2.iobuf, rxioUSART2.iobuflen) == HAL_OK) {
-            return;
-        }
-#endif
+
+    // DMA ports receive circularly over the ring, interrupting at half and full so
+    // that we needn't rely on IDLE for continuous streams.  Because DMA restarts at
+    // the beginning of the ring, anything unread is discarded.
+    if (uio->dmaRing) {
+        rxReset(uio, 0);
+        HAL_UART_Receive_DMA(huart, uio->buf, uio->buflen);
         return;
     }
 
+    // Other ports (notably LPUART1, whose only DMA request lines are taken by USART1)
+    // receive by interrupt directly into the ring
+    huart->ErrorCode = HAL_UART_ERROR_NONE;
+    huart->RxISR = rxRingISR;
+    huart->RxState = HAL_UART_STATE_BUSY_RX;
+    __HAL_UART_ENABLE_IT(huart, UART_IT_ERR);
+    __HAL_UART_ENABLE_IT(huart, UART_IT_RXNE);
+
 }
 
-// Register a completion callback and allocate receive buffer
+// Register a completion callback and the receive ring
 void MX_UART_RxConfigure(UART_HandleTypeDef *huart, uint8_t *rxbuf, uint16_t rxbuflen, void (*cb)(UART_HandleTypeDef *huart, bool error))
 {
-
-    // Initialize receive buffers
-    if (huart == NULL) {
-        rxioUSB.buf = rxbuf;
-        rxioUSB.buflen = rxbuflen;
-        rxioUSB.fill = rxioUSB.drain = rxioUSB.rxlen = 0;
-        rxioUSB.notifyReceivedFn = cb;
-        rxioUSB.iobuflen = 0;
-        rxioUSB.iobuf = NULL;
-    }
-    if (huart == &hlpuart1) {
-        rxioLPUART1.buf = rxbuf;
-        rxioLPUART1.buflen = rxbuflen;
-        rxioLPUART1.fill = rxioLPUART1.drain = rxioLPUART1.rxlen = 0;
-        rxioLPUART1.notifyReceivedFn = cb;
-        rxioLPUART1.iobuflen = UART_IOBUF_LEN;
-        err_t err = memAlloc(rxioLPUART1.iobuflen, &rxioLPUART1.iobuf);
-        if (err) {
-            debugPanic("lpuart1 iobuf");
-        }
+    UARTIO *uio = rxPort(huart);
+    if (uio == NULL) {
+        return;
     }
+    uio->buf = rxbuf;
+    uio->buflen = rxbuflen;
+    uio->fill = uio->drain = 0;
+    uio->resetsApplied = uio->resets;
+    uio->laps = uio->consumed = 0;
+    uio->notifyReceivedFn = cb;
+    uio->dmaRing = false;
     if (huart == &huart1) {
-        rxioUSART1.buf = rxbuf;
-        rxioUSART1.buflen = rxbuflen;
-        rxioUSART1.fill = rxioUSART1.drain = rxioUSART1.rxlen =  0;
-        rxioUSART1.notifyReceivedFn = cb;
-        rxioUSART1.iobuflen = UART_IOBUF_LEN;
-        err_t err = memAlloc(rxioUSART1.iobuflen, &rxioUSART1.iobuf);
-        if (err) {
-            debugPanic("usart1 iobuf");
-        }
+        uio->dmaRing = USART1_USE_DMA;
     }
     if (huart == &huart2) {
-        rxioUSART2.buf = rxbuf;
-        rxioUSART2.buflen = rxbuflen;
-        rxioUSART2.fill = rxioUSART2.drain = rxioUSART2.rxlen =  0;
-        rxioUSART2.notifyReceivedFn = cb;
-        rxioUSART2.iobuflen = UART_IOBUF_LEN;
-        err_t err = memAlloc(rxioUSART2.iobuflen, &rxioUSART2.iobuf);
-        if (err) {
-            debugPanic("usart2 iobuf");
-        }
+        uio->dmaRing = USART2_USE_DMA;
     }
 }
 
-// Add from the iobuf to the ring buffer, return true if success else false for failure
+// Add to the ring buffer, return true if success else false for failure
 bool uioReceivedBytes(UARTIO *uio, uint8_t *buf, uint32_t buflen)
 {
     for (int i=0; i<buflen; i++) {
@@ -355,14 +727,15 @@ bool uioReceivedBytes(UARTIO *uio, uint8_t *buf, uint32_t buflen)
         // Always write the last byte, even if overrun.  This ensures
         // that a \n terminator will get into the buffer.
         uio->buf[uio->fill] = *buf++;
-        if (uio->fill+1 == uio->drain) {
+        uint16_t next = uio->fill + 1;
+        if (next >= uio->buflen) {
+            next = 0;
+        }
+        if (next == rxDrain(uio)) {
             // overrun - don't increment the pointer
             return false;
         }
-        uio->fill++;
-        if (uio->fill >= uio->buflen) {
-            uio->fill = 0;
-        }
+        uio->fill = next;
     }
     return true;
 }
@@ -370,119 +743,101 @@ bool uioReceivedBytes(UARTIO *uio, uint8_t *buf, uint32_t buflen)
 // Receive complete for USB serial device
 void MX_USB_RxCplt(uint8_t* buf, uint32_t buflen)
 {
-    receiveComplete(NULL, &rxioUSB, buf, buflen);
+    bool success = uioReceivedBytes(&rxioUSB, buf, buflen);
+    if (rxioUSB.notifyReceivedFn != NULL) {
+        rxioUSB.notifyReceivedFn(NULL, !success);
+    }
 }
 
-// Receive complete
-void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
+// DMA ring has reached its midpoint
+void HAL_UART_RxHalfCpltCallback(UART_HandleTypeDef *huart)
 {
-
-    // If we've gone into low speed mode, crank it back up
-#if !defined(LPUART1_DISABLE_HIGH_BUSY_SAMPLING_RATE)
-    if (huart == &hlpuart1 && lpuart1PeriphClockSelection != RCC_LPUART1CLKSOURCE_HSI) {
-        lpuart1PeriphClockSelection = RCC_LPUART1CLKSOURCE_HSI;
-        __HAL_RCC_LPUART1_CONFIG(lpuart1PeriphClockSelection);
-        hlpuart1.Instance->BRR = UART_DIV_LPUART(HSI_VALUE, hlpuart1.Init.BaudRate);
+    UARTIO *uio = rxPort(huart);
+    if (uio != NULL) {
+        rxNotify(huart, uio);
     }
-#endif
-
-    // Get the receive port
-    uint16_t receivedBytes;
-    UARTIO *uio = rxPort(huart, &receivedBytes);
-    if (uio == NULL) {
-        return;
-    }
-
-    // Process completed data
-    receiveComplete(huart, uio, uio->iobuf, receivedBytes);
-
 }
 
-// Receive complete
-void receiveComplete(UART_HandleTypeDef *huart, UARTIO *uio, uint8_t *buf, uint32_t buflen)
+// DMA ring has wrapped
+void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
 {
-
-    // If there's an error, abort
-    if (huart != NULL && huart->ErrorCode != HAL_UART_ERROR_NONE) {
-        HAL_UART_Abort(huart);
-        uio->fill = uio->drain = uio->rxlen = 0;
-        if (uio->notifyReceivedFn != NULL) {
-            uio->notifyReceivedFn(huart, true);
-        }
-        MX_UART_RxStart(huart);
-        return;
-    }
-
-    // Use the static buffer and do double-buffering if possible.  Note that
-    // this will almost always be the case, unless the interrupt priorities
-    // are changed such that one serial IRQ is higher prio than the others.
-    uint8_t *iobuf = buf;
-    if (atomic_fetch_add(&rxtempInUse, 1) == 0) {
-        memcpy(rxtemp, iobuf, buflen);
-        iobuf = rxtemp;
-        MX_UART_RxStart(huart);
+    UARTIO *uio = rxPort(huart);
+    if (uio != NULL) {
+        uio->laps++;
+        rxNotify(huart, uio);
     }
-
-    // Process the received bytes
-    if (!uioReceivedBytes(uio, iobuf, buflen)) {
-        if (uio->notifyReceivedFn != NULL) {
-            uio->notifyReceivedFn(huart, true);
-        }
-    } else {
-        if (uio->notifyReceivedFn != NULL) {
-            uio->notifyReceivedFn(huart, false);
-        }
-    }
-
-    // Release the double-buffer or restart the receive
-    if (iobuf != rxtemp) {
-        MX_UART_RxStart(huart);
-    }
-    atomic_fetch_sub(&rxtempInUse, 1);
-
 }
 
 // See if anything is available
 bool MX_UART_RxAvailable(UART_HandleTypeDef *huart)
 {
-    UARTIO *uio;
-    if (huart == NULL) {
-        uio = &rxioUSB;
-    }
-    if (huart == &hlpuart1) {
-        uio = &rxioLPUART1;
-    }
-    if (huart == &huart1) {
-        uio = &rxioUSART1;
-    }
-    if (huart == &huart2) {
-        uio = &rxioUSART2;
+    UARTIO *uio = rxPort(huart);
+    if (uio == NULL || uio->buf == NULL) {
+        return false;
     }
-    return (uio->fill != uio->drain);
+    return (rxFill(huart, uio) != rxDrain(uio));
 }
 
 // Get a byte from the receive buffer
 // Note: only call this if RxAvailable returns true
 uint8_t MX_UART_RxGet(UART_HandleTypeDef *huart)
 {
-    UARTIO *uio;
-    if (huart == NULL) {
-        uio = &rxioUSB;
+    uint8_t *data;
+    if (MX_UART_RxPeek(huart, &data) == 0) {
+        return 0;
     }
-    if (huart == &hlpuart1) {
-        uio = &rxioLPUART1;
+    uint8_t databyte = *data;
+    MX_UART_RxConsume(huart, 1);
+    return databyte;
+}
+
+// Get the longest contiguous span of received bytes without consuming them, returning
+// its length.  Because the hardware only ever advances fill, the span remains valid
+// until it is consumed with MX_UART_RxConsume, unless the DMA laps us, which we detect
+// at the next peek.  Called only by the task that owns the port.
+uint32_t MX_UART_RxPeek(UART_HandleTypeDef *huart, uint8_t **retData)
+{
+    UARTIO *uio = rxPort(huart);
+    if (uio == NULL || uio->buf == NULL) {
+        return 0;
     }
-    if (huart == &huart1) {
-        uio = &rxioUSART1;
+    rxSync(huart, uio);
+    uint16_t fill = rxFill(huart, uio);
+    uint16_t drain = uio->drain;
+    *retData = &uio->buf[drain];
+    if (fill >= drain) {
+        return fill - drain;
     }
-    if (huart == &huart2) {
-        uio = &rxioUSART2;
+    return uio->buflen - drain;
+}
+
+// Consume bytes previously returned by MX_UART_RxPeek.  If a reset was requested since
+// the peek the bytes have been discarded anyway, and the reset will reposition drain.
+void MX_UART_RxConsume(UART_HandleTypeDef *huart, uint32_t len)
+{
+    UARTIO *uio = rxPort(huart);
+    if (uio->resets != uio->resetsApplied) {
+        return;
     }
-    uint8_t databyte = uio->buf[uio->drain++];
-    if (uio->drain >= uio->buflen) {
-        uio->drain = 0;
+    uint32_t drain = uio->drain + len;
+    if (drain >= uio->buflen) {
+        drain -= uio->buflen;
     }
-    return databyte;
+    uio->drain = (uint16_t) drain;
+    uio->consumed += len;
+}
+
+// Get the number of times received data was discarded, either because of a receive
+// error or because the DMA overwrote it unread
+void MX_UART_RxStats(UART_HandleTypeDef *huart, uint32_t *retErrors, uint32_t *retOverruns)
+{
+    UARTIO *uio = rxPort(huart);
+    if (uio == NULL) {
+        *retErrors = *retOverruns = 0;
+        return;
+    }
+    *retErrors = uio->errors;
+    *retOverruns = uio->overruns;
 }
 
 // LPUART1 init function
@@ -527,9 +882,10 @@ void MX_LPUART1_UART_Suspend(void)
         return;
     }
 
-        // Before going to sleep, make sure the LPUART is in low speed mode.
+    // Before going to sleep, make sure the LPUART is in low speed mode if the
+    // baud rate allows it.
 #if !defined(LPUART1_DISABLE_HIGH_BUSY_SAMPLING_RATE)
-    if (lpuart1PeriphClockSelection != RCC_LPUART1CLKSOURCE_LSE) {
+    if (lpuart1PeriphClockSelection != RCC_LPUART1CLKSOURCE_LSE && hlpuart1.Init.BaudRate <= LPUART1_LSE_MAX_BAUD) {
         lpuart1PeriphClockSelection = RCC_LPUART1CLKSOURCE_LSE;
         __HAL_RCC_LPUART1_CONFIG(lpuart1PeriphClockSelection);
         hlpuart1.Instance->BRR = UART_DIV_LPUART(LSE_VALUE, hlpuart1.Init.BaudRate);
@@ -605,6 +961,79 @@ void MX_LPUART1_UART_Transmit(uint8_t *buf, uint32_t len, uint32_t timeoutMs)
 
 }
 
+// Change the baud rate of a running port, restarting its receive.  Anything in
+// the receive ring is discarded, and the caller must make sure that no transmit
+// is in progress.
+bool MX_UART_SetBaudRate(UART_HandleTypeDef *huart, uint32_t baudRate)
+{
+
+    // Validate the port
+    if (huart == &hlpuart1) {
+        if ((peripherals & PERIPHERAL_LPUART1) == 0) {
+            return false;
+        }
+#if defined(LPUART1_DISABLE_HIGH_BUSY_SAMPLING_RATE)
+        if (baudRate > LPUART1_LSE_MAX_BAUD) {
+            return false;
+        }
+#endif
+    } else if (huart == &huart1) {
+        if ((peripherals & PERIPHERAL_USART1) == 0) {
+            return false;
+        }
+    } else if (huart == &huart2) {
+        if ((peripherals & PERIPHERAL_USART2) == 0) {
+            return false;
+        }
+    } else {
+        return false;
+    }
+
+    // Stop the receive and the peripheral
+    HAL_UART_AbortReceive(huart);
+    __HAL_UART_DISABLE(huart);
+
+    // LPUART1 must be on the HSI for anything above what the LSE can do, and
+    // we leave it there because it's about to be used.
+#if !defined(LPUART1_DISABLE_HIGH_BUSY_SAMPLING_RATE)
+    if (huart == &hlpuart1 && lpuart1PeriphClockSelection != RCC_LPUART1CLKSOURCE_HSI) {
+        lpuart1PeriphClockSelection = RCC_LPUART1CLKSOURCE_HSI;
+        __HAL_RCC_LPUART1_CONFIG(lpuart1PeriphClockSelection);
+    }
+#endif
+
+    // Reprogram the divisor, reverting if the rate can't be generated
+    uint32_t previousBaudRate = huart->Init.BaudRate;
+    huart->Init.BaudRate = baudRate;
+    bool success = (UART_SetConfig(huart) == HAL_OK);
+    if (!success) {
+        huart->Init.BaudRate = previousBaudRate;
+        UART_SetConfig(huart);
+    }
+    if (huart == &hlpuart1) {
+        lpuart1BaudRate = huart->Init.BaudRate;
+    } else if (huart == &huart1) {
+        usart1BaudRate = huart->Init.BaudRate;
+    } else {
+        usart2BaudRate = huart->Init.BaudRate;
+    }
+
+    // Restart
+    __HAL_UART_ENABLE(huart);
+    MX_UART_RxStart(huart);
+    return success;
+
+}
+
+// Get the current baud rate of a port
+uint32_t MX_UART_BaudRate(UART_HandleTypeDef *huart)
+{
+    if (huart == NULL) {
+        return 0;
+    }
+    return huart->Init.BaudRate;
+}
+
 // LPUART1 De-Initialization Function
 void MX_LPUART1_UART_DeInit(void)
 {
@@ -823,7 +1252,7 @@ void HAL_UART_MspInit(UART_HandleTypeDef* uartHandle)
         hdma_usart1_rx.Init.MemInc = DMA_MINC_ENABLE;
         hdma_usart1_rx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
         hdma_usart1_rx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
-        hdma_usart1_rx.Init.Mode = DMA_NORMAL;
+        hdma_usart1_rx.Init.Mode = DMA_CIRCULAR;
         hdma_usart1_rx.Init.Priority = DMA_PRIORITY_LOW;
         if (HAL_DMA_Init(&hdma_usart1_rx) != HAL_OK) {
             Error_Handler();
@@ -907,7 +1336,7 @@ void HAL_UART_MspInit(UART_HandleTypeDef* uartHandle)
         hdma_usart2_rx.Init.MemInc = DMA_MINC_ENABLE;
         hdma_usart2_rx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
         hdma_usart2_rx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
-        hdma_usart2_rx.Init.Mode = DMA_NORMAL;
+        hdma_usart2_rx.Init.Mode = DMA_CIRCULAR;
         hdma_usart2_rx.Init.Priority = DMA_PRIORITY_LOW;
         if (HAL_DMA_Init(&hdma_usart2_rx) != HAL_OK) {
             Error_Handler();
@@ -4,6 +4,7 @@
 
 #include "usbd_cdc_if.h"
 #include "usart.h"
+#include "usb_device.h"
 
 // Received data over USB are stored in this buffer
 uint8_t UserRxBufferFS[APP_RX_DATA_SIZE];
@@ -13,12 +14,27 @@ uint8_t UserTxBufferFS[APP_TX_DATA_SIZE];
 
 extern USBD_HandleTypeDef hUsbDeviceFS;
 
+// Transmit engine.  UserTxBufferFS is split into two halves used as a two-entry
+// queue: while the head half is being clocked out of the IN endpoint, the other is
+// filled from the serial transmit ring, and when the head completes the other is
+// submitted directly from the completion interrupt, so that the endpoint is kept
+// busy for as long as there is data.  A transfer whose length is a non-zero multiple
+// of the packet size must be terminated by a zero-length packet, which the CDC class
+// sends before reporting completion.  We cap each transfer one byte short of a half
+// so that back-to-back full transfers end in a short packet and don't need one.
+#define CDC_TX_HALF     (APP_TX_DATA_SIZE/2)
+#define CDC_TX_MAX      (CDC_TX_HALF-1)
+static volatile uint16_t txLen[2];
+static volatile uint8_t txHead;
+static volatile bool txBusy;
+
 // Forwards
 static int8_t CDC_Init_FS(void);
 static int8_t CDC_DeInit_FS(void);
 static int8_t CDC_Control_FS(uint8_t cmd, uint8_t* pbuf, uint16_t length);
 static int8_t CDC_Receive_FS(uint8_t* pbuf, uint32_t *Len);
 static int8_t CDC_TransmitCplt_FS(uint8_t *pbuf, uint32_t *Len, uint8_t epnum);
+static void CDC_TxReset(void);
 
 USBD_CDC_ItfTypeDef USBD_Interface_fops_FS = {
     CDC_Init_FS,
@@ -32,6 +48,7 @@ USBD_CDC_ItfTypeDef USBD_Interface_fops_FS = {
 static int8_t CDC_Init_FS(void)
 {
     // Set Application Buffers
+    CDC_TxReset();
     USBD_CDC_SetTxBuffer(&hUsbDeviceFS, UserTxBufferFS, 0);
     USBD_CDC_SetRxBuffer(&hUsbDeviceFS, UserRxBufferFS);
     return (USBD_OK);
@@ -40,6 +57,7 @@ static int8_t CDC_Init_FS(void)
 //  DeInitializes the CDC media low layer
 static int8_t CDC_DeInit_FS(void)
 {
+    CDC_TxReset();
     return (USBD_OK);
 }
 
@@ -180,5 +198,74 @@ static int8_t CDC_TransmitCplt_FS(uint8_t *Buf, uint32_t *Len, uint8_t epnum)
     UNUSED(Buf);
     UNUSED(Len);
     UNUSED(epnum);
+
+    // Retire the head half and immediately chain the other if it's staged
+    uint16_t sent = 0;
+    if (txBusy) {
+        sent = txLen[txHead];
+        txLen[txHead] = 0;
+        txHead ^= 1;
+        txBusy = false;
+        CDC_TxKick();
+    }
+
+    // Have the ring refill the half that just went out
+    MX_USB_TxCplt(sent);
     return result;
 }
+
+// Discard anything staged or in flight
+static void CDC_TxReset(void)
+{
+    txLen[0] = txLen[1] = 0;
+    txHead = 0;
+    txBusy = false;
+}
+
+// Stage data for transmission into the half that isn't in flight, returning the
+// number of bytes accepted.  This must be called either at interrupt level or with
+// interrupts disabled.
+uint16_t CDC_TxStage(uint8_t *buf, uint16_t len)
+{
+    uint8_t half = txBusy ? (txHead ^ 1) : txHead;
+    uint16_t staged = txLen[half];
+    if (len > CDC_TX_MAX - staged) {
+        len = CDC_TX_MAX - staged;
+    }
+    if (len > 0) {
+        memcpy(&UserTxBufferFS[(half * CDC_TX_HALF) + staged], buf, len);
+        txLen[half] = staged + len;
+    }
+    return len;
+}
+
+// Submit the head half if the endpoint is idle, returning true if a transfer is in
+// flight.  This must be called either at interrupt level or with interrupts disabled.
+bool CDC_TxKick(void)
+{
+    if (txBusy) {
+        return true;
+    }
+    USBD_CDC_HandleTypeDef *hcdc = (USBD_CDC_HandleTypeDef*)hUsbDeviceFS.pClassData;
+    if (txLen[txHead] == 0 || hcdc == NULL || hUsbDeviceFS.dev_state != USBD_STATE_CONFIGURED) {
+        return false;
+    }
+    if (CDC_Transmit_FS(&UserTxBufferFS[txHead * CDC_TX_HALF], txLen[txHead]) != USBD_OK) {
+        return false;
+    }
+    txBusy = true;
+    return true;
+}
+
+// Abandon a transfer that the host isn't reading, along with whatever is staged
+void CDC_TxAbort(void)
+{
+    USBD_CDC_HandleTypeDef *hcdc = (USBD_CDC_HandleTypeDef*)hUsbDeviceFS.pClassData;
+    if (txBusy) {
+        USBD_LL_FlushEP(&hUsbDeviceFS, CDC_IN_EP);
+    }
+    if (hcdc != NULL) {
+        hcdc->TxState = 0;
+    }
+    CDC_TxReset();
+}
@@ -157,7 +157,13 @@ err_t arrayAppendBytes(array *ctx, void *data, uint16_t datalen)
 // in the array length.
 err_t arrayAppendStringBytes(array *ctx, char *data)
 {
-    err_t err = arrayAppendBytes(ctx, data, strlen(data));
+    return arrayAppendStringSpan(ctx, data, strlen(data));
+}
+
+// Same as above, but for a span of known length that needn't be null-terminated
+err_t arrayAppendStringSpan(array *ctx, char *data, uint16_t datalen)
+{
+    err_t err = arrayAppendBytes(ctx, data, datalen);
     if (!err) {
         err = arrayAppendStringTerminate(ctx);
         if (!err) {
@@ -1,5 +1,5 @@
 
-#include "global.h"
+#include "crc16.h"
 
 //  Processor-independent CRC-16 calculation using IBM polynomial
 //  x^16 + x^15 + x^2 + 1 (0xA001)
@@ -0,0 +1,11 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// crc16.c
+uint16_t crc16(uint8_t const *data, size_t size);
@@ -11,7 +11,12 @@ STATIC uint32_t lut[16] = {
 
 int32_t crc32(const void* data, size_t length)
 {
-    uint32_t previousCrc32 = 0;
+    return crc32Update(0, data, length);
+}
+
+// Continue a CRC32 across multiple discontiguous buffers, starting with 0
+int32_t crc32Update(uint32_t previousCrc32, const void* data, size_t length)
+{
     uint32_t crc = ~previousCrc32;
     unsigned char* current = (unsigned char*) data;
     while (length--) {
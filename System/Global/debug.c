@@ -5,10 +5,35 @@
 #include <stdarg.h>
 #include "global.h"
 #include "main.h"
+#include "tlog.h"
 #include <stdatomic.h>
 
 STATIC atomic_int debugPaused = 0;
 
+// Tokenized log ring.  Rather than formatting synchronously, debugf may post a
+// tlog.h record here, from any task or ISR, for the serial task to drain later.
+// Producers reserve space by advancing logReserved with a compare-and-swap, fill in
+// the record, and then publish it by storing its header word, which reads as zero
+// until then because the drain zeroes whatever it consumes.  Records never wrap; one
+// that doesn't fit at the end of the ring is preceded by padding.  The counters are
+// running byte counts, so the ring size must be a power of two.
+#define LOG_RING_BYTES      2048
+#define LOG_PAD             0x80000000
+#define LOG_SPAN(len)       (((len) + 4 + 3) & ~3UL)
+STATIC uint32_t logRing[LOG_RING_BYTES/4];
+STATIC atomic_uint logReserved = 0;
+STATIC atomic_uint logConsumed = 0;
+STATIC atomic_uint logRecords = 0;
+STATIC atomic_uint logDropped = 0;
+STATIC atomic_uint logCycles = 0;
+STATIC atomic_uint logTimed = 0;
+STATIC bool logTokenized = false;
+STATIC void (*logNotifyFn)(void) = NULL;
+
+// Forwards
+void debugLogV(const char *format, va_list vaArgs);
+bool debugLogPost(const char *format, const uint8_t *args, uint32_t argsLen);
+
 // Suppress debug output temporarily
 void debugPause(void)
 {
@@ -59,12 +84,20 @@ void debugMessageLen(const char *buf, uint32_t buflen)
     MX_DBG(buf, buflen);
 }
 
-// Output a debug string with timer
+// Output a debug string with timer.  This is tokenized rather than formatted when
+// in that mode, and always at interrupt level, where formatting would be too costly.
 void debugf(const char *strFormat, ...)
 {
     if (atomic_load(&debugPaused) != 0) {
         return;
     }
+    if (logTokenized || MX_InISR()) {
+        va_list vaArgs;
+        va_start(vaArgs, strFormat);
+        debugLogV(strFormat, vaArgs);
+        va_end(vaArgs);
+        return;
+    }
     char buf[MAXERRSTRING];
     va_list vaArgs;
     va_start(vaArgs, strFormat);
@@ -73,6 +106,155 @@ void debugf(const char *strFormat, ...)
     va_end(vaArgs);
 }
 
+// Select tokenized or formatted output for debugf, returning the previous mode
+bool debugLogTokenized(bool on)
+{
+    bool wasOn = logTokenized;
+    logTokenized = on;
+    return wasOn;
+}
+
+// Set the function that wakes the drain when a record is published at the head of the ring
+void debugLogSetNotify(void (*fn)(void))
+{
+    logNotifyFn = fn;
+}
+
+// Post a tokenized record for a format and its arguments
+void debugLogV(const char *format, va_list vaArgs)
+{
+    if (!MX_DBG_Enabled()) {
+        return;
+    }
+
+    // A format that isn't in flash, such as text already formatted into a buffer,
+    // may not outlive us and has no meaning to a host, so it is sent verbatim
+    if ((uint32_t) format < FLASH_BASE || (uint32_t) format > FLASH_END) {
+        debugLogText(format, strlen(format));
+        return;
+    }
+
+    uint32_t beganCycles = MX_CYC_Count();
+    if (tlogCapture(format, vaArgs, debugLogPost) != 0) {
+        atomic_fetch_add(&logCycles, MX_CYC_Count() - beganCycles);
+        atomic_fetch_add(&logTimed, 1);
+    }
+}
+
+// Post text verbatim, such as that output by the ST middleware at interrupt level,
+// splitting it across as many records as needed
+void debugLogText(const char *text, uint32_t len)
+{
+    while (len > 0) {
+        uint8_t args[TLOG_MAX_ARGS];
+        uint32_t chunk = GMIN(len, sizeof(args)-1);
+        memcpy(args, text, chunk);
+        args[chunk] = '\0';
+        if (!debugLogPost(TLOG_STRING, args, chunk+1)) {
+            return;
+        }
+        text += chunk;
+        len -= chunk;
+    }
+}
+
+// Reserve, fill, and publish a record, returning false if the ring is full
+bool debugLogPost(const char *format, const uint8_t *args, uint32_t argsLen)
+{
+    uint32_t len = TLOG_HEADER + argsLen;
+    uint32_t span = LOG_SPAN(len);
+
+    // Reserve space, with padding if it would otherwise wrap
+    uint32_t reserved, offset, pad;
+    do {
+        reserved = atomic_load(&logReserved);
+        offset = reserved % LOG_RING_BYTES;
+        pad = (offset + span > LOG_RING_BYTES) ? (LOG_RING_BYTES - offset) : 0;
+        if ((reserved + pad + span) - atomic_load(&logConsumed) > LOG_RING_BYTES) {
+            atomic_fetch_add(&logDropped, 1);
+            return false;
+        }
+    } while (!atomic_compare_exchange_weak(&logReserved, &reserved, reserved + pad + span));
+    if (pad != 0) {
+        logRing[offset/4] = LOG_PAD | pad;
+        offset = 0;
+    }
+
+    // Fill it in, and publish it by storing its header last
+    uint8_t *rec = (uint8_t *) &logRing[offset/4];
+    uint32_t id = (uint32_t) format;
+    uint32_t ms = HAL_GetTick();
+    memcpy(&rec[4], &id, 4);
+    memcpy(&rec[8], &ms, 4);
+    memcpy(&rec[4+TLOG_HEADER], args, argsLen);
+    __DMB();
+    ((volatile uint32_t *) logRing)[offset/4] = len;
+    __DMB();
+    atomic_fetch_add(&logRecords, 1);
+
+    // Wake the drain if this is now the oldest record, because it may have gone idle
+    // or stopped here while this was being filled in
+    uint32_t ahead = (reserved + pad) - atomic_load(&logConsumed);
+    if (ahead <= pad && logNotifyFn != NULL) {
+        logNotifyFn();
+    }
+    return true;
+
+}
+
+// Copy the oldest published record (the format address, timestamp, and arguments) into
+// the buffer, returning its length, or 0 if there is none.  A record may have been
+// reserved but not yet published, in which case debugLogStats shows bytes pending
+// and the notify function is called once it is.  Only one task may drain.
+uint32_t debugLogPeek(uint8_t *buf, uint32_t bufLen)
+{
+    while (true) {
+        uint32_t consumed = atomic_load(&logConsumed);
+        if (consumed == atomic_load(&logReserved)) {
+            return 0;
+        }
+        uint32_t offset = consumed % LOG_RING_BYTES;
+        uint32_t header = ((volatile uint32_t *) logRing)[offset/4];
+        if (header == 0) {
+            return 0;
+        }
+        if ((header & LOG_PAD) != 0) {
+            uint32_t pad = header & ~LOG_PAD;
+            memset(&logRing[offset/4], 0, pad);
+            atomic_store(&logConsumed, consumed + pad);
+            continue;
+        }
+        uint32_t len = GMIN(header, bufLen);
+        memcpy(buf, &logRing[(offset/4)+1], len);
+        return len;
+    }
+}
+
+// Release the record returned by debugLogPeek
+void debugLogConsume(void)
+{
+    uint32_t consumed = atomic_load(&logConsumed);
+    uint32_t offset = consumed % LOG_RING_BYTES;
+    uint32_t header = logRing[offset/4];
+    if (consumed == atomic_load(&logReserved) || header == 0 || (header & LOG_PAD) != 0) {
+        return;
+    }
+    uint32_t span = LOG_SPAN(header);
+    memset(&logRing[offset/4], 0, span);
+    atomic_store(&logConsumed, consumed + span);
+}
+
+// Get logging stats
+void debugLogStats(bool *tokenized, uint32_t *records, uint32_t *dropped, uint32_t *avgCycles, uint32_t *pendingBytes)
+{
+    *tokenized = logTokenized;
+    *records = atomic_load(&logRecords);
+    *dropped = atomic_load(&logDropped);
+    uint32_t timed = atomic_load(&logTimed);
+    *avgCycles = (timed == 0) ? 0 : atomic_load(&logCycles) / timed;
+    *pendingBytes = atomic_load(&logReserved) - atomic_load(&logConsumed);
+}
+
 // Breakpoint
 void debugBreakpoint(void)
 {
@@ -24,12 +24,18 @@ STATIC errorEntry_t errors[MAXCONCURRENTERRORS];
 STATIC uint16_t errorsNext = 0;
 STATIC char errorText[MAXCONCURRENTERRORTEXT];
 STATIC uint16_t errorTextNext = 0;
-STATIC mutex errorMutex = {MTX_ERR, {0}};
+STATIC mutex errorMutex = {0};
 
 // The fact that we offset by 1 simply guarantees that we never issue noError as a result
 #define errorEntryToError(x) ((err_t)(x+1))
 #define errorEntryFromError(x) (((uint16_t)x)-1)
 
+// Init the error package, before the scheduler starts
+void errInit(void)
+{
+    mutexInit(&errorMutex, MTX_ERR);
+}
+
 // Print an error, cascading it by adding the previous error as a suffix.  If there's nothing to cascade,
 // supply 0 as the first argument.  If format == NULL, we are guaranteed to return errNone;
 err_t errF(const char *format, ...)
@@ -10,6 +10,8 @@
 #include <string.h>
 #include <time.h>
 #include "amd5.h"
+#include "msgq.h"
+#include "crc16.h"
 
 #pragma once
 
@@ -124,6 +126,7 @@ size_t strlcat(char *dst, const char *src, size_t siz);
 typedef int32_t err_t;
 #define MAXERRSTRING 256
 #define errNone ((err_t)0)
+void errInit(void);
 err_t errF(const char *format, ...);
 err_t errBody(err_t err, uint8_t **retBody, uint32_t *retBodyLen);
 bool errContains(err_t err, const char *errkey);
@@ -140,6 +143,12 @@ void debugSoftPanic(const char *message);
 void debugPause(void);
 bool debugIsPaused(void);
 void debugResume(void);
+bool debugLogTokenized(bool on);
+void debugLogSetNotify(void (*fn)(void));
+void debugLogText(const char *text, uint32_t len);
+uint32_t debugLogPeek(uint8_t *buf, uint32_t bufLen);
+void debugLogConsume(void);
+void debugLogStats(bool *tokenized, uint32_t *records, uint32_t *dropped, uint32_t *avgCycles, uint32_t *pendingBytes);
 
 // gmem.c
 extern long memObjects;
@@ -151,6 +160,7 @@ err_t memAlloc(uint32_t length, void *ptr);
 void memFree(void *p);
 err_t memRealloc(uint32_t fromLength, uint32_t toLength, void *ptr);
 err_t memDup(void *pSrc, uint32_t srcLength, void *pCopy);
+void memStats(void);
 
 // loc.c
 bool locSet(double lat, double lon, uint32_t ltime);
@@ -160,6 +170,7 @@ bool locValid(void);
 void locInvalidate(void);
 
 // timer.c
+void timerInit(void);
 int64_t timerMsSinceBoot(void);
 uint32_t timeSecsBoot(void);
 void timerSetBootTime(void);
@@ -213,6 +224,7 @@ err_t arraySet(array *ctx, int index, void *data);
 void arrayShrink(array *ctx);
 err_t arrayAppendBytes(array *ctx, void *data, uint16_t datalen);
 err_t arrayAppendStringBytes(array *ctx, char *data);
+err_t arrayAppendStringSpan(array *ctx, char *data, uint16_t datalen);
 err_t arrayAppendStringTerminate(array *ctx);
 err_t arrayAppend(array *ctx, void *data);
 void arrayResetEntry(array *ctx, int i);
@@ -252,6 +264,7 @@ void md5HashToString(uint8_t *data, uint32_t len, char *strbuf, uint32_t buflen)
 void md5BinaryToString(uint8_t *hash, char *strbuf, uint32_t buflen);
 
 // rand.c
+void randInit(void);
 unsigned long int randNumber(void);
 unsigned long int randNumberBuffer(unsigned char* output, uint32_t sz);
 unsigned long int prandNumber(void);
@@ -259,8 +272,10 @@ uint32_t randEvenDistribution(uint32_t n);
 #define prandUint64() ((((uint64_t)prandNumber()) << 32LL) | ((uint64_t)prandNumber()))
 
 // task.c
+void taskInit(void);
 void taskRegister(int taskID, char *name, char letter, uint32_t stackBytes);
 void taskRegisterAsNonBlocking(int taskID);
+void taskRegisterAsSignalled(int taskID);
 char *taskLabel(int taskID);
 char taskIdentifier(void);
 int taskID(void);
@@ -269,29 +284,66 @@ uint32_t taskAllIdleForMs(bool trace);
 bool taskTake(int taskID, uint32_t timeoutMs);
 void taskGive(int taskID);
 void taskGiveFromISR(int taskID);
-void taskGiveAllFromISR(void);
+#define TASK_SIGNAL_WAKE            0x80000000  // Set by taskGive and taskPost for signalled tasks
+uint32_t taskWaitSignals(int taskID, uint32_t timeoutMs);
+uint32_t taskPollSignals(int taskID);
+void taskSignal(int taskID, uint32_t bits);
+bool taskPost(int taskID, uint32_t type, uint32_t value);
+void taskPostAll(uint32_t type, uint32_t value);
+bool taskReceive(int taskID, msgqMsg *msg);
+void taskMessageStats(void);
 void taskSuspend(void);
 void taskResume(void);
 void taskStackStats();
+void taskStackProfileReset(void);
+void taskMemoryStats(void);
 uint32_t taskIOPriorityBegin();
 void taskIOPriorityEnd(uint32_t prio);
 void taskStackOverflowCheck();
 
 // tss.c
-void tssPreSuspend(int tssID);
+#define TSS_ISR_SAI_DMA             0
+#define TSS_ISR_SAI                 1
+#define TSS_ISR_LPUART1             2
+#define TSS_ISR_USART1              3
+#define TSS_ISR_USART1_DMA          4
+#define TSS_ISR_USART2              5
+#define TSS_ISR_USB                 6
+#define TSS_ISR_RTC                 7
+#define TSS_ISR_COUNT               8
 void tssPostSuspend(int tssID);
 void tssPause(void);
 void tssResume(void);
 void tssStats(void);
+void tssTaskSwitchedIn(uint32_t taskNumber);
+void tssTaskSwitchedOut(uint32_t taskNumber);
+void tssIsrEnter(uint8_t isr);
+void tssIsrExit(uint8_t isr);
+const char *tssIsrName(uint8_t isr);
+
+// timeline.c
+#define TIMELINE_EVENTS             512         // Most recent events held, a power of two
+#define TIMELINE_SPAN_BLOCK         0
+#define TIMELINE_SPAN_PCM           1
+#define TIMELINE_SPAN_BANDS         2
+#define TIMELINE_SPAN_ADPCM         3
+#define TIMELINE_SPAN_COUNT         4
+void timelineTaskSwitchedIn(uint32_t taskNumber);
+void timelineTaskSwitchedOut(uint32_t taskNumber);
+void timelineIsrEnter(uint8_t isr);
+void timelineIsrExit(uint8_t isr);
+void timelineSpanBegin(uint8_t span);
+void timelineSpanEnd(uint8_t span);
+void timelineEnable(bool on);
+bool timelineStatus(uint32_t *events);
+void timelineDump(void);
 
 // memmem.c
 void *memmem(const void *h0, size_t k, const void *n0, size_t l);
 
-// crc16.c
-uint16_t crc16(uint8_t const *data, size_t size);
-
 // crc32.c
 int32_t crc32(const void* data, size_t length);
+int32_t crc32Update(uint32_t previousCrc32, const void* data, size_t length);
 
 // base64.c
 int Base64encode_len(int len);
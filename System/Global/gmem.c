@@ -3,12 +3,83 @@
 // copyright holder including that found in the LICENSE file.
 
 #include "FreeRTOS.h"
+#include "task.h"
 #include "global.h"
 
 // Remember the count of objects allocated
 long memObjects = 0;
 long memFailures = 0;
 
+// Small objects, such as serial lines, error strings and response copies, come and go
+// at the same few sizes, so they are served from fixed size classes rather than from
+// heap_4, whose allocations suspend the scheduler and walk a first-fit free list.
+// Each class is a run of equal blocks within one static arena, with free blocks
+// linked through their first word, so that allocating and freeing are O(1) and the
+// class of a block being freed is known from its address.  Requests that are too
+// large, or whose class is exhausted, fall through to heap_4.
+typedef struct {
+    uint16_t size;
+    uint16_t count;
+    uint8_t *base;
+    void *free;
+    uint16_t inUse;
+    uint16_t peak;
+    uint32_t allocs;
+    uint32_t misses;                // Fell through to heap_4 because the class was full
+    uint64_t requestedBytes;        // Over all allocs, to show how well the class fits
+} memSlab;
+
+// The classes as X(block size, block count), in ascending order of size, from which
+// both the table and the arena that it carves up are derived
+#define MEM_SLAB_TABLE(X)   X(32, 16) X(64, 16) X(128, 8) X(256, 4) X(512, 2)
+#define MEM_SLAB_ENTRY(size, count)     { size, count },
+#define MEM_SLAB_SPAN(size, count)      + ((size) * (count))
+STATIC memSlab memSlabs[] = {
+    MEM_SLAB_TABLE(MEM_SLAB_ENTRY)
+};
+#define MEM_SLAB_CLASSES    (sizeof(memSlabs)/sizeof(memSlabs[0]))
+#define MEM_SLAB_BYTES      (0 MEM_SLAB_TABLE(MEM_SLAB_SPAN))
+STATIC uint64_t memSlabArena[MEM_SLAB_BYTES / sizeof(uint64_t)];
+STATIC bool memSlabsInitialized = false;
+STATIC uint32_t memHeapAllocs = 0;
+
+// Forwards
+void memSlabInit(void);
+memSlab *memSlabOf(void *p);
+
+// Carve the arena into the classes' free lists.  Called within a critical section.
+void memSlabInit(void)
+{
+    uint8_t *next = (uint8_t *) memSlabArena;
+    for (uint32_t i=0; i<MEM_SLAB_CLASSES; i++) {
+        memSlab *slab = &memSlabs[i];
+        slab->base = next;
+        slab->free = NULL;
+        for (int block=slab->count-1; block>=0; block--) {
+            void **b = (void **) &slab->base[block * slab->size];
+            *b = slab->free;
+            slab->free = b;
+        }
+        next += slab->size * slab->count;
+    }
+    memSlabsInitialized = true;
+}
+
+// Get the class that a block belongs to, or NULL if it came from heap_4
+memSlab *memSlabOf(void *p)
+{
+    uint8_t *b = (uint8_t *) p;
+    if (b < (uint8_t *) memSlabArena || b >= (uint8_t *) memSlabArena + MEM_SLAB_BYTES) {
+        return NULL;
+    }
+    for (int i=MEM_SLAB_CLASSES-1; i>=0; i--) {
+        if (b >= memSlabs[i].base) {
+            return &memSlabs[i];
+        }
+    }
+    return NULL;
+}
+
 // Currently free
 uint32_t memCurrentlyFree(void)
 {
@@ -18,10 +89,40 @@ uint32_t memCurrentlyFree(void)
 // Alloc
 err_t memAlloc(uint32_t length, void *ptr)
 {
-    void *p = pvPortMalloc((size_t)length);
+
+    // Take a block from the smallest class that fits, if it has one free
+    void *p = NULL;
+    taskENTER_CRITICAL();
+    if (!memSlabsInitialized) {
+        memSlabInit();
+    }
+    for (uint32_t i=0; i<MEM_SLAB_CLASSES; i++) {
+        memSlab *slab = &memSlabs[i];
+        if (length <= slab->size) {
+            if (slab->free == NULL) {
+                slab->misses++;
+            } else {
+                p = slab->free;
+                slab->free = *(void **) p;
+                slab->allocs++;
+                slab->requestedBytes += length;
+                if (++slab->inUse > slab->peak) {
+                    slab->peak = slab->inUse;
+                }
+            }
+            break;
+        }
+    }
+    taskEXIT_CRITICAL();
+
+    // Otherwise go to the heap
     if (p == NULL) {
-        memFailures++;
-        return errF("cannot allocate %d bytes " ERR_MEM_ALLOC, length);
+        p = pvPortMalloc((size_t)length);
+        if (p == NULL) {
+            memFailures++;
+            return errF("cannot allocate %d bytes " ERR_MEM_ALLOC, length);
+        }
+        memHeapAllocs++;
     }
     memObjects++;
     memset(p, 0, length);
@@ -33,18 +134,58 @@ err_t memAlloc(uint32_t length, void *ptr)
 void memFree(void *p)
 {
     memObjects--;
-    vPortFree(p);
+    memSlab *slab = memSlabOf(p);
+    if (slab == NULL) {
+        vPortFree(p);
+        return;
+    }
+    taskENTER_CRITICAL();
+    *(void **) p = slab->free;
+    slab->free = p;
+    slab->inUse--;
+    taskEXIT_CRITICAL();
+}
+
+// Show usage of the size classes and of the heap behind them
+void memStats(void)
+{
+    debugR("RAM by size class:\n");
+    for (uint32_t i=0; i<MEM_SLAB_CLASSES; i++) {
+        memSlab slab;
+        taskENTER_CRITICAL();
+        slab = memSlabs[i];
+        taskEXIT_CRITICAL();
+        double fill = slab.allocs == 0 ? 0 : (double) slab.requestedBytes * 100.0 / ((double) slab.allocs * slab.size);
+        debugR("  %12u: %u/%u in use (peak %u) %lu allocs %0.1f%% filled %lu overflowed\n",
+               slab.size, slab.inUse, slab.count, slab.peak, (unsigned long) slab.allocs, fill, (unsigned long) slab.misses);
+    }
+    HeapStats_t heap;
+    vPortGetHeapStats(&heap);
+    double fragmented = heap.xAvailableHeapSpaceInBytes == 0 ? 0 : 100.0 - ((double) heap.xSizeOfLargestFreeBlockInBytes * 100.0 / (double) heap.xAvailableHeapSpaceInBytes);
+    debugR("  %12s: %lu allocs, %lu free in %lu blocks (largest %lu, %0.1f%% fragmented)\n", "heap",
+           (unsigned long) memHeapAllocs, (unsigned long) heap.xAvailableHeapSpaceInBytes, (unsigned long) heap.xNumberOfFreeBlocks,
+           (unsigned long) heap.xSizeOfLargestFreeBlockInBytes, fragmented);
 }
 
 // Realloc
 err_t memRealloc(uint32_t fromLength, uint32_t toLength, void *ptr)
 {
+
+    // Grow or shrink in place if the block's class still fits, as arrays often do
+    uint8_t *old = * (void **) ptr;
+    memSlab *slab = memSlabOf(old);
+    if (slab != NULL && toLength <= slab->size) {
+        if (toLength > fromLength) {
+            memset(&old[fromLength], 0, toLength - fromLength);
+        }
+        return errNone;
+    }
+
     uint8_t *new;
     err_t err = memAlloc(toLength, &new);
     if (err) {
         return err;
     }
-    uint8_t *old = * (void **) ptr;
     memcpy(new, old, GMIN(toLength, fromLength));
     * (void **) ptr = new;
     memFree(old);
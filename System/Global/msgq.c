@@ -0,0 +1,57 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#include "msgq.h"
+#include <string.h>
+
+// Empty a queue and clear its stats.  Neither side may be using it.
+void msgqInit(msgq *q)
+{
+    memset(q, 0, sizeof(msgq));
+    atomic_init(&q->put, 0);
+    atomic_init(&q->get, 0);
+}
+
+// Post a message, returning false (and counting the overflow) if the queue is full.
+// Called only by the producer.
+bool msgqPut(msgq *q, uint32_t type, uint32_t value)
+{
+    uint32_t put = atomic_load_explicit(&q->put, memory_order_relaxed);
+    uint32_t get = atomic_load_explicit(&q->get, memory_order_acquire);
+    uint32_t pending = put - get;
+    if (pending >= MSGQ_CAPACITY) {
+        q->overflows++;
+        return false;
+    }
+    msgqMsg *msg = &q->msgs[put % MSGQ_CAPACITY];
+    msg->type = type;
+    msg->value = value;
+    atomic_store_explicit(&q->put, put + 1, memory_order_release);
+    q->posted++;
+    if (pending + 1 > q->highWater) {
+        q->highWater = pending + 1;
+    }
+    return true;
+}
+
+// Take the oldest message, returning false if there is none.  Called only by the consumer.
+bool msgqGet(msgq *q, msgqMsg *msg)
+{
+    uint32_t get = atomic_load_explicit(&q->get, memory_order_relaxed);
+    uint32_t put = atomic_load_explicit(&q->put, memory_order_acquire);
+    if (get == put) {
+        return false;
+    }
+    *msg = q->msgs[get % MSGQ_CAPACITY];
+    atomic_store_explicit(&q->get, get + 1, memory_order_release);
+    return true;
+}
+
+// Number of messages waiting, from either side
+uint32_t msgqPending(msgq *q)
+{
+    uint32_t put = atomic_load_explicit(&q->put, memory_order_acquire);
+    uint32_t get = atomic_load_explicit(&q->get, memory_order_acquire);
+    return put - get;
+}
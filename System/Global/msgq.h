@@ -0,0 +1,39 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+// A fixed-capacity single-producer, single-consumer message queue that needs no locks,
+// so that interrupts can post to tasks.  The producer only ever advances the put index
+// and the consumer only the get index, each publishing its side after the slot has been
+// written or read.  Where several interrupts post to the same queue, their puts must be
+// serialized by the caller (see taskPost).  Like frame.h this is free of any HAL or
+// RTOS dependency, and Test/msgq_test.c stresses it with a producer and a consumer
+// thread on a host.
+
+// Messages held, a power of two
+#define MSGQ_CAPACITY           16
+
+typedef struct {
+    uint32_t type;
+    uint32_t value;
+} msgqMsg;
+
+typedef struct {
+    atomic_uint put;            // Advanced only by the producer
+    atomic_uint get;            // Advanced only by the consumer
+    uint32_t posted;            // Producer's stats
+    uint32_t overflows;
+    uint32_t highWater;
+    msgqMsg msgs[MSGQ_CAPACITY];
+} msgq;
+
+void msgqInit(msgq *q);
+bool msgqPut(msgq *q, uint32_t type, uint32_t value);
+bool msgqGet(msgq *q, msgqMsg *msg);
+uint32_t msgqPending(msgq *q);
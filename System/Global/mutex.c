@@ -27,19 +27,37 @@
 STATIC mtxtype_t taskMutexes[TASKID_NUM_TASKS] = {0};
 #endif
 
-// The mutex to protect mutex creation
-STATIC mutex initMutex = {MTX_MTX, {0}};
+// Mutexes created, for the memory report
+STATIC uint32_t mutexesCreated = 0;
+
+// Contention and hold-time stats.  Each mutex is assigned the slot for its type when
+// it's created, so that accounting doesn't need to search.  Mutexes
+// of the same type may be held concurrently by different tasks, so updates are done
+// with interrupts disabled.
+#if mutexProfile
+STATIC mutexProfileEntry mutexProfiles[MUTEX_PROFILE_TYPES] = {0};
+STATIC int mutexProfileTypes = 0;
+#endif
 
 // Forwards
 char *justFilename(const char *fileName);
+void mutexCreate(mutex *m);
+void mutexCheckCreated(const char *filename, uint32_t lineno, mutex *m);
+void mutexCheckNested(mutex *m, int thisTaskID);
+void mutexTaken(const char *filename, uint32_t lineno, mutex *m, int thisTaskID, bool contended, uint32_t waited);
+#if mutexProfile
+int8_t mutexProfileSlot(mtxtype_t mtx);
+uint32_t mutexElapsedCycles(uint32_t beganCycles, int64_t beganMs);
+#endif
 
-// Init a mutex
+// Init a mutex, creating its RTOS mutex.  Every mutex must be initialized before it's
+// first locked, and those that are statics of a module are initialized by that
+// module's init function, which appInit calls before the scheduler starts.
 void mutexInit(mutex *m, mtxtype_t mtype)
 {
     memset(m, 0, sizeof(mutex));
     m->mtx = mtype;
-    mutexLock(m);
-    mutexUnlock(m);
+    mutexCreate(m);
 }
 
 // For debugging, display which mutexes are owned by the current task.  Note that
@@ -50,8 +68,11 @@ void mutexDebugOwned(const char **name, int64_t *owned)
     *owned = 0;
     *name = "";
 #if mutexTrace
-    *name = taskLabel(taskID());
-    *owned = (int64_t) taskMutexes[taskID()];
+    int thisTaskID = taskID();
+    if (thisTaskID != TASKID_UNKNOWN) {
+        *name = taskLabel(thisTaskID);
+        *owned = (int64_t) taskMutexes[thisTaskID];
+    }
 #endif
 }
 
@@ -60,43 +81,55 @@ void mutexDeInit(mutex *m)
 {
     if (m->state.initialized) {
         vSemaphoreDelete(m->state.handle);
+        m->state.initialized = false;
     }
 }
 
-// Lock a resource
-#if mutexTrace
-void mutexLockHandler(const char *filename, uint32_t lineno, mutex *m)
+// Create the RTOS mutex, in the mutex's own storage when statically allocating
+void mutexCreate(mutex *m)
+{
+#if STATIC_ALLOCATION_PROFILE
+    m->state.handle = xSemaphoreCreateMutexStatic(&m->state.storage);
 #else
-void mutexLock(mutex *m)
+    m->state.handle = xSemaphoreCreateMutex();
+    if (m->state.handle == NULL) {
+        debugPanic("can't allocate mutex");
+    }
 #endif
-{
-    int thisTaskID = taskID();
+    m->state.lockedTask = -1;
 
-    // First time through ANY mutex lock?
-    if (!initMutex.state.initialized) {
-        initMutex.state.handle = xSemaphoreCreateMutex();
-        if (initMutex.state.handle == NULL) {
-            debugPanic("can't allocate init mutex");
-        }
-        initMutex.state.initialized = true;
-    }
+    // Mutexes may also be created by tasks once the scheduler is running
+    vTaskSuspendAll();
+#if mutexProfile
+    m->state.profileSlot = mutexProfileSlot(m->mtx);
+#endif
+    mutexesCreated++;
+    xTaskResumeAll();
+    m->state.initialized = true;
+
+}
 
-    // First time through this mutex?
+// Validate that a mutex was initialized before being locked
+void mutexCheckCreated(const char *filename, uint32_t lineno, mutex *m)
+{
     if (!m->state.initialized) {
-        xSemaphoreTake(initMutex.state.handle, portMAX_DELAY);
-        if (!m->state.initialized) {
-            m->state.handle = xSemaphoreCreateMutex();
-            if (m->state.handle == NULL) {
-                debugPanic("can't allocate mutex");
-            }
-            m->state.lockedTask = -1;
-            m->state.initialized = true;
-        }
-        xSemaphoreGive(initMutex.state.handle);
+#if mutexTrace
+        char reason[128];
+        snprintf(reason, sizeof(reason), "*** mutexLock before mutexInit! %s:%u\n", justFilename(filename), (unsigned)lineno);
+        debugPanic(reason);
+#else
+        (void) filename;
+        (void) lineno;
+        debugPanic("*** mutexLock before mutexInit!");
+#endif
     }
+}
 
-    // Validate that we're not locking nested
-    if (m->state.lockedTask == thisTaskID) {
+// Validate that we're not locking nested.  Unregistered tasks all share an ID, so
+// they can't be told apart here.
+void mutexCheckNested(mutex *m, int thisTaskID)
+{
+    if (thisTaskID != TASKID_UNKNOWN && m->state.lockedTask == thisTaskID) {
 #if mutexTrace
         char reason[128];
         snprintf(reason, sizeof(reason), "*** mutexLock nested! %s:%u\n", justFilename(m->state.filename), (unsigned)m->state.lineno);
@@ -105,19 +138,12 @@ void mutexLock(mutex *m)
         debugPanic("*** mutexLock Nested!");
 #endif
     }
+}
 
-    // Take the mutex
-#if mutexTrace && SHOW_MUTEX_DURATION_WARNINGS
-    int64_t timerBegan = timerMs();
-    while (!xSemaphoreTake(m->state.handle, MUTEX_NEEDED_DURATION_WARNING_MS)) {
-        char reason[128];
-        uint32_t secsHeld = (uint32_t) (timerMs() - timerBegan)/1000;
-        snprintf(reason, sizeof(reason), "$$$$ mutex needed by %s:%u (%d) is being held for %us by %s:%u (%d)\n", justFilename(filename), (unsigned)lineno, taskID(), secsHeld, justFilename(m->state.filename), m->state.lineno, m->state.lockedTask);
-        debugMessage(reason);
-    }
-#else
-    xSemaphoreTake(m->state.handle, portMAX_DELAY);
-#endif
+// Record the state of a mutex that has just been taken, having waited for it
+// for the given number of cycles if it was contended
+void mutexTaken(const char *filename, uint32_t lineno, mutex *m, int thisTaskID, bool contended, uint32_t waited)
+{
 
     // Trace
 #if SHOW_MUTEX_LOCKS
@@ -130,10 +156,36 @@ void mutexLock(mutex *m)
     m->state.lockedTask = thisTaskID;
     m->state.lockedMs = timerMs();
 
+    // Account for the acquisition
+#if mutexProfile
+    m->state.lockedCycles = MX_CYC_Count();
+    if (m->state.profileSlot >= 0) {
+        mutexProfileEntry *p = &mutexProfiles[m->state.profileSlot];
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        p->acquisitions++;
+        if (contended) {
+            p->contended++;
+            p->waitCycles += waited;
+            if (waited > p->waitMaxCycles) {
+                p->waitMaxCycles = waited;
+#if mutexTrace
+                p->waitMaxFilename = filename;
+                p->waitMaxLineno = lineno;
+#endif
+            }
+        }
+        __set_PRIMASK(primask);
+    }
+#else
+    (void) contended;
+    (void) waited;
+#endif
+
     // Do mutex ordering checking.  Note that we do allow mutex type to be 0 because
     // external packages such as lwip create mutexes and manage their own nesting.
 #if mutexTrace
-    if (m->mtx != 0) {
+    if (m->mtx != 0 && thisTaskID != TASKID_UNKNOWN) {
         mtxtype_t lowerLevelMask = m->mtx - 1;
         if (taskMutexes[thisTaskID] & lowerLevelMask) {
             char reason[128];
@@ -148,10 +200,81 @@ void mutexLock(mutex *m)
 #if mutexTrace
     m->state.filename = filename;
     m->state.lineno = lineno;
+#else
+    (void) filename;
+    (void) lineno;
+#endif
+
+}
+
+// Lock a resource
+#if mutexTrace
+void mutexLockHandler(const char *filename, uint32_t lineno, mutex *m)
+#else
+void mutexLock(mutex *m)
+#endif
+{
+#if !mutexTrace
+    const char *filename = NULL;
+    uint32_t lineno = 0;
+#endif
+    int thisTaskID = taskID();
+    mutexCheckCreated(filename, lineno, m);
+    mutexCheckNested(m, thisTaskID);
+
+    // Take the mutex, noting whether we had to wait for it
+#if mutexProfile
+    uint32_t waitBeganCycles = MX_CYC_Count();
+    int64_t waitBeganMs = timerMs();
+    bool contended = (xSemaphoreTake(m->state.handle, 0) != pdTRUE);
+#else
+    bool contended = true;
+#endif
+    if (contended) {
+#if mutexTrace && SHOW_MUTEX_DURATION_WARNINGS
+        int64_t timerBegan = timerMs();
+        while (!xSemaphoreTake(m->state.handle, MUTEX_NEEDED_DURATION_WARNING_MS)) {
+            char reason[128];
+            uint32_t secsHeld = (uint32_t) (timerMs() - timerBegan)/1000;
+            snprintf(reason, sizeof(reason), "$$$$ mutex needed by %s:%u (%d) is being held for %us by %s:%u (%d)\n", justFilename(filename), (unsigned)lineno, taskID(), secsHeld, justFilename(m->state.filename), m->state.lineno, m->state.lockedTask);
+            debugMessage(reason);
+        }
+#else
+        xSemaphoreTake(m->state.handle, portMAX_DELAY);
 #endif
+    }
+#if mutexProfile
+    uint32_t waited = contended ? mutexElapsedCycles(waitBeganCycles, waitBeganMs) : 0;
+#else
+    uint32_t waited = 0;
+#endif
+    mutexTaken(filename, lineno, m, thisTaskID, contended, waited);
 
 }
 
+// Lock a resource only if it's free right now, returning true if it was locked.  Unlike
+// checking mutexIsLocked before mutexLock, there's no window in which another task can
+// take it between the two, so the caller never blocks.
+#if mutexTrace
+bool mutexTryLockHandler(const char *filename, uint32_t lineno, mutex *m)
+#else
+bool mutexTryLock(mutex *m)
+#endif
+{
+#if !mutexTrace
+    const char *filename = NULL;
+    uint32_t lineno = 0;
+#endif
+    int thisTaskID = taskID();
+    mutexCheckCreated(filename, lineno, m);
+    mutexCheckNested(m, thisTaskID);
+    if (xSemaphoreTake(m->state.handle, 0) != pdTRUE) {
+        return false;
+    }
+    mutexTaken(filename, lineno, m, thisTaskID, false, 0);
+    return true;
+}
+
 // Test OPPORTUNISTICALLY to see if this mutex is currently locked.  This is used ONLY when there are
 // multiple options for "work to do" and it's preferable to do something that you know would cause a
 // block.  This is used by the serial poll task, where other tasks may have receive buffers locked
@@ -201,11 +324,30 @@ void mutexUnlock(mutex *m)
     const char *xFilename = m->state.filename;
     uint32_t xLineno = m->state.lineno;
     xLockedMs = m->state.lockedMs;
+#endif
+#if mutexProfile
+    if (m->state.profileSlot >= 0) {
+        mutexProfileEntry *p = &mutexProfiles[m->state.profileSlot];
+        uint32_t held = mutexElapsedCycles(m->state.lockedCycles, m->state.lockedMs);
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        p->holdCycles += held;
+        if (held > p->holdMaxCycles) {
+            p->holdMaxCycles = held;
+#if mutexTrace
+            p->holdMaxFilename = m->state.filename;
+            p->holdMaxLineno = m->state.lineno;
+#endif
+        }
+        __set_PRIMASK(primask);
+    }
 #endif
     m->state.lockedTask = -1;
     m->state.lockedMs = 0;
 #if mutexTrace
-    taskMutexes[taskID()] &= ~m->mtx;
+    if (taskID() != TASKID_UNKNOWN) {
+        taskMutexes[taskID()] &= ~m->mtx;
+    }
 #endif
 
 #if mutexTrace
@@ -235,6 +377,106 @@ void mutexUnlock(mutex *m)
 
 }
 
+#if mutexProfile
+
+// Find or assign the stats slot for a mutex type, returning -1 if the table is full.
+// This is called with the scheduler suspended.
+int8_t mutexProfileSlot(mtxtype_t mtx)
+{
+    for (int i=0; i<mutexProfileTypes; i++) {
+        if (mutexProfiles[i].mtx == mtx) {
+            return (int8_t) i;
+        }
+    }
+    if (mutexProfileTypes >= MUTEX_PROFILE_TYPES) {
+        return -1;
+    }
+    mutexProfiles[mutexProfileTypes].mtx = mtx;
+    return (int8_t) mutexProfileTypes++;
+}
+
+// Cycles elapsed since a mutex event.  The cycle counter stops while the core sleeps,
+// which it may well do while a task is blocked on a mutex, so if the tick shows that
+// more time passed than the cycle counter saw, go by the tick.
+uint32_t mutexElapsedCycles(uint32_t beganCycles, int64_t beganMs)
+{
+    uint32_t cycles = MX_CYC_Count() - beganCycles;
+    uint64_t tickCycles = (uint64_t) (timerMs() - beganMs) * (SystemCoreClock / 1000);
+    if (tickCycles > (uint64_t) cycles + (SystemCoreClock / 500)) {
+        return (tickCycles > UINT32_MAX) ? UINT32_MAX : (uint32_t) tickCycles;
+    }
+    return cycles;
+}
+
+#endif
+
+// Get the stats for a mutex type, returning false if there are no more
+bool mutexProfileGet(int slot, mutexProfileEntry *entry)
+{
+#if mutexProfile
+    if (slot < 0 || slot >= mutexProfileTypes) {
+        return false;
+    }
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    *entry = mutexProfiles[slot];
+    __set_PRIMASK(primask);
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Clear the stats, keeping the slot assignments
+void mutexProfileReset(void)
+{
+#if mutexProfile
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    for (int i=0; i<mutexProfileTypes; i++) {
+        mtxtype_t mtx = mutexProfiles[i].mtx;
+        memset(&mutexProfiles[i], 0, sizeof(mutexProfiles[i]));
+        mutexProfiles[i].mtx = mtx;
+    }
+    __set_PRIMASK(primask);
+#endif
+}
+
+// Get the number of mutexes created and the RTOS memory that they occupy, which is
+// within the mutexes themselves when statically allocating and otherwise in the heap
+void mutexMemoryStats(uint32_t *count, uint32_t *bytes)
+{
+    *count = mutexesCreated;
+    *bytes = mutexesCreated * sizeof(StaticSemaphore_t);
+}
+
+// Get the name of a mutex type
+const char *mutexTypeName(mtxtype_t mtx)
+{
+    switch (mtx) {
+    case MTX_MTX:
+        return "mtx";
+    case MTX_TIME:
+        return "time";
+    case MTX_EVENT:
+        return "event";
+    case MTX_QUEUE:
+        return "queue";
+    case MTX_RAND:
+        return "rand";
+    case MTX_ERR:
+        return "err";
+    case MTX_SERIAL_TX:
+        return "serial tx";
+    case MTX_SERIAL_RX:
+        return "serial rx";
+    }
+    if (mtx >= MTX_APP_FIRST && mtx <= MTX_APP_LAST) {
+        return "app";
+    }
+    return "other";
+}
+
 // Return a pointer to the filename portion of a path.  Do NOT use mutexes, because this is
 // too low level and is called by the mutex code itself.
 char *justFilename(const char *fileName)
@@ -10,6 +10,7 @@
 // This file was split out from global.h because its included headers are substantial and
 // thus by splitting it out there is a significant speedup of builds.
 #define mutexTrace              true        // Leave on in production because the cost is very low
+#define mutexProfile            true        // Contention and hold-time stats per mutex type
 
 // Mutex definitions, low-order to high-order in order of layering - for deadlock detection.
 // These values can be changed as necessary when adding new ones, however be very careful because
@@ -32,12 +33,15 @@ typedef uint64_t mtxtype_t;
 #include "FreeRTOS.h"
 #include "semphr.h"
 #include "task.h"
-// Note that all mutexes in the product MUST BE STATIC and initialized to {0}, for both RTOS and GLIB
+// Note that all mutexes in the product MUST BE STATIC and created with mutexInit before they are locked
 typedef struct {
     mtxtype_t mtx;
     struct {
         volatile bool initialized;
         SemaphoreHandle_t handle;
+#if STATIC_ALLOCATION_PROFILE
+        StaticSemaphore_t storage;
+#endif
 #if mutexTrace
         const char *filename;
         uint32_t lineno;
@@ -46,13 +50,21 @@ typedef struct {
         int64_t lockedMs;
         // For internal consistency validation
         int lockedTask;
+#if mutexProfile
+        // Cycle counter when locked, and the stats slot for this mutex's type
+        uint32_t lockedCycles;
+        int8_t profileSlot;
+#endif
     } state;
 } mutex;
 #if mutexTrace
 #define mutexLock(x) mutexLockHandler(__FILE__, __LINE__, x)
 void mutexLockHandler(const char *filename, uint32_t lineno, mutex *m);
+#define mutexTryLock(x) mutexTryLockHandler(__FILE__, __LINE__, x)
+bool mutexTryLockHandler(const char *filename, uint32_t lineno, mutex *m);
 #else
 void mutexLock(mutex *m);
+bool mutexTryLock(mutex *m);
 #endif
 void mutexUnlock(mutex *m);
 bool mutexIsLocked(mutex *m, int *lockedTaskID);
@@ -60,6 +72,29 @@ void mutexShow(mutex *m);
 void mutexInit(mutex *m, mtxtype_t mtype);
 void mutexDeInit(mutex *m);
 void mutexDebugOwned(const char **name, int64_t *owned);
+char *justFilename(const char *fileName);
+void mutexMemoryStats(uint32_t *count, uint32_t *bytes);
+
+// Contention and hold-time stats, gathered per mutex type.  Times are in cycles.
+#define MUTEX_PROFILE_TYPES     12
+typedef struct {
+    mtxtype_t mtx;
+    uint32_t acquisitions;
+    uint32_t contended;
+    uint64_t waitCycles;
+    uint32_t waitMaxCycles;
+    uint64_t holdCycles;
+    uint32_t holdMaxCycles;
+#if mutexTrace
+    const char *holdMaxFilename;
+    uint32_t holdMaxLineno;
+    const char *waitMaxFilename;
+    uint32_t waitMaxLineno;
+#endif
+} mutexProfileEntry;
+bool mutexProfileGet(int slot, mutexProfileEntry *entry);
+void mutexProfileReset(void);
+const char *mutexTypeName(mtxtype_t mtx);
 
 // Events
 typedef struct {
@@ -14,7 +14,13 @@ char *rsetstate (const char *arg_state);
 long rrandom();
 
 // Statics
-STATIC mutex randMutex = {MTX_RAND, {0}};
+STATIC mutex randMutex = {0};
+
+// Init the random number package, before the scheduler starts
+void randInit(void)
+{
+    mutexInit(&randMutex, MTX_RAND);
+}
 
 // Method to generate a 32-bit TRNG, with on-demand initialization
 uint32_t halGenerateRandomNumber()
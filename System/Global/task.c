@@ -5,93 +5,146 @@
 #include "app.h"
 #include "global.h"
 #include "mutex.h"
+#include "rtc.h"
 
 // The mutex to protect event queues
-STATIC mutex queueMutex = {MTX_QUEUE, {0}};
-
-// Under FreeRTOS, the task contexts are task handles
-STATIC TaskHandle_t taskHandle[TASKID_NUM_TASKS] = {0};
-STATIC int64_t takeTimeoutDueMs[TASKID_NUM_TASKS] = {0};
-STATIC char *taskName[TASKID_NUM_TASKS] = {0};
-STATIC char taskLetter[TASKID_NUM_TASKS] = {0};
-STATIC uint32_t taskStackBytes[TASKID_NUM_TASKS] = {0};
-STATIC bool taskNoBlock[TASKID_NUM_TASKS] = {0};
-
+STATIC mutex queueMutex = {0};
+
+// Under FreeRTOS, the task contexts are task handles.  Each registered task also
+// has its info attached to its thread-local storage, so that a task can find its
+// own in constant time rather than by searching for its handle.
+#define TASK_TLS_INFO 0
+typedef struct {
+    int id;
+    TaskHandle_t handle;
+    char *name;
+    char letter;
+    uint32_t stackBytes;
+    bool noBlock;
+    bool signalled;
+    int64_t takeTimeoutDueMs;
+    msgq messages;
+    int64_t stackSampledMs;
+    uint32_t stackWorstBytes;
+} taskInfo;
+STATIC taskInfo tasks[TASKID_NUM_TASKS] = {0};
+
+// Stack profiling.  FreeRTOS paints each stack when the task is created, so the
+// high-water mark can be found by looking for where the paint ends.  Because that
+// scan isn't free, each task samples its own at most once a second as it blocks,
+// and the worst case seen is kept in RTC backup registers so that it accumulates
+// across resets over the course of a test workload.
+#define TASK_STACK_MAGIC            (0x53544B00 | TASKID_NUM_TASKS)
+#define TASK_STACK_SAMPLE_MS        1000
+#define TASK_STACK_MIN_MARGIN       500         // Below this remaining, taskStackStats warns
+
+// Forwards
+taskInfo *taskCurrent(void);
+void taskWake(taskInfo *t, uint32_t bits);
+#if TASK_STACK_PROFILE
+void taskStackSample(taskInfo *t);
+#endif
+
+// Get the info of the running task, or NULL if in an ISR, before the scheduler has
+// started, or in a task that hasn't registered (such as the idle task)
+taskInfo *taskCurrent(void)
+{
+    if (__get_IPSR() != 0) {
+        return NULL;
+    }
+    TaskHandle_t currentTaskHandle = xTaskGetCurrentTaskHandle();
+    if (currentTaskHandle == NULL) {
+        return NULL;
+    }
+    return (taskInfo *) pvTaskGetThreadLocalStoragePointer(currentTaskHandle, TASK_TLS_INFO);
+}
 
 // Set a task as doing its own blocking as opposed to using taskTake for blocks
 void taskRegisterAsNonBlocking(int taskID)
 {
-    taskNoBlock[taskID] = true;
+    tasks[taskID].noBlock = true;
+}
+
+// Set a task as waiting with taskWaitSignals rather than taskTake, so that the
+// notification value holds readiness bits rather than a count
+void taskRegisterAsSignalled(int taskID)
+{
+    tasks[taskID].signalled = true;
+}
+
+// Init the task package, before the scheduler starts
+void taskInit(void)
+{
+    mutexInit(&queueMutex, MTX_QUEUE);
 }
 
 // Register a task's context
 void taskRegister(int taskID, char *name, char letter, uint32_t stackBytes)
 {
-    taskHandle[taskID] = xTaskGetCurrentTaskHandle();
-    taskName[taskID] = name;
-    taskLetter[taskID] = letter;
-    taskStackBytes[taskID] = stackBytes;
+    taskInfo *info = &tasks[taskID];
+    info->id = taskID;
+    info->name = name;
+    info->letter = letter;
+    info->stackBytes = stackBytes;
+    info->handle = xTaskGetCurrentTaskHandle();
+    vTaskSetThreadLocalStoragePointer(info->handle, TASK_TLS_INFO, info);
+
+    // Pick up the worst case recorded before the last reset
+#if TASK_STACK_PROFILE
+    if (MX_RTC_GetBackup(RTC_BACKUP_STACK_MAGIC) != TASK_STACK_MAGIC) {
+        taskStackProfileReset();
+    }
+    info->stackWorstBytes = MX_RTC_GetBackup(RTC_BACKUP_STACK_FIRST + taskID);
+#endif
 }
 
 // Get a task's name
 char *taskLabel(int taskID)
 {
-    char *label = taskName[taskID];
+    if (taskID < 0 || taskID >= TASKID_NUM_TASKS) {
+        return "";
+    }
+    char *label = tasks[taskID].name;
     return label == NULL ? "" : label;
 }
 
-// Get a task's identifying character
+// Get a task's identifying character, or '?' if not a registered task
 char taskIdentifier(void)
 {
-    char taskChar = '?';
-    TaskHandle_t currentTaskHandle = xTaskGetCurrentTaskHandle();
-    for (int task=0; task<TASKID_NUM_TASKS; task++) {
-        if (taskHandle[task] == currentTaskHandle) {
-            taskChar = taskLetter[task];
-            break;
-        }
-    }
-    return taskChar;
+    taskInfo *info = taskCurrent();
+    return info == NULL ? '?' : info->letter;
 }
 
-// Get a task's ID.
+// Get a task's ID, or TASKID_UNKNOWN if not a registered task
 int taskID(void)
 {
-    int id = 0;
-    TaskHandle_t currentTaskHandle = xTaskGetCurrentTaskHandle();
-    for (int task=0; task<TASKID_NUM_TASKS; task++) {
-        if (taskHandle[task] == currentTaskHandle) {
-            return task;
-        }
-    }
-    // Defensive programming only.
-    debugPanic("task not found");
-    return id;
+    taskInfo *info = taskCurrent();
+    return info == NULL ? TASKID_UNKNOWN : info->id;
 }
 
 // Return the shortest number of milliseconds that it's safe to sleep, in absence of an interrupt,
 // based upon the timeouts on the taskTake()'s that are in-progress.
 uint32_t taskAllIdleForMs(bool trace)
 {
-    int myTaskID = taskID();
+    taskInfo *me = taskCurrent();
     int64_t nowMs = timerMs();
     int64_t firstDueMs = 0;
     bool somethingRunning = false;
     char buf[32], status[256];
     if (trace) {
-        snprintf(status, sizeof(status), "%c:run", taskLetter[myTaskID]);
+        snprintf(status, sizeof(status), "%c:run", me == NULL ? '?' : me->letter);
     }
     for (int i=0; i<TASKID_NUM_TASKS; i++) {
         // Skip tasks that aren't initialized, and skip our task because obviously we're running
-        if (taskNoBlock[i] || taskName[i] == NULL || i == myTaskID) {
+        if (tasks[i].noBlock || tasks[i].name == NULL || &tasks[i] == me) {
             continue;
         }
         // If we find something running or which is already due, we're done
-        int64_t taskDueMs = takeTimeoutDueMs[i];
+        int64_t taskDueMs = tasks[i].takeTimeoutDueMs;
         if (taskDueMs == 0) {
             somethingRunning = true;
             if (trace) {
-                snprintf(buf, sizeof(buf), " %c:run", taskLetter[i]);
+                snprintf(buf, sizeof(buf), " %c:run", tasks[i].letter);
                 strLcat(status, buf);
             } else {
                 break;
@@ -99,7 +152,7 @@ uint32_t taskAllIdleForMs(bool trace)
         } else if (taskDueMs < nowMs) {
             somethingRunning = true;
             if (trace) {
-                snprintf(buf, sizeof(buf), " %c:due", taskLetter[i]);
+                snprintf(buf, sizeof(buf), " %c:due", tasks[i].letter);
                 strLcat(status, buf);
             } else {
                 break;
@@ -111,9 +164,9 @@ uint32_t taskAllIdleForMs(bool trace)
             if (trace) {
                 uint32_t ms = (uint32_t) (taskDueMs - nowMs);
                 if (ms > ms1Sec) {
-                    snprintf(buf, sizeof(buf), " %c:%lds", taskLetter[i], (long) (ms/ms1Sec));
+                    snprintf(buf, sizeof(buf), " %c:%lds", tasks[i].letter, (long) (ms/ms1Sec));
                 } else {
-                    snprintf(buf, sizeof(buf), " %c:%ldms", taskLetter[i], (long) ms);
+                    snprintf(buf, sizeof(buf), " %c:%ldms", tasks[i].letter, (long) ms);
                 }
                 strLcat(status, buf);
             }
@@ -145,49 +198,179 @@ bool taskTake(int taskID, uint32_t timeoutMs)
     }
 
     // Defensive coding for init
-    if (taskHandle[taskID] == 0) {
+    if (tasks[taskID].handle == 0) {
+        return true;
+    }
+
+    // Don't block if messages are already waiting
+    if (msgqPending(&tasks[taskID].messages) != 0) {
         return true;
     }
 
+    // Note how deep the stack has been, now that we're at rest
+#if TASK_STACK_PROFILE
+    taskStackSample(&tasks[taskID]);
+#endif
+
     // Pause
-    tssPreSuspend(taskID);
-    takeTimeoutDueMs[taskID] = timerMs() + (int64_t) timeoutMs;
+    tasks[taskID].takeTimeoutDueMs = timerMs() + (int64_t) timeoutMs;
     bool timeout = (ulTaskNotifyTake(pdFALSE, timeoutMs) == 0);
-    takeTimeoutDueMs[taskID] = 0;
+    tasks[taskID].takeTimeoutDueMs = 0;
     tssPostSuspend(taskID);
 
     // Done
     return !timeout;
 }
 
-// Give to an event's semaphore, but not from an ISR
-void taskGive(int taskID)
+// Wait for any of the readiness bits set by taskSignal, or for a taskGive or
+// taskPost (which set TASK_SIGNAL_WAKE), returning the bits that were set and
+// clearing them, or 0 if timeout.  This is for tasks registered as signalled.
+uint32_t taskWaitSignals(int taskID, uint32_t timeoutMs)
 {
-    if (taskHandle[taskID] == 0) {
-        return;
+
+    // Same timeout semantics as taskTake
+    if (timeoutMs == 0) {
+        timeoutMs = 1;
     }
-    TaskHandle_t hTask = taskHandle[taskID];
-    if (hTask != xTaskGetCurrentTaskHandle()) {
-        xTaskNotifyGive(hTask);
+    if (timeoutMs == TASK_WAIT_FOREVER) {
+        timeoutMs = portMAX_DELAY;
     }
+    taskInfo *t = &tasks[taskID];
+    if (t->handle == 0) {
+        return TASK_SIGNAL_WAKE;
+    }
+
+    // Don't block if messages are already waiting, but do pick up whatever else is ready
+    uint32_t bits = 0;
+    if (msgqPending(&t->messages) != 0) {
+        bits |= TASK_SIGNAL_WAKE;
+        timeoutMs = 0;
+    }
+#if TASK_STACK_PROFILE
+    taskStackSample(t);
+#endif
+
+    // Pause
+    uint32_t signalled = 0;
+    t->takeTimeoutDueMs = timerMs() + (int64_t) timeoutMs;
+    xTaskNotifyWait(0, UINT32_MAX, &signalled, timeoutMs);
+    t->takeTimeoutDueMs = 0;
+    tssPostSuspend(taskID);
+    return bits | signalled;
+
 }
 
-// Give to all tasks from an ISR
-void taskGiveAllFromISR(void)
+// Collect, without blocking, the readiness bits set since the last taskWaitSignals or
+// taskPollSignals, clearing them.  This lets a task that is still busy with one source
+// learn that others have become ready.
+uint32_t taskPollSignals(int taskID)
 {
-    for (int task=0; task<TASKID_NUM_TASKS; task++) {
-        taskGiveFromISR(task);
+    taskInfo *t = &tasks[taskID];
+    if (t->handle == 0) {
+        return 0;
+    }
+    uint32_t bits = 0;
+    if (msgqPending(&t->messages) != 0) {
+        bits |= TASK_SIGNAL_WAKE;
+    }
+    uint32_t signalled = 0;
+    xTaskNotifyWait(0, UINT32_MAX, &signalled, 0);
+    return bits | signalled;
+}
+
+// Set readiness bits for a signalled task and wake it, from an ISR or a task
+void taskSignal(int taskID, uint32_t bits)
+{
+    if (taskID < 0 || taskID >= TASKID_NUM_TASKS) {
+        return;
+    }
+    taskWake(&tasks[taskID], bits);
+}
+
+// Wake a task, from an ISR or a task.  A signalled task has the bits set in its
+// notification value, and any other has its notification count given to.
+void taskWake(taskInfo *t, uint32_t bits)
+{
+    if (t->handle == 0) {
+        return;
     }
+    if (MX_InISR()) {
+        if (t->signalled) {
+            xTaskNotifyFromISR(t->handle, bits, eSetBits, NULL);
+        } else {
+            vTaskNotifyGiveFromISR(t->handle, NULL);
+        }
+    } else if (t->handle != xTaskGetCurrentTaskHandle()) {
+        if (t->signalled) {
+            xTaskNotify(t->handle, bits, eSetBits);
+        } else {
+            xTaskNotifyGive(t->handle);
+        }
+    }
+}
+
+// Give to an event's semaphore, but not from an ISR
+void taskGive(int taskID)
+{
+    taskWake(&tasks[taskID], TASK_SIGNAL_WAKE);
 }
 
 // Give to an event's semaphore from an ISR, and allow the scheduler to naturally determine what
 // task is next to be scheduled given task priorities as they are.
 void taskGiveFromISR(int taskID)
 {
-    if (taskHandle[taskID] == 0) {
-        return;
+    taskWake(&tasks[taskID], TASK_SIGNAL_WAKE);
+}
+
+// Post a message to a task and wake it, from an ISR or a task, returning false if its
+// queue is full.  The queue has a single consumer, but because interrupts of different
+// priorities may post to the same task, producers are serialized by masking interrupts
+// for the duration of the put.
+bool taskPost(int taskID, uint32_t type, uint32_t value)
+{
+    if (taskID < 0 || taskID >= TASKID_NUM_TASKS) {
+        return false;
+    }
+    taskInfo *t = &tasks[taskID];
+    if (t->handle == 0) {
+        return false;
+    }
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    bool posted = msgqPut(&t->messages, type, value);
+    __set_PRIMASK(primask);
+    taskWake(t, TASK_SIGNAL_WAKE);
+    return posted;
+}
+
+// Post a message to all tasks
+void taskPostAll(uint32_t type, uint32_t value)
+{
+    for (int task=0; task<TASKID_NUM_TASKS; task++) {
+        taskPost(task, type, value);
+    }
+}
+
+// Take the next message posted to a task, returning false if there is none.  Only the
+// task itself may do this.
+bool taskReceive(int taskID, msgqMsg *msg)
+{
+    return msgqGet(&tasks[taskID].messages, msg);
+}
+
+// Show message queue stats
+void taskMessageStats(void)
+{
+    debugR("task messages:\n");
+    for (int task=0; task<TASKID_NUM_TASKS; task++) {
+        msgq *q = &tasks[task].messages;
+        if (tasks[task].handle != 0) {
+            debugR("  %12s: %lu posted %lu overflowed %lu/%d peak %lu pending\n", tasks[task].name,
+                   (unsigned long) q->posted, (unsigned long) q->overflows, (unsigned long) q->highWater,
+                   MSGQ_CAPACITY, (unsigned long) msgqPending(q));
+        }
     }
-    vTaskNotifyGiveFromISR(taskHandle[taskID], NULL);
+    debugR("\n");
 }
 
 // Terminate all task scheduling
@@ -202,20 +385,49 @@ void taskResume()
     xTaskResumeAll();
 }
 
-// Check stack stats
+// Sample the calling task's stack high-water mark, persisting it if it's a new worst case
+#if TASK_STACK_PROFILE
+void taskStackSample(taskInfo *t)
+{
+    if (!timerMsElapsed(t->stackSampledMs, TASK_STACK_SAMPLE_MS)) {
+        return;
+    }
+    t->stackSampledMs = timerMs();
+    uint32_t usedBytes = t->stackBytes - (uint32_t) (uxTaskGetStackHighWaterMark(NULL) * sizeof(StackType_t));
+    if (usedBytes > t->stackWorstBytes) {
+        t->stackWorstBytes = usedBytes;
+        MX_RTC_SetBackup(RTC_BACKUP_STACK_FIRST + t->id, usedBytes);
+    }
+}
+#endif
+
+// Forget the worst-case stack use recorded across resets
+void taskStackProfileReset(void)
+{
+#if TASK_STACK_PROFILE
+    for (int task=0; task<TASKID_NUM_TASKS; task++) {
+        MX_RTC_SetBackup(RTC_BACKUP_STACK_FIRST + task, 0);
+        tasks[task].stackWorstBytes = 0;
+    }
+    MX_RTC_SetBackup(RTC_BACKUP_STACK_MAGIC, TASK_STACK_MAGIC);
+#endif
+}
+
+// Check stack stats, and when profiling suggest stack sizes that leave a margin of a
+// quarter of the worst case seen (but at least TASK_STACK_MIN_MARGIN) over it
 void taskStackStats()
 {
 
     debugR("task stacks:\n");
 
     for (int task=0; task<TASKID_NUM_TASKS; task++) {
-        TaskHandle_t hTask = taskHandle[task];
+        TaskHandle_t hTask = tasks[task].handle;
         if (hTask != 0) {
             TaskStatus_t status;
             vTaskGetInfo(hTask, &status, pdTRUE, eInvalid);
-            double pct = (double)(status.usStackHighWaterMark*sizeof(StackType_t))/(double)taskStackBytes[task];
-            debugR("  %12s: %lu/%lu %0.2f%% remaining\n", status.pcTaskName, status.usStackHighWaterMark*sizeof(StackType_t), taskStackBytes[task], pct*100.0);
-            if (status.usStackHighWaterMark < STACKWORDS(500)) {
+            double pct = (double)(status.usStackHighWaterMark*sizeof(StackType_t))/(double)tasks[task].stackBytes;
+            debugR("  %12s: %lu/%lu %0.2f%% remaining\n", status.pcTaskName, status.usStackHighWaterMark*sizeof(StackType_t), tasks[task].stackBytes, pct*100.0);
+            if (status.usStackHighWaterMark < STACKWORDS(TASK_STACK_MIN_MARGIN)) {
                 for (int i=0; i<8; i++) {
                     debugf("*****************************************************\n");
                     if (i == 4) {
@@ -226,10 +438,55 @@ void taskStackStats()
         }
     }
 
+#if TASK_STACK_PROFILE
+    debugR("task stacks, worst case across resets:\n");
+    for (int task=0; task<TASKID_NUM_TASKS; task++) {
+        taskInfo *t = &tasks[task];
+        if (t->handle != 0) {
+            uint32_t usedBytes = t->stackBytes - (uint32_t) (uxTaskGetStackHighWaterMark(t->handle) * sizeof(StackType_t));
+            uint32_t worstBytes = GMAX(t->stackWorstBytes, usedBytes);
+            uint32_t suggestedBytes = worstBytes + GMAX(worstBytes / 4, TASK_STACK_MIN_MARGIN);
+            suggestedBytes = ((suggestedBytes + 99) / 100) * 100;
+            debugR("  %12s: %lu used of %lu, suggest %lu\n", t->name, (unsigned long) worstBytes,
+                   (unsigned long) t->stackBytes, (unsigned long) suggestedBytes);
+        }
+    }
+#endif
+
     debugR("\n");
 
 }
 
+// Show where RAM has gone to long-lived RTOS objects.  When statically allocating,
+// each of these is also listed by name in the linker's map file.
+void taskMemoryStats(void)
+{
+#if STATIC_ALLOCATION_PROFILE
+    const char *where = "static";
+#else
+    const char *where = "heap";
+#endif
+    debugR("RAM by consumer (%s):\n", where);
+    uint32_t total = 0;
+    for (int task=0; task<TASKID_NUM_TASKS; task++) {
+        if (tasks[task].handle != 0) {
+            uint32_t bytes = tasks[task].stackBytes + sizeof(StaticTask_t);
+            debugR("  %12s: %lu (stack %lu, tcb %lu)\n", tasks[task].name, (unsigned long) bytes,
+                   (unsigned long) tasks[task].stackBytes, (unsigned long) sizeof(StaticTask_t));
+            total += bytes;
+        }
+    }
+    uint32_t mutexCount, mutexBytes;
+    mutexMemoryStats(&mutexCount, &mutexBytes);
+    debugR("  %12s: %lu (%lu)\n", "mutexes", (unsigned long) mutexBytes, (unsigned long) mutexCount);
+    total += mutexBytes;
+#if STATIC_ALLOCATION_PROFILE
+    debugR("  %12s: %lu\n", "heap", (unsigned long) configTOTAL_HEAP_SIZE);
+    total += configTOTAL_HEAP_SIZE;
+#endif
+    debugR("  %12s: %lu\n", "total", (unsigned long) total);
+}
+
 // Temporarily increase the task's priority to maximum
 uint32_t taskIOPriorityBegin()
 {
@@ -250,7 +507,7 @@ void taskStackOverflowCheck()
 {
 
     for (int task=0; task<TASKID_NUM_TASKS; task++) {
-        TaskHandle_t hTask = taskHandle[task];
+        TaskHandle_t hTask = tasks[task].handle;
         if (hTask != 0) {
             TaskStatus_t status;
             vTaskGetInfo(hTask, &status, pdTRUE, eInvalid);
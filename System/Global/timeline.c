@@ -0,0 +1,184 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#include "main.h"
+#include "app.h"
+#include "global.h"
+#include <stdatomic.h>
+
+// Event timeline.  While enabled, context switches (from the FreeRTOS trace hooks
+// in FreeRTOSConfig.h), interrupt entry and exit, and spans marked by the audio
+// pipeline are recorded into a ring that is continuously overwritten, so that it
+// always holds the most recent events.  It is dumped in the Chrome trace event
+// format, which Perfetto and chrome://tracing load once Test/traceextract.c has
+// separated it from the rest of a captured log.
+//
+// Events are stamped with the cycle counter for resolution, but because it stops
+// while the core sleeps, each also carries the low bits of the tick so that the
+// dump can tell when time passed that the cycle counter didn't see.
+
+// Event types
+#define TL_TASK_IN          0
+#define TL_TASK_OUT         1
+#define TL_ISR_ENTER        2
+#define TL_ISR_EXIT         3
+#define TL_SPAN_BEGIN       4
+#define TL_SPAN_END         5
+
+typedef struct {
+    uint32_t cycles;
+    uint16_t ms;
+    uint8_t type;
+    uint8_t id;
+} timelineEvent;
+
+STATIC timelineEvent timeline[TIMELINE_EVENTS];
+STATIC atomic_uint timelineNext = 0;
+STATIC volatile bool timelineOn = false;
+
+// Names of spans, as they will appear on the timeline
+STATIC const char *timelineSpanName[TIMELINE_SPAN_COUNT] = {
+    "block",
+    "pdm2pcm",
+    "bands",
+    "adpcm",
+};
+
+// Threads in the trace, where tasks use their FreeRTOS task number
+#define TL_TID_ISR          100
+#define TL_TID_SPAN         200
+
+// Forwards
+void timelineRecord(uint8_t type, uint8_t id);
+
+// Record an event, from any context
+void timelineRecord(uint8_t type, uint8_t id)
+{
+    if (!timelineOn) {
+        return;
+    }
+    uint32_t i = atomic_fetch_add(&timelineNext, 1) % TIMELINE_EVENTS;
+    timeline[i].cycles = MX_CYC_Count();
+    timeline[i].ms = (uint16_t) HAL_GetTick();
+    timeline[i].type = type;
+    timeline[i].id = id;
+}
+
+// Context switches, from the FreeRTOS trace hooks by way of tss.c
+void timelineTaskSwitchedIn(uint32_t taskNumber)
+{
+    timelineRecord(TL_TASK_IN, (uint8_t) taskNumber);
+}
+void timelineTaskSwitchedOut(uint32_t taskNumber)
+{
+    timelineRecord(TL_TASK_OUT, (uint8_t) taskNumber);
+}
+
+// Interrupt markers, by way of tss.c
+void timelineIsrEnter(uint8_t isr)
+{
+    timelineRecord(TL_ISR_ENTER, isr);
+}
+void timelineIsrExit(uint8_t isr)
+{
+    timelineRecord(TL_ISR_EXIT, isr);
+}
+
+// Spans of work within a task
+void timelineSpanBegin(uint8_t span)
+{
+    timelineRecord(TL_SPAN_BEGIN, span);
+}
+void timelineSpanEnd(uint8_t span)
+{
+    timelineRecord(TL_SPAN_END, span);
+}
+
+// Start recording afresh, or stop
+void timelineEnable(bool on)
+{
+    if (on && !timelineOn) {
+        atomic_store(&timelineNext, 0);
+    }
+    timelineOn = on;
+}
+
+// See if recording, and how many events are held
+bool timelineStatus(uint32_t *events)
+{
+    *events = GMIN(atomic_load(&timelineNext), TIMELINE_EVENTS);
+    return timelineOn;
+}
+
+// Dump the timeline as a Chrome trace.  Recording is paused while we do so, because
+// the output itself would otherwise overwrite what we're dumping.
+void timelineDump(void)
+{
+    bool wasOn = timelineOn;
+    timelineOn = false;
+
+    // Name the threads
+    debugR("{\"traceEvents\":[\n");
+    UBaseType_t taskCount = uxTaskGetNumberOfTasks();
+    TaskStatus_t tasks[TASKID_NUM_TASKS+4];
+    taskCount = uxTaskGetSystemState(tasks, GMIN(taskCount, sizeof(tasks)/sizeof(tasks[0])), NULL);
+    for (UBaseType_t i=0; i<taskCount; i++) {
+        debugR("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%lu,\"args\":{\"name\":\"%s\"}},\n",
+               (unsigned long) tasks[i].xTaskNumber, tasks[i].pcTaskName);
+    }
+    for (int i=0; i<TSS_ISR_COUNT; i++) {
+        debugR("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"isr %s\"}},\n",
+               TL_TID_ISR+i, tssIsrName(i));
+    }
+    debugR("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"audio pipeline\"}},\n", TL_TID_SPAN);
+
+    // Walk the events from oldest to newest, converting their stamps to a running
+    // time.  If the tick advanced by more than the cycle counter can account for,
+    // the core was asleep and we go by the tick instead.
+    uint32_t next = atomic_load(&timelineNext);
+    uint32_t count = GMIN(next, TIMELINE_EVENTS);
+    double us = 0;
+    uint32_t prevCycles = 0;
+    uint16_t prevMs = 0;
+    for (uint32_t n=next-count; n!=next; n++) {
+        timelineEvent *e = &timeline[n % TIMELINE_EVENTS];
+        if (n != next-count) {
+            double cycleUs = MX_CYC_ToUs((uint32_t) (e->cycles - prevCycles));
+            double tickUs = (double) (uint16_t) (e->ms - prevMs) * 1000.0;
+            us += (tickUs > cycleUs + 2000.0) ? tickUs : cycleUs;
+        }
+        prevCycles = e->cycles;
+        prevMs = e->ms;
+
+        const char *name = "";
+        int tid = e->id;
+        bool begin = false;
+        switch (e->type) {
+        case TL_TASK_IN:
+        case TL_TASK_OUT:
+            for (UBaseType_t i=0; i<taskCount; i++) {
+                if (tasks[i].xTaskNumber == e->id) {
+                    name = tasks[i].pcTaskName;
+                }
+            }
+            begin = (e->type == TL_TASK_IN);
+            break;
+        case TL_ISR_ENTER:
+        case TL_ISR_EXIT:
+            name = tssIsrName(e->id);
+            tid = TL_TID_ISR + e->id;
+            begin = (e->type == TL_ISR_ENTER);
+            break;
+        default:
+            name = (e->id < TIMELINE_SPAN_COUNT) ? timelineSpanName[e->id] : "";
+            tid = TL_TID_SPAN;
+            begin = (e->type == TL_SPAN_BEGIN);
+            break;
+        }
+        debugR("{\"name\":\"%s\",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":1,\"tid\":%d},\n", name, begin ? "B" : "E", us, tid);
+    }
+    debugR("{}]}\n");
+
+    timelineOn = wasOn;
+}
@@ -13,11 +13,17 @@
 STATIC int64_t bootTimeMs = 0;
 
 // Protect clib
-STATIC mutex timeMutex = {MTX_TIME, {0}};
+STATIC mutex timeMutex = {0};
 
 // timegm.c
 extern time_t rk_timegm (struct tm *tm);
 
+// Init the timer package, before the scheduler starts
+void timerInit(void)
+{
+    mutexInit(&timeMutex, MTX_TIME);
+}
+
 // Get the approximate number of seconds since boot
 int64_t timerMsSinceBoot()
 {
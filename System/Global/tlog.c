@@ -0,0 +1,323 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#include "tlog.h"
+#include <stdio.h>
+#include <string.h>
+
+// A parsed conversion specification, such as "%-*.2lf"
+typedef struct {
+    const char *begin;          // The '%'
+    const char *end;            // Just past the conversion character
+    uint8_t stars;              // Widths and precisions taken from arguments
+    bool precisionStar;         // The last of those is the precision
+    int32_t precision;          // A precision given in the format, or -1
+    bool longLong;              // ll or j
+    bool longDouble;            // L
+    char conversion;
+} tlogSpec;
+
+// Parse the conversion specification beginning at the '%'
+static const char *tlogParse(const char *p, tlogSpec *spec)
+{
+    spec->begin = p++;
+    spec->stars = 0;
+    spec->precisionStar = false;
+    spec->precision = -1;
+    spec->longLong = spec->longDouble = false;
+    while (*p != '\0' && strchr("-+ #0", *p) != NULL) {
+        p++;
+    }
+    for (int part=0; part<2; part++) {
+        if (*p == '*') {
+            spec->stars++;
+            spec->precisionStar = (part == 1);
+            p++;
+        }
+        if (part == 1 && !spec->precisionStar) {
+            spec->precision = 0;
+        }
+        while (*p >= '0' && *p <= '9') {
+            if (part == 1) {
+                spec->precision = (spec->precision * 10) + (*p - '0');
+            }
+            p++;
+        }
+        if (part == 0 && *p == '.') {
+            p++;
+        } else {
+            break;
+        }
+    }
+    while (*p != '\0' && strchr("hljztL", *p) != NULL) {
+        if ((p[0] == 'l' && p[1] == 'l') || p[0] == 'j') {
+            spec->longLong = true;
+        }
+        if (p[0] == 'L') {
+            spec->longDouble = true;
+        }
+        p++;
+    }
+    spec->conversion = *p;
+    if (*p != '\0') {
+        p++;
+    }
+    spec->end = p;
+    return p;
+}
+
+// Conversion classes
+static bool tlogIsFloat(char c)
+{
+    return (c != '\0' && strchr("fFeEgGaA", c) != NULL);
+}
+static bool tlogIsInt(char c)
+{
+    return (c != '\0' && strchr("diuxXoc", c) != NULL);
+}
+
+// Little-endian argument access
+static void tlogPut(uint8_t *p, uint64_t v, uint32_t len)
+{
+    for (uint32_t i=0; i<len; i++) {
+        p[i] = (uint8_t) (v >> (i*8));
+    }
+}
+static uint64_t tlogGet(const uint8_t *p, uint32_t len)
+{
+    uint64_t v = 0;
+    for (uint32_t i=0; i<len; i++) {
+        v |= (uint64_t) p[i] << (i*8);
+    }
+    return v;
+}
+
+// Capture the arguments consumed by a format as records, calling post for each, and
+// returning how many were posted
+uint32_t tlogCapture(const char *format, va_list vaArgs, tlogPostFn post)
+{
+    uint8_t args[TLOG_MAX_ARGS];
+    uint32_t len = 0;
+    uint32_t records = 0;
+    const char *recordFormat = format;
+    const char *p = format;
+    while ((p = strchr(p, '%')) != NULL) {
+        tlogSpec spec;
+        p = tlogParse(p, &spec);
+        if (spec.conversion == '%' || spec.conversion == '\0') {
+            continue;
+        }
+
+        // Widths and precisions
+        int32_t stars[2];
+        for (int i=0; i<spec.stars; i++) {
+            stars[i] = (int32_t) va_arg(vaArgs, int);
+        }
+        if (spec.precisionStar) {
+            spec.precision = (stars[spec.stars-1] < 0) ? -1 : stars[spec.stars-1];
+        }
+
+        // The value, where a string is copied, only as far as its precision, so that
+        // it needn't outlive the call
+        const char *str = NULL;
+        uint64_t v = 0;
+        uint32_t vlen;
+        if (spec.conversion == 's') {
+            str = va_arg(vaArgs, const char *);
+            if (str == NULL) {
+                str = "(null)";
+            }
+            vlen = (uint32_t) strlen(str);
+            if (spec.precision >= 0 && vlen > (uint32_t) spec.precision) {
+                vlen = (uint32_t) spec.precision;
+            }
+            vlen++;
+        } else if (tlogIsFloat(spec.conversion)) {
+            double d = spec.longDouble ? (double) va_arg(vaArgs, long double) : va_arg(vaArgs, double);
+            memcpy(&v, &d, sizeof(v));
+            vlen = 8;
+        } else if (spec.conversion == 'n') {
+            (void) va_arg(vaArgs, void *);
+            continue;
+        } else if (spec.conversion == 'p') {
+            v = (uintptr_t) va_arg(vaArgs, void *);
+            vlen = 4;
+        } else if (spec.longLong) {
+            v = (uint64_t) va_arg(vaArgs, long long);
+            vlen = 8;
+        } else {
+            v = (uint32_t) va_arg(vaArgs, long);
+            vlen = 4;
+        }
+
+        // If it doesn't fit, post what's been captured, which renders up to this
+        // conversion, and continue in a record whose format begins with it
+        uint32_t need = (spec.stars * 4) + vlen;
+        if (len + need > sizeof(args) && (len > 0 || spec.begin > recordFormat)) {
+            if (!post(recordFormat, args, len)) {
+                return records;
+            }
+            records++;
+            len = 0;
+            recordFormat = spec.begin;
+        }
+
+        // A string too long for any record is posted alone, in pieces, and the format
+        // then continues beyond it
+        if (need > sizeof(args)) {
+            for (uint32_t remaining = vlen - 1; remaining > 0;) {
+                uint32_t chunk = (remaining < sizeof(args) - 1) ? remaining : sizeof(args) - 1;
+                memcpy(args, str, chunk);
+                args[chunk] = '\0';
+                if (!post(TLOG_STRING, args, chunk + 1)) {
+                    return records;
+                }
+                records++;
+                str += chunk;
+                remaining -= chunk;
+            }
+            recordFormat = spec.end;
+            continue;
+        }
+
+        // Capture it
+        for (int i=0; i<spec.stars; i++) {
+            tlogPut(&args[len], (uint32_t) stars[i], 4);
+            len += 4;
+        }
+        if (str != NULL) {
+            memcpy(&args[len], str, vlen - 1);
+            len += vlen - 1;
+            args[len++] = '\0';
+        } else {
+            tlogPut(&args[len], v, vlen);
+            len += vlen;
+        }
+
+    }
+
+    // Post what remains, unless a long string ended the format
+    if (len > 0 || *recordFormat != '\0') {
+        if (!post(recordFormat, args, len)) {
+            return records;
+        }
+        records++;
+    }
+    return records;
+}
+
+// Render a format with captured arguments as text, returning its length
+uint32_t tlogRender(const char *format, const uint8_t *args, uint32_t argsLen, char *text, uint32_t textMax)
+{
+    if (textMax == 0) {
+        return 0;
+    }
+    uint32_t len = 0;
+    uint32_t a = 0;
+    const char *p = format;
+    text[0] = '\0';
+    while (*p != '\0' && len < textMax-1) {
+
+        // Copy literal text
+        const char *pct = strchr(p, '%');
+        uint32_t literal = (pct == NULL) ? (uint32_t) strlen(p) : (uint32_t) (pct - p);
+        if (literal > 0) {
+            if (literal > textMax-1-len) {
+                literal = textMax-1-len;
+            }
+            memcpy(&text[len], p, literal);
+            len += literal;
+            text[len] = '\0';
+            p += literal;
+            continue;
+        }
+
+        // Rebuild the specification with its widths and precisions filled in
+        tlogSpec spec;
+        p = tlogParse(p, &spec);
+        char fmt[32];
+        uint32_t f = 0;
+        for (const char *s=spec.begin; s<spec.end && f<sizeof(fmt)-12; s++) {
+            if (*s != '*') {
+                fmt[f++] = *s;
+                continue;
+            }
+            int32_t v = 0;
+            if (a + 4 <= argsLen) {
+                v = (int32_t) tlogGet(&args[a], 4);
+                a += 4;
+            }
+            if (v < 0 && f > 0 && fmt[f-1] == '.') {
+                f--;
+            } else {
+                f += (uint32_t) snprintf(&fmt[f], sizeof(fmt)-f, "%ld", (long) v);
+            }
+        }
+        fmt[f] = '\0';
+
+        // Format the value, stopping if the arguments run out
+        char *out = &text[len];
+        size_t outMax = textMax - len;
+        int n;
+        if (spec.conversion == '%') {
+            n = snprintf(out, outMax, "%%");
+        } else if (spec.conversion == 'n' || spec.conversion == '\0') {
+            n = 0;
+        } else if (spec.conversion == 's') {
+            if (a >= argsLen) {
+                break;
+            }
+            const char *s = (const char *) &args[a];
+            uint32_t slen = 0;
+            while (a + slen < argsLen && slen < TLOG_MAX_ARGS && s[slen] != '\0') {
+                slen++;
+            }
+            char str[TLOG_MAX_ARGS+1];
+            memcpy(str, s, slen);
+            str[slen] = '\0';
+            a += slen + 1;
+            n = snprintf(out, outMax, fmt, str);
+        } else if (tlogIsFloat(spec.conversion)) {
+            if (a + 8 > argsLen) {
+                break;
+            }
+            uint64_t v = tlogGet(&args[a], 8);
+            double d;
+            memcpy(&d, &v, sizeof(d));
+            a += 8;
+            n = spec.longDouble ? snprintf(out, outMax, fmt, (long double) d) : snprintf(out, outMax, fmt, d);
+        } else if (spec.conversion == 'p') {
+            if (a + 4 > argsLen) {
+                break;
+            }
+            n = snprintf(out, outMax, fmt, (void *) (uintptr_t) tlogGet(&args[a], 4));
+            a += 4;
+        } else if (tlogIsInt(spec.conversion)) {
+            bool isSigned = (spec.conversion == 'd' || spec.conversion == 'i');
+            uint32_t vlen = spec.longLong ? 8 : 4;
+            if (a + vlen > argsLen) {
+                break;
+            }
+            uint64_t v = tlogGet(&args[a], vlen);
+            a += vlen;
+            if (spec.longLong) {
+                n = isSigned ? snprintf(out, outMax, fmt, (long long) v) : snprintf(out, outMax, fmt, (unsigned long long) v);
+            } else if (strchr(fmt, 'l') != NULL) {
+                n = isSigned ? snprintf(out, outMax, fmt, (long) (int32_t) v) : snprintf(out, outMax, fmt, (unsigned long) (uint32_t) v);
+            } else if (strpbrk(fmt, "zt") != NULL) {
+                n = snprintf(out, outMax, fmt, (size_t) (uint32_t) v);
+            } else {
+                n = isSigned ? snprintf(out, outMax, fmt, (int) (int32_t) v) : snprintf(out, outMax, fmt, (unsigned) (uint32_t) v);
+            }
+        } else {
+            n = snprintf(out, outMax, "%s", fmt);
+        }
+        if (n < 0) {
+            break;
+        }
+        len += ((uint32_t) n < outMax) ? (uint32_t) n : (uint32_t) outMax - 1;
+
+    }
+    return len;
+}
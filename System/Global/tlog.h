@@ -0,0 +1,51 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+
+// Tokenized log records.  Rather than formatting text at the point of logging, a
+// record holds the address of its printf-style format string, which lives in flash
+// and so identifies it within a given build, followed by the raw argument values
+// that the format consumes.  Formatting is deferred to whoever reads the record:
+// the firmware itself when it emits text, or a host that looks up the format at
+// that address in the build's image and renders it with tlogRender, as
+// Test/tlogdecode.c does for the FRAME_LOG frames sent over USB.  Like frame.h this
+// is free of any HAL or RTOS dependency so that it can be compiled into such a host
+// application, as Test/tlog_test.c does to check rendering against printf.
+//
+// Arguments are packed little-endian without padding, in the order they are consumed:
+//   %c %d %i %u %x %X %o %p, and * widths/precisions      4 bytes
+//   any of the above with ll or j                          8 bytes
+//   %f %F %e %E %g %G %a %A                                8 bytes (double)
+//   %s                                                     the string, up to its precision, null-terminated
+// Arguments that don't fit in one record continue in the next, whose format address
+// points into the same format string at the conversion that didn't fit, so that
+// each record renders its own part of the text.  A string too long for any record
+// is sent in pieces, each a record of TLOG_STRING, and the format then continues
+// just beyond its conversion; the width of such a string is not applied.  The
+// records of one call are consecutive unless another call interrupts it.
+
+// Most bytes of arguments in a record
+#define TLOG_MAX_ARGS           120
+
+// Record header
+#define TLOG_HEADER             8       // [0..3] format string address, [4..7] ms timestamp
+
+// The format of each piece of a long string, and of verbatim text
+#define TLOG_STRING             "%s"
+
+// Post a record of a format and its captured arguments, returning false if it can't be
+typedef bool (*tlogPostFn)(const char *format, const uint8_t *args, uint32_t argsLen);
+
+// Capture the arguments consumed by a format as records, calling post for each, and
+// returning how many were posted
+uint32_t tlogCapture(const char *format, va_list vaArgs, tlogPostFn post);
+
+// Render a format with captured arguments as text, returning its length.  The text
+// is always null-terminated, and truncated only if it doesn't fit the buffer.
+uint32_t tlogRender(const char *format, const uint8_t *args, uint32_t argsLen, char *text, uint32_t textMax);
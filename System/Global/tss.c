@@ -10,18 +10,96 @@ STATIC bool paused = false;
 STATIC int64_t tssBeganMs = 0;
 STATIC int64_t tssEndedMs = 0;
 STATIC uint32_t taskSwitches[TASKID_NUM_TASKS];
-STATIC int64_t taskResumedMs[TASKID_NUM_TASKS];
-STATIC int64_t taskTotalMs[TASKID_NUM_TASKS];
 
-// Remember how long we were running
-void tssPreSuspend(int tssID)
+// CPU accounting.  The FreeRTOS context switch hooks and the interrupt markers each
+// charge the cycles since the previous event to whatever was running, and then note
+// what runs next, so that time spent in an interrupt is not charged to the task or
+// interrupt that it preempted.  Tasks are bucketed by their FreeRTOS task number,
+// and interrupts by TSS_ISR_, where unmarked interrupts (and the scheduler itself)
+// are charged to whatever they interrupted.  The cycle counter stops while the core
+// sleeps, so whatever wall time isn't accounted for was spent asleep.  Task numbers
+// start at 1, and there is one for each of our tasks, the idle task and the timer
+// task; any beyond those, and time before the scheduler starts, go to "other".
+#define TSS_TASK_BUCKETS    (1 + TASKID_NUM_TASKS + 2)
+#define TSS_TASK_OTHER      0
+#define TSS_ISR_BUCKET(isr) (TSS_TASK_BUCKETS + (isr))
+#define TSS_BUCKETS         (TSS_TASK_BUCKETS + TSS_ISR_COUNT)
+STATIC uint64_t tssCycles[TSS_BUCKETS];
+STATIC uint32_t tssIsrCount[TSS_ISR_COUNT];
+STATIC uint8_t tssRunning = TSS_TASK_OTHER;
+STATIC uint8_t tssPreempted[TSS_ISR_COUNT];
+STATIC uint32_t tssDepth = 0;
+STATIC uint32_t tssLastCycles = 0;
+
+// Names of the interrupts, as reported
+STATIC const char *tssIsrNames[TSS_ISR_COUNT] = {
+    "SAI DMA",
+    "SAI",
+    "LPUART1",
+    "USART1",
+    "USART1 DMA",
+    "USART2",
+    "USB",
+    "RTC",
+};
+
+// Forwards
+void tssCharge(void);
+
+// Get the name of an interrupt
+const char *tssIsrName(uint8_t isr)
+{
+    return (isr < TSS_ISR_COUNT) ? tssIsrNames[isr] : "";
+}
+
+// Charge the cycles since the last event to whatever was running.  This must be
+// called with interrupts disabled.
+void tssCharge(void)
+{
+    uint32_t now = MX_CYC_Count();
+    tssCycles[tssRunning] += (uint32_t) (now - tssLastCycles);
+    tssLastCycles = now;
+}
+
+// FreeRTOS trace hooks, called by the scheduler with interrupts masked
+void tssTaskSwitchedIn(uint32_t taskNumber)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    tssCharge();
+    tssRunning = (taskNumber < TSS_TASK_BUCKETS) ? (uint8_t) taskNumber : TSS_TASK_OTHER;
+    __set_PRIMASK(primask);
+    timelineTaskSwitchedIn(taskNumber);
+}
+void tssTaskSwitchedOut(uint32_t taskNumber)
+{
+    timelineTaskSwitchedOut(taskNumber);
+}
+
+// Interrupt markers, which may nest
+void tssIsrEnter(uint8_t isr)
+{
+    timelineIsrEnter(isr);
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    tssCharge();
+    if (tssDepth < TSS_ISR_COUNT) {
+        tssPreempted[tssDepth++] = tssRunning;
+    }
+    tssRunning = TSS_ISR_BUCKET(isr);
+    tssIsrCount[isr]++;
+    __set_PRIMASK(primask);
+}
+void tssIsrExit(uint8_t isr)
 {
-    int64_t runningMs = timerMs() - taskResumedMs[tssID];
-    if (runningMs <= 0) {
-        taskTotalMs[tssID]++;
-    } else {
-        taskTotalMs[tssID] += runningMs;
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    tssCharge();
+    if (tssDepth > 0) {
+        tssRunning = tssPreempted[--tssDepth];
     }
+    __set_PRIMASK(primask);
+    timelineIsrExit(isr);
 }
 
 // Bump the count associated with a task
@@ -33,7 +111,6 @@ void tssPostSuspend(int tssID)
     if (!paused) {
         taskSwitches[tssID]++;
     }
-    taskResumedMs[tssID] = timerMs();
 }
 
 // Pause stats gathering
@@ -47,26 +124,75 @@ void tssPause()
 void tssResume()
 {
     memset(taskSwitches, 0, sizeof(taskSwitches));
-    memset(taskTotalMs, 0, sizeof(taskTotalMs));
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    memset(tssCycles, 0, sizeof(tssCycles));
+    memset(tssIsrCount, 0, sizeof(tssIsrCount));
+    tssLastCycles = MX_CYC_Count();
+    __set_PRIMASK(primask);
     tssBeganMs = timerMs();
     paused = false;
 }
 
-// Dump stats about task switches
+// Dump stats about task switches and CPU use, as a percentage of wall time
 void tssStats()
 {
     if (paused) {
         int64_t durationMs = (tssEndedMs - tssBeganMs);
-        debugR("Task Switch Rate over prev %d seconds:\n", (uint32_t)(durationMs/1000));
-        for (int task=0; task<TASKID_NUM_TASKS; task++) {
-            uint32_t switches = taskSwitches[task];
-            taskSwitches[task] = 0;
+        if (durationMs <= 0) {
+            return;
+        }
+
+        // Take a consistent copy of the buckets
+        uint64_t cycles[TSS_BUCKETS];
+        uint32_t isrCount[TSS_ISR_COUNT];
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        tssCharge();
+        memcpy(cycles, tssCycles, sizeof(cycles));
+        memcpy(isrCount, tssIsrCount, sizeof(isrCount));
+        __set_PRIMASK(primask);
+        double totalCycles = ((double) durationMs * (double) SystemCoreClock) / 1000.0;
+        double awakeCycles = 0;
+
+        debugR("Task Switch Rate and CPU over prev %d seconds:\n", (uint32_t)(durationMs/1000));
+        UBaseType_t taskCount = uxTaskGetNumberOfTasks();
+        TaskStatus_t tasks[TASKID_NUM_TASKS+4];
+        taskCount = uxTaskGetSystemState(tasks, GMIN(taskCount, sizeof(tasks)/sizeof(tasks[0])), NULL);
+        bool reported[TSS_TASK_BUCKETS] = {0};
+        for (UBaseType_t i=0; i<taskCount; i++) {
+            UBaseType_t n = tasks[i].xTaskNumber;
+            if (n >= TSS_TASK_BUCKETS || n == TSS_TASK_OTHER) {
+                continue;
+            }
+            reported[n] = true;
+            awakeCycles += (double) cycles[n];
+            double cpu = ((double) cycles[n] * 100.0) / totalCycles;
+            uint32_t switches = 0;
+            for (int task=0; task<TASKID_NUM_TASKS; task++) {
+                if (strcmp(taskLabel(task), tasks[i].pcTaskName) == 0) {
+                    switches = taskSwitches[task];
+                    taskSwitches[task] = 0;
+                }
+            }
             double rate = (((double) switches) / durationMs) * ms1Min;
-            char *label = taskLabel(task);
-            if (label[0] != '\0') {
-                debugR("%12s: %.2f/min %ld ms\n", label, rate, (long) taskTotalMs[task]);
+            debugR("%12s: %6.2f%% %.2f/min\n", tasks[i].pcTaskName, cpu, rate);
+        }
+        double otherCycles = 0;
+        for (int n=0; n<TSS_TASK_BUCKETS; n++) {
+            if (!reported[n]) {
+                otherCycles += (double) cycles[n];
             }
         }
+        awakeCycles += otherCycles;
+        debugR("%12s: %6.2f%%\n", "other", (otherCycles * 100.0) / totalCycles);
+        for (int isr=0; isr<TSS_ISR_COUNT; isr++) {
+            awakeCycles += (double) cycles[TSS_ISR_BUCKET(isr)];
+            double cpu = ((double) cycles[TSS_ISR_BUCKET(isr)] * 100.0) / totalCycles;
+            debugR("%12s: %6.2f%% %lu interrupts\n", tssIsrNames[isr], cpu, (unsigned long) isrCount[isr]);
+        }
+        double asleep = 100.0 - ((awakeCycles * 100.0) / totalCycles);
+        debugR("%12s: %6.2f%%\n", "asleep", asleep < 0 ? 0 : asleep);
         debugR("\n");
     }
 }
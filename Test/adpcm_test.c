@@ -0,0 +1,192 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Round-trips synthetic speech and noise through adpcmFrame and adpcmUnframe, in
+// the frames and at the rate that the audio task produces them, reporting the SNR of
+// each, and checks that damaged frames are rejected.  Then streams frames as the
+// 'adpcm' diag command does, among other log output, and checks that adpcmdecode
+// recovers the audio, filling the frames that were dropped or damaged.
+
+#include "test.h"
+#define ADPCMDECODE_NO_MAIN
+#include "adpcmdecode.c"
+#include <math.h>
+
+// A 3.047619MHz PDM clock decimated by 640, in 115-sample blocks (see
+// AUDIO_PCM_RATE_HZ and AUDIO_PCM_SAMPLES in app.h)
+#define RATE_HZ         (3047619.0 / 640.0)
+#define FRAME_SAMPLES   115
+#define FRAMES          166             // About 4 seconds
+#define SAMPLES         (FRAME_SAMPLES * FRAMES)
+
+static int16_t pcmIn[SAMPLES];
+static int16_t pcmOut[SAMPLES];
+
+// Deterministic uniform noise in [-1, 1)
+static uint32_t noiseSeed = 12345;
+static double noise(void)
+{
+    noiseSeed = noiseSeed * 1664525 + 1013904223;
+    return ((double) (noiseSeed >> 8) / (double) (1 << 23)) - 1.0;
+}
+
+// A voiced vowel: a 120 Hz train of raised-cosine glottal pulses through three
+// formant resonators, with a syllable-rate envelope so that the level sweeps through
+// quiet and loud passages.  The third formant is lowered to fit below Nyquist.
+static void makeSpeech(int16_t *pcm, uint32_t samples)
+{
+    static const double formantHz[3] = { 730, 1090, 2000 };
+    static const double formantGain[3] = { 1.0, 0.5, 0.25 };
+    double y1[3] = { 0 }, y2[3] = { 0 };
+    double period = RATE_HZ / 120.0;
+    double phase = 0;
+    for (uint32_t i=0; i<samples; i++) {
+        phase += 1.0;
+        if (phase >= period) {
+            phase -= period;
+        }
+        double open = phase / (0.4 * period);
+        double excitation = open < 1.0 ? 0.5 * (1.0 - cos(2.0 * M_PI * open)) : 0.0;
+        excitation += 0.01 * noise();
+        double out = 0;
+        for (int f=0; f<3; f++) {
+            double r = 0.97;
+            double theta = 2.0 * M_PI * formantHz[f] / RATE_HZ;
+            double y = excitation + 2.0 * r * cos(theta) * y1[f] - r * r * y2[f];
+            y2[f] = y1[f];
+            y1[f] = y;
+            out += formantGain[f] * y;
+        }
+        double envelope = 0.05 + 0.95 * pow(sin(M_PI * 4.0 * i / RATE_HZ), 2);
+        double v = out * envelope * 200.0;
+        pcm[i] = (int16_t) (v > 32767 ? 32767 : v < -32768 ? -32768 : v);
+    }
+}
+
+// Broadband noise at a moderate level
+static void makeNoise(int16_t *pcm, uint32_t samples)
+{
+    for (uint32_t i=0; i<samples; i++) {
+        pcm[i] = (int16_t) (noise() * 8000.0);
+    }
+}
+
+// Encode in frames, decode each one independently, and return the SNR in dB
+static double roundTrip(const int16_t *in, int16_t *out, uint32_t samples)
+{
+    adpcmState st;
+    adpcmInit(&st);
+    uint8_t frame[ADPCM_FRAME_SIZE(FRAME_SAMPLES)];
+    uint16_t sequence = 0;
+    for (uint32_t i=0; i<samples; i+=FRAME_SAMPLES) {
+        uint32_t n = samples - i < FRAME_SAMPLES ? samples - i : FRAME_SAMPLES;
+        uint32_t len = adpcmFrame(&st, &in[i], n, sequence, i, frame, sizeof(frame));
+        CHECK(len == ADPCM_FRAME_SIZE(n));
+        uint16_t gotSequence;
+        uint32_t gotTimeMs;
+        CHECK(adpcmUnframe(frame, len, &out[i], FRAME_SAMPLES, &gotSequence, &gotTimeMs) == n);
+        CHECK(gotSequence == sequence);
+        CHECK(gotTimeMs == i);
+        sequence++;
+    }
+    double signal = 0, error = 0;
+    for (uint32_t i=0; i<samples; i++) {
+        double d = (double) in[i] - (double) out[i];
+        signal += (double) in[i] * (double) in[i];
+        error += d * d;
+    }
+    return 10.0 * log10(signal / (error > 0 ? error : 1));
+}
+
+// Frames that are truncated, corrupted or too large for the caller are rejected
+static void checkRejects(void)
+{
+    adpcmState st;
+    adpcmInit(&st);
+    uint8_t frame[ADPCM_FRAME_SIZE(FRAME_SAMPLES)];
+    int16_t pcm[FRAME_SAMPLES];
+    uint32_t len = adpcmFrame(&st, pcmIn, FRAME_SAMPLES, 7, 0, frame, sizeof(frame));
+    CHECK(adpcmUnframe(frame, len, pcm, FRAME_SAMPLES, NULL, NULL) == FRAME_SAMPLES);
+    CHECK(adpcmUnframe(frame, len-1, pcm, FRAME_SAMPLES, NULL, NULL) == 0);
+    CHECK(adpcmUnframe(frame, len, pcm, FRAME_SAMPLES-1, NULL, NULL) == 0);
+    for (uint32_t i=0; i<len; i++) {
+        frame[i] ^= 0x10;
+        CHECK(adpcmUnframe(frame, len, pcm, FRAME_SAMPLES, NULL, NULL) == 0);
+        frame[i] ^= 0x10;
+    }
+    CHECK(adpcmFrame(&st, pcmIn, 256, 0, 0, frame, sizeof(frame)) == 0);
+}
+
+// Stream the frames of the speech as the diag command does, with a terminal's
+// timestamp before each line, the stats line after them, and one frame missing and
+// another damaged, and check that the decoder fills both with silence
+static void testDecode(void)
+{
+    FILE *f = tmpfile();
+    CHECK(f != NULL);
+    if (f == NULL) {
+        return;
+    }
+    adpcmState st;
+    adpcmInit(&st);
+    for (uint32_t n=0; n<FRAMES; n++) {
+        uint8_t frame[ADPCM_FRAME_SIZE(FRAME_SAMPLES)];
+        uint32_t timeMs = 1000000 + (uint32_t) lrint(n * FRAME_SAMPLES * 1000.0 / RATE_HZ);
+        uint32_t len = adpcmFrame(&st, &pcmIn[n * FRAME_SAMPLES], FRAME_SAMPLES, (uint16_t) (65500 + n), timeMs, frame, sizeof(frame));
+        char line[((sizeof(frame) + 2) / 3 * 4) + 1];
+        Base64encode(line, (const char *) frame, (int) len);
+        if (n == 20) {
+            continue;
+        }
+        if (n == 30) {
+            line[10] = (line[10] == 'A') ? 'B' : 'A';
+        }
+        fprintf(f, "[12:00:00.%03lu] adpcm:%s\r\n", (unsigned long) (n % 1000), line);
+        if (n == 40) {
+            fprintf(f, "[12:00:00.040] audio: block overrun\n");
+        }
+    }
+    fprintf(f, "[12:00:01.000] adpcm: frames:%d dropped:1 encoder:41.5 cycles/sample\n", FRAMES);
+    rewind(f);
+
+    adpcmReader r;
+    adpcmReaderInit(&r, f);
+    adpcmSummary s;
+    uint32_t samples = adpcmDecodeLog(&r, pcmOut, SAMPLES, NULL, &s);
+    CHECK(s.frames == FRAMES - 2 && s.damaged == 1 && s.missing == 2);
+    CHECK(samples == SAMPLES);
+    double signal = 0, error = 0;
+    bool silent = true;
+    for (uint32_t i=0; i<SAMPLES; i++) {
+        uint32_t n = i / FRAME_SAMPLES;
+        if (n == 20 || n == 30) {
+            silent = silent && (pcmOut[i] == 0);
+            continue;
+        }
+        double d = (double) pcmIn[i] - (double) pcmOut[i];
+        signal += (double) pcmIn[i] * (double) pcmIn[i];
+        error += d * d;
+    }
+    CHECK(silent);
+    CHECK(10.0 * log10(signal / (error > 0 ? error : 1)) > 20.0);
+    fclose(f);
+}
+
+int main(void)
+{
+    makeSpeech(pcmIn, SAMPLES);
+    double speechSnr = roundTrip(pcmIn, pcmOut, SAMPLES);
+    printf("adpcm: speech SNR %.1f dB\n", speechSnr);
+    CHECK(speechSnr > 20.0);
+
+    makeNoise(pcmIn, SAMPLES);
+    double noiseSnr = roundTrip(pcmIn, pcmOut, SAMPLES);
+    printf("adpcm: noise SNR %.1f dB\n", noiseSnr);
+    CHECK(noiseSnr > 10.0);
+
+    checkRejects();
+    makeSpeech(pcmIn, SAMPLES);
+    testDecode();
+    TEST_DONE("adpcm");
+}
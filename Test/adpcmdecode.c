@@ -0,0 +1,172 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Decodes the IMA-ADPCM frames that 'adpcm <frames>' streams (see diag.c, and adpcm.h
+// for the frame format) from a captured debug log, writing the audio as a 16-bit mono
+// WAV file and as CSV of each sample against the RTC time of its frame.  Only lines
+// with "adpcm:" followed directly by base64 are frames, and anything that precedes it
+// on a line, such as a terminal's timestamp, is ignored.  Frames whose base64 or CRC
+// is damaged are dropped, and a gap in the sequence numbers, whether from those or
+// from frames the firmware dropped, is filled with silence so the audio keeps time.
+//   make -C Test
+//   Test/build/adpcmdecode capture.txt stream      writes stream.wav and stream.csv
+// Test/adpcm_test.c includes this file to decode its own synthesized stream.
+
+#include "global.h"
+#include "adpcm.h"
+#include "wav.h"
+
+#define ADPCM_PREFIX        "adpcm:"
+#define ADPCM_LINE_MAX      512
+#define ADPCM_SAMPLES_MAX   255             // What a frame's header can describe
+#define ADPCM_RATE_HZ       (3047619.0 / 640.0)     // AUDIO_PCM_RATE_HZ
+#define ADPCM_GAP_MAX       64              // Longer gaps are taken as a new stream, not filled
+#define ADPCM_BASE64        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/="
+
+// What was found in a log
+typedef struct {
+    uint32_t frames;                // Frames decoded
+    uint32_t damaged;               // Frame lines whose base64 or CRC was bad
+    uint32_t missing;               // Frames absent from the sequence, filled with silence
+    uint32_t samples;               // Samples decoded, including the silence
+} adpcmSummary;
+
+// A log being read, and where the stream it holds has got to
+typedef struct {
+    FILE *in;
+    char line[ADPCM_LINE_MAX];
+    bool started;
+    uint16_t nextSequence;
+    uint32_t frameSamples;
+} adpcmReader;
+
+// Begin reading a log
+void adpcmReaderInit(adpcmReader *r, FILE *in)
+{
+    r->in = in;
+    r->started = false;
+    r->nextSequence = 0;
+    r->frameSamples = 0;
+}
+
+// Read the next good frame from a log into pcm, which holds ADPCM_SAMPLES_MAX,
+// returning its samples, or 0 at the end of the log
+uint32_t adpcmReadFrame(adpcmReader *r, int16_t *pcm, uint16_t *retSequence, uint32_t *retTimeMs, adpcmSummary *s)
+{
+    while (fgets(r->line, sizeof(r->line), r->in) != NULL) {
+
+        // Find a frame line, ignoring the stats line and anything else
+        char *p = strstr(r->line, ADPCM_PREFIX);
+        if (p == NULL) {
+            continue;
+        }
+        p += strlen(ADPCM_PREFIX);
+        p[strcspn(p, "\r\n")] = '\0';
+        if (p[0] == '\0' || p[strspn(p, ADPCM_BASE64)] != '\0') {
+            continue;
+        }
+
+        // Decode it
+        uint8_t frame[ADPCM_LINE_MAX];
+        int processed;
+        int len = Base64decode((char *) frame, p, &processed);
+        uint32_t samples = 0;
+        if (len > 0 && processed == (int) strlen(p)) {
+            samples = adpcmUnframe(frame, (uint32_t) len, pcm, ADPCM_SAMPLES_MAX, retSequence, retTimeMs);
+        }
+        if (samples == 0) {
+            s->damaged++;
+            continue;
+        }
+        return samples;
+
+    }
+    return 0;
+}
+
+// Decode every frame in a log into up to pcmMax samples, writing each sample to csv
+// if it isn't NULL, and returning the number of samples
+uint32_t adpcmDecodeLog(adpcmReader *r, int16_t *pcm, uint32_t pcmMax, FILE *csv, adpcmSummary *s)
+{
+    memset(s, 0, sizeof(*s));
+    if (csv != NULL) {
+        fprintf(csv, "ms,sample\n");
+    }
+    int16_t frame[ADPCM_SAMPLES_MAX];
+    uint16_t sequence;
+    uint32_t timeMs;
+    uint32_t samples;
+    while ((samples = adpcmReadFrame(r, frame, &sequence, &timeMs, s)) != 0) {
+
+        // Fill a gap in the sequence with silence, at the length of the frames before it
+        uint16_t gap = (uint16_t) (sequence - r->nextSequence);
+        if (r->started && gap != 0 && gap <= ADPCM_GAP_MAX) {
+            s->missing += gap;
+            for (uint32_t i=0; i<(uint32_t) gap * r->frameSamples && s->samples < pcmMax; i++) {
+                pcm[s->samples++] = 0;
+            }
+        }
+        r->started = true;
+        r->nextSequence = (uint16_t) (sequence + 1);
+        r->frameSamples = samples;
+
+        // Append the frame
+        s->frames++;
+        for (uint32_t i=0; i<samples && s->samples < pcmMax; i++) {
+            pcm[s->samples++] = frame[i];
+            if (csv != NULL) {
+                fprintf(csv, "%.3f,%d\n", timeMs + (i * 1000.0 / ADPCM_RATE_HZ), frame[i]);
+            }
+        }
+
+    }
+    return s->samples;
+}
+
+#ifndef ADPCMDECODE_NO_MAIN
+
+// Decode the stream in a log
+int main(int argc, char **argv)
+{
+    if (argc != 3) {
+        fprintf(stderr, "usage: adpcmdecode <captured log> <output prefix>\n");
+        return 2;
+    }
+    FILE *in = fopen(argv[1], "r");
+    if (in == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    char filename[256];
+    snprintf(filename, sizeof(filename), "%s.csv", argv[2]);
+    FILE *csv = fopen(filename, "w");
+    if (csv == NULL) {
+        perror(filename);
+        fclose(in);
+        return 1;
+    }
+    static int16_t pcm[1 << 22];
+    adpcmReader r;
+    adpcmReaderInit(&r, in);
+    adpcmSummary s;
+    uint32_t samples = adpcmDecodeLog(&r, pcm, sizeof(pcm) / sizeof(pcm[0]), csv, &s);
+    fclose(in);
+    fclose(csv);
+    if (s.frames == 0) {
+        fprintf(stderr, "%s: no adpcm frames found\n", argv[1]);
+        remove(filename);
+        return 1;
+    }
+    snprintf(filename, sizeof(filename), "%s.wav", argv[2]);
+    if (!wavWrite(filename, pcm, samples, (uint32_t) (ADPCM_RATE_HZ + 0.5))) {
+        perror(filename);
+        return 1;
+    }
+    printf("%s: %lu samples (%.1fs) from %lu frames, %lu damaged, %lu missing and filled with silence\n", filename,
+           (unsigned long) samples, samples / ADPCM_RATE_HZ, (unsigned long) s.frames, (unsigned long) s.damaged,
+           (unsigned long) s.missing);
+    return (s.damaged == 0 && s.missing == 0) ? 0 : 1;
+}
+
+#endif
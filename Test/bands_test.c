@@ -0,0 +1,114 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Drives the filter bank with tones at each center frequency, at the firmware's
+// decimated sample rate and in blocks as the audio task does, and checks that each
+// band passes its own tone at unity gain and that the other bands reject it.
+
+#include "test.h"
+#include "bands.h"
+#include <math.h>
+#include <string.h>
+
+// The rate and block size that the audio task runs the bank at: a 3.047619MHz PDM
+// clock decimated by 640, in 115-sample blocks (see AUDIO_PCM_RATE_HZ in app.h)
+#define RATE_HZ         (3047619.0 / 640.0)
+#define BLOCK           115
+#define BLOCKS          40
+#define AMPLITUDE       10000.0
+
+// Run a tone through the bank, returning the level of each band over the last
+// block relative to the tone's own, in dB
+static void tone(double hz, double *retDb)
+{
+    bandsState st;
+    bandsInit(&st, RATE_HZ);
+    int16_t pcm[BLOCK];
+    double meanSquare[BANDS_COUNT];
+    uint32_t n = 0;
+    for (int b=0; b<BLOCKS; b++) {
+        for (int i=0; i<BLOCK; i++, n++) {
+            pcm[i] = (int16_t) lrint(AMPLITUDE * sin(2.0 * M_PI * hz * n / RATE_HZ));
+        }
+        bandsProcess(&st, pcm, BLOCK, meanSquare);
+    }
+    double toneMeanSquare = AMPLITUDE * AMPLITUDE / 2.0;
+    for (int i=0; i<BANDS_COUNT; i++) {
+        retDb[i] = 10.0 * log10(meanSquare[i] / toneMeanSquare);
+    }
+}
+
+// Each band passes its own center at unity gain and rejects the other centers by at
+// least 6dB, except that the top band, being effectively a high-pass at this rate
+// (see bands.h), need only roll off steadily below its center
+static void testSelectivity(void)
+{
+    static const double centersHz[BANDS_COUNT] = BANDS_CENTERS_HZ;
+    double db[BANDS_COUNT][BANDS_COUNT];
+    for (int t=0; t<BANDS_COUNT; t++) {
+        tone(centersHz[t], db[t]);
+    }
+    const int top = BANDS_COUNT - 1;
+    double worstDb = -INFINITY;
+    for (int band=0; band<BANDS_COUNT; band++) {
+        CHECK(fabs(db[band][band]) < 0.5);
+        for (int t=0; t<BANDS_COUNT; t++) {
+            if (t == band) {
+                continue;
+            }
+            if (band == top) {
+                CHECK(t == 0 || db[t][band] > db[t-1][band]);
+                continue;
+            }
+            CHECK(db[t][band] < -6.0);
+            if (db[t][band] > worstDb) {
+                worstDb = db[t][band];
+            }
+        }
+    }
+    printf("bands: below the top band, other centers are rejected by at least %.1f dB; the top band passes %.0f Hz at %.1f dB\n",
+           -worstDb, centersHz[top-1], db[top-1][top]);
+}
+
+// The filters carry their history from block to block, so that a block boundary
+// is invisible, and a reset clears it
+static void testContinuity(void)
+{
+    int16_t pcm[BLOCK * 4];
+    for (uint32_t i=0; i<sizeof(pcm)/sizeof(pcm[0]); i++) {
+        pcm[i] = (int16_t) ((i * 7919) % 20000) - 10000;
+    }
+    bandsState whole, pieces;
+    bandsInit(&whole, RATE_HZ);
+    bandsInit(&pieces, RATE_HZ);
+    double msWhole[BANDS_COUNT], ms[BANDS_COUNT], msSum[BANDS_COUNT] = {0};
+    bandsProcess(&whole, pcm, BLOCK * 4, msWhole);
+    for (int b=0; b<4; b++) {
+        bandsProcess(&pieces, &pcm[b * BLOCK], BLOCK, ms);
+        for (int i=0; i<BANDS_COUNT; i++) {
+            msSum[i] += ms[i] / 4;
+        }
+    }
+    for (int i=0; i<BANDS_COUNT; i++) {
+        CHECK(fabs(msSum[i] - msWhole[i]) <= msWhole[i] * 1e-3);
+        CHECK(memcmp(&whole.filter[i], &pieces.filter[i], sizeof(bandsFilter)) == 0);
+    }
+
+    // Silence after a reset is silent in every band
+    int16_t silence[BLOCK] = {0};
+    bandsReset(&pieces);
+    bandsProcess(&pieces, silence, BLOCK, ms);
+    for (int i=0; i<BANDS_COUNT; i++) {
+        CHECK(ms[i] == 0);
+    }
+    bandsProcess(&pieces, silence, 0, ms);
+    CHECK(ms[0] == 0);
+}
+
+int main(void)
+{
+    testSelectivity();
+    testContinuity();
+    TEST_DONE("bands");
+}
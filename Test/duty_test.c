@@ -0,0 +1,121 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Drives the duty-cycle schedule as the audio task does, sleeping for the wait that
+// each update returns, and checks the edges of the window and period, continuous
+// measurement, recovery from missed periods, and that the cadence neither drifts nor
+// misbehaves over months of uptime, past where a ms count would wrap 32 bits.
+
+#include "test.h"
+#include "duty.h"
+
+#define WINDOW_MS       10000
+#define PERIOD_MS       60000
+#define BEGIN_MS        1234            // A timerMs() shortly after boot
+
+// Update at a time, checking whether we measure and how long until the next change
+static void expect(dutySchedule *ds, int64_t nowMs, bool measuring, uint32_t waitMs)
+{
+    uint32_t w;
+    bool m = dutyUpdate(ds, nowMs, &w);
+    CHECK(m == measuring);
+    CHECK(w == waitMs);
+    if (m != measuring || w != waitMs) {
+        printf("duty: at %lld expected %d/%lu, got %d/%lu\n", (long long) nowMs,
+               measuring, (unsigned long) waitMs, m, (unsigned long) w);
+    }
+}
+
+// A window of 0, or one that fills the period, measures continuously and never wakes
+static void testContinuous(void)
+{
+    dutySchedule ds;
+    dutyInit(&ds, 0, PERIOD_MS);
+    CHECK(!dutyIsCycling(&ds));
+    expect(&ds, BEGIN_MS, true, 0xffffffff);
+    expect(&ds, BEGIN_MS + PERIOD_MS * 3, true, 0xffffffff);
+    CHECK(dutyAverageMa(&ds, 5.0, 1.0) == 5.0);
+    dutyInit(&ds, PERIOD_MS, PERIOD_MS);
+    CHECK(!dutyIsCycling(&ds));
+    dutyInit(&ds, PERIOD_MS + 1, PERIOD_MS);
+    CHECK(!dutyIsCycling(&ds));
+    expect(&ds, BEGIN_MS, true, 0xffffffff);
+    dutyInit(&ds, PERIOD_MS - 1, PERIOD_MS);
+    CHECK(dutyIsCycling(&ds));
+}
+
+// The window and the period each end exactly when the wait says
+static void testEdges(void)
+{
+    dutySchedule ds;
+    dutyInit(&ds, WINDOW_MS, PERIOD_MS);
+    CHECK(dutyIsCycling(&ds));
+    expect(&ds, BEGIN_MS, true, WINDOW_MS);
+    expect(&ds, BEGIN_MS + WINDOW_MS - 1, true, 1);
+    expect(&ds, BEGIN_MS + WINDOW_MS, false, PERIOD_MS - WINDOW_MS);
+    expect(&ds, BEGIN_MS + PERIOD_MS - 1, false, 1);
+    expect(&ds, BEGIN_MS + PERIOD_MS, true, WINDOW_MS);
+
+    // Waking late keeps the cadence rather than restarting it
+    expect(&ds, BEGIN_MS + 2*PERIOD_MS + 5, true, WINDOW_MS - 5);
+    expect(&ds, BEGIN_MS + 2*PERIOD_MS + WINDOW_MS + 7, false, PERIOD_MS - WINDOW_MS - 7);
+
+    // Having missed whole periods, such as while held awake, the cadence restarts
+    int64_t late = BEGIN_MS + 5*PERIOD_MS + 123;
+    expect(&ds, late, true, WINDOW_MS);
+    expect(&ds, late + WINDOW_MS, false, PERIOD_MS - WINDOW_MS);
+
+    // A clock that went backwards restarts it too
+    expect(&ds, BEGIN_MS, true, WINDOW_MS);
+}
+
+// Follow the waits for 100 days, starting just short of where a 32-bit ms count
+// wraps, waking a little late each time, and check that every window begins on the
+// cadence and that the time accounted to each state matches the schedule
+static void testLongRun(void)
+{
+    dutySchedule ds;
+    dutyInit(&ds, WINDOW_MS, PERIOD_MS);
+    int64_t beganMs = (int64_t) UINT32_MAX - 3 * PERIOD_MS;
+    int64_t endMs = beganMs + 100LL * 24 * 60 * 60 * 1000;
+    int64_t nowMs = beganMs, updatedMs = beganMs;
+    uint32_t windows = 0, offCadence = 0;
+    bool wasMeasuring = false;
+    while (nowMs < endMs) {
+        uint32_t waitMs;
+        bool measuring = dutyUpdate(&ds, nowMs, &waitMs);
+        updatedMs = nowMs;
+        if (measuring && !wasMeasuring) {
+            windows++;
+            if ((ds.cycleBeganMs - beganMs) % PERIOD_MS != 0) {
+                offCadence++;
+            }
+        }
+        wasMeasuring = measuring;
+        CHECK(waitMs > 0 && waitMs <= PERIOD_MS);
+        if (waitMs == 0 || waitMs > PERIOD_MS) {
+            break;
+        }
+        nowMs += waitMs + randBelow(20);
+    }
+    uint32_t periods = (uint32_t) ((endMs - beganMs) / PERIOD_MS);
+    CHECK(offCadence == 0);
+    CHECK(windows >= periods && windows <= periods + 1);
+    CHECK(ds.measuringTotalMs + ds.idleTotalMs == updatedMs - beganMs);
+    double measuringFraction = (double) ds.measuringTotalMs / (double) (updatedMs - beganMs);
+    double scheduledFraction = (double) WINDOW_MS / PERIOD_MS;
+    CHECK(measuringFraction > scheduledFraction - 0.001 && measuringFraction < scheduledFraction + 0.001);
+    double avgMa = dutyAverageMa(&ds, 1.0, 0.0);
+    CHECK(avgMa == measuringFraction);
+    printf("duty: %lu windows in %lu periods over 100 days, measuring %.3f%% of the time\n",
+           (unsigned long) windows, (unsigned long) periods, measuringFraction * 100.0);
+}
+
+int main(void)
+{
+    testContinuous();
+    testEdges();
+    testLongRun();
+    TEST_DONE("duty");
+}
@@ -0,0 +1,182 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Round-trips COBS and frames through the codec, including the runs of zeros and of
+// 254 non-zero bytes where COBS has its edge cases, checks that corruption is caught,
+// and compares the wire size of each response with its JSON equivalent.
+
+#include "test.h"
+#include "frame.h"
+#include "json.h"
+#include <string.h>
+
+// COBS round-trip of a buffer, whose encoding must contain no zeros
+static void cobsRoundTrip(const uint8_t *in, uint32_t len)
+{
+    uint8_t enc[1024], dec[1024];
+    uint32_t encLen = cobsEncode(in, len, enc);
+    CHECK(encLen <= len + (len / 254) + 1);
+    CHECK(memchr(enc, 0, encLen) == NULL);
+    int32_t decLen = cobsDecode(enc, encLen, dec);
+    CHECK(decLen == (int32_t) len && memcmp(dec, in, len) == 0);
+}
+
+static void testCobs(void)
+{
+    uint8_t buf[800];
+
+    // Empty, all zeros, and a lone non-zero between zeros
+    memset(buf, 0, sizeof(buf));
+    cobsRoundTrip(buf, 0);
+    for (uint32_t len=1; len<=4; len++) {
+        cobsRoundTrip(buf, len);
+    }
+    buf[1] = 0x11;
+    cobsRoundTrip(buf, 3);
+
+    // Runs of non-zero bytes either side of 254, alone and followed by a zero
+    for (uint32_t run=250; run<=512; run++) {
+        for (uint32_t i=0; i<run; i++) {
+            buf[i] = (uint8_t) ((i % 255) + 1);
+        }
+        buf[run] = 0;
+        cobsRoundTrip(buf, run);
+        cobsRoundTrip(buf, run + 1);
+    }
+
+    // Random content
+    for (int n=0; n<10000; n++) {
+        uint32_t len = randBelow(sizeof(buf));
+        for (uint32_t i=0; i<len; i++) {
+            buf[i] = (uint8_t) (randBelow(3) == 0 ? 0 : randBelow(256));
+        }
+        cobsRoundTrip(buf, len);
+    }
+
+    // Malformed: a code that runs past the end, and a zero within the encoding
+    uint8_t dec[8];
+    CHECK(cobsDecode((const uint8_t *) "\x05\x01\x02", 3, dec) < 0);
+    CHECK(cobsDecode((const uint8_t *) "\x03\x01\x00", 3, dec) < 0);
+}
+
+static void testFrames(void)
+{
+    uint8_t payload[FRAME_MAX_PAYLOAD];
+    uint8_t wire[FRAME_MAX_WIRE(FRAME_MAX_PAYLOAD)];
+    uint8_t buf[sizeof(wire)];
+    uint8_t type, sequence;
+    uint8_t *got;
+    uint32_t gotLen;
+
+    for (int n=0; n<10000; n++) {
+        uint32_t len = randBelow(FRAME_MAX_PAYLOAD + 1);
+        for (uint32_t i=0; i<len; i++) {
+            payload[i] = (uint8_t) (randBelow(4) == 0 ? 0 : randBelow(256));
+        }
+        uint32_t wireLen = frameEncode(FRAME_INTERVAL_GET, (uint8_t) n, payload, len, wire, sizeof(wire));
+        CHECK(wireLen > 2 && wireLen <= FRAME_MAX_WIRE(len));
+        CHECK(wire[0] == FRAME_DELIMITER && wire[wireLen-1] == FRAME_DELIMITER);
+        CHECK(memchr(&wire[1], FRAME_DELIMITER, wireLen - 2) == NULL);
+        CHECK(frameDecode(&wire[1], wireLen - 2, buf, sizeof(buf), &type, &sequence, &got, &gotLen) == FRAME_OK);
+        CHECK(type == FRAME_INTERVAL_GET && sequence == (uint8_t) n);
+        CHECK(gotLen == len && memcmp(got, payload, len) == 0);
+
+        // A corrupted byte is caught, either by COBS or by the CRC
+        uint32_t at = 1 + randBelow(wireLen - 2);
+        wire[at] ^= (uint8_t) (randBelow(255) + 1);
+        if (wire[at] != FRAME_DELIMITER) {
+            int err = frameDecode(&wire[1], wireLen - 2, buf, sizeof(buf), &type, &sequence, &got, &gotLen);
+            CHECK(err == FRAME_ERR_COBS || err == FRAME_ERR_CRC || err == FRAME_ERR_LENGTH);
+        }
+    }
+
+    // Too large to encode, too large for the buffer, and too short to be a frame
+    CHECK(frameEncode(FRAME_SPL_GET, 0, payload, FRAME_MAX_PAYLOAD + 1, wire, sizeof(wire)) == 0);
+    CHECK(frameEncode(FRAME_SPL_GET, 0, payload, 10, wire, FRAME_MAX_WIRE(10) - 1) == 0);
+    uint32_t wireLen = frameEncode(FRAME_SPL_GET, 0, payload, 10, wire, sizeof(wire));
+    CHECK(frameDecode(&wire[1], wireLen - 2, buf, 4, &type, &sequence, &got, &gotLen) == FRAME_ERR_LENGTH);
+    CHECK(frameDecode((const uint8_t *) "\x02\x01", 2, buf, sizeof(buf), &type, &sequence, &got, &gotLen) == FRAME_ERR_LENGTH);
+}
+
+// Message payloads round-trip to within the centi-dB they are carried in
+static void testPayloads(void)
+{
+    uint8_t payload[FRAME_MAX_PAYLOAD];
+
+    frameSpl spl = { .timeUs = 1760000000123456LL, .spl = 61.27 }, spl2;
+    uint32_t len = framePackSpl(&spl, payload);
+    CHECK(frameUnpackSpl(payload, len, &spl2));
+    CHECK(spl2.timeUs == spl.timeUs && spl2.spl > 61.265 && spl2.spl < 61.275);
+    CHECK(!frameUnpackSpl(payload, len - 1, &spl2));
+
+    frameBands bands = { .count = FRAME_MAX_BANDS }, bands2;
+    for (int i=0; i<FRAME_MAX_BANDS; i++) {
+        bands.centerHz[i] = (uint16_t) (63 << i);
+        bands.level[i] = 30.0 + (i * 5.5);
+    }
+    len = framePackBands(&bands, payload);
+    CHECK(len == 1 + (FRAME_MAX_BANDS * 4) && len <= FRAME_MAX_PAYLOAD);
+    CHECK(frameUnpackBands(payload, len, &bands2) && bands2.count == bands.count);
+    for (int i=0; i<FRAME_MAX_BANDS; i++) {
+        CHECK(bands2.centerHz[i] == bands.centerHz[i]);
+        CHECK(bands2.level[i] > bands.level[i] - 0.006 && bands2.level[i] < bands.level[i] + 0.006);
+    }
+    CHECK(!frameUnpackBands(payload, len + 1, &bands2));
+    payload[0] = FRAME_MAX_BANDS + 1;
+    CHECK(!frameUnpackBands(payload, 1 + ((FRAME_MAX_BANDS + 1) * 4), &bands2));
+
+    frameInterval iv = { .blocks = 600000, .secs = 3600, .min = 35.5, .max = 92.25, .leq = 71.03 }, iv2;
+    len = framePackInterval(&iv, payload);
+    CHECK(frameUnpackInterval(payload, len, &iv2));
+    CHECK(iv2.blocks == iv.blocks && iv2.secs == iv.secs);
+    CHECK(iv2.min > 35.495 && iv2.min < 35.505 && iv2.max > 92.245 && iv2.max < 92.255);
+    CHECK(iv2.leq > 71.025 && iv2.leq < 71.035);
+}
+
+// The wire cost of spl.get and bands.get each way, as JSON and as frames, with the
+// responses laid out as req.c lays them out, which is what frame.h quotes
+static void testSizes(void)
+{
+    uint8_t payload[FRAME_MAX_PAYLOAD];
+    uint8_t wire[FRAME_MAX_WIRE(FRAME_MAX_PAYLOAD)];
+    char json[256];
+    jsonWriter w;
+
+    const char *splReq = "{\"req\":\"spl.get\"}\n";
+    jsonWriterBegin(&w, json, sizeof(json));
+    jsonAddNumber(&w, "spl", 61.27, 2);
+    jsonAddNumber(&w, "time", 1760000000.123456, 6);
+    uint32_t splJson = jsonWriterEnd(&w) + 1;
+    uint32_t splReqFrame = frameEncode(FRAME_SPL_GET, 1, NULL, 0, wire, sizeof(wire));
+    frameSpl spl = { .timeUs = 1760000000123456LL, .spl = 61.27 };
+    uint32_t splFrame = frameEncode(FRAME_SPL, 1, payload, framePackSpl(&spl, payload), wire, sizeof(wire));
+
+    const char *bandsReq = "{\"req\":\"bands.get\"}\n";
+    jsonWriterBegin(&w, json, sizeof(json));
+    double centers[8] = { 63, 125, 250, 500, 1000, 2000, 4000, 8000 };
+    double levels[8] = { 41.23, 44.81, 52.17, 58.34, 61.02, 57.66, 49.95, 40.31 };
+    jsonAddNumbers(&w, "hz", centers, 8, 0);
+    jsonAddNumbers(&w, "db", levels, 8, 2);
+    uint32_t bandsJson = jsonWriterEnd(&w) + 1;
+    frameBands bands = { .count = 8 };
+    for (int i=0; i<8; i++) {
+        bands.centerHz[i] = (uint16_t) centers[i];
+        bands.level[i] = levels[i];
+    }
+    uint32_t bandsFrame = frameEncode(FRAME_BANDS, 1, payload, framePackBands(&bands, payload), wire, sizeof(wire));
+
+    CHECK(splReqFrame < strlen(splReq) && splFrame < splJson && bandsFrame < bandsJson);
+    printf("frame: spl.get %u+%u bytes as JSON, %u+%u as frames; bands.get %u+%u as JSON, %u+%u as frames\n",
+           (unsigned) strlen(splReq), splJson, splReqFrame, splFrame,
+           (unsigned) strlen(bandsReq), bandsJson, splReqFrame, bandsFrame);
+}
+
+int main(void)
+{
+    testCobs();
+    testFrames();
+    testPayloads();
+    testSizes();
+    TEST_DONE("frame");
+}
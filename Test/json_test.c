@@ -0,0 +1,224 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Checks the tokenizer and writer against the kinds of request the request table
+// handles, and times the parse, lookup and response path as reqProcess uses it,
+// through the real table and reqTableDispatch with stand-ins for the handlers.
+
+#include "test.h"
+#include "json.h"
+#include "reqtable.h"
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_TOKENS      48          // REQ_MAX_TOKENS
+#define REQ_RESPONSE    320         // REQ_MAX_RESPONSE
+
+// Parse a request and look up a member, returning its token or -1
+static int lookup(const char *json, jsonToken *tokens, const char *key)
+{
+    int count = jsonParse(json, tokens, MAX_TOKENS);
+    if (count <= 0) {
+        return -1;
+    }
+    return jsonObjectGet(json, tokens, count, 0, key);
+}
+
+static void testParse(void)
+{
+    jsonToken tokens[MAX_TOKENS];
+    const char *req = "{\"req\":\"config.set\",\"threshold\":85.5,\"window\":10,\"enabled\":true,\"nested\":{\"req\":\"x\"},\"list\":[1,2,3]}";
+    int count = jsonParse(req, tokens, MAX_TOKENS);
+    CHECK(count > 0);
+    int i = jsonObjectGet(req, tokens, count, 0, "req");
+    CHECK(i >= 0 && jsonEquals(req, &tokens[i], "config.set"));
+    double value;
+    i = jsonObjectGet(req, tokens, count, 0, "threshold");
+    CHECK(i >= 0 && jsonNumber(req, &tokens[i], &value) && value == 85.5);
+    bool enabled = false;
+    i = jsonObjectGet(req, tokens, count, 0, "enabled");
+    CHECK(i >= 0 && jsonBool(req, &tokens[i], &enabled) && enabled);
+    CHECK(jsonObjectGet(req, tokens, count, 0, "missing") < 0);
+
+
+    CHECK(jsonParse("{\"req\":\"spl.get\"", tokens, MAX_TOKENS) == JSON_ERR_PARTIAL);
+    CHECK(jsonParse("{\"req\" 1}", tokens, MAX_TOKENS) == JSON_ERR_INVALID);
+    CHECK(jsonParse("{\"req\":x}", tokens, MAX_TOKENS) == JSON_ERR_INVALID);
+    CHECK(jsonParse("{\"a\":1,\"b\":2,\"c\":3}", tokens, 4) == JSON_ERR_NOMEM);
+    CHECK(lookup("{\"req\":\"spl.get\"}", tokens, "req") >= 0);
+}
+
+// Integers beyond 32 bits, and non-finite levels such as that of digital silence
+static void testWriter(void)
+{
+    char buf[256];
+    jsonWriter w;
+    jsonWriterBegin(&w, buf, sizeof(buf));
+    jsonAddInt(&w, "big", 5000000000LL);
+    jsonAddInt(&w, "count", (uint32_t) 3000000000U);
+    jsonAddInt(&w, "neg", -7);
+    jsonAddNumber(&w, "spl", -INFINITY, 2);
+    jsonAddNumber(&w, "leq", NAN, 2);
+    double levels[3] = { 40.5, -INFINITY, 60.25 };
+    jsonAddNumbers(&w, "db", levels, 3, 2);
+    jsonAddString(&w, "s", "a\"b");
+    jsonAddBool(&w, "ok", true);
+    uint32_t len = jsonWriterEnd(&w);
+    const char *expected = "{\"big\":5000000000,\"count\":3000000000,\"neg\":-7,\"spl\":null,\"leq\":null,"
+                           "\"db\":[40.50,null,60.25],\"s\":\"a\\\"b\",\"ok\":true}";
+    CHECK(len == strlen(expected) && strcmp(buf, expected) == 0);
+
+    // What the writer produces must itself parse
+    jsonToken tokens[MAX_TOKENS];
+    CHECK(jsonParse(buf, tokens, MAX_TOKENS) > 0);
+
+    // A response that doesn't fit is reported as such
+    jsonWriterBegin(&w, buf, 8);
+    jsonAddString(&w, "err", "too long to fit");
+    CHECK(jsonWriterEnd(&w) == 0);
+}
+
+// Errors, without gerr.c's ring of messages
+err_t errF(const char *format, ...)
+{
+    (void) format;
+    return 1;
+}
+
+// Stand-ins for the handlers in req.c, reading the same arguments and writing
+// responses of the same shape
+err_t reqSplGet(reqContext *ctx)
+{
+    jsonAddNumber(ctx->rsp, "spl", 61.27, 2);
+    jsonAddNumber(ctx->rsp, "time", 1760000000.123456, 6);
+    return errNone;
+}
+err_t reqSplStats(reqContext *ctx)
+{
+    jsonAddInt(ctx->rsp, "count", 2400);
+    jsonAddNumber(ctx->rsp, "min", 41.5, 2);
+    jsonAddNumber(ctx->rsp, "max", 88.25, 2);
+    jsonAddNumber(ctx->rsp, "leq", 63.1, 2);
+    jsonAddInt(ctx->rsp, "secs", 60);
+    bool reset;
+    reqArgBool(ctx, "reset", &reset);
+    return errNone;
+}
+err_t reqBandsGet(reqContext *ctx)
+{
+    static const double centers[] = { 63, 125, 250, 500, 1000, 2000 };
+    static const double levels[] = { 41.2, 45.9, 52.3, 58.7, 61.0, 49.4 };
+    jsonAddNumbers(ctx->rsp, "hz", centers, 6, 0);
+    jsonAddNumbers(ctx->rsp, "db", levels, 6, 2);
+    return errNone;
+}
+err_t reqConfigSet(reqContext *ctx)
+{
+    double threshold = 0, window = 0, period = 60;
+    reqArgNumber(ctx, "threshold", &threshold);
+    reqArgNumber(ctx, "window", &window);
+    reqArgNumber(ctx, "period", &period);
+    jsonAddNumber(ctx->rsp, "threshold", threshold, 1);
+    jsonAddNumber(ctx->rsp, "window", window, 0);
+    jsonAddNumber(ctx->rsp, "period", period, 0);
+    return errNone;
+}
+err_t reqSerialBaud(reqContext *ctx)
+{
+    double rate;
+    if (!reqArgNumber(ctx, "rate", &rate)) {
+        return errF("rate must be specified");
+    }
+    jsonAddInt(ctx->rsp, "rate", (uint32_t) rate);
+    return errNone;
+}
+err_t reqSplSubscribe(reqContext *ctx)
+{
+    jsonObjectGet(ctx->json, ctx->tokens, ctx->count, 0, "type");
+    jsonObjectGet(ctx->json, ctx->tokens, ctx->count, 0, "format");
+    double ms = 1000, secs = 0;
+    reqArgNumber(ctx, "ms", &ms);
+    reqArgNumber(ctx, "secs", &secs);
+    jsonAddInt(ctx->rsp, "ms", (uint32_t) ms);
+    jsonAddInt(ctx->rsp, "secs", (uint32_t) secs);
+    return errNone;
+}
+err_t reqSplUnsubscribe(reqContext *ctx)
+{
+    (void) ctx;
+    return errNone;
+}
+static const reqDef reqTable[] = {
+    REQ_TABLE(REQ_TABLE_ENTRY)
+    {NULL, NULL},
+};
+
+// Requests that dispatch fails, and responses that don't fit, are errors
+static void testDispatch(void)
+{
+    jsonToken tokens[MAX_TOKENS];
+    char rsp[REQ_RESPONSE];
+    uint32_t rspLen;
+    char req[64];
+    snprintf(req, sizeof(req), "{\"req\":\"spl.get\"}");
+    CHECK(reqTableDispatch(reqTable, NULL, req, tokens, MAX_TOKENS, rsp, sizeof(rsp), &rspLen) == errNone);
+    CHECK(rspLen == strlen(rsp) && strncmp(rsp, "{\"spl\":61.27,", 13) == 0);
+    CHECK(reqTableDispatch(reqTable, NULL, req, tokens, MAX_TOKENS, rsp, 16, &rspLen) != errNone);
+    snprintf(req, sizeof(req), "{\"req\":\"spl.gets\"}");
+    CHECK(reqTableDispatch(reqTable, NULL, req, tokens, MAX_TOKENS, rsp, sizeof(rsp), &rspLen) != errNone);
+    snprintf(req, sizeof(req), "{\"rate\":9600}");
+    CHECK(reqTableDispatch(reqTable, NULL, req, tokens, MAX_TOKENS, rsp, sizeof(rsp), &rspLen) != errNone);
+    snprintf(req, sizeof(req), "[\"req\",\"spl.get\"]");
+    CHECK(reqTableDispatch(reqTable, NULL, req, tokens, MAX_TOKENS, rsp, sizeof(rsp), &rspLen) != errNone);
+    snprintf(req, sizeof(req), "{\"req\":\"serial.baud\"}");
+    CHECK(reqTableDispatch(reqTable, NULL, req, tokens, MAX_TOKENS, rsp, sizeof(rsp), &rspLen) != errNone);
+}
+
+// Time the path that reqDispatch takes for each request in the table, the last of
+// which is looked up furthest down it
+static void testSpeed(void)
+{
+    const char *reqs[] = {
+        "{\"req\":\"spl.get\"}",
+        "{\"req\":\"spl.stats\",\"reset\":true}",
+        "{\"req\":\"bands.get\"}",
+        "{\"req\":\"config.set\",\"threshold\":85.5,\"window\":10,\"period\":60}",
+        "{\"req\":\"serial.baud\",\"rate\":115200}",
+        "{\"req\":\"spl.subscribe\",\"type\":\"interval\",\"ms\":1000,\"secs\":600,\"format\":\"json\"}",
+        "{\"req\":\"spl.unsubscribe\"}",
+    };
+    enum { REQS = sizeof(reqs) / sizeof(reqs[0]), ITERATIONS = 200000 };
+    jsonToken tokens[MAX_TOKENS];
+    char req[128], rsp[REQ_RESPONSE];
+    uint32_t total = 0, failed = 0;
+    struct timespec began, ended;
+    clock_gettime(CLOCK_MONOTONIC, &began);
+    for (int n=0; n<ITERATIONS; n++) {
+
+        // Dispatch tokenizes in place, so each request starts from a fresh copy as
+        // it would from the receive buffer
+        const char *r = reqs[n % REQS];
+        memcpy(req, r, strlen(r) + 1);
+        uint32_t rspLen;
+        if (reqTableDispatch(reqTable, NULL, req, tokens, MAX_TOKENS, rsp, sizeof(rsp), &rspLen) != errNone) {
+            failed++;
+            continue;
+        }
+        total += rspLen;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ended);
+    double us = ((ended.tv_sec - began.tv_sec) * 1e9 + (ended.tv_nsec - began.tv_nsec)) / 1000.0;
+    CHECK(failed == 0 && total > 0);
+    printf("json: %.2f us per request through the request table on this host\n", us / ITERATIONS);
+}
+
+int main(void)
+{
+    testParse();
+    testWriter();
+    testDispatch();
+    testSpeed();
+    TEST_DONE("json");
+}
@@ -0,0 +1,131 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Runs a producer and a consumer thread against one queue, the producer numbering
+// its messages and the consumer checking that what arrives is in order with no
+// gaps other than those the producer counted as overflows.  On its own:
+//   cc -O2 -std=gnu11 -I../System/Global -o msgq_test msgq_test.c ../System/Global/msgq.c -lpthread
+
+#include "test.h"
+#include "msgq.h"
+#include <pthread.h>
+#include <sched.h>
+
+#define MESSAGES        1000000
+
+static msgq q;
+static atomic_bool producerDone;
+static uint32_t rejected;
+
+// Post numbered messages in bursts, as interrupts would, noting each that doesn't fit.
+// A burst may be up to twice the capacity, and between bursts the consumer is given
+// a random chance to catch up, so the queue both overflows and runs dry.
+static void *producer(void *arg)
+{
+    (void) arg;
+    uint32_t n = 0;
+    while (n < MESSAGES) {
+        uint32_t burst = randBelow(2 * MSGQ_CAPACITY) + 1;
+        for (uint32_t i=0; i<burst && n<MESSAGES; i++, n++) {
+            if (!msgqPut(&q, n & 0xff, n)) {
+                rejected++;
+            }
+        }
+        uint32_t threshold = randBelow(MSGQ_CAPACITY);
+        while (msgqPending(&q) > threshold) {
+            sched_yield();
+        }
+    }
+    atomic_store(&producerDone, true);
+    return NULL;
+}
+
+// Take messages until the producer is done and the queue is empty, checking that
+// they arrive in order
+static void *consumer(void *arg)
+{
+    uint32_t *received = arg;
+    uint32_t next = 0;
+    bool ordered = true;
+    for (;;) {
+        bool done = atomic_load(&producerDone);
+        msgqMsg msg;
+        if (!msgqGet(&q, &msg)) {
+            if (done) {
+                break;
+            }
+            sched_yield();
+            continue;
+        }
+        if (msg.value < next || msg.type != (msg.value & 0xff)) {
+            ordered = false;
+        }
+        next = msg.value + 1;
+        (*received)++;
+    }
+    CHECK(ordered);
+    return NULL;
+}
+
+// The queue fills at its capacity and empties in order, single-threaded
+static void testCapacity(void)
+{
+    msgqInit(&q);
+    for (uint32_t i=0; i<MSGQ_CAPACITY; i++) {
+        CHECK(msgqPut(&q, 1, i));
+    }
+    CHECK(!msgqPut(&q, 1, 99));
+    CHECK(q.overflows == 1 && q.posted == MSGQ_CAPACITY && q.highWater == MSGQ_CAPACITY);
+    CHECK(msgqPending(&q) == MSGQ_CAPACITY);
+    msgqMsg msg;
+    for (uint32_t i=0; i<MSGQ_CAPACITY; i++) {
+        CHECK(msgqGet(&q, &msg) && msg.value == i);
+    }
+    CHECK(!msgqGet(&q, &msg));
+    CHECK(msgqPending(&q) == 0);
+}
+
+// Indices wrap past 2^32 without losing track of what's pending, which relies on the
+// capacity being a power of two
+static void testWrap(void)
+{
+    msgqInit(&q);
+    atomic_store(&q.put, UINT32_MAX - 2);
+    atomic_store(&q.get, UINT32_MAX - 2);
+    for (uint32_t i=0; i<8; i++) {
+        CHECK(msgqPut(&q, 2, i));
+    }
+    CHECK(msgqPending(&q) == 8);
+    msgqMsg msg;
+    for (uint32_t i=0; i<8; i++) {
+        CHECK(msgqGet(&q, &msg) && msg.value == i);
+    }
+    CHECK(msgqPending(&q) == 0);
+}
+
+static void testThreads(void)
+{
+    msgqInit(&q);
+    atomic_store(&producerDone, false);
+    rejected = 0;
+    uint32_t received = 0;
+    pthread_t p, c;
+    pthread_create(&c, NULL, consumer, &received);
+    pthread_create(&p, NULL, producer, NULL);
+    pthread_join(p, NULL);
+    pthread_join(c, NULL);
+    CHECK(received + q.overflows == MESSAGES);
+    CHECK(q.overflows == rejected && q.posted == received);
+    CHECK(q.highWater <= MSGQ_CAPACITY);
+    printf("msgq: %u messages, %u received, %u overflows, high water %u of %u\n",
+           MESSAGES, received, q.overflows, q.highWater, MSGQ_CAPACITY);
+}
+
+int main(void)
+{
+    testCapacity();
+    testWrap();
+    testThreads();
+    TEST_DONE("msgq");
+}
@@ -0,0 +1,432 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Drives lineScan the way pollPort does, from a simulated UART receive ring that
+// behaves as UARTIO does in usart.c: the "interrupt" appends at fill, and the poller
+// peeks the longest contiguous span at drain, scans it, and consumes what it used.
+// Completed lines and frames go to a queue of SERIAL_RX_LINES that a simulated
+// request task empties at its own pace, discarding them when it falls behind.
+
+#include "test.h"
+#include "linescan.h"
+#include "frame.h"
+#include <string.h>
+
+#define RING_SIZE       600
+#define RX_LINES        4
+#define LINE_MAX        400
+
+// Receive ring, as UARTIO
+typedef struct {
+    uint8_t buf[RING_SIZE];
+    uint16_t fill;
+    uint16_t drain;
+    uint32_t overruns;
+} simRing;
+
+// Port, as serialDesc
+typedef struct {
+    simRing ring;
+    lineScanner scanner;
+    uint8_t bytes[LINE_MAX];
+    uint32_t bytesLen;
+    uint8_t lines[RX_LINES][LINE_MAX];
+    uint32_t linesLen[RX_LINES];
+    bool linesBinary[RX_LINES];
+    uint32_t linesIn;
+    uint32_t linesOut;
+    uint32_t lineOverflows;
+    uint32_t framesAbandoned;
+    uint32_t nowMs;
+    uint32_t spans;
+    uint32_t polls;
+} simPort;
+
+static uint32_t minU32(uint32_t a, uint32_t b)
+{
+    return a < b ? a : b;
+}
+
+// Make the numbered message, using its own random sequence so that the receiver can
+// regenerate it to compare against.  One in four is a frame whose payload begins with
+// the number, where what's returned is the frame as sent on the wire, and otherwise
+// it's a text line that begins with the number, without its terminator.
+static uint32_t makeMessage(uint32_t n, uint32_t *seed, uint8_t *msg, bool *retBinary)
+{
+    uint32_t saved = randSeed;
+    randSeed = *seed;
+    uint32_t len;
+    *retBinary = (randBelow(4) == 0);
+    if (*retBinary) {
+        uint8_t payload[FRAME_MAX_PAYLOAD];
+        memcpy(payload, &n, sizeof(n));
+        uint32_t payloadLen = sizeof(n) + randBelow(FRAME_MAX_PAYLOAD - sizeof(n));
+        for (uint32_t i=sizeof(n); i<payloadLen; i++) {
+            payload[i] = (uint8_t) (randBelow(4) == 0 ? 0 : randBelow(256));
+        }
+        len = frameEncode(0x01, (uint8_t) n, payload, payloadLen, msg, FRAME_MAX_WIRE(FRAME_MAX_PAYLOAD));
+    } else {
+        len = (uint32_t) sprintf((char *) msg, "%u:", n);
+        uint32_t extra = randBelow(8) == 0 ? randBelow(LINE_MAX - 12) : randBelow(40);
+        for (uint32_t i=0; i<extra; i++) {
+            msg[len++] = (uint8_t) (' ' + randBelow(95));
+        }
+    }
+    *seed = randSeed;
+    randSeed = saved;
+    return len;
+}
+
+// Get the number of a received line or frame
+static uint32_t messageNumber(const uint8_t *line, uint32_t len, bool binary)
+{
+    if (!binary) {
+        return (uint32_t) strtoul((const char *) line, NULL, 10);
+    }
+    uint8_t buf[FRAME_MAX_WIRE(FRAME_MAX_PAYLOAD)];
+    uint8_t type, sequence;
+    uint8_t *payload;
+    uint32_t payloadLen, n;
+    if (frameDecode(line, len, buf, sizeof(buf), &type, &sequence, &payload, &payloadLen) != FRAME_OK || payloadLen < sizeof(n)) {
+        return 0xffffffff;
+    }
+    memcpy(&n, payload, sizeof(n));
+    return n;
+}
+
+// Receive bytes as the interrupt handler does, dropping those that would overrun
+static uint32_t ringPut(simRing *r, const uint8_t *data, uint32_t len)
+{
+    for (uint32_t i=0; i<len; i++) {
+        uint16_t next = (r->fill + 1) % RING_SIZE;
+        if (next == r->drain) {
+            r->overruns++;
+            return i;
+        }
+        r->buf[r->fill] = data[i];
+        r->fill = next;
+    }
+    return len;
+}
+
+// Bytes that can be received without overrun
+static uint32_t ringSpace(simRing *r)
+{
+    uint32_t used = (r->fill >= r->drain) ? (r->fill - r->drain) : (RING_SIZE - r->drain + r->fill);
+    return RING_SIZE - 1 - used;
+}
+
+// As MX_UART_RxPeek and MX_UART_RxConsume
+static uint32_t ringPeek(simRing *r, uint8_t **retData)
+{
+    *retData = &r->buf[r->drain];
+    return (r->fill >= r->drain) ? (r->fill - r->drain) : (RING_SIZE - r->drain);
+}
+static void ringConsume(simRing *r, uint32_t len)
+{
+    r->drain = (uint16_t) ((r->drain + len) % RING_SIZE);
+}
+
+// As pollPort
+static void poll(simPort *p)
+{
+    uint8_t *data;
+    uint32_t dataLen;
+    p->polls++;
+    while ((dataLen = ringPeek(&p->ring, &data)) > 0) {
+        p->spans++;
+        uint32_t appendLen;
+        int event;
+        uint32_t consumed = lineScan(&p->scanner, data, dataLen, p->nowMs, &appendLen, &event);
+        CHECK(consumed <= dataLen && (consumed > 0 || event == LINESCAN_ABANDON));
+        CHECK(appendLen <= consumed);
+        CHECK(p->bytesLen + appendLen <= LINE_MAX);
+        memcpy(&p->bytes[p->bytesLen], data, appendLen);
+        p->bytesLen += appendLen;
+        ringConsume(&p->ring, consumed);
+        if (event == LINESCAN_MORE) {
+            continue;
+        }
+        if (event == LINESCAN_DISCARD || event == LINESCAN_ABANDON) {
+            if (event == LINESCAN_ABANDON) {
+                p->framesAbandoned++;
+            }
+            p->bytesLen = 0;
+            continue;
+        }
+        if (p->linesIn - p->linesOut >= RX_LINES) {
+            p->lineOverflows++;
+        } else {
+            uint32_t slot = p->linesIn % RX_LINES;
+            memcpy(p->lines[slot], p->bytes, p->bytesLen);
+            p->linesLen[slot] = p->bytesLen;
+            p->linesBinary[slot] = (event == LINESCAN_FRAME);
+            p->linesIn++;
+        }
+        p->bytesLen = 0;
+    }
+}
+
+// Take the oldest queued line, as serialLock and serialUnlock
+static bool takeLine(simPort *p, uint8_t **retLine, uint32_t *retLen, bool *retBinary)
+{
+    *retLine = NULL;
+    *retLen = 0;
+    if (p->linesIn == p->linesOut) {
+        return false;
+    }
+    uint32_t slot = p->linesOut % RX_LINES;
+    *retLine = p->lines[slot];
+    *retLen = p->linesLen[slot];
+    if (retBinary != NULL) {
+        *retBinary = p->linesBinary[slot];
+    }
+    p->linesOut++;
+    return true;
+}
+
+static void portInit(simPort *p)
+{
+    memset(p, 0, sizeof(simPort));
+    lineScanInit(&p->scanner);
+}
+
+// Send a string and poll, then see that exactly the expected lines arrived
+static void expectLines(simPort *p, const char *sent, int count, const char **expected)
+{
+    CHECK(ringPut(&p->ring, (const uint8_t *) sent, strlen(sent)) == strlen(sent));
+    poll(p);
+    for (int i=0; i<count; i++) {
+        uint8_t *line;
+        uint32_t len;
+        CHECK(takeLine(p, &line, &len, NULL));
+        CHECK(len == strlen(expected[i]) && memcmp(line, expected[i], len) == 0);
+    }
+    uint8_t *line;
+    uint32_t len;
+    CHECK(!takeLine(p, &line, &len, NULL));
+}
+
+// Terminators: \r\n is one line, but \n\n is two empty lines, which note-c sends to
+// see if we're there, and \r\r is two lines as well.
+static void testTerminators(void)
+{
+    simPort p;
+    portInit(&p);
+    expectLines(&p, "{\"req\":\"a\"}\r\n", 1, (const char *[]) { "{\"req\":\"a\"}" });
+    expectLines(&p, "\n\n", 2, (const char *[]) { "", "" });
+    expectLines(&p, "x\ry\r", 2, (const char *[]) { "x", "y" });
+    expectLines(&p, "\nz\n", 1, (const char *[]) { "z" });
+    expectLines(&p, "a\n\rb\r\n", 3, (const char *[]) { "a", "", "b" });
+}
+
+// A line that spans the end of the ring takes two spans, and a \r\n pair split across
+// the wrap, even across polls, is still a single terminator.
+static void testWrap(void)
+{
+    simPort p;
+    portInit(&p);
+    p.ring.fill = p.ring.drain = RING_SIZE - 5;
+    expectLines(&p, "abcdefghij\r\n", 1, (const char *[]) { "abcdefghij" });
+    CHECK(p.ring.drain == 7);
+
+    portInit(&p);
+    p.ring.fill = p.ring.drain = RING_SIZE - 4;
+    expectLines(&p, "abc\r", 1, (const char *[]) { "abc" });
+    CHECK(p.ring.drain == 0);
+    expectLines(&p, "\ndef\n", 1, (const char *[]) { "def" });
+}
+
+// When the request task doesn't keep up, the lines beyond the queue are counted and
+// discarded, and the ones that were queued are intact.
+static void testOverflow(void)
+{
+    simPort p;
+    portInit(&p);
+    const char *sent = "l0\nl1\nl2\nl3\nl4\nl5\nl6\n";
+    ringPut(&p.ring, (const uint8_t *) sent, strlen(sent));
+    poll(&p);
+    CHECK(p.lineOverflows == 3);
+    const char *expected[] = { "l0", "l1", "l2", "l3" };
+    for (int i=0; i<RX_LINES; i++) {
+        uint8_t *line;
+        uint32_t len;
+        CHECK(takeLine(&p, &line, &len, NULL));
+        CHECK(len == 2 && memcmp(line, expected[i], 2) == 0);
+    }
+    expectLines(&p, "l7\n", 1, (const char *[]) { "l7" });
+}
+
+// Frames and text lines interleave, each frame carrying its own leading delimiter
+static void testFrames(void)
+{
+    simPort p;
+    portInit(&p);
+    uint8_t payload[3] = { 0x00, 0x11, 0x00 };
+    uint8_t wire[FRAME_MAX_WIRE(FRAME_MAX_PAYLOAD)];
+    uint32_t wireLen = frameEncode(FRAME_SPL_GET, 9, payload, sizeof(payload), wire, sizeof(wire));
+    ringPut(&p.ring, (const uint8_t *) "a\r\n", 3);
+    ringPut(&p.ring, wire, wireLen);
+    ringPut(&p.ring, (const uint8_t *) "b\n", 2);
+    ringPut(&p.ring, (const uint8_t *) "\0\0", 2);
+    ringPut(&p.ring, wire, wireLen);
+    poll(&p);
+    uint8_t *line;
+    uint32_t len;
+    bool binary;
+    CHECK(takeLine(&p, &line, &len, &binary) && !binary && len == 1 && line[0] == 'a');
+    CHECK(takeLine(&p, &line, &len, &binary) && binary && len == wireLen - 2 && memcmp(line, &wire[1], len) == 0);
+    uint8_t buf[FRAME_MAX_WIRE(FRAME_MAX_PAYLOAD)];
+    uint8_t type, sequence;
+    uint8_t *got;
+    uint32_t gotLen;
+    CHECK(frameDecode(line, len, buf, sizeof(buf), &type, &sequence, &got, &gotLen) == FRAME_OK);
+    CHECK(type == FRAME_SPL_GET && sequence == 9 && gotLen == sizeof(payload) && memcmp(got, payload, gotLen) == 0);
+    CHECK(takeLine(&p, &line, &len, &binary) && !binary && len == 1 && line[0] == 'b');
+    CHECK(takeLine(&p, &line, &len, &binary) && binary && len == wireLen - 2);
+    CHECK(!takeLine(&p, &line, &len, &binary));
+    CHECK(p.framesAbandoned == 0);
+}
+
+// A stray 0x00 on a text link mustn't lock out a host that only speaks text.  If the
+// host pauses, the frame is abandoned and what follows is text again, and if it
+// doesn't, the frame is abandoned once it is longer than any valid frame.
+static void testStrayDelimiter(void)
+{
+    simPort p;
+    portInit(&p);
+    p.nowMs = 1000;
+    ringPut(&p.ring, (const uint8_t *) "\0", 1);
+    poll(&p);
+    p.nowMs += LINESCAN_FRAME_IDLE_MS;
+    expectLines(&p, "\n{\"req\":\"spl.get\"}\n", 2, (const char *[]) { "", "{\"req\":\"spl.get\"}" });
+    CHECK(p.framesAbandoned == 1);
+
+    // Without a pause, only what makes it too long for a frame is lost
+    portInit(&p);
+    char text[LINESCAN_FRAME_MAX + 64];
+    memset(text, 'x', sizeof(text));
+    text[0] = '\0';
+    memcpy(&text[sizeof(text) - 20], "\n{\"req\":\"spl.get\"}\n", 19);
+    ringPut(&p.ring, (const uint8_t *) text, sizeof(text) - 1);
+    poll(&p);
+    CHECK(p.framesAbandoned == 1);
+    uint8_t *line;
+    uint32_t len;
+    bool binary;
+    CHECK(takeLine(&p, &line, &len, &binary) && !binary);
+    CHECK(takeLine(&p, &line, &len, &binary) && !binary && len == 17 && memcmp(line, "{\"req\":\"spl.get\"}", len) == 0);
+    CHECK(!takeLine(&p, &line, &len, &binary));
+
+    // A frame that takes a little while to arrive is unaffected
+    portInit(&p);
+    uint8_t payload[100] = { 0 };
+    uint8_t wire[FRAME_MAX_WIRE(FRAME_MAX_PAYLOAD)];
+    uint32_t wireLen = frameEncode(FRAME_SPL_GET, 1, payload, sizeof(payload), wire, sizeof(wire));
+    for (uint32_t i=0; i<wireLen; i+=10) {
+        ringPut(&p.ring, &wire[i], wireLen - i < 10 ? wireLen - i : 10);
+        poll(&p);
+        p.nowMs += LINESCAN_FRAME_IDLE_MS / 2;
+    }
+    CHECK(takeLine(&p, &line, &len, &binary) && binary && len == wireLen - 2);
+    CHECK(p.framesAbandoned == 0);
+}
+
+// Random lines and frames, terminators and arrival chunking at a high rate, with a
+// request task that sometimes falls behind.  Each message is numbered, so that every
+// one can be seen to arrive intact and in order unless it was counted as an overflow.
+static void testStress(void)
+{
+    static const char *terminators[] = { "\n", "\r\n", "\r" };
+    static simPort p;
+    portInit(&p);
+
+    enum { MESSAGES = 200000 };
+    uint32_t sent = 0, received = 0, frames = 0, nextExpected = 0, wraps = 0;
+    uint64_t bytes = 0;
+    uint8_t pending[LINE_MAX+2];
+    uint32_t pendingLen = 0, pendingOff = 0;
+    uint8_t expected[LINE_MAX];
+    uint32_t expectedLen = 0;
+    bool expectedBinary = false;
+    uint32_t sentSeed = 7, expectedSeed = 7;
+
+    for (;;) {
+
+        // Compose the next message once the last has been fully received by the ring
+        if (pendingOff == pendingLen && sent < MESSAGES) {
+            bool binary;
+            pendingLen = makeMessage(sent, &sentSeed, pending, &binary);
+            if (!binary) {
+                const char *t = terminators[randBelow(3)];
+                memcpy(&pending[pendingLen], t, strlen(t));
+                pendingLen += strlen(t);
+            }
+            pendingOff = 0;
+            sent++;
+        }
+
+        // The interrupt delivers a burst, never more than there's room for
+        uint32_t burst = minU32(randBelow(64) + 1, pendingLen - pendingOff);
+        burst = minU32(burst, ringSpace(&p.ring));
+        uint16_t before = p.ring.fill;
+        pendingOff += ringPut(&p.ring, &pending[pendingOff], burst);
+        if (p.ring.fill < before) {
+            wraps++;
+        }
+        bytes += burst;
+        p.nowMs++;
+
+        // The serial task is woken, as it would be by IDLE or a terminator
+        bool allSent = (sent == MESSAGES && pendingOff == pendingLen);
+        if (randBelow(4) == 0 || ringSpace(&p.ring) == 0 || allSent) {
+            poll(&p);
+        }
+
+        // The request task takes messages, sometimes stalling, and checks each against
+        // the message of that number, which it regenerates
+        uint32_t take = allSent ? RX_LINES : (randBelow(100) < 5 ? 0 : randBelow(3));
+        for (uint32_t i=0; i<take; i++) {
+            uint8_t *line;
+            uint32_t len;
+            bool binary;
+            if (!takeLine(&p, &line, &len, &binary)) {
+                break;
+            }
+            uint32_t n = messageNumber(line, len, binary);
+            CHECK(n >= nextExpected && n < sent);
+            while (nextExpected <= n) {
+                expectedLen = makeMessage(nextExpected++, &expectedSeed, expected, &expectedBinary);
+            }
+            CHECK(binary == expectedBinary);
+            if (binary) {
+                CHECK(len == expectedLen - 2 && memcmp(line, &expected[1], len) == 0);
+                frames++;
+            } else {
+                CHECK(len == expectedLen && memcmp(line, expected, len) == 0);
+            }
+            received++;
+        }
+        if (allSent && p.linesIn == p.linesOut) {
+            break;
+        }
+    }
+    CHECK(received + p.lineOverflows == MESSAGES);
+    CHECK(p.framesAbandoned == 0);
+    CHECK(p.ring.overruns == 0);
+    CHECK(wraps > 1000);
+    printf("serial: %u messages (%u frames), %llu bytes, %u wraps, %u overflows, %u polls, %.2f spans/message\n",
+           MESSAGES, frames, (unsigned long long) bytes, wraps, p.lineOverflows, p.polls, (double) p.spans / MESSAGES);
+}
+
+int main(void)
+{
+    testTerminators();
+    testWrap();
+    testOverflow();
+    testFrames();
+    testStrayDelimiter();
+    testStress();
+    TEST_DONE("serial");
+}
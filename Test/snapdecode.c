@@ -0,0 +1,196 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Decodes the audio snapshots that 'snap dump' exports (see snapshot.c for the format)
+// from a captured debug log, writing each as a 16-bit mono WAV file.  Lines without
+// "snapshot:" are ignored, as is anything that precedes it on a line, such as a
+// terminal's timestamp, so the log can be captured with any terminal program.
+//   make -C Test
+//   Test/build/snapdecode capture.txt snap      writes snap-1.wav, snap-2.wav, ...
+// Test/snapshot_test.c includes this file to decode its own synthesized exports.
+
+#include "global.h"
+#include "json.h"
+#include "ulaw.h"
+#include "wav.h"
+
+// What a snapshot's header says about it
+typedef struct {
+    uint32_t rateHz;
+    uint32_t samples;
+    uint32_t pre;
+    double timeSecs;
+    double spl;
+} snapInfo;
+
+// Results of decoding
+#define SNAP_OK             0
+#define SNAP_NONE           1       // No further snapshot in the log
+#define SNAP_ERR_HEADER     2       // Header unparseable, or too many samples
+#define SNAP_ERR_BODY       3       // Malformed base64, or more samples than the header said
+#define SNAP_ERR_LENGTH     4       // Fewer samples than the header said
+#define SNAP_ERR_CRC        5       // CRC mismatch
+#define SNAP_ERR_TRUNCATED  6       // The log, or this snapshot, ended before its end line
+
+#define SNAP_PREFIX         "snapshot:"
+#define SNAP_LINE_MAX       1024
+
+// A log being read, where a header found while reading the snapshot before it is
+// held until the next snapDecode
+typedef struct {
+    FILE *in;
+    char line[SNAP_LINE_MAX];
+    bool pending;
+} snapReader;
+
+// Find the snapshot line within a captured line, trimming its line ending, or
+// return NULL if it isn't one
+static char *snapLine(char *line)
+{
+    char *p = strstr(line, SNAP_PREFIX);
+    if (p == NULL) {
+        return NULL;
+    }
+    p += strlen(SNAP_PREFIX);
+    p[strcspn(p, "\r\n")] = '\0';
+    return p;
+}
+
+// Parse a header line into the snapshot's info
+static bool snapHeader(const char *json, snapInfo *info)
+{
+    jsonToken tokens[16];
+    int count = jsonParse(json, tokens, sizeof(tokens) / sizeof(tokens[0]));
+    if (count <= 0) {
+        return false;
+    }
+    static const char *keys[] = { "rate", "samples", "pre", "time", "spl" };
+    double values[5];
+    for (int i=0; i<5; i++) {
+        int t = jsonObjectGet(json, tokens, count, 0, keys[i]);
+        if (t < 0 || !jsonNumber(json, &tokens[t], &values[i])) {
+            return false;
+        }
+    }
+    int t = jsonObjectGet(json, tokens, count, 0, "enc");
+    if (t < 0 || !jsonEquals(json, &tokens[t], "ulaw")) {
+        return false;
+    }
+    info->rateHz = (uint32_t) values[0];
+    info->samples = (uint32_t) values[1];
+    info->pre = (uint32_t) values[2];
+    info->timeSecs = values[3];
+    info->spl = values[4];
+    return (info->rateHz > 0 && info->pre <= info->samples);
+}
+
+// Begin reading a log
+void snapReaderInit(snapReader *r, FILE *in)
+{
+    r->in = in;
+    r->pending = false;
+}
+
+// Read the next snapshot from a log, decoding up to pcmMax samples into pcm
+int snapDecode(snapReader *r, snapInfo *info, int16_t *pcm, uint32_t pcmMax)
+{
+
+    // Find the header, skipping anything left of a snapshot that ended early
+    char *p;
+    if (r->pending) {
+        r->pending = false;
+        p = snapLine(r->line);
+    } else {
+        do {
+            if (fgets(r->line, sizeof(r->line), r->in) == NULL) {
+                return SNAP_NONE;
+            }
+            p = snapLine(r->line);
+        } while (p == NULL || p[0] != '{');
+    }
+    if (!snapHeader(p, info) || info->samples > pcmMax) {
+        return SNAP_ERR_HEADER;
+    }
+
+    // Decode body lines until the end line, or until the next header if the log
+    // lost the end of this snapshot
+    uint32_t samples = 0;
+    uint32_t crc = 0;
+    while (fgets(r->line, sizeof(r->line), r->in) != NULL) {
+        p = snapLine(r->line);
+        if (p == NULL) {
+            continue;
+        }
+        if (p[0] == '{') {
+            r->pending = true;
+            return SNAP_ERR_TRUNCATED;
+        }
+        if (strncmp(p, "end ", 4) == 0) {
+            if (samples != info->samples) {
+                return SNAP_ERR_LENGTH;
+            }
+            if (strtoul(&p[4], NULL, 16) != crc) {
+                return SNAP_ERR_CRC;
+            }
+            return SNAP_OK;
+        }
+        int processed;
+        char codes[SNAP_LINE_MAX];
+        int len = Base64decode(codes, p, &processed);
+        if (len <= 0 || processed != (int) strlen(p) || samples + (uint32_t) len > info->samples) {
+            return SNAP_ERR_BODY;
+        }
+        crc = (uint32_t) crc32Update(crc, codes, (size_t) len);
+        for (int i=0; i<len; i++) {
+            pcm[samples++] = ulawDecode((uint8_t) codes[i]);
+        }
+    }
+    return SNAP_ERR_TRUNCATED;
+}
+
+#ifndef SNAPDECODE_NO_MAIN
+
+// Decode every snapshot in a log
+int main(int argc, char **argv)
+{
+    if (argc != 3) {
+        fprintf(stderr, "usage: snapdecode <captured log> <output prefix>\n");
+        return 2;
+    }
+    FILE *in = fopen(argv[1], "r");
+    if (in == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    static int16_t pcm[1 << 20];
+    snapReader r;
+    snapReaderInit(&r, in);
+    int written = 0, failed = 0;
+    for (;;) {
+        snapInfo info;
+        int err = snapDecode(&r, &info, pcm, sizeof(pcm) / sizeof(pcm[0]));
+        if (err == SNAP_NONE) {
+            break;
+        }
+        if (err != SNAP_OK) {
+            fprintf(stderr, "snapshot %d: error %d\n", written + failed + 1, err);
+            failed++;
+            continue;
+        }
+        char filename[256];
+        snprintf(filename, sizeof(filename), "%s-%d.wav", argv[2], written + failed + 1);
+        if (!wavWrite(filename, pcm, info.samples, info.rateHz)) {
+            perror(filename);
+            failed++;
+            continue;
+        }
+        printf("%s: %lu samples at %lu Hz, trigger at %.3fs (%.2f dB), starting at %.6f\n", filename,
+               (unsigned long) info.samples, (unsigned long) info.rateHz, (double) info.pre / info.rateHz, info.spl, info.timeSecs);
+        written++;
+    }
+    fclose(in);
+    return failed == 0 ? 0 : 1;
+}
+
+#endif
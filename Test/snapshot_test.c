@@ -0,0 +1,151 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Checks mu-law companding across the whole 16-bit range, then writes snapshot
+// exports in the format that snapshotExport produces, among other log output, and
+// checks that snapdecode recovers the companded audio and rejects damaged exports.
+
+#include "test.h"
+#define SNAPDECODE_NO_MAIN
+#include "snapdecode.c"
+#include <math.h>
+#include <unistd.h>
+
+#define CLIP            32635       // Where ulaw.c clips
+#define EXPORT_BYTES    96          // SNAPSHOT_EXPORT_BYTES
+#define BLOCK           115         // AUDIO_PCM_SAMPLES
+#define RATE_HZ         4761
+
+// Every sample decodes to within half a step of itself, where the step doubles with
+// each segment, and every code but mu-law's negative zero survives a round trip
+static void testUlaw(void)
+{
+    int32_t worst = 0;
+    for (int32_t x=-32768; x<=32767; x++) {
+        int16_t y = ulawDecode(ulawEncode((int16_t) x));
+        int32_t mag = (x < 0) ? -x : x;
+        int32_t step = 8;
+        while (step < 1024 && mag + 0x84 >= (step << 5)) {
+            step <<= 1;
+        }
+        int32_t err = abs(y - x);
+        if (mag <= CLIP) {
+            CHECK(err <= step / 2);
+        }
+        if (err > worst && mag <= CLIP) {
+            worst = err;
+        }
+    }
+    for (int c=0; c<256; c++) {
+        if (c != 0x7f) {
+            CHECK(ulawEncode(ulawDecode((uint8_t) c)) == c);
+        }
+    }
+    for (int c=0x80; c<0xff; c++) {
+        CHECK(ulawDecode((uint8_t) c) > ulawDecode((uint8_t) (c + 1)));
+    }
+    printf("snapshot: mu-law round-trip error is at most %d\n", worst);
+}
+
+// Write a snapshot export of the samples as snapshotExport does, with a terminal's
+// timestamp before each line and other log lines among them.  The damage argument
+// corrupts one body line, or if negative, stops before the end.
+static void writeExport(FILE *f, const int16_t *pcm, uint32_t samples, uint32_t pre, int damage)
+{
+    fprintf(f, "[12:00:00.000] spl: 61.27\n");
+    fprintf(f, "[12:00:00.001] snapshot:{\"rate\":%d,\"samples\":%lu,\"pre\":%lu,\"time\":1760000000.123456,\"spl\":94.50,\"enc\":\"ulaw\"}\r\n",
+            RATE_HZ, (unsigned long) samples, (unsigned long) pre);
+    uint8_t chunk[EXPORT_BYTES];
+    char line[((EXPORT_BYTES + 2) / 3 * 4) + 1];
+    uint32_t chunkLen = 0, crc = 0;
+    int lines = 0;
+    for (uint32_t i=0; i<samples; i++) {
+        chunk[chunkLen++] = ulawEncode(pcm[i]);
+        if (chunkLen == sizeof(chunk) || i == samples-1) {
+            crc = (uint32_t) crc32Update(crc, chunk, chunkLen);
+            Base64encode(line, (const char *) chunk, (int) chunkLen);
+            if (++lines == damage) {
+                line[5] = (line[5] == 'A') ? 'B' : 'A';
+            }
+            fprintf(f, "[12:00:00.002] snapshot:%s\r\n", line);
+            if (lines == 3) {
+                fprintf(f, "[12:00:00.003] audio: block overrun\n");
+            }
+            chunkLen = 0;
+        }
+    }
+    if (damage >= 0) {
+        fprintf(f, "[12:00:00.004] snapshot:end %08lx\r\n", (unsigned long) crc);
+    }
+}
+
+static void testExport(void)
+{
+    static int16_t pcm[BLOCK * 80], got[BLOCK * 80];
+    uint32_t samples = sizeof(pcm) / sizeof(pcm[0]);
+    uint32_t pre = BLOCK * 64;
+    for (uint32_t i=0; i<samples; i++) {
+        double amplitude = (i < pre) ? 1000.0 : 20000.0;
+        pcm[i] = (int16_t) lrint(amplitude * sin(2.0 * M_PI * 440.0 * i / RATE_HZ));
+    }
+
+    // A good export, then a corrupted one, one cut short, and another good one
+    FILE *f = tmpfile();
+    CHECK(f != NULL);
+    if (f == NULL) {
+        return;
+    }
+    writeExport(f, pcm, samples, pre, 0);
+    writeExport(f, pcm, samples, pre, 7);
+    writeExport(f, pcm, BLOCK, 0, -1);
+    writeExport(f, pcm, samples, pre, 0);
+    rewind(f);
+
+    snapReader r;
+    snapReaderInit(&r, f);
+    snapInfo info;
+    CHECK(snapDecode(&r, &info, got, samples) == SNAP_OK);
+    CHECK(info.rateHz == RATE_HZ && info.samples == samples && info.pre == pre);
+    CHECK(info.spl == 94.5 && fabs(info.timeSecs - 1760000000.123456) < 1e-6);
+    bool same = true;
+    for (uint32_t i=0; i<samples; i++) {
+        same = same && (got[i] == ulawDecode(ulawEncode(pcm[i])));
+    }
+    CHECK(same);
+    CHECK(snapDecode(&r, &info, got, samples) == SNAP_ERR_CRC);
+
+    // The export that was cut short is followed by the next one's header, which the
+    // decoder picks up again after reporting the one it abandoned
+    CHECK(snapDecode(&r, &info, got, samples) == SNAP_ERR_TRUNCATED);
+    CHECK(snapDecode(&r, &info, got, samples) == SNAP_OK && info.samples == samples);
+    CHECK(snapDecode(&r, &info, got, samples) == SNAP_NONE);
+
+    // A snapshot longer than the caller can hold is refused
+    rewind(f);
+    snapReaderInit(&r, f);
+    CHECK(snapDecode(&r, &info, got, samples - 1) == SNAP_ERR_HEADER);
+    fclose(f);
+
+    // And the WAV file is the expected size
+    char filename[] = "/tmp/snapshot_testXXXXXX";
+    int fd = mkstemp(filename);
+    CHECK(fd >= 0);
+    if (fd >= 0) {
+        close(fd);
+        CHECK(wavWrite(filename, got, samples, RATE_HZ));
+        FILE *w = fopen(filename, "rb");
+        CHECK(w != NULL && fseek(w, 0, SEEK_END) == 0 && ftell(w) == (long) (44 + (samples * 2)));
+        if (w != NULL) {
+            fclose(w);
+        }
+        remove(filename);
+    }
+}
+
+int main(void)
+{
+    testUlaw();
+    testExport();
+    TEST_DONE("snapshot");
+}
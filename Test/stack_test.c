@@ -0,0 +1,99 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Reads call graphs in the form that GCC's -fcallgraph-info=su writes, across two
+// translation units, and checks the deepest stack that stackdepth finds from each
+// root, and what it reports as making that depth only a lower bound.
+
+#include "test.h"
+#define STACKDEPTH_NO_MAIN
+#include "stackdepth.c"
+
+// a.c calls into b.c, whose helper it knows only as an external, and each has a
+// static function named leaf
+static const char *fileA =
+    "graph: { title: \"a.c\"\n"
+    "node: { title: \"a.c:leaf\" label: \"leaf\\na.c:2:38\\n8 bytes (static)\" }\n"
+    "node: { title: \"mid\" label: \"mid\\na.c:3:31\\n64 bytes (static)\" }\n"
+    "edge: { sourcename: \"mid\" targetname: \"a.c:leaf\" label: \"a.c:3:69\" }\n"
+    "node: { title: \"strlen\" label: \"strlen\\n/usr/include/string.h:407:15\" shape : ellipse }\n"
+    "edge: { sourcename: \"mid\" targetname: \"strlen\" label: \"a.c:3:95\" }\n"
+    "node: { title: \"root\" label: \"root\\na.c:4:5\\n48 bytes (static)\" }\n"
+    "edge: { sourcename: \"root\" targetname: \"mid\" label: \"a.c:4:58\" }\n"
+    "node: { title: \"helper\" label: \"helper\\nb.h:1:5\" shape : ellipse }\n"
+    "edge: { sourcename: \"root\" targetname: \"helper\" label: \"a.c:4:70\" }\n"
+    "node: { title: \"task\" label: \"task\\na.c:9:6\\n16 bytes (static)\" }\n"
+    "edge: { sourcename: \"task\" targetname: \"root\" label: \"a.c:9:20\" }\n"
+    "node: { title: \"__indirect_call\" label: \"Indirect Call Placeholder\" shape : ellipse }\n"
+    "edge: { sourcename: \"task\" targetname: \"__indirect_call\" label: \"a.c:9:30\" }\n"
+    "}\n";
+static const char *fileB =
+    "graph: { title: \"b.c\"\n"
+    "node: { title: \"b.c:leaf\" label: \"leaf\\nb.c:2:12\\n24 bytes (static)\" }\n"
+    "node: { title: \"helper\" label: \"helper\\nb.c:5:5\\n40 bytes (dynamic,bounded)\" }\n"
+    "edge: { sourcename: \"helper\" targetname: \"b.c:leaf\" label: \"b.c:6:9\" }\n"
+    "node: { title: \"walk\" label: \"walk\\nb.c:9:5\\n32 bytes (static)\" }\n"
+    "edge: { sourcename: \"walk\" targetname: \"walk\" label: \"b.c:10:16\" }\n"
+    "node: { title: \"scratch\" label: \"scratch\\nb.c:14:5\\n16 bytes (dynamic)\" }\n"
+    "edge: { sourcename: \"walk\" targetname: \"scratch\" label: \"b.c:11:9\" }\n"
+    "}\n";
+
+// Read a file's text into the graph
+static void readText(stackGraph *g, const char *text)
+{
+    FILE *f = tmpfile();
+    CHECK(f != NULL);
+    if (f == NULL) {
+        return;
+    }
+    fputs(text, f);
+    rewind(f);
+    CHECK(stackGraphRead(g, f));
+    fclose(f);
+}
+
+static void testDepth(void)
+{
+    static stackGraph g;
+    stackGraphInit(&g);
+    readText(&g, fileA);
+    readText(&g, fileB);
+
+    // The external is resolved by the file that defines it, so that root's deepest
+    // path runs through mid (64+8) rather than helper (40+24), but the call of
+    // strlen, whose frame isn't known, leaves it a lower bound
+    uint32_t flags;
+    int root = stackNodeFind(&g, "root", false);
+    CHECK(root >= 0);
+    if (root >= 0) {
+        CHECK(stackDepth(&g, root, &flags) == 48 + 64 + 8);
+        CHECK(flags == STACK_UNKNOWN);
+        int mid = g.nodes[root].next;
+        CHECK(mid >= 0 && strcmp(g.nodes[mid].name, "mid") == 0);
+        CHECK(mid >= 0 && strcmp(g.nodes[g.nodes[mid].next].name, "a.c:leaf") == 0);
+    }
+    int helper = stackNodeFind(&g, "helper", false);
+    CHECK(helper >= 0 && stackDepth(&g, helper, &flags) == 40 + 24 && flags == 0);
+
+    // The task adds its own frame and reaches an indirect call
+    int task = stackNodeFind(&g, "task", false);
+    CHECK(task >= 0 && stackDepth(&g, task, &flags) == 16 + 48 + 64 + 8);
+    CHECK(flags == (STACK_UNKNOWN | STACK_INDIRECT));
+
+    // Recursion and an unbounded dynamic frame are both reported
+    int walk = stackNodeFind(&g, "walk", false);
+    CHECK(walk >= 0 && stackDepth(&g, walk, &flags) == 32 + 16);
+    CHECK(flags == (STACK_RECURSIVE | STACK_DYNAMIC));
+
+    // A static function is found by its qualified name, but not by an ambiguous one
+    CHECK(stackNodeFind(&g, "b.c:leaf", false) >= 0);
+    CHECK(stackNodeFind(&g, "leaf", false) < 0);
+    CHECK(stackNodeFind(&g, "missing", false) < 0);
+}
+
+int main(void)
+{
+    testDepth();
+    TEST_DONE("stack");
+}
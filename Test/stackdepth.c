@@ -0,0 +1,232 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Finds the deepest stack that each of a set of root functions can reach, from the
+// call graph and frame sizes that GCC writes with -fcallgraph-info=su (one .ci file
+// per translation unit).  This is the static cross-check for the worst cases that
+// taskStackStats measures, for a GCC build; under EWARM the linker does the same
+// analysis itself for the roots named in EWARM/splash.suc.  Depths are a lower bound
+// when the analysis meets recursion, frames of dynamic size, indirect calls, or
+// calls into functions it has no frame size for, and each of these is reported.
+//   arm-none-eabi-gcc ... -fstack-usage -fcallgraph-info=su
+//   Test/build/stackdepth mainTask,reqTask,audioTask build/*.ci
+// Test/stack_test.c includes this file to analyze its own call graphs.
+
+#include "global.h"
+
+#define STACK_NODES         4096
+#define STACK_EDGES         16384
+#define STACK_NAME_MAX      96
+#define STACK_LINE_MAX      1024
+#define STACK_INDIRECT_NODE "__indirect_call"
+
+// What limits the accuracy of a depth
+#define STACK_RECURSIVE     0x01    // A cycle in the call graph
+#define STACK_DYNAMIC       0x02    // A frame of unbounded dynamic size, as with alloca
+#define STACK_INDIRECT      0x04    // A call through a pointer
+#define STACK_UNKNOWN       0x08    // A call of a function with no frame size, such as a library's
+
+// A function, as named by the compiler, where functions with internal linkage are
+// qualified by their file
+typedef struct {
+    char name[STACK_NAME_MAX];
+    uint32_t bytes;
+    bool sized;
+    bool dynamic;
+    uint8_t state;                  // For the search: 0 unvisited, 1 on the path, 2 done
+    uint8_t flags;
+    uint32_t depth;
+    int32_t next;                   // The callee on the deepest path, or -1
+} stackNode;
+
+typedef struct {
+    int32_t from;
+    int32_t to;
+} stackEdge;
+
+typedef struct {
+    stackNode nodes[STACK_NODES];
+    uint32_t nodeCount;
+    stackEdge edges[STACK_EDGES];
+    uint32_t edgeCount;
+} stackGraph;
+
+// Copy the quoted value following a key on a line
+static bool stackQuoted(const char *line, const char *key, char *buf, uint32_t size)
+{
+    const char *p = strstr(line, key);
+    if (p == NULL) {
+        return false;
+    }
+    p += strlen(key);
+    uint32_t len = 0;
+    while (p[len] != '\0' && p[len] != '"' && len < size - 1) {
+        buf[len] = p[len];
+        len++;
+    }
+    buf[len] = '\0';
+    return (p[len] == '"');
+}
+
+// Find a function by the compiler's name for it, or by its unqualified name if
+// that's unambiguous, adding it if asked and it's new
+int stackNodeFind(stackGraph *g, const char *name, bool add)
+{
+    int found = -1;
+    for (uint32_t i=0; i<g->nodeCount; i++) {
+        if (strcmp(g->nodes[i].name, name) == 0) {
+            return (int) i;
+        }
+        const char *colon = strrchr(g->nodes[i].name, ':');
+        if (!add && colon != NULL && strcmp(colon + 1, name) == 0) {
+            found = (found == -1) ? (int) i : -2;
+        }
+    }
+    if (found != -1 || !add || g->nodeCount == STACK_NODES) {
+        return (found >= 0) ? found : -1;
+    }
+    stackNode *n = &g->nodes[g->nodeCount];
+    memset(n, 0, sizeof(*n));
+    snprintf(n->name, sizeof(n->name), "%s", name);
+    n->next = -1;
+    return (int) g->nodeCount++;
+}
+
+// Begin a graph
+void stackGraphInit(stackGraph *g)
+{
+    g->nodeCount = 0;
+    g->edgeCount = 0;
+}
+
+// Add the functions and calls in a .ci file to the graph, returning false if it's full
+bool stackGraphRead(stackGraph *g, FILE *in)
+{
+    char line[STACK_LINE_MAX];
+    char title[STACK_NAME_MAX], label[STACK_LINE_MAX], target[STACK_NAME_MAX];
+    while (fgets(line, sizeof(line), in) != NULL) {
+
+        // A function, whose frame size is known if it was compiled here
+        if (strncmp(line, "node:", 5) == 0 && stackQuoted(line, "title: \"", title, sizeof(title))) {
+            int n = stackNodeFind(g, title, true);
+            if (n < 0) {
+                return false;
+            }
+            const char *bytes;
+            if (stackQuoted(line, "label: \"", label, sizeof(label)) && (bytes = strstr(label, " bytes (")) != NULL) {
+                const char *p = bytes;
+                while (p > label && p[-1] >= '0' && p[-1] <= '9') {
+                    p--;
+                }
+                g->nodes[n].bytes = (uint32_t) strtoul(p, NULL, 10);
+                g->nodes[n].sized = true;
+                g->nodes[n].dynamic = (strncmp(bytes, " bytes (dynamic)", 16) == 0);
+            }
+        }
+
+        // A call
+        if (strncmp(line, "edge:", 5) == 0 && stackQuoted(line, "sourcename: \"", title, sizeof(title)) &&
+            stackQuoted(line, "targetname: \"", target, sizeof(target))) {
+            int from = stackNodeFind(g, title, true);
+            int to = stackNodeFind(g, target, true);
+            if (from < 0 || to < 0 || g->edgeCount == STACK_EDGES) {
+                return false;
+            }
+            g->edges[g->edgeCount].from = from;
+            g->edges[g->edgeCount].to = to;
+            g->edgeCount++;
+        }
+
+    }
+    return true;
+}
+
+// The deepest stack reachable from a function, including its own frame, where the
+// flags say what may make it deeper still.  The path is found by following next.
+uint32_t stackDepth(stackGraph *g, int node, uint32_t *retFlags)
+{
+    stackNode *n = &g->nodes[node];
+    if (n->state == 1) {
+        *retFlags = STACK_RECURSIVE;
+        return 0;
+    }
+    if (n->state == 2) {
+        *retFlags = n->flags;
+        return n->depth;
+    }
+    n->state = 1;
+    n->flags = 0;
+    if (strcmp(n->name, STACK_INDIRECT_NODE) == 0) {
+        n->flags |= STACK_INDIRECT;
+    } else if (!n->sized) {
+        n->flags |= STACK_UNKNOWN;
+    }
+    if (n->dynamic) {
+        n->flags |= STACK_DYNAMIC;
+    }
+    uint32_t deepest = 0;
+    for (uint32_t e=0; e<g->edgeCount; e++) {
+        if (g->edges[e].from != node) {
+            continue;
+        }
+        uint32_t flags;
+        uint32_t depth = stackDepth(g, g->edges[e].to, &flags);
+        n->flags |= flags;
+        if (depth > deepest || n->next < 0) {
+            deepest = depth;
+            n->next = g->edges[e].to;
+        }
+    }
+    n->depth = n->bytes + deepest;
+    n->state = 2;
+    *retFlags = n->flags;
+    return n->depth;
+}
+
+#ifndef STACKDEPTH_NO_MAIN
+
+// Report the deepest path from each root
+int main(int argc, char **argv)
+{
+    if (argc < 3) {
+        fprintf(stderr, "usage: stackdepth <root>[,<root>...] <file.ci>...\n");
+        return 2;
+    }
+    static stackGraph g;
+    stackGraphInit(&g);
+    for (int i=2; i<argc; i++) {
+        FILE *in = fopen(argv[i], "r");
+        if (in == NULL) {
+            perror(argv[i]);
+            return 1;
+        }
+        bool ok = stackGraphRead(&g, in);
+        fclose(in);
+        if (!ok) {
+            fprintf(stderr, "%s: call graph too large\n", argv[i]);
+            return 1;
+        }
+    }
+    int missing = 0;
+    for (char *root = strtok(argv[1], ","); root != NULL; root = strtok(NULL, ",")) {
+        int node = stackNodeFind(&g, root, false);
+        if (node < 0) {
+            fprintf(stderr, "%s: not found\n", root);
+            missing++;
+            continue;
+        }
+        uint32_t flags;
+        uint32_t depth = stackDepth(&g, node, &flags);
+        printf("%s: %lu bytes%s%s%s%s%s\n", root, (unsigned long) depth, flags ? ", at least, because of" : "",
+               (flags & STACK_RECURSIVE) ? " recursion" : "", (flags & STACK_DYNAMIC) ? " dynamic frames" : "",
+               (flags & STACK_INDIRECT) ? " indirect calls" : "", (flags & STACK_UNKNOWN) ? " calls of unknown size" : "");
+        uint32_t steps = 0;
+        for (int n=node; n>=0 && steps<g.nodeCount; n=g.nodes[n].next, steps++) {
+            printf("  %6lu %s%s\n", (unsigned long) g.nodes[n].bytes, g.nodes[n].name, g.nodes[n].sized ? "" : " (unknown)");
+        }
+    }
+    return missing == 0 ? 0 : 1;
+}
+
+#endif
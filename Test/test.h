@@ -0,0 +1,33 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+// Minimal checking for the host tests, each of which is a standalone program that
+// exits non-zero if any check failed.
+static int testFailures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        testFailures++; \
+    } \
+} while (0)
+
+#define TEST_DONE(name) do { \
+    printf("%s: %s\n", name, testFailures == 0 ? "ok" : "FAILED"); \
+    return testFailures == 0 ? 0 : 1; \
+} while (0)
+
+// Deterministic random numbers, so that a failure can be reproduced
+static uint32_t randSeed = 1;
+static inline uint32_t randBelow(uint32_t n)
+{
+    randSeed = randSeed * 1103515245 + 12345;
+    return (randSeed >> 8) % n;
+}
@@ -0,0 +1,129 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Writes timeline dumps in the format that timelineDump produces, among other log
+// output, and checks that traceextract recovers each as a well-formed Chrome trace,
+// pairs up its begin and end events, and measures its spans.
+
+#include "test.h"
+#define TRACEEXTRACT_NO_MAIN
+#include "traceextract.c"
+
+#define TID_ISR         100         // TL_TID_ISR
+#define TID_SPAN        200         // TL_TID_SPAN
+#define BLOCKS          6
+#define BLOCK_US        24150.0     // AUDIO_PCM_SAMPLES at AUDIO_PCM_RATE_HZ
+
+// Write a dump as timelineDump does, with a terminal's timestamp before each line.
+// The audio task runs a block every BLOCK_US, the last of them overrunning, while a
+// UART interrupt comes and goes and the request task runs in between.  The ring
+// having wrapped, the oldest event is an end whose begin was overwritten.  The
+// damage argument breaks that many events with other log output, or if negative,
+// stops before the end.
+static void writeDump(FILE *f, int damage)
+{
+    fprintf(f, "[12:00:00.000] timeline: 512 events\n");
+    fprintf(f, "[12:00:00.001] {\"traceEvents\":[\n");
+    fprintf(f, "[12:00:00.001] {\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"audio\"}},\n");
+    fprintf(f, "[12:00:00.001] {\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":3,\"args\":{\"name\":\"request\"}},\n");
+    fprintf(f, "[12:00:00.001] {\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"isr lpuart1\"}},\n", TID_ISR + 2);
+    fprintf(f, "[12:00:00.001] {\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"audio pipeline\"}},\n", TID_SPAN);
+    fprintf(f, "[12:00:00.002] {\"name\":\"request\",\"ph\":\"E\",\"ts\":0.000,\"pid\":1,\"tid\":3},\n");
+    for (int b=0; b<BLOCKS; b++) {
+        double t = 10.0 + b * BLOCK_US;
+        double work = (b == BLOCKS-1) ? BLOCK_US + 500.0 : 9000.0;
+        fprintf(f, "[12:00:00.002] {\"name\":\"audio\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":1,\"tid\":2},\n", t);
+        fprintf(f, "[12:00:00.002] {\"name\":\"block\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":1,\"tid\":%d},\n", t + 1.0, TID_SPAN);
+        fprintf(f, "[12:00:00.002] {\"name\":\"bands\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":1,\"tid\":%d},\n", t + 2.0, TID_SPAN);
+        if (b == 2) {
+            fprintf(f, "[12:00:00.003] audio: block overrun\n");
+        }
+        if (damage > 0 && b < damage) {
+            fprintf(f, "[12:00:00.003] {\"name\":\"lpuart1\",\"ph\":\"B\",\"ts\":%.3f,\"pi[12:00:00.003] req: spl.get\n", t + 3.0);
+        } else {
+            fprintf(f, "[12:00:00.003] {\"name\":\"lpuart1\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":1,\"tid\":%d},\n", t + 3.0, TID_ISR + 2);
+        }
+        fprintf(f, "[12:00:00.003] {\"name\":\"lpuart1\",\"ph\":\"E\",\"ts\":%.3f,\"pid\":1,\"tid\":%d},\n", t + 12.5, TID_ISR + 2);
+        fprintf(f, "[12:00:00.003] {\"name\":\"bands\",\"ph\":\"E\",\"ts\":%.3f,\"pid\":1,\"tid\":%d},\n", t + work - 100.0, TID_SPAN);
+        fprintf(f, "[12:00:00.003] {\"name\":\"block\",\"ph\":\"E\",\"ts\":%.3f,\"pid\":1,\"tid\":%d},\n", t + work, TID_SPAN);
+        fprintf(f, "[12:00:00.003] {\"name\":\"audio\",\"ph\":\"E\",\"ts\":%.3f,\"pid\":1,\"tid\":2},\n", t + work + 1.0);
+        if (damage < 0 && b == 1) {
+            return;
+        }
+        fprintf(f, "[12:00:00.004] {\"name\":\"request\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":1,\"tid\":3},\n", t + work + 2.0);
+        fprintf(f, "[12:00:00.004] {\"name\":\"request\",\"ph\":\"E\",\"ts\":%.3f,\"pid\":1,\"tid\":3},\n", t + work + 50.0);
+    }
+    fprintf(f, "[12:00:00.005] {}]}\n");
+}
+
+// Check that an extracted trace is a single JSON object whose events are all there
+static void checkTrace(FILE *trace, uint32_t events)
+{
+    static char json[65536];
+    rewind(trace);
+    size_t len = fread(json, 1, sizeof(json) - 1, trace);
+    json[len] = '\0';
+    static jsonToken tokens[4096];
+    int count = jsonParse(json, tokens, sizeof(tokens) / sizeof(tokens[0]));
+    CHECK(count > 0 && tokens[0].type == JSON_OBJECT);
+    int t = (count > 0) ? jsonObjectGet(json, tokens, count, 0, "traceEvents") : -1;
+    CHECK(t >= 0 && tokens[t].size == events);
+}
+
+static void testExtract(void)
+{
+    FILE *f = tmpfile();
+    CHECK(f != NULL);
+    if (f == NULL) {
+        return;
+    }
+    writeDump(f, 0);
+    writeDump(f, 2);
+    writeDump(f, -1);
+    writeDump(f, 0);
+    rewind(f);
+
+    // A whole dump: every event pairs up but the one whose begin was overwritten,
+    // and the last block is seen to overrun its deadline
+    traceReader r;
+    traceReaderInit(&r, f);
+    traceSummary s;
+    FILE *trace = tmpfile();
+    CHECK(traceExtract(&r, trace, &s) == TRACE_OK);
+    uint32_t events = 1 + (BLOCKS * 10);
+    CHECK(s.events == events && s.threads == 4);
+    CHECK(s.skipped == 1 && s.unmatched == 1 && s.backwards == 0);
+    bool found = false;
+    for (uint32_t i=0; i<s.spanCount; i++) {
+        if (strcmp(s.spans[i].name, "block") == 0) {
+            found = true;
+            CHECK(s.spans[i].count == BLOCKS);
+            CHECK(s.spans[i].longestUs > BLOCK_US && s.spans[i].longestUs < BLOCK_US + 500.0);
+            printf("timeline: longest of %lu blocks %.3fms, against a deadline of %.3fms\n",
+                   (unsigned long) s.spans[i].count, s.spans[i].longestUs / 1000.0, BLOCK_US / 1000.0);
+        }
+    }
+    CHECK(found);
+    if (trace != NULL) {
+        checkTrace(trace, events + s.threads);
+        fclose(trace);
+    }
+
+    // Events broken by other output are dropped, leaving their ends unmatched
+    CHECK(traceExtract(&r, NULL, &s) == TRACE_OK);
+    CHECK(s.events == events - 2 && s.skipped == 1 + 2 && s.unmatched == 1 + 2);
+
+    // A dump cut short is reported, and the one after it is picked up whole
+    CHECK(traceExtract(&r, NULL, &s) == TRACE_TRUNCATED);
+    CHECK(s.events == 1 + 10 + 8 && s.unmatched == 1);
+    CHECK(traceExtract(&r, NULL, &s) == TRACE_OK && s.events == events);
+    CHECK(traceExtract(&r, NULL, &s) == TRACE_NONE);
+    fclose(f);
+}
+
+int main(void)
+{
+    testExtract();
+    TEST_DONE("timeline");
+}
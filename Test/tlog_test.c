@@ -0,0 +1,258 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Captures arguments for the kinds of format that debugf is given and renders them
+// again as a host would, checking that the text matches what printf makes of the
+// same call, including when the arguments are split across several records.  Values
+// are kept within 32 bits where the target's int, long and pointers are, because
+// this host's may be wider.  Then sends records as FRAME_LOG frames, among text, and
+// checks that tlogdecode finds their formats in an image and renders them.
+
+#include "test.h"
+#define TLOGDECODE_NO_MAIN
+#include "tlogdecode.c"
+#include <stdarg.h>
+
+// Records posted by a capture, as the log ring would hold them, and how many the
+// ring has room for at the start of each
+#define RECORDS_MAX     8
+typedef struct {
+    const char *format;
+    uint8_t args[TLOG_MAX_ARGS];
+    uint32_t argsLen;
+} record;
+static record records[RECORDS_MAX];
+static uint32_t recordCount;
+static uint32_t recordRoom;
+static uint32_t ringRoom = RECORDS_MAX;
+static bool post(const char *format, const uint8_t *args, uint32_t argsLen)
+{
+    CHECK(argsLen <= TLOG_MAX_ARGS);
+    if (recordRoom == 0 || recordCount == RECORDS_MAX || argsLen > TLOG_MAX_ARGS) {
+        return false;
+    }
+    recordRoom--;
+    records[recordCount].format = format;
+    memcpy(records[recordCount].args, args, argsLen);
+    records[recordCount].argsLen = argsLen;
+    recordCount++;
+    return true;
+}
+
+// Capture a call and render its records one after another, as the serial task
+// does, returning how many records it took
+static uint32_t roundTrip(char *text, uint32_t textMax, const char *format, ...)
+{
+    recordCount = 0;
+    recordRoom = ringRoom;
+    va_list vaArgs;
+    va_start(vaArgs, format);
+    uint32_t posted = tlogCapture(format, vaArgs, post);
+    va_end(vaArgs);
+    CHECK(posted == recordCount);
+    uint32_t len = 0;
+    text[0] = '\0';
+    for (uint32_t i=0; i<recordCount; i++) {
+        len += tlogRender(records[i].format, records[i].args, records[i].argsLen, &text[len], textMax - len);
+    }
+    return recordCount;
+}
+
+// Check that a call renders as printf would format it directly
+#define EXPECT(format, ...) do { \
+    char got[512], want[512]; \
+    roundTrip(got, sizeof(got), format, __VA_ARGS__); \
+    snprintf(want, sizeof(want), format, __VA_ARGS__); \
+    if (strcmp(got, want) != 0) { \
+        printf("  rendered \"%s\", expected \"%s\"\n", got, want); \
+    } \
+    CHECK(strcmp(got, want) == 0); \
+} while (0)
+
+static void testConversions(void)
+{
+    EXPECT("plain %d", 42);
+    EXPECT("%d %i %u %x %X %o %c", -7, 12, 3000000000U, 0xbeef, 0xbeef, 0755, 'z');
+    EXPECT("%lld %llu %llx %jd", -5000000000LL, 18000000000000000000ULL, 0x123456789abcULL, (intmax_t) -1);
+    EXPECT("%ld %lu %zu", -100000L, 4000000000UL, (size_t) 77);
+    EXPECT("%f %.2f %e %g %G %a", 61.27, -0.005, 1.5e-9, 100000.0, 1e20, 0.5);
+    EXPECT("%Lf", (long double) 2.5);
+    EXPECT("%s and %s", "one", "");
+    EXPECT("%-8s|%8s|%.3s", "left", "right", "truncated");
+    EXPECT("%5d|%-5d|%05d|%+d|% d", 42, 42, 42, 42, 42);
+    EXPECT("%*d|%-*d|%.*f|%*.*f", 6, 42, 6, 42, 3, 3.14159, 9, 2, 2.71828);
+    EXPECT("%.*f", -1, 1.25);
+    EXPECT("%p", (void *) (uintptr_t) 0x20001234);
+    EXPECT("100%% of %d", 5);
+    EXPECT("%s=%d, %s=%.1f dB, %s", "blocks", 1200, "spl", 61.27, "ok");
+}
+
+// Arguments that don't fit continue in further records, a string too long for any
+// record is split across them, and the whole renders as a single call would
+static void testContinuation(void)
+{
+    char longString[TLOG_MAX_ARGS * 2];
+    memset(longString, 'x', sizeof(longString) - 1);
+    longString[sizeof(longString) - 1] = '\0';
+    char text[512];
+    CHECK(roundTrip(text, sizeof(text), "%d %s %d", 1, "short", 2) == 1);
+    CHECK(roundTrip(text, sizeof(text), "%d %s %d", 1, longString, 2) == 5);
+    EXPECT("%d %s %d", 1, longString, 2);
+    EXPECT("[%s]\n", longString);
+    EXPECT("%s%s", longString, longString);
+    EXPECT("%d %.3s %d", 1, longString, 2);
+    EXPECT("%.*s|%c", 150, longString, 'z');
+
+    // Only the precision of a string is captured, so a long string cut by one fits
+    CHECK(roundTrip(text, sizeof(text), "%.10s", longString) == 1 && records[0].argsLen == 11);
+
+    // Many numbers fill the record and the rest begin another
+    const char *sixteen = "%lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld";
+    CHECK(roundTrip(text, sizeof(text), sixteen, 1LL, 2LL, 3LL, 4LL, 5LL, 6LL, 7LL, 8LL, 9LL, 10LL, 11LL, 12LL, 13LL, 14LL, 15LL, 16LL) == 2);
+    CHECK(records[0].argsLen == 15 * 8 && records[1].argsLen == 8 && records[1].format == strrchr(sixteen, '%'));
+    EXPECT("%lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld",
+           1LL, 2LL, 3LL, 4LL, 5LL, 6LL, 7LL, 8LL, 9LL, 10LL, 11LL, 12LL, 13LL, 14LL, 15LL, 16LL);
+
+    // If the ring fills, the records posted so far are counted and render a prefix
+    ringRoom = 2;
+    CHECK(roundTrip(text, sizeof(text), "%d %s %d", 1, longString, 2) == 2);
+    CHECK(strncmp(text, "1 xxxx", 6) == 0 && strlen(text) == strlen("1 ") + TLOG_MAX_ARGS - 1);
+    ringRoom = RECORDS_MAX;
+}
+
+// Text is truncated to the buffer and always terminated
+static void testLimits(void)
+{
+    char text[8];
+    roundTrip(text, sizeof(text), "%s", "abcdefghijkl");
+    CHECK(strcmp(text, "abcdefg") == 0);
+    char one[1] = { 'q' };
+    CHECK(tlogRender("%d", NULL, 0, one, 1) == 0 && one[0] == '\0');
+}
+
+// An image of flash holding the formats, loaded at FLASH_BASE
+#define LOAD_ADDRESS    0x08000000
+static char image[256];
+static uint32_t imageLen;
+static const char *imageString;
+static const char *imageFormat(const char *format)
+{
+    const char *p = &image[imageLen];
+    memcpy(&image[imageLen], format, strlen(format) + 1);
+    imageLen += (uint32_t) strlen(format) + 1;
+    return p;
+}
+
+// Little-endian fields, as the target writes them
+static void put(uint8_t *p, uint32_t v, uint32_t len)
+{
+    for (uint32_t i=0; i<len; i++) {
+        p[i] = (uint8_t) (v >> (8 * i));
+    }
+}
+
+// Send the records of a call as the serial task does, with the sequence numbers that
+// it counts in
+static uint8_t logSequence;
+static void sendCall(FILE *f, uint32_t ms, const char *format, ...)
+{
+    recordCount = 0;
+    recordRoom = ringRoom;
+    va_list vaArgs;
+    va_start(vaArgs, format);
+    tlogCapture(format, vaArgs, post);
+    va_end(vaArgs);
+    for (uint32_t i=0; i<recordCount; i++) {
+        const char *inImage = records[i].format;
+        if (inImage < image || inImage >= &image[imageLen]) {
+            inImage = imageString;
+        }
+        uint8_t rec[TLOG_HEADER + TLOG_MAX_ARGS];
+        put(&rec[0], LOAD_ADDRESS + (uint32_t) (inImage - image), 4);
+        put(&rec[4], ms, 4);
+        memcpy(&rec[TLOG_HEADER], records[i].args, records[i].argsLen);
+        uint8_t wire[FRAME_MAX_WIRE(FRAME_MAX_PAYLOAD)];
+        uint32_t wireLen = frameEncode(FRAME_LOG, logSequence++, rec, TLOG_HEADER + records[i].argsLen, wire, sizeof(wire));
+        fwrite(wire, 1, wireLen, f);
+    }
+}
+
+// Records, one split by a long string and one of a format not in the image, among
+// text and a frame of another type, with one record lost
+static void testDecode(void)
+{
+    const char *boot = imageFormat("boot %s v%d\n");
+    const char *spl = imageFormat("spl: %.2f dB, ");
+    const char *tail = imageFormat("%d blocks\n");
+    const char *path = imageFormat("path [%s] %d\n");
+    imageString = imageFormat(TLOG_STRING);
+    char longString[TLOG_MAX_ARGS + 40];
+    memset(longString, 'y', sizeof(longString) - 1);
+    longString[sizeof(longString) - 1] = '\0';
+
+    FILE *f = tmpfile();
+    FILE *out = tmpfile();
+    CHECK(f != NULL && out != NULL);
+    if (f == NULL || out == NULL) {
+        return;
+    }
+    sendCall(f, 1500, boot, "splash", 3);
+    fputs("text from a request\r\n", f);
+    sendCall(f, 2250, spl, 61.27);
+    sendCall(f, 2250, tail, 1200);
+    sendCall(f, 3000, path, longString, 7);
+    logSequence++;
+    sendCall(f, 4000, spl, 70.5);
+    uint8_t wire[FRAME_MAX_WIRE(FRAME_MAX_PAYLOAD)];
+    fwrite(wire, 1, frameEncode(FRAME_SPL, 0, NULL, 0, wire, sizeof(wire)), f);
+    uint8_t rec[TLOG_HEADER] = { 0x00, 0x10, 0x00, 0x08 };
+    fwrite(wire, 1, frameEncode(FRAME_LOG, logSequence++, rec, sizeof(rec), wire, sizeof(wire)), f);
+    rewind(f);
+
+    tlogImage img;
+    CHECK(tlogImageParse(&img, (const uint8_t *) image, imageLen, LOAD_ADDRESS));
+    tlogReader r;
+    tlogReaderInit(&r, f);
+    tlogSummary s;
+    tlogDecode(&r, &img, out, &s);
+    CHECK(s.records == 1 + 2 + 4 + 1 && s.unknown == 1 && s.lost == 1 && s.skipped == 1);
+
+    char want[512], got[512];
+    snprintf(want, sizeof(want), "[1.500] boot splash v3\n[2.250] spl: 61.27 dB, 1200 blocks\n[3.000] path [%s] 7\n"
+             "[1 records lost]\n[4.000] spl: 70.50 dB, \n[0.000] <no format at 0x08001000>\n", longString);
+    rewind(out);
+    size_t len = fread(got, 1, sizeof(got) - 1, out);
+    got[len] = '\0';
+    if (strcmp(got, want) != 0) {
+        printf("  decoded \"%s\", expected \"%s\"\n", got, want);
+    }
+    CHECK(strcmp(got, want) == 0);
+    fclose(f);
+    fclose(out);
+
+    // An ELF file's loadable segments are found by their addresses
+    static uint8_t elf[52 + 32 + 16];
+    memcpy(elf, "\x7f" "ELF\x01\x01", 6);
+    put(&elf[28], 52, 4);
+    put(&elf[42], 32, 2);
+    put(&elf[44], 1, 2);
+    put(&elf[52], 1, 4);
+    put(&elf[52 + 4], 84, 4);
+    put(&elf[52 + 8], 0x08004000, 4);
+    put(&elf[52 + 16], 16, 4);
+    memcpy(&elf[84], "abc\0%d dB\n", 11);
+    CHECK(tlogImageParse(&img, elf, sizeof(elf), LOAD_ADDRESS));
+    const char *found = tlogImageString(&img, 0x08004004);
+    CHECK(found != NULL && strcmp(found, "%d dB\n") == 0);
+    CHECK(tlogImageString(&img, 0x08004010) == NULL && tlogImageString(&img, LOAD_ADDRESS) == NULL);
+}
+
+int main(void)
+{
+    testConversions();
+    testContinuation();
+    testLimits();
+    testDecode();
+    TEST_DONE("tlog");
+}
@@ -0,0 +1,247 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Renders the tokenized log records that the firmware sends over USB as FRAME_LOG
+// frames (see frame.h, and tlog.h for the record) after 'log tokens'.  The capture
+// is the raw bytes received, in which the frames may be mixed with text.  Each
+// record's format string is looked up at its address in the image of the build that
+// sent it, either the linker's ELF output or a raw binary and the address it was
+// loaded at, and rendered with tlogRender, preceded at each line by the record's
+// timestamp.  Records lost to a full ring or a damaged frame show as a gap in the
+// frames' sequence numbers, and are reported where they were lost.
+//   make -C Test
+//   Test/build/tlogdecode capture.bin EWARM/splash/Exe/splash.out
+//   Test/build/tlogdecode capture.bin splash.bin 0x08000000
+// Test/tlog_test.c includes this file to decode its own synthesized capture.
+
+#include "global.h"
+#include "frame.h"
+#include "tlog.h"
+
+#define TLOGDECODE_SEGMENTS     16
+#define TLOGDECODE_TEXT_MAX     512
+#define TLOGDECODE_LOAD_ADDRESS 0x08000000      // FLASH_BASE, for a raw binary
+
+// An image of a build, as the address ranges that were loaded from it
+typedef struct {
+    const uint8_t *data;
+    uint32_t segmentCount;
+    struct {
+        uint32_t address;
+        uint32_t offset;
+        uint32_t size;
+    } segments[TLOGDECODE_SEGMENTS];
+} tlogImage;
+
+// What was found in a capture
+typedef struct {
+    uint32_t records;               // Records rendered
+    uint32_t unknown;               // Records whose format isn't in the image
+    uint32_t lost;                  // Records missing from the sequence
+    uint32_t skipped;               // Stretches between delimiters that weren't frames, such as text
+} tlogSummary;
+
+// A capture being read
+typedef struct {
+    FILE *in;
+    uint8_t cobs[FRAME_MAX_WIRE(FRAME_MAX_PAYLOAD)];
+    uint32_t cobsLen;
+    bool overflowed;
+    bool started;
+    uint8_t nextSequence;
+    bool atLineStart;
+} tlogReader;
+
+// Little-endian fields of an ELF header
+static uint32_t tlogGet16(const uint8_t *p)
+{
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8);
+}
+static uint32_t tlogGet32(const uint8_t *p)
+{
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+// Describe an image held in memory, which is a 32-bit little-endian ELF file whose
+// loadable segments are used, or else a raw binary loaded at the address given
+bool tlogImageParse(tlogImage *img, const uint8_t *data, uint32_t size, uint32_t loadAddress)
+{
+    img->data = data;
+    img->segmentCount = 0;
+    if (size < 52 || memcmp(data, "\x7f" "ELF", 4) != 0) {
+        img->segments[0].address = loadAddress;
+        img->segments[0].offset = 0;
+        img->segments[0].size = size;
+        img->segmentCount = 1;
+        return true;
+    }
+    if (data[4] != 1 || data[5] != 1) {
+        return false;
+    }
+    uint32_t phoff = tlogGet32(&data[28]);
+    uint32_t phentsize = tlogGet16(&data[42]);
+    uint32_t phnum = tlogGet16(&data[44]);
+    for (uint32_t i=0; i<phnum && img->segmentCount < TLOGDECODE_SEGMENTS; i++) {
+        uint32_t ph = phoff + (i * phentsize);
+        if (phentsize < 32 || ph > size || size - ph < 32) {
+            return false;
+        }
+        uint32_t offset = tlogGet32(&data[ph + 4]);
+        uint32_t filesz = tlogGet32(&data[ph + 16]);
+        if (tlogGet32(&data[ph]) != 1 || filesz == 0) {
+            continue;
+        }
+        if (offset > size || filesz > size - offset) {
+            return false;
+        }
+        img->segments[img->segmentCount].address = tlogGet32(&data[ph + 8]);
+        img->segments[img->segmentCount].offset = offset;
+        img->segments[img->segmentCount].size = filesz;
+        img->segmentCount++;
+    }
+    return (img->segmentCount > 0);
+}
+
+// Find the null-terminated string at an address in the image, or NULL if there isn't one
+const char *tlogImageString(const tlogImage *img, uint32_t address)
+{
+    for (uint32_t i=0; i<img->segmentCount; i++) {
+        uint32_t at = address - img->segments[i].address;
+        if (address < img->segments[i].address || at >= img->segments[i].size) {
+            continue;
+        }
+        const char *s = (const char *) &img->data[img->segments[i].offset + at];
+        if (memchr(s, '\0', img->segments[i].size - at) == NULL) {
+            return NULL;
+        }
+        return s;
+    }
+    return NULL;
+}
+
+// Begin reading a capture
+void tlogReaderInit(tlogReader *r, FILE *in)
+{
+    r->in = in;
+    r->cobsLen = 0;
+    r->overflowed = false;
+    r->started = false;
+    r->nextSequence = 0;
+    r->atLineStart = true;
+}
+
+// Render a record and write its text, stamping the beginning of each line
+static void tlogWrite(tlogReader *r, const tlogImage *img, const uint8_t *rec, uint32_t recLen, FILE *out, tlogSummary *s)
+{
+    char text[TLOGDECODE_TEXT_MAX];
+    uint32_t ms = tlogGet32(&rec[4]);
+    const char *format = tlogImageString(img, tlogGet32(&rec[0]));
+    if (format == NULL) {
+        s->unknown++;
+        snprintf(text, sizeof(text), "%s<no format at 0x%08lx>\n", r->atLineStart ? "" : "\n", (unsigned long) tlogGet32(&rec[0]));
+    } else {
+        s->records++;
+        tlogRender(format, &rec[TLOG_HEADER], recLen - TLOG_HEADER, text, sizeof(text));
+    }
+    for (const char *p=text; *p != '\0'; p++) {
+        if (r->atLineStart) {
+            fprintf(out, "[%lu.%03lu] ", (unsigned long) (ms / 1000), (unsigned long) (ms % 1000));
+        }
+        fputc(*p, out);
+        r->atLineStart = (*p == '\n');
+    }
+}
+
+// Decode a frame, writing its record if it's a log record
+static void tlogFrame(tlogReader *r, const tlogImage *img, FILE *out, tlogSummary *s)
+{
+    uint8_t buf[sizeof(r->cobs)];
+    uint8_t type, sequence;
+    uint8_t *rec;
+    uint32_t recLen;
+    if (frameDecode(r->cobs, r->cobsLen, buf, sizeof(buf), &type, &sequence, &rec, &recLen) != FRAME_OK) {
+        s->skipped++;
+        return;
+    }
+    if (type != FRAME_LOG || recLen < TLOG_HEADER) {
+        return;
+    }
+    uint8_t gap = (uint8_t) (sequence - r->nextSequence);
+    if (r->started && gap != 0) {
+        s->lost += gap;
+        fprintf(out, "%s[%u records lost]\n", r->atLineStart ? "" : "\n", gap);
+        r->atLineStart = true;
+    }
+    r->started = true;
+    r->nextSequence = (uint8_t) (sequence + 1);
+    tlogWrite(r, img, rec, recLen, out, s);
+}
+
+// Render every log record in a capture
+void tlogDecode(tlogReader *r, const tlogImage *img, FILE *out, tlogSummary *s)
+{
+    memset(s, 0, sizeof(*s));
+    int c;
+    while ((c = fgetc(r->in)) != EOF) {
+        if (c != FRAME_DELIMITER) {
+            if (r->cobsLen < sizeof(r->cobs)) {
+                r->cobs[r->cobsLen++] = (uint8_t) c;
+            } else {
+                r->overflowed = true;
+            }
+            continue;
+        }
+        if (r->overflowed) {
+            s->skipped++;
+        } else if (r->cobsLen > 0) {
+            tlogFrame(r, img, out, s);
+        }
+        r->cobsLen = 0;
+        r->overflowed = false;
+    }
+    if (!r->atLineStart) {
+        fputc('\n', out);
+        r->atLineStart = true;
+    }
+}
+
+#ifndef TLOGDECODE_NO_MAIN
+
+// Render the log records in a capture
+int main(int argc, char **argv)
+{
+    if (argc != 3 && argc != 4) {
+        fprintf(stderr, "usage: tlogdecode <captured bytes> <image .out or .bin> [load address of a .bin]\n");
+        return 2;
+    }
+    FILE *f = fopen(argv[2], "rb");
+    if (f == NULL) {
+        perror(argv[2]);
+        return 1;
+    }
+    static uint8_t data[8 << 20];
+    uint32_t size = (uint32_t) fread(data, 1, sizeof(data), f);
+    fclose(f);
+    tlogImage img;
+    uint32_t loadAddress = (argc == 4) ? (uint32_t) strtoul(argv[3], NULL, 0) : TLOGDECODE_LOAD_ADDRESS;
+    if (!tlogImageParse(&img, data, size, loadAddress)) {
+        fprintf(stderr, "%s: not a 32-bit little-endian ELF file with loadable segments\n", argv[2]);
+        return 1;
+    }
+    FILE *in = fopen(argv[1], "rb");
+    if (in == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    tlogReader r;
+    tlogReaderInit(&r, in);
+    tlogSummary s;
+    tlogDecode(&r, &img, stdout, &s);
+    fclose(in);
+    fprintf(stderr, "%lu records, %lu with unknown formats, %lu lost, %lu stretches skipped\n",
+            (unsigned long) s.records, (unsigned long) s.unknown, (unsigned long) s.lost, (unsigned long) s.skipped);
+    return (s.unknown == 0 && s.lost == 0) ? 0 : 1;
+}
+
+#endif
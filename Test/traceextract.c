@@ -0,0 +1,277 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Extracts the event timelines that 'timeline dump' writes (see timeline.c) from a
+// captured debug log, writing each as a Chrome trace that Perfetto or chrome://tracing
+// can load.  Anything that precedes an event on a line, such as a terminal's
+// timestamp, is dropped, as are lines of other log output that landed among the
+// events or that damaged them.  Each trace is checked that its begin and end events
+// pair up on each track and that time runs forward, and the longest instance of each
+// span is reported, such as the audio pipeline's "block" against its 24ms deadline.
+//   make -C Test
+//   Test/build/traceextract capture.txt timeline      writes timeline-1.json, ...
+// Test/timeline_test.c includes this file to extract its own synthesized dumps.
+
+#include "global.h"
+#include "json.h"
+
+// Results of extraction
+#define TRACE_OK            0
+#define TRACE_NONE          1       // No further timeline in the log
+#define TRACE_TRUNCATED     2       // The log, or this timeline, ended before its end line
+
+#define TRACE_BEGIN         "{\"traceEvents\":["
+#define TRACE_END           "{}]}"
+#define TRACE_LINE_MAX      512
+#define TRACE_NAME_MAX      32
+#define TRACE_TRACKS        64
+#define TRACE_DEPTH         8
+#define TRACE_SPANS         32
+
+// The longest instance of a named span
+typedef struct {
+    char name[TRACE_NAME_MAX];
+    uint32_t count;
+    double longestUs;
+} traceSpan;
+
+// What was found in a timeline
+typedef struct {
+    uint32_t events;                // Begin and end events
+    uint32_t threads;               // Track names
+    uint32_t skipped;               // Lines among the events that weren't events
+    uint32_t unmatched;             // Ends without a begin, or begins never ended
+    uint32_t backwards;             // Events stamped earlier than the one before
+    uint32_t spanCount;
+    traceSpan spans[TRACE_SPANS];
+} traceSummary;
+
+// A log being read, where a timeline's first line found while reading the one before
+// it is held until the next traceExtract
+typedef struct {
+    FILE *in;
+    char line[TRACE_LINE_MAX];
+    bool pending;
+} traceReader;
+
+// Begin events not yet ended, per track
+typedef struct {
+    int tid;
+    uint32_t depth;
+    char name[TRACE_DEPTH][TRACE_NAME_MAX];
+    double beginUs[TRACE_DEPTH];
+} traceTrack;
+
+// Copy a string token, truncating it to fit
+static void traceString(const char *json, const jsonToken *token, char *buf, uint32_t size)
+{
+    uint32_t len = (token->len < size - 1) ? token->len : size - 1;
+    memcpy(buf, &json[token->start], len);
+    buf[len] = '\0';
+}
+
+// Find a track, adding it if it's new
+static traceTrack *traceTrackFind(traceTrack *tracks, uint32_t *trackCount, int tid)
+{
+    for (uint32_t i=0; i<*trackCount; i++) {
+        if (tracks[i].tid == tid) {
+            return &tracks[i];
+        }
+    }
+    if (*trackCount == TRACE_TRACKS) {
+        return NULL;
+    }
+    traceTrack *t = &tracks[(*trackCount)++];
+    t->tid = tid;
+    t->depth = 0;
+    return t;
+}
+
+// Note an instance of a span
+static void traceSpanEnded(traceSummary *s, const char *name, double us)
+{
+    traceSpan *span = NULL;
+    for (uint32_t i=0; i<s->spanCount; i++) {
+        if (strcmp(s->spans[i].name, name) == 0) {
+            span = &s->spans[i];
+        }
+    }
+    if (span == NULL) {
+        if (s->spanCount == TRACE_SPANS) {
+            return;
+        }
+        span = &s->spans[s->spanCount++];
+        snprintf(span->name, sizeof(span->name), "%s", name);
+        span->count = 0;
+        span->longestUs = 0;
+    }
+    span->count++;
+    if (us > span->longestUs) {
+        span->longestUs = us;
+    }
+}
+
+// Begin reading a log
+void traceReaderInit(traceReader *r, FILE *in)
+{
+    r->in = in;
+    r->pending = false;
+}
+
+// Extract the next timeline from a log into a Chrome trace written to out, which may
+// be NULL to only summarize it
+int traceExtract(traceReader *r, FILE *out, traceSummary *s)
+{
+    memset(s, 0, sizeof(*s));
+
+    // Find the first line
+    if (r->pending) {
+        r->pending = false;
+    } else {
+        do {
+            if (fgets(r->line, sizeof(r->line), r->in) == NULL) {
+                return TRACE_NONE;
+            }
+        } while (strstr(r->line, TRACE_BEGIN) == NULL);
+    }
+    if (out != NULL) {
+        fprintf(out, "%s\n", TRACE_BEGIN);
+    }
+
+    // Copy events until the end line, or until the next timeline begins if the log
+    // lost the end of this one
+    static traceTrack tracks[TRACE_TRACKS];
+    uint32_t trackCount = 0;
+    double lastUs = 0;
+    int result = TRACE_TRUNCATED;
+    while (fgets(r->line, sizeof(r->line), r->in) != NULL) {
+        if (strstr(r->line, TRACE_BEGIN) != NULL) {
+            r->pending = true;
+            break;
+        }
+        if (strstr(r->line, TRACE_END) != NULL) {
+            result = TRACE_OK;
+            break;
+        }
+
+        // Trim the event from what surrounds it, and skip anything that isn't one
+        char *p = strchr(r->line, '{');
+        if (p == NULL) {
+            s->skipped++;
+            continue;
+        }
+        size_t len = strlen(p);
+        while (len > 0 && (p[len-1] == '\n' || p[len-1] == '\r' || p[len-1] == ',' || p[len-1] == ' ')) {
+            p[--len] = '\0';
+        }
+        jsonToken tokens[24];
+        int count = jsonParse(p, tokens, sizeof(tokens) / sizeof(tokens[0]));
+        int phT = (count > 0) ? jsonObjectGet(p, tokens, count, 0, "ph") : -1;
+        int nameT = (count > 0) ? jsonObjectGet(p, tokens, count, 0, "name") : -1;
+        int tidT = (count > 0) ? jsonObjectGet(p, tokens, count, 0, "tid") : -1;
+        double tid;
+        if (phT < 0 || nameT < 0 || tidT < 0 || !jsonNumber(p, &tokens[tidT], &tid)) {
+            s->skipped++;
+            continue;
+        }
+        if (out != NULL) {
+            fprintf(out, "%s%s", (s->events + s->threads) ? ",\n" : "", p);
+        }
+        if (jsonEquals(p, &tokens[phT], "M")) {
+            s->threads++;
+            continue;
+        }
+
+        // Pair begins with ends on each track
+        int tsT = jsonObjectGet(p, tokens, count, 0, "ts");
+        double us = 0;
+        if (tsT >= 0) {
+            jsonNumber(p, &tokens[tsT], &us);
+        }
+        if (us < lastUs) {
+            s->backwards++;
+        }
+        lastUs = us;
+        s->events++;
+        traceTrack *t = traceTrackFind(tracks, &trackCount, (int) tid);
+        if (t == NULL) {
+            continue;
+        }
+        if (jsonEquals(p, &tokens[phT], "B")) {
+            if (t->depth == TRACE_DEPTH) {
+                s->unmatched++;
+                continue;
+            }
+            traceString(p, &tokens[nameT], t->name[t->depth], TRACE_NAME_MAX);
+            t->beginUs[t->depth++] = us;
+        } else if (jsonEquals(p, &tokens[phT], "E")) {
+            if (t->depth == 0) {
+                s->unmatched++;
+                continue;
+            }
+            t->depth--;
+            traceSpanEnded(s, t->name[t->depth], us - t->beginUs[t->depth]);
+        }
+    }
+    for (uint32_t i=0; i<trackCount; i++) {
+        s->unmatched += tracks[i].depth;
+    }
+
+    if (out != NULL) {
+        fprintf(out, "\n]}\n");
+    }
+    return result;
+}
+
+#ifndef TRACEEXTRACT_NO_MAIN
+
+// Extract every timeline in a log
+int main(int argc, char **argv)
+{
+    if (argc != 3) {
+        fprintf(stderr, "usage: traceextract <captured log> <output prefix>\n");
+        return 2;
+    }
+    FILE *in = fopen(argv[1], "r");
+    if (in == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    traceReader r;
+    traceReaderInit(&r, in);
+    int written = 0, truncated = 0;
+    for (;;) {
+        char filename[256];
+        snprintf(filename, sizeof(filename), "%s-%d.json", argv[2], written + 1);
+        FILE *out = fopen(filename, "w");
+        if (out == NULL) {
+            perror(filename);
+            break;
+        }
+        traceSummary s;
+        int err = traceExtract(&r, out, &s);
+        fclose(out);
+        if (err == TRACE_NONE) {
+            remove(filename);
+            break;
+        }
+        written++;
+        if (err == TRACE_TRUNCATED) {
+            truncated++;
+        }
+        printf("%s: %lu events on %lu tracks%s, %lu lines skipped, %lu unmatched, %lu out of order\n", filename,
+               (unsigned long) s.events, (unsigned long) s.threads, (err == TRACE_TRUNCATED) ? " (cut short)" : "",
+               (unsigned long) s.skipped, (unsigned long) s.unmatched, (unsigned long) s.backwards);
+        for (uint32_t i=0; i<s.spanCount; i++) {
+            printf("  %24s: %lu, longest %.3fms\n", s.spans[i].name, (unsigned long) s.spans[i].count, s.spans[i].longestUs / 1000.0);
+        }
+    }
+    fclose(in);
+    if (written == 0) {
+        fprintf(stderr, "%s: no timeline found\n", argv[1]);
+    }
+    return (written > 0 && truncated == 0) ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,418 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+// Simulates a host polling spl.get over LPUART1 at 9600 baud, to count how often the
+// serial task wakes per request and how long serialIsActive keeps us out of STOP2,
+// under the wake rules before and after serial servicing became event-driven:
+//   before  every received byte notified the task, which then polled every 1ms
+//           while there was work and every 100ms for 3s after it, staying active
+//   after   rxRingISR notifies only for a terminator or a half-full ring, IDLE
+//           notifies if the sender pauses with bytes unread, a transmit completion
+//           notifies if it can't chain another chunk, a log record notifies if it is
+//           the oldest, telemetry notifies when it's ready, and the task otherwise
+//           sleeps for what serialWaitMs makes of its services' waits, staying active
+//           only while bytes, lines or transmits are pending or within the RX guard
+// Lines are split by the real lineScan, as pollPort does, and the transmitters follow
+// MX_UART_TxEnqueue, MX_UART_TxService and their completion interrupts.  Then bursts
+// of log records to USB, and telemetry faster than LPUART1 can carry it, are added to
+// the requests, to check that output left for lack of room is always sent once
+// there's room, without the task polling for it.  Time advances in 10us steps.
+
+#include "test.h"
+#include "linescan.h"
+#include "serialwait.h"
+#include <string.h>
+
+#define STEP_US         10
+#define BAUD            9600
+#define CHAR_US         ((10 * 1000000) / BAUD)
+#define USB_BYTE_US     16              // 64-byte packets in 1ms frames
+#define RING_SIZE       600             // lpuart1InterruptBuffer
+#define GUARD_US        25000           // SERIAL_RX_GUARD_MS
+#define STALL_MS        500             // UART_TX_STALL_MS
+#define LPUART_TX_SIZE  512             // lpuart1TransmitBuffer
+#define USB_TX_SIZE     1024            // usbTransmitBuffer
+#define LOG_RECORDS     80              // About what LOG_RING_BYTES holds
+#define LOG_LEN         24              // A FRAME_LOG frame of a record with two arguments
+#define TELEMETRY_LEN   70              // {"leq":61.27,"min":...,"seq":12}\r\n
+#define REQUEST         "{\"req\":\"spl.get\"}\r\n"
+#define RESPONSE_LEN    41              // {"spl":61.27,"time":1760000000.123456}\r\n
+
+typedef struct {
+    bool eventDriven;
+    uint64_t periodUs;              // Between requests
+    uint64_t durationUs;
+    uint64_t quietUs;               // At the end, without new log records or telemetry
+    uint64_t logUs;                 // Between bursts of log records, or 0 for none
+    uint32_t logBurst;
+    uint64_t telemetryUs;           // Between telemetry records, or 0 for none
+    uint32_t gapMs;                 // LPUART1's pacing between chunks
+} simConfig;
+
+typedef struct {
+    uint32_t requests;
+    uint32_t responses;
+    uint32_t wakeups;
+    uint32_t timedWakeups;
+    uint64_t activeUs;
+    uint32_t logPosted;
+    uint32_t logSent;
+    uint32_t logDropped;
+    uint32_t logLeft;
+    uint32_t logBlocked;            // Passes that left log records for lack of room
+    uint32_t telemetryPosted;
+    uint32_t telemetrySent;
+    uint32_t telemetryCoalesced;
+    uint32_t telemetryBlocked;      // Passes that left telemetry for lack of room
+    bool telemetryLeft;
+    uint64_t stuckUs;               // Longest that output waited with its transmitter idle
+} simResult;
+
+// A transmit ring, as far as its timing goes
+typedef struct {
+    uint32_t size;
+    uint64_t byteUs;
+    uint32_t gapMs;
+    uint32_t queued;                // Bytes not yet started
+    uint32_t inflight;
+    uint64_t startedUs;
+    uint64_t completedUs;
+    uint64_t doneUs;
+} simTx;
+
+static void txInit(simTx *tx, uint32_t size, uint64_t byteUs, uint32_t gapMs)
+{
+    memset(tx, 0, sizeof(*tx));
+    tx->size = size;
+    tx->byteUs = byteUs;
+    tx->gapMs = gapMs;
+}
+
+static bool txPending(simTx *tx)
+{
+    return (tx->queued != 0 || tx->inflight != 0);
+}
+
+// Start what's queued, as txStart does
+static bool txStart(simTx *tx, uint64_t now)
+{
+    if (tx->inflight != 0 || tx->queued == 0) {
+        return false;
+    }
+    tx->inflight = tx->queued;
+    tx->queued = 0;
+    tx->startedUs = now;
+    tx->doneUs = now + (uint64_t) tx->inflight * tx->byteUs;
+    return true;
+}
+
+// Queue output if it fits, kicking the transmitter unless it's being paced, as
+// serialTryOutputV and MX_UART_TxEnqueue do
+static bool txEnqueue(simTx *tx, uint32_t len, uint64_t now)
+{
+    if (tx->size - tx->queued - tx->inflight < len) {
+        return false;
+    }
+    tx->queued += len;
+    if (tx->gapMs == 0 || now - tx->completedUs >= (uint64_t) tx->gapMs * 1000) {
+        txStart(tx, now);
+    }
+    return true;
+}
+
+// Complete a transmit, returning true if the task is notified because it didn't chain
+// another, as MX_UART_TxCpltFromISR does
+static bool txComplete(simTx *tx, uint64_t now)
+{
+    if (tx->inflight == 0 || now < tx->doneUs) {
+        return false;
+    }
+    tx->inflight = 0;
+    tx->completedUs = now;
+    return (tx->gapMs != 0 || !txStart(tx, now));
+}
+
+// Start paced chunks, returning how long until the port next needs service, as
+// MX_UART_TxService does
+static uint32_t txService(simTx *tx, uint64_t now)
+{
+    uint32_t waitMs = 0xffffffff;
+    if (tx->inflight != 0) {
+        uint32_t elapsedMs = (uint32_t) ((now - tx->startedUs) / 1000);
+        if (elapsedMs < STALL_MS) {
+            waitMs = STALL_MS - elapsedMs;
+        }
+    }
+    if (tx->inflight == 0 && tx->queued != 0) {
+        uint32_t elapsedMs = (uint32_t) ((now - tx->completedUs) / 1000);
+        if (elapsedMs < tx->gapMs) {
+            waitMs = tx->gapMs - elapsedMs;
+        } else if (txStart(tx, now)) {
+            waitMs = (tx->gapMs != 0) ? tx->gapMs : STALL_MS;
+        } else {
+            waitMs = 1;
+        }
+    }
+    return waitMs;
+}
+
+// Run a host sending a request each periodUs, along with any log records and
+// telemetry, under either set of rules
+static simResult simulate(const simConfig *c)
+{
+    simResult r = {0};
+
+    // Receive ring and line scanner
+    uint8_t ring[RING_SIZE];
+    uint32_t fill = 0, drain = 0;
+    lineScanner scanner;
+    lineScanInit(&scanner);
+
+    // Host
+    uint64_t nextRequestUs = 0;
+    uint32_t sending = 0;
+    bool sendingRequest = false;
+    uint64_t nextByteUs = 0;
+    uint64_t lastByteUs = 0;
+    bool idlePending = false;
+
+    // Output, from debugf on other tasks and from the audio task's telemetry
+    uint32_t logQueued = 0;
+    uint64_t nextLogUs = c->logUs;
+    bool telemetryReady = false;
+    uint64_t nextTelemetryUs = c->telemetryUs;
+    uint64_t stuckSinceUs = UINT64_MAX;
+
+    // Task and transmitters
+    simTx lpuart, usb;
+    txInit(&lpuart, LPUART_TX_SIZE, CHAR_US, c->gapMs);
+    txInit(&usb, USB_TX_SIZE, USB_BYTE_US, 0);
+    bool notified = false;
+    uint64_t timedWakeUs = UINT64_MAX;
+    uint64_t guardUntilUs = 0;
+    bool active = false;
+    uint64_t lastWorkUs = 0;
+    uint32_t answering = 0;
+
+    for (uint64_t now=0; now<c->durationUs; now+=STEP_US) {
+
+        // The host begins a request on schedule, and its bytes arrive a character apart
+        if (!sendingRequest && now >= nextRequestUs) {
+            sendingRequest = true;
+            sending = 0;
+            nextByteUs = now + CHAR_US;
+            nextRequestUs += c->periodUs;
+            r.requests++;
+        }
+        if (sendingRequest && now >= nextByteUs) {
+            uint8_t byte = (uint8_t) REQUEST[sending++];
+            ring[fill] = byte;
+            fill = (fill + 1) % RING_SIZE;
+            uint32_t used = (fill + RING_SIZE - drain) % RING_SIZE;
+            if (!c->eventDriven || byte == '\r' || byte == '\n' || used == RING_SIZE/2) {
+                notified = true;
+                guardUntilUs = now + GUARD_US;
+            }
+            lastByteUs = now;
+            idlePending = true;
+            nextByteUs = now + CHAR_US;
+            if (sending == strlen(REQUEST)) {
+                sendingRequest = false;
+            }
+        }
+
+        // The line goes idle a character time after the last byte
+        if (idlePending && now >= lastByteUs + CHAR_US) {
+            idlePending = false;
+            if (c->eventDriven && fill != drain) {
+                notified = true;
+                guardUntilUs = now + GUARD_US;
+            }
+        }
+
+        // A burst of log records, where debugLogPost notifies for one that is the oldest
+        bool generating = (now + c->quietUs < c->durationUs);
+        if (c->logUs != 0 && generating && now >= nextLogUs) {
+            nextLogUs += c->logUs;
+            for (uint32_t i=0; i<c->logBurst; i++) {
+                if (logQueued == LOG_RECORDS) {
+                    r.logDropped++;
+                    continue;
+                }
+                if (logQueued++ == 0 && c->eventDriven) {
+                    notified = true;
+                }
+                r.logPosted++;
+            }
+        }
+
+        // Telemetry replaces a record that hasn't yet been sent, and serialWake notifies
+        if (c->telemetryUs != 0 && generating && now >= nextTelemetryUs) {
+            nextTelemetryUs += c->telemetryUs;
+            if (telemetryReady) {
+                r.telemetryCoalesced++;
+            }
+            telemetryReady = true;
+            r.telemetryPosted++;
+            if (c->eventDriven) {
+                notified = true;
+            }
+        }
+
+        // Transmits complete, which notify the task only once it was event-driven
+        if (txComplete(&lpuart, now) && c->eventDriven) {
+            notified = true;
+        }
+        if (txComplete(&usb, now) && c->eventDriven) {
+            notified = true;
+        }
+
+        // The task runs when notified or when its timed wait expires
+        if (notified || now >= timedWakeUs) {
+            if (!notified) {
+                r.timedWakeups++;
+            }
+            notified = false;
+            r.wakeups++;
+
+            // Poll the port as pollPort does, the request task answering each line
+            bool didWork = false;
+            while (fill != drain) {
+                uint32_t dataLen = (fill > drain) ? (fill - drain) : (RING_SIZE - drain);
+                uint32_t appendLen;
+                int event;
+                uint32_t consumed = lineScan(&scanner, &ring[drain], dataLen, (uint32_t) (now / 1000), &appendLen, &event);
+                drain = (drain + consumed) % RING_SIZE;
+                didWork = true;
+                if (event == LINESCAN_LINE) {
+                    answering++;
+                }
+            }
+
+            // Queue telemetry and log records, as telemetryService and serviceLog do
+            serialWaitInputs wait = {0};
+            if (telemetryReady) {
+                if (txEnqueue(&lpuart, TELEMETRY_LEN, now)) {
+                    telemetryReady = false;
+                    r.telemetrySent++;
+                    didWork = true;
+                } else {
+                    wait.telemetryBlocked = true;
+                    r.telemetryBlocked++;
+                }
+            }
+            while (logQueued != 0) {
+                if (!txEnqueue(&usb, LOG_LEN, now)) {
+                    wait.logBlocked = true;
+                    r.logBlocked++;
+                    break;
+                }
+                logQueued--;
+                r.logSent++;
+                didWork = true;
+            }
+
+            // Service the transmitters, and decide when to wake again
+            uint32_t lpuartMs = txService(&lpuart, now);
+            uint32_t usbMs = txService(&usb, now);
+            if (c->eventDriven) {
+                wait.txServiceMs = (lpuartMs < usbMs) ? lpuartMs : usbMs;
+                wait.txPending = (txPending(&lpuart) || txPending(&usb));
+                wait.baudMs = SERIAL_WAIT_MAX_MS;
+                wait.rxGuardMs = (guardUntilUs > now) ? (uint32_t) ((guardUntilUs - now + 999) / 1000) : 0;
+                timedWakeUs = now + (uint64_t) serialWaitMs(&wait) * 1000;
+            } else {
+                active = true;
+                if (didWork) {
+                    lastWorkUs = now;
+                    timedWakeUs = now + 1000;
+                } else if (now - lastWorkUs < 3000000) {
+                    timedWakeUs = now + 100000;
+                } else {
+                    timedWakeUs = UINT64_MAX;
+                    active = false;
+                }
+            }
+        }
+
+        // The request task answers, waiting for room as serialOutputV does
+        while (answering != 0 && txEnqueue(&lpuart, RESPONSE_LEN, now)) {
+            answering--;
+            r.responses++;
+        }
+
+        // Watch for output waiting on a transmitter that has nothing to complete
+        bool stuck = ((logQueued != 0 && !txPending(&usb)) || (telemetryReady && !txPending(&lpuart)));
+        if (!stuck) {
+            stuckSinceUs = UINT64_MAX;
+        } else if (stuckSinceUs == UINT64_MAX) {
+            stuckSinceUs = now;
+        } else if (now - stuckSinceUs > r.stuckUs) {
+            r.stuckUs = now - stuckSinceUs;
+        }
+
+        // Account for time that STOP2 is blocked
+        if (c->eventDriven) {
+            active = (fill != drain || txPending(&lpuart) || txPending(&usb) || now < guardUntilUs);
+        }
+        if (active) {
+            r.activeUs += STEP_US;
+        }
+
+    }
+    r.logLeft = logQueued;
+    r.telemetryLeft = telemetryReady;
+    return r;
+}
+
+// Compare the rules for a host that polls every second and one that polls every ten
+static void testWakeups(void)
+{
+    static const uint64_t periodsUs[] = { 1000000, 10000000 };
+    for (int i=0; i<2; i++) {
+        simConfig c = { .periodUs = periodsUs[i], .durationUs = periodsUs[i] * 30 };
+        c.eventDriven = false;
+        simResult before = simulate(&c);
+        c.eventDriven = true;
+        simResult after = simulate(&c);
+        CHECK(before.responses == before.requests && after.responses == after.requests);
+        CHECK(after.wakeups * 4 < before.wakeups);
+        CHECK(after.activeUs * 4 < before.activeUs);
+        printf("wakeup: a request every %llus, %.1f wakeups and %.0fms active per request before, %.1f and %.0fms after\n",
+               (unsigned long long) (periodsUs[i] / 1000000),
+               (double) before.wakeups / before.requests, (double) before.activeUs / before.requests / 1000.0,
+               (double) after.wakeups / after.requests, (double) after.activeUs / after.requests / 1000.0);
+    }
+}
+
+// Add bursts of log records larger than USB's transmit ring, and telemetry every 50ms
+// that LPUART1 at 9600 baud can't keep up with, both unpaced and paced.  All of the
+// log records must be sent, every telemetry record sent or replaced by a newer one,
+// and no output may wait with its transmitter idle for longer than the task's retry.
+static void testPendingOutput(void)
+{
+    static const uint32_t gapsMs[] = { 0, 5 };
+    for (int i=0; i<2; i++) {
+        simConfig c = { .eventDriven = true, .periodUs = 1000000, .durationUs = 20000000, .quietUs = 3000000,
+                        .logUs = 250000, .logBurst = 60, .telemetryUs = 50000, .gapMs = gapsMs[i] };
+        simResult r = simulate(&c);
+        CHECK(r.responses == r.requests);
+        CHECK(r.logBlocked > 0 && r.telemetryBlocked > 0);
+        CHECK(r.logDropped == 0 && r.logSent == r.logPosted && r.logLeft == 0);
+        CHECK(r.telemetrySent + r.telemetryCoalesced == r.telemetryPosted && !r.telemetryLeft);
+        CHECK(r.stuckUs <= SERIAL_WAIT_RETRY_MS * 1000);
+        CHECK(r.wakeups < r.logPosted / 4);
+        printf("wakeup: with %lu log records and %lu telemetry (%lu replaced) at a %lums gap, %lu wakeups (%lu timed), %.1f records per wakeup\n",
+               (unsigned long) r.logPosted, (unsigned long) r.telemetryPosted, (unsigned long) r.telemetryCoalesced,
+               (unsigned long) c.gapMs, (unsigned long) r.wakeups, (unsigned long) r.timedWakeups,
+               (double) (r.logSent + r.telemetrySent) / r.wakeups);
+    }
+}
+
+int main(void)
+{
+    testWakeups();
+    testPendingOutput();
+    TEST_DONE("wakeup");
+}
@@ -0,0 +1,40 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#include <stdio.h>
+#include <string.h>
+#include "wav.h"
+
+// Write samples as a 16-bit mono WAV file
+static void put32le(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t) v;
+    p[1] = (uint8_t) (v >> 8);
+    p[2] = (uint8_t) (v >> 16);
+    p[3] = (uint8_t) (v >> 24);
+}
+bool wavWrite(const char *filename, const int16_t *pcm, uint32_t samples, uint32_t rateHz)
+{
+    uint8_t header[44];
+    memcpy(&header[0], "RIFF", 4);
+    put32le(&header[4], 36 + (samples * 2));
+    memcpy(&header[8], "WAVEfmt ", 8);
+    put32le(&header[16], 16);
+    put32le(&header[20], 1 | (1 << 16));            // PCM, mono
+    put32le(&header[24], rateHz);
+    put32le(&header[28], rateHz * 2);
+    put32le(&header[32], 2 | (16 << 16));           // 2 bytes per frame, 16 bits
+    memcpy(&header[36], "data", 4);
+    put32le(&header[40], samples * 2);
+    FILE *f = fopen(filename, "wb");
+    if (f == NULL) {
+        return false;
+    }
+    bool ok = (fwrite(header, sizeof(header), 1, f) == 1);
+    for (uint32_t i=0; ok && i<samples; i++) {
+        uint8_t le[2] = { (uint8_t) pcm[i], (uint8_t) ((uint16_t) pcm[i] >> 8) };
+        ok = (fwrite(le, sizeof(le), 1, f) == 1);
+    }
+    return (fclose(f) == 0 && ok);
+}
@@ -0,0 +1,11 @@
+// Copyright 2025 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// WAV output for the host tools that decode audio captured from the device
+bool wavWrite(const char *filename, const int16_t *pcm, uint32_t samples, uint32_t rateHz);